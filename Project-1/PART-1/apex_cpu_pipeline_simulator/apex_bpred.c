@@ -0,0 +1,615 @@
+/*
+ * apex_bpred.c
+ * Contains APEX branch direction predictor implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_bpred.h"
+#include "apex_macros.h"
+
+/* History lengths of the TAGE tagged tables, shortest first */
+static const int tage_lengths[TAGE_TABLES] = {4, 8, 16, 32};
+
+/* Indexed by BPRED_*, also the values of the bpred option */
+const char *const APEX_bpred_names[] = {"static", "bimodal", "gshare", "tage",
+                                        NULL};
+
+/* Saturating 2-bit counter, taken in the upper half */
+static void
+counter_update(unsigned char *ctr, int taken)
+{
+    if (taken && *ctr < 3)
+    {
+        (*ctr)++;
+    }
+    else if (!taken && *ctr > 0)
+    {
+        (*ctr)--;
+    }
+}
+
+/* Folds the youngest 'length' history bits down to 'bits' bits */
+static unsigned int
+fold_history(unsigned long long history, int length, int bits)
+{
+    unsigned int folded = 0;
+    int i;
+
+    if (length < 64)
+    {
+        history &= (1ULL << length) - 1;
+    }
+
+    for (i = 0; i < length; i += bits)
+    {
+        folded ^= (unsigned int)(history >> i);
+    }
+    return folded & ((1U << bits) - 1);
+}
+
+static unsigned int
+gshare_index(const APEX_BPred *bp, int pc, unsigned long long history)
+{
+    return (((unsigned int)pc >> 2) ^ (unsigned int)history)
+           & ((1U << bp->gshare_bits) - 1);
+}
+
+static unsigned int
+tage_base_index(int pc)
+{
+    return ((unsigned int)pc >> 2) & ((1U << TAGE_BASE_BITS) - 1);
+}
+
+static unsigned int
+tage_index(int table, int pc, unsigned long long history)
+{
+    unsigned int word = (unsigned int)pc >> 2;
+
+    return (word ^ (word >> TAGE_TABLE_BITS)
+            ^ fold_history(history, tage_lengths[table], TAGE_TABLE_BITS))
+           & ((1U << TAGE_TABLE_BITS) - 1);
+}
+
+static unsigned short
+tage_tag(int table, int pc, unsigned long long history)
+{
+    unsigned int word = (unsigned int)pc >> 2;
+
+    return (word ^ fold_history(history, tage_lengths[table], TAGE_TAG_BITS)
+            ^ (fold_history(history, tage_lengths[table], TAGE_TAG_BITS - 1)
+               << 1))
+           & ((1U << TAGE_TAG_BITS) - 1);
+}
+
+/*
+ * Finds the longest matching tagged table (the provider) and the next
+ * longest one (the alternate) for 'pc' under 'history'. Missing components
+ * are -1, in which case the base table predicts.
+ */
+static void
+tage_lookup(const APEX_BPred *bp, int pc, unsigned long long history,
+            int *provider, int *alternate)
+{
+    int t;
+
+    *provider = -1;
+    *alternate = -1;
+    for (t = TAGE_TABLES - 1; t >= 0; --t)
+    {
+        const TAGE_Entry *entry = &bp->tables[t][tage_index(t, pc, history)];
+
+        if (entry->tag != tage_tag(t, pc, history))
+        {
+            continue;
+        }
+
+        if (*provider < 0)
+        {
+            *provider = t;
+        }
+        else
+        {
+            *alternate = t;
+            break;
+        }
+    }
+}
+
+static int
+tage_component_predict(const APEX_BPred *bp, int table, int pc,
+                       unsigned long long history)
+{
+    if (table < 0)
+    {
+        return bp->base[tage_base_index(pc)] >= 2;
+    }
+    return bp->tables[table][tage_index(table, pc, history)].ctr >= 0;
+}
+
+static void
+tage_update(APEX_BPred *bp, int pc, unsigned long long history, int taken)
+{
+    int provider, alternate;
+    int provider_pred, alternate_pred;
+    int t;
+
+    tage_lookup(bp, pc, history, &provider, &alternate);
+    provider_pred = tage_component_predict(bp, provider, pc, history);
+    alternate_pred = tage_component_predict(bp, alternate, pc, history);
+
+    /* On a misprediction claim an entry in one longer table, or age the
+     * candidates so one frees up later */
+    if (provider_pred != taken && provider < TAGE_TABLES - 1)
+    {
+        int allocated = FALSE;
+
+        for (t = provider + 1; t < TAGE_TABLES && !allocated; ++t)
+        {
+            TAGE_Entry *entry = &bp->tables[t][tage_index(t, pc, history)];
+
+            if (entry->u == 0)
+            {
+                entry->tag = tage_tag(t, pc, history);
+                entry->ctr = taken ? 0 : -1;
+                allocated = TRUE;
+            }
+        }
+
+        for (t = provider + 1; t < TAGE_TABLES && !allocated; ++t)
+        {
+            bp->tables[t][tage_index(t, pc, history)].u--;
+        }
+    }
+
+    if (provider < 0)
+    {
+        counter_update(&bp->base[tage_base_index(pc)], taken);
+    }
+    else
+    {
+        TAGE_Entry *entry =
+            &bp->tables[provider][tage_index(provider, pc, history)];
+
+        if (taken && entry->ctr < 3)
+        {
+            entry->ctr++;
+        }
+        else if (!taken && entry->ctr > -4)
+        {
+            entry->ctr--;
+        }
+
+        /* The provider is useful when it disagrees with the alternate and
+         * turns out right */
+        if (provider_pred != alternate_pred)
+        {
+            if (provider_pred == taken && entry->u < 3)
+            {
+                entry->u++;
+            }
+            else if (provider_pred != taken && entry->u > 0)
+            {
+                entry->u--;
+            }
+        }
+    }
+
+    /* Periodically decay usefulness so stale entries can be replaced */
+    if ((++bp->updates & 0xfff) == 0)
+    {
+        for (t = 0; t < TAGE_TABLES; ++t)
+        {
+            int i;
+
+            for (i = 0; i < (1 << TAGE_TABLE_BITS); ++i)
+            {
+                bp->tables[t][i].u >>= 1;
+            }
+        }
+    }
+}
+
+int
+APEX_bpred_init(APEX_BPred *bp, int type, int gshare_bits)
+{
+    int t, i;
+
+    memset(bp, 0, sizeof(APEX_BPred));
+    bp->type = type;
+
+    switch (type)
+    {
+        case BPRED_STATIC:
+        case BPRED_BIMODAL:
+        {
+            return TRUE;
+        }
+
+        case BPRED_GSHARE:
+        {
+            if (gshare_bits < 1 || gshare_bits > 24)
+            {
+                return FALSE;
+            }
+
+            bp->gshare_bits = gshare_bits;
+            bp->pht = malloc(1U << gshare_bits);
+            if (!bp->pht)
+            {
+                return FALSE;
+            }
+
+            /* Start weakly not taken */
+            memset(bp->pht, 1, 1U << gshare_bits);
+            return TRUE;
+        }
+
+        case BPRED_TAGE:
+        {
+            bp->base = malloc(1U << TAGE_BASE_BITS);
+            if (!bp->base)
+            {
+                return FALSE;
+            }
+            memset(bp->base, 1, 1U << TAGE_BASE_BITS);
+
+            for (t = 0; t < TAGE_TABLES; ++t)
+            {
+                bp->tables[t] = calloc(1 << TAGE_TABLE_BITS, sizeof(TAGE_Entry));
+                if (!bp->tables[t])
+                {
+                    APEX_bpred_free(bp);
+                    return FALSE;
+                }
+
+                /* Tags are narrower than the field, so no lookup matches an
+                 * entry that was never allocated */
+                for (i = 0; i < (1 << TAGE_TABLE_BITS); ++i)
+                {
+                    bp->tables[t][i].tag = 0xffff;
+                }
+            }
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void
+APEX_bpred_free(APEX_BPred *bp)
+{
+    int t;
+
+    free(bp->pht);
+    bp->pht = NULL;
+    free(bp->base);
+    bp->base = NULL;
+    for (t = 0; t < TAGE_TABLES; ++t)
+    {
+        free(bp->tables[t]);
+        bp->tables[t] = NULL;
+    }
+}
+
+/* Makes 'dst' a copy of 'src' with tables of its own */
+int
+APEX_bpred_copy(APEX_BPred *dst, const APEX_BPred *src)
+{
+    APEX_BPred copy;
+    int t;
+
+    if (!APEX_bpred_init(&copy, src->type, src->gshare_bits))
+    {
+        return FALSE;
+    }
+
+    if (copy.pht)
+    {
+        memcpy(copy.pht, src->pht, 1U << src->gshare_bits);
+    }
+    if (copy.base)
+    {
+        memcpy(copy.base, src->base, 1U << TAGE_BASE_BITS);
+    }
+    for (t = 0; t < TAGE_TABLES && copy.tables[t]; ++t)
+    {
+        memcpy(copy.tables[t], src->tables[t],
+               (1 << TAGE_TABLE_BITS) * sizeof(TAGE_Entry));
+    }
+
+    *dst = *src;
+    dst->pht = copy.pht;
+    dst->base = copy.base;
+    for (t = 0; t < TAGE_TABLES; ++t)
+    {
+        dst->tables[t] = copy.tables[t];
+    }
+    return TRUE;
+}
+
+/*
+ * Predicts the direction of the conditional branch at 'pc'. 'btb_counter'
+ * is the counter of its BTB entry, or NULL on a BTB miss.
+ */
+int
+APEX_bpred_predict(APEX_BPred *bp, int pc, const int *btb_counter)
+{
+    int provider, alternate;
+
+    switch (bp->type)
+    {
+        case BPRED_STATIC:
+        {
+            return btb_counter != NULL;
+        }
+
+        case BPRED_BIMODAL:
+        {
+            return btb_counter && *btb_counter >= 2;
+        }
+
+        case BPRED_GSHARE:
+        {
+            return bp->pht[gshare_index(bp, pc, bp->history)] >= 2;
+        }
+
+        case BPRED_TAGE:
+        {
+            tage_lookup(bp, pc, bp->history, &provider, &alternate);
+            return tage_component_predict(bp, provider, pc, bp->history);
+        }
+    }
+
+    return FALSE;
+}
+
+/* Shifts the direction fetch followed into the global history */
+void
+APEX_bpred_speculate(APEX_BPred *bp, int taken)
+{
+    bp->history = (bp->history << 1) | (taken ? 1 : 0);
+}
+
+/* Restores the global history after younger instructions were squashed */
+void
+APEX_bpred_recover(APEX_BPred *bp, unsigned long long history)
+{
+    bp->history = history;
+}
+
+/*
+ * Trains the predictor with the outcome of the branch at 'pc', which was
+ * predicted under global history 'history'.
+ */
+void
+APEX_bpred_update(APEX_BPred *bp, int pc, int *btb_counter,
+                  unsigned long long history, int taken, int predicted_taken)
+{
+    bp->predictions++;
+    if (predicted_taken != taken)
+    {
+        bp->mispredictions++;
+    }
+
+    switch (bp->type)
+    {
+        case BPRED_BIMODAL:
+        {
+            if (btb_counter)
+            {
+                unsigned char ctr = *btb_counter;
+
+                counter_update(&ctr, taken);
+                *btb_counter = ctr;
+            }
+            break;
+        }
+
+        case BPRED_GSHARE:
+        {
+            counter_update(&bp->pht[gshare_index(bp, pc, history)], taken);
+            break;
+        }
+
+        case BPRED_TAGE:
+        {
+            tage_update(bp, pc, history, taken);
+            break;
+        }
+    }
+}
+
+void
+APEX_bpred_print_stats(const APEX_BPred *bp, int instructions)
+{
+    printf("----------\n%s\n----------\n", "DIRECTION PREDICTOR");
+    printf("Predictor        : %s", APEX_bpred_names[bp->type]);
+    if (bp->type == BPRED_GSHARE)
+    {
+        printf(" (%d history bits)", bp->gshare_bits);
+    }
+    printf("\n");
+    printf("Cond. branches   : %d\n", bp->predictions);
+    printf("Mispredicted     : %d\n", bp->mispredictions);
+    printf("Accuracy         : %.2f%%\n",
+           bp->predictions
+               ? 100.0 * (bp->predictions - bp->mispredictions) / bp->predictions
+               : 0.0);
+    printf("MPKI             : %.2f\n",
+           instructions ? 1000.0 * bp->mispredictions / instructions : 0.0);
+    printf("\n");
+}
+
+static double
+bpred_accuracy(const void *owner)
+{
+    const APEX_BPred *bp = owner;
+
+    return bp->predictions
+               ? (double)(bp->predictions - bp->mispredictions) / bp->predictions
+               : 0.0;
+}
+
+/* The predictor is registered by the index of its bpred= name */
+void
+APEX_bpred_register_stats(const APEX_BPred *bp, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "type", &bp->type);
+    APEX_stats_counter(stats, "predictions", &bp->predictions);
+    APEX_stats_counter(stats, "mispredictions", &bp->mispredictions);
+    APEX_stats_derived(stats, "accuracy", bpred_accuracy, bp);
+}
+
+static unsigned int
+indirect_index(const APEX_Indirect *ind, int pc, unsigned int history)
+{
+    return (((unsigned int)pc >> 2) ^ history) & (ind->size - 1);
+}
+
+int
+APEX_indirect_init(APEX_Indirect *ind, int size)
+{
+    memset(ind, 0, sizeof(APEX_Indirect));
+
+    if (size == 0)
+    {
+        return TRUE;
+    }
+
+    if (size < 0 || (size & (size - 1)))
+    {
+        return FALSE;
+    }
+
+    ind->table = calloc(size, sizeof(Indirect_Entry));
+    if (!ind->table)
+    {
+        return FALSE;
+    }
+
+    ind->size = size;
+    return TRUE;
+}
+
+void
+APEX_indirect_free(APEX_Indirect *ind)
+{
+    free(ind->table);
+    ind->table = NULL;
+}
+
+/* Makes 'dst' a copy of 'src' with a table of its own */
+int
+APEX_indirect_copy(APEX_Indirect *dst, const APEX_Indirect *src)
+{
+    Indirect_Entry *table = NULL;
+
+    if (src->table)
+    {
+        table = malloc(src->size * sizeof(Indirect_Entry));
+        if (!table)
+        {
+            return FALSE;
+        }
+        memcpy(table, src->table, src->size * sizeof(Indirect_Entry));
+    }
+
+    *dst = *src;
+    dst->table = table;
+    return TRUE;
+}
+
+/*
+ * Looks up the target of the JUMP or JALR at 'pc' of thread 'tid' under
+ * path 'history'. Returns TRUE and sets 'target' on a hit.
+ */
+int
+APEX_indirect_predict(APEX_Indirect *ind, int tid, int pc,
+                      unsigned int history, int *target)
+{
+    const Indirect_Entry *entry;
+
+    if (!ind->table)
+    {
+        return FALSE;
+    }
+
+    ind->lookups++;
+    entry = &ind->table[indirect_index(ind, pc, history)];
+    if (!entry->valid || entry->tid != tid || entry->pc != pc)
+    {
+        return FALSE;
+    }
+
+    ind->hits++;
+    *target = entry->target;
+    return TRUE;
+}
+
+/*
+ * Records the resolved 'target' of the transfer at 'pc' of thread 'tid',
+ * predicted under path 'history', and shifts it into the path history.
+ */
+void
+APEX_indirect_update(APEX_Indirect *ind, int tid, int pc,
+                     unsigned int history, int target)
+{
+    Indirect_Entry *entry;
+
+    if (!ind->table)
+    {
+        return;
+    }
+
+    entry = &ind->table[indirect_index(ind, pc, history)];
+    entry->valid = TRUE;
+    entry->tid = tid;
+    entry->pc = pc;
+    entry->target = target;
+
+    ind->history = (ind->history << 2) ^ ((unsigned int)target >> 2);
+}
+
+void
+APEX_indirect_print_stats(const APEX_Indirect *ind)
+{
+    int predicted = ind->correct + ind->wrong;
+
+    printf("----------\n%s\n----------\n", "INDIRECT TARGET PREDICTOR");
+    if (!ind->table)
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    printf("Table            : %d entries\n", ind->size);
+    printf("Lookups / Hits   : %d / %d\n", ind->lookups, ind->hits);
+    printf("Targets          : %d correct, %d wrong\n", ind->correct,
+           ind->wrong);
+    printf("Accuracy         : %.2f%%\n",
+           predicted ? 100.0 * ind->correct / predicted : 0.0);
+    printf("\n");
+}
+
+static double
+indirect_accuracy(const void *owner)
+{
+    const APEX_Indirect *ind = owner;
+    int predicted = ind->correct + ind->wrong;
+
+    return predicted ? (double)ind->correct / predicted : 0.0;
+}
+
+void
+APEX_indirect_register_stats(const APEX_Indirect *ind, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "size", &ind->size);
+    APEX_stats_counter(stats, "lookups", &ind->lookups);
+    APEX_stats_counter(stats, "hits", &ind->hits);
+    APEX_stats_counter(stats, "correct", &ind->correct);
+    APEX_stats_counter(stats, "wrong", &ind->wrong);
+    APEX_stats_derived(stats, "accuracy", indirect_accuracy, ind);
+}
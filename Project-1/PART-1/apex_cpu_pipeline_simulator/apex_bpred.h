@@ -0,0 +1,105 @@
+/*
+ * apex_bpred.h
+ * Contains APEX branch direction predictor declarations
+ *
+ * Fetch asks the selected predictor whether a conditional branch is taken,
+ * the BTB supplies the target. The global history is updated speculatively
+ * in Fetch and restored from the snapshot carried by a mispredicted
+ * instruction when Execute redirects the pipeline.
+ *
+ * JUMP and JALR targets that do not come from the return address stack are
+ * predicted by a small indirect target table indexed by the PC and a
+ * history of recent indirect targets.
+ */
+#ifndef _APEX_BPRED_H_
+#define _APEX_BPRED_H_
+
+#include "apex_stats.h"
+
+/* Direction predictors, selected at startup */
+#define BPRED_STATIC 0x0  /* Taken on a BTB hit */
+#define BPRED_BIMODAL 0x1 /* 2-bit counter kept in the BTB entry */
+#define BPRED_GSHARE 0x2  /* PC xor global history into 2-bit counters */
+#define BPRED_TAGE 0x3    /* Bimodal base plus tagged geometric tables */
+
+/* Size of the small TAGE predictor */
+#define TAGE_TABLES 4
+#define TAGE_BASE_BITS 10
+#define TAGE_TABLE_BITS 8
+#define TAGE_TAG_BITS 8
+
+/* Format of a TAGE tagged table entry */
+typedef struct TAGE_Entry
+{
+    unsigned short tag;
+    signed char ctr;    /* 3-bit signed counter, taken when >= 0 */
+    unsigned char u;    /* 2-bit usefulness */
+} TAGE_Entry;
+
+/* Model of the direction predictor */
+typedef struct APEX_BPred
+{
+    int type;
+    unsigned long long history; /* Global history, youngest outcome in bit 0 */
+
+    /* gshare */
+    int gshare_bits;
+    unsigned char *pht;
+
+    /* TAGE */
+    unsigned char *base;
+    TAGE_Entry *tables[TAGE_TABLES];
+    int updates;
+
+    /* Statistics */
+    int predictions;
+    int mispredictions;
+} APEX_BPred;
+
+/* Format of an indirect target table entry */
+typedef struct Indirect_Entry
+{
+    int valid;
+    int tid;               /* Hardware thread the target belongs to */
+    int pc;
+    int target;
+} Indirect_Entry;
+
+/* Model of the indirect target predictor, a size of 0 disables it */
+typedef struct APEX_Indirect
+{
+    Indirect_Entry *table;
+    int size;              /* Entries, a power of two */
+    unsigned int history;  /* Path history of resolved indirect targets */
+
+    /* Statistics */
+    int lookups;
+    int hits;
+    int correct;
+    int wrong;
+} APEX_Indirect;
+
+extern const char *const APEX_bpred_names[];
+
+int APEX_bpred_init(APEX_BPred *bp, int type, int gshare_bits);
+void APEX_bpred_free(APEX_BPred *bp);
+int APEX_bpred_copy(APEX_BPred *dst, const APEX_BPred *src);
+int APEX_bpred_predict(APEX_BPred *bp, int pc, const int *btb_counter);
+void APEX_bpred_speculate(APEX_BPred *bp, int taken);
+void APEX_bpred_recover(APEX_BPred *bp, unsigned long long history);
+void APEX_bpred_update(APEX_BPred *bp, int pc, int *btb_counter,
+                       unsigned long long history, int taken,
+                       int predicted_taken);
+void APEX_bpred_print_stats(const APEX_BPred *bp, int instructions);
+void APEX_bpred_register_stats(const APEX_BPred *bp, APEX_Stats *stats);
+
+int APEX_indirect_init(APEX_Indirect *ind, int size);
+void APEX_indirect_free(APEX_Indirect *ind);
+int APEX_indirect_copy(APEX_Indirect *dst, const APEX_Indirect *src);
+int APEX_indirect_predict(APEX_Indirect *ind, int tid, int pc,
+                          unsigned int history, int *target);
+void APEX_indirect_update(APEX_Indirect *ind, int tid, int pc,
+                          unsigned int history, int target);
+void APEX_indirect_print_stats(const APEX_Indirect *ind);
+void APEX_indirect_register_stats(const APEX_Indirect *ind, APEX_Stats *stats);
+#endif
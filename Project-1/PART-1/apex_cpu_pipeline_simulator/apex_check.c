@@ -0,0 +1,490 @@
+/*
+ * apex_check.c
+ * Contains APEX lockstep checker implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_check.h"
+#include "apex_macros.h"
+
+/* What the interpreter did for one instruction */
+typedef struct Check_Effect
+{
+    int is_store;
+    int address;                   /* Data memory word of a load or store */
+    int value;                     /* Data stored */
+} Check_Effect;
+
+APEX_Checker *
+APEX_check_init(const APEX_Instruction *code_memory, int code_memory_size,
+                int pc, int address_bits)
+{
+    APEX_Checker *checker = calloc(1, sizeof(APEX_Checker));
+
+    if (!checker)
+    {
+        return NULL;
+    }
+
+    if (!APEX_memory_init(&checker->data_memory, address_bits, FALSE))
+    {
+        free(checker);
+        return NULL;
+    }
+
+    checker->code_memory = code_memory;
+    checker->code_memory_size = code_memory_size;
+    checker->pc = pc;
+    return checker;
+}
+
+void
+APEX_check_free(APEX_Checker *checker)
+{
+    if (checker)
+    {
+        APEX_memory_free(&checker->data_memory);
+        free(checker);
+    }
+}
+
+/*
+ * A checker at the same point as 'checker' for a forked CPU, sharing its
+ * code memory and its data memory copy-on-write. Returns NULL if out of
+ * memory.
+ */
+APEX_Checker *
+APEX_check_fork(APEX_Checker *checker)
+{
+    APEX_Checker *fork = malloc(sizeof(APEX_Checker));
+
+    if (!fork)
+    {
+        return NULL;
+    }
+
+    *fork = *checker;
+    if (!APEX_memory_fork(&fork->data_memory, &checker->data_memory))
+    {
+        free(fork);
+        return NULL;
+    }
+    return fork;
+}
+
+/* The instruction at 'pc', or NULL outside code memory */
+static const APEX_Instruction *
+instruction_at(const APEX_Checker *checker, int pc)
+{
+    int index = (pc - 4000) / 4;
+
+    if (pc % 4 || index < 0 || index >= checker->code_memory_size)
+    {
+        return NULL;
+    }
+    return &checker->code_memory[index];
+}
+
+/* Writes the instruction at 'pc' in assembly form, as the pipeline prints it */
+static void
+print_instruction_at(const APEX_Checker *checker, int pc)
+{
+    const APEX_Instruction *insn = instruction_at(checker, pc);
+
+    printf("pc(%d) ", pc);
+    if (!insn)
+    {
+        printf("<outside code memory>");
+        return;
+    }
+
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+            printf("%s,R%d,R%d,R%d", insn->opcode_str, insn->rd, insn->rs1,
+                   insn->rs2);
+            break;
+        case OPCODE_MOVC:
+            printf("%s,R%d,#%d", insn->opcode_str, insn->rd, insn->imm);
+            break;
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        case OPCODE_JALR:
+            printf("%s,R%d,R%d,#%d", insn->opcode_str, insn->rd, insn->rs1,
+                   insn->imm);
+            break;
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+            printf("%s,R%d,R%d,#%d", insn->opcode_str, insn->rs1, insn->rs2,
+                   insn->imm);
+            break;
+        case OPCODE_CML:
+        case OPCODE_JUMP:
+            printf("%s,R%d,#%d", insn->opcode_str, insn->rs1, insn->imm);
+            break;
+        case OPCODE_CMP:
+            printf("%s,R%d,R%d", insn->opcode_str, insn->rs1, insn->rs2);
+            break;
+        case OPCODE_HALT:
+        case OPCODE_NOP:
+            printf("%s", insn->opcode_str);
+            break;
+        default:
+            printf("%s,#%d", insn->opcode_str, insn->imm);
+            break;
+    }
+}
+
+static void
+set_flags(APEX_Checker *checker, int a, int b)
+{
+    checker->zero_flag = a == b;
+    checker->p_flag = a > b;
+    checker->n_flag = a < b;
+}
+
+static int
+valid_address(const APEX_Checker *checker, int address)
+{
+    return address >= 0
+           && APEX_memory_in_range(&checker->data_memory, address);
+}
+
+/*
+ * Runs the instruction at the checker's PC. Loads take 'loaded' instead of
+ * the golden memory when 'adopt' is set. Returns FALSE if a load or store
+ * is outside data memory or its page cannot be allocated.
+ */
+static int
+execute(APEX_Checker *checker, Check_Effect *effect, int adopt, int loaded)
+{
+    const APEX_Instruction *insn = instruction_at(checker, checker->pc);
+    int *regs = checker->regs;
+    int next_pc = checker->pc + 4;
+    int taken = FALSE;
+    int result;
+
+    memset(effect, 0, sizeof(Check_Effect));
+
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        {
+            int a = regs[insn->rs1];
+            int b = regs[insn->rs2];
+
+            switch (insn->opcode)
+            {
+                case OPCODE_ADD: result = a + b; break;
+                case OPCODE_SUB: result = a - b; break;
+                case OPCODE_MUL: result = a * b; break;
+                case OPCODE_DIV: result = b ? a / b : 0; break;
+                case OPCODE_AND: result = a & b; break;
+                case OPCODE_OR: result = a | b; break;
+                case OPCODE_XOR: result = a ^ b; break;
+                case OPCODE_ADDL: result = a + insn->imm; break;
+                default: result = a - insn->imm; break;
+            }
+
+            regs[insn->rd] = result;
+            set_flags(checker, result, 0);
+            break;
+        }
+
+        case OPCODE_MOVC:
+            regs[insn->rd] = insn->imm;
+            break;
+
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        {
+            int base = regs[insn->rs1];
+
+            effect->address = base + insn->imm;
+            if (!valid_address(checker, effect->address))
+            {
+                return FALSE;
+            }
+            if (adopt)
+            {
+                checker->loads_adopted++;
+            }
+
+            /* The pipeline writes the incremented base before the loaded
+             * value, so a load into its own base keeps the value */
+            if (insn->opcode == OPCODE_LOADP)
+            {
+                regs[insn->rs1] = base + 4;
+            }
+            regs[insn->rd] = adopt ? loaded
+                                   : APEX_memory_read(&checker->data_memory,
+                                                      effect->address);
+            break;
+        }
+
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+            effect->is_store = TRUE;
+            effect->address = regs[insn->rs2] + insn->imm;
+            effect->value = regs[insn->rs1];
+            if (!valid_address(checker, effect->address))
+            {
+                return FALSE;
+            }
+            if (!APEX_memory_write(&checker->data_memory, effect->address,
+                                   effect->value))
+            {
+                return FALSE;
+            }
+            if (insn->opcode == OPCODE_STOREP)
+            {
+                regs[insn->rs2] += 4;
+            }
+            break;
+
+        case OPCODE_CMP:
+            set_flags(checker, regs[insn->rs1], regs[insn->rs2]);
+            break;
+
+        case OPCODE_CML:
+            set_flags(checker, regs[insn->rs1], insn->imm);
+            break;
+
+        case OPCODE_BZ: taken = checker->zero_flag; break;
+        case OPCODE_BNZ: taken = !checker->zero_flag; break;
+        case OPCODE_BP: taken = checker->p_flag; break;
+        case OPCODE_BNP: taken = !checker->p_flag; break;
+        case OPCODE_BN: taken = checker->n_flag; break;
+        case OPCODE_BNN: taken = !checker->n_flag; break;
+
+        case OPCODE_JUMP:
+            next_pc = regs[insn->rs1] + insn->imm;
+            break;
+
+        case OPCODE_JALR:
+            next_pc = regs[insn->rs1] + insn->imm;
+            regs[insn->rd] = checker->pc + 4;
+            break;
+    }
+
+    if (taken)
+    {
+        next_pc = checker->pc + insn->imm;
+    }
+
+    checker->pc = next_pc;
+    return TRUE;
+}
+
+/* Starts a divergence report for the instruction in Writeback */
+static void
+report(APEX_Checker *checker, const APEX_CPU *cpu, const char *what)
+{
+    checker->diverged = TRUE;
+    checker->divergence_cycle = cpu->clock + 1;
+
+    printf("----------\n%s\n----------\n", "CHECKER DIVERGENCE");
+    if (cpu->threads > 1)
+    {
+        printf("Thread           : %d\n", cpu->writeback.tid);
+    }
+    printf("Cycle            : %d\n", cpu->clock + 1);
+    printf("Retirement       : #%d ", checker->checked + 1);
+    print_instruction_at(checker, cpu->writeback.pc);
+    printf("\n");
+    printf("Mismatch         : %s\n", what);
+}
+
+/* Ends a divergence report with the instructions retired before */
+static void
+report_history(const APEX_Checker *checker)
+{
+    int count = checker->history_count < CHECK_HISTORY
+                    ? checker->history_count
+                    : CHECK_HISTORY;
+    int i;
+
+    printf("Retired before   :");
+    if (!count)
+    {
+        printf(" none");
+    }
+    printf("\n");
+
+    for (i = checker->history_count - count; i < checker->history_count;
+         ++i)
+    {
+        printf("                   ");
+        print_instruction_at(checker, checker->history[i % CHECK_HISTORY]);
+        printf("\n");
+    }
+    printf("\n");
+}
+
+/* Compares the registers of the pipeline with the checker's */
+static int
+compare_registers(APEX_Checker *checker, const APEX_CPU *cpu)
+{
+    const int *regs = cpu->ctx[cpu->writeback.tid].regs;
+    int i;
+
+    if (!memcmp(checker->regs, regs, sizeof(checker->regs)))
+    {
+        return TRUE;
+    }
+
+    report(checker, cpu, "register file");
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        if (checker->regs[i] != regs[i])
+        {
+            char label[16];
+
+            snprintf(label, sizeof(label), "R%d", i);
+            printf("%-17s: expected %d, pipeline %d\n", label,
+                   checker->regs[i], regs[i]);
+        }
+    }
+    return FALSE;
+}
+
+/* Compares data memory after HALT drained every store */
+static int
+compare_memory(APEX_Checker *checker, const APEX_CPU *cpu)
+{
+    unsigned address = 0;
+    int shown;
+
+    if (!APEX_memory_diff(&checker->data_memory, &cpu->data_memory,
+                          &address))
+    {
+        return TRUE;
+    }
+
+    report(checker, cpu, "data memory");
+    for (shown = 0; shown < CHECK_HISTORY; ++shown)
+    {
+        char label[24];
+
+        snprintf(label, sizeof(label), "MEM[%u]", address);
+        printf("%-17s: expected %d, pipeline %d\n", label,
+               APEX_memory_peek(&checker->data_memory, address),
+               APEX_memory_peek(&cpu->data_memory, address));
+        if (++address == 0
+            || !APEX_memory_diff(&checker->data_memory, &cpu->data_memory,
+                                 &address))
+        {
+            break;
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * Runs the instruction the pipeline just retired and compares the results.
+ * Returns FALSE at the first divergence, after printing the report.
+ */
+int
+APEX_check_retire(APEX_Checker *checker, const APEX_CPU *cpu)
+{
+    const CPU_Stage *stage = &cpu->writeback;
+    int shared = cpu->threads > 1;
+    int expected_pc = checker->pc;
+    Check_Effect effect;
+
+    if (checker->diverged)
+    {
+        return FALSE;
+    }
+
+    if (stage->pc != expected_pc || !instruction_at(checker, expected_pc))
+    {
+        report(checker, cpu, "control flow");
+        printf("Expected         : ");
+        print_instruction_at(checker, expected_pc);
+        printf("\n");
+        report_history(checker);
+        return FALSE;
+    }
+
+    if (!execute(checker, &effect, shared, stage->result_buffer))
+    {
+        report(checker, cpu, "address outside memory");
+        printf("Address          : %d\n", effect.address);
+        report_history(checker);
+        return FALSE;
+    }
+
+    if (effect.is_store
+        && (stage->memory_address != effect.address
+            || stage->rs1_value != effect.value))
+    {
+        report(checker, cpu, "store");
+        printf("Expected         : MEM[%d] = %d\n", effect.address,
+               effect.value);
+        printf("Pipeline         : MEM[%d] = %d\n", stage->memory_address,
+               stage->rs1_value);
+        report_history(checker);
+        return FALSE;
+    }
+
+    if (!compare_registers(checker, cpu)
+        || (stage->opcode == OPCODE_HALT && !shared
+            && !compare_memory(checker, cpu)))
+    {
+        report_history(checker);
+        return FALSE;
+    }
+
+    checker->history[checker->history_count++ % CHECK_HISTORY] = stage->pc;
+    checker->checked++;
+    return TRUE;
+}
+
+void
+APEX_check_print_stats(const APEX_Checker *checker)
+{
+    printf("----------\n%s\n----------\n", "LOCKSTEP CHECKER");
+    printf("Checked          : %d instructions\n", checker->checked);
+    if (checker->loads_adopted)
+    {
+        printf("Loads adopted    : %d\n", checker->loads_adopted);
+    }
+    if (checker->diverged)
+    {
+        printf("Result           : diverged at cycle %d\n",
+               checker->divergence_cycle);
+    }
+    else
+    {
+        printf("Result           : no divergence\n");
+    }
+    printf("\n");
+}
+
+void
+APEX_check_register_stats(const APEX_Checker *checker, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "checked", &checker->checked);
+    APEX_stats_counter(stats, "loads_adopted", &checker->loads_adopted);
+    APEX_stats_counter(stats, "diverged", &checker->diverged);
+    APEX_stats_counter(stats, "divergence_cycle", &checker->divergence_cycle);
+}
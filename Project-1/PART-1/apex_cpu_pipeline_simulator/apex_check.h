@@ -0,0 +1,58 @@
+/*
+ * apex_check.h
+ * Contains APEX lockstep checker declarations
+ *
+ * The checker is a plain ISA interpreter with its own registers, flags and
+ * data memory that runs one instruction for every instruction the pipeline
+ * retires. Writeback retires in program order, so after each retirement
+ * the pipeline's register file must match the interpreter's exactly: the
+ * checker compares the PC of the retired instruction, the address and data
+ * of stores, and all registers. At HALT the data memory is compared as
+ * well. The first mismatch stops the simulation with a report of what was
+ * expected, what the pipeline produced and the instructions retired before.
+ *
+ * Every hardware thread has its own checker. Flags are not compared since
+ * Execute sets them ahead of retirement; a wrong flag shows up as a branch
+ * retiring down the wrong path. When several threads share data memory,
+ * loads may see stores the checker never ran, so the checker takes loaded
+ * values from the pipeline and only checks their addresses, and skips the
+ * memory comparison.
+ */
+#ifndef _APEX_CHECK_H_
+#define _APEX_CHECK_H_
+
+#include "apex_cpu.h"
+
+/* Retired instructions shown in a divergence report */
+#define CHECK_HISTORY 8
+
+/* Model of the lockstep checker of one thread */
+typedef struct APEX_Checker
+{
+    const APEX_Instruction *code_memory; /* The CPU's code memory */
+    int code_memory_size;
+    int pc;                        /* PC of the next instruction to retire */
+    int regs[REG_FILE_SIZE];
+    int zero_flag;
+    int n_flag;
+    int p_flag;
+    APEX_Memory data_memory;       /* Golden copy of data memory */
+    int history[CHECK_HISTORY];    /* PCs of the latest retirements */
+    int history_count;
+
+    /* Statistics */
+    int checked;                   /* Retired instructions compared */
+    int loads_adopted;             /* Load values taken from the pipeline */
+    int diverged;                  /* A mismatch stopped the simulation */
+    int divergence_cycle;
+} APEX_Checker;
+
+APEX_Checker *APEX_check_init(const APEX_Instruction *code_memory,
+                              int code_memory_size, int pc,
+                              int address_bits);
+void APEX_check_free(APEX_Checker *checker);
+APEX_Checker *APEX_check_fork(APEX_Checker *checker);
+int APEX_check_retire(APEX_Checker *checker, const APEX_CPU *cpu);
+void APEX_check_print_stats(const APEX_Checker *checker);
+void APEX_check_register_stats(const APEX_Checker *checker, APEX_Stats *stats);
+#endif
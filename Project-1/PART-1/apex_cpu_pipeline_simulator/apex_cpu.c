@@ -6,13 +6,22 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "apex_cpu.h"
+#include "apex_check.h"
+#include "apex_debug.h"
 #include "apex_macros.h"
 
+static int branchTaken(APEX_CPU *cpu, int opcode);
+static void resolveTarget(APEX_CPU* cpu, int target);
+static void loopCapture(APEX_CPU *cpu, const CPU_Stage *stage);
+static void bpredSelect(APEX_CPU *cpu, int tid);
+static int selectThread(APEX_CPU *cpu);
+
 /* Converts the PC(4000 series) into array index for code memory
  *
  * Note: You are not supposed to edit this function
@@ -99,10 +108,10 @@ print_instruction(const CPU_Stage *stage)
 }
 
 static void 
-print_flags(const APEX_CPU *cpu)
+print_flags(const APEX_Context *ctx)
 {
     printf("--------\n%s\n--------\n", "FLAGS");
-    printf("Zero Flag : %d;  Positive Flag : %d; Negative Flag: %d;", cpu->zero_flag, cpu->p_flag, cpu->n_flag);
+    printf("Zero Flag : %d;  Positive Flag : %d; Negative Flag: %d;", ctx->zero_flag, ctx->p_flag, ctx->n_flag);
     printf("\n\n");
 }
 
@@ -111,8 +120,12 @@ print_flags(const APEX_CPU *cpu)
  * Note: You can edit this function to print in more detail
  */
 static void
-print_stage_content(const char *name, const CPU_Stage *stage)
+print_stage_content(const APEX_CPU *cpu, const char *name, const CPU_Stage *stage)
 {
+    if (cpu->threads > 1)
+    {
+        printf("T%d ", stage->tid);
+    }
     printf("%-15s: pc(%d) ", name, stage->pc);
     print_instruction(stage);
     printf("\n");
@@ -123,7 +136,7 @@ print_stage_content(const char *name, const CPU_Stage *stage)
  * Note: You are not supposed to edit this function
  */
 static void
-print_reg_file(const APEX_CPU *cpu)
+print_reg_file(const APEX_Context *ctx)
 {
     int i;
 
@@ -131,258 +144,444 @@ print_reg_file(const APEX_CPU *cpu)
 
     for (int i = 0; i < REG_FILE_SIZE / 2; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        printf("R%-3d[%-3d] ", i, ctx->regs[i]);
     }
 
     printf("\n");
 
     for (i = (REG_FILE_SIZE / 2); i < REG_FILE_SIZE; ++i)
     {
-        printf("R%-3d[%-3d] ", i, cpu->regs[i]);
+        printf("R%-3d[%-3d] ", i, ctx->regs[i]);
     }
 
     printf("\n");
 }
 
+/* TRUE if 'pc' holds an instruction of the program of 'ctx' */
+static int
+inCode(const APEX_Context *ctx, int pc)
+{
+    return pc >= 4000 && pc % 4 == 0
+           && get_code_memory_index_from_pc(pc) < ctx->code_memory_size;
+}
+
+/* TRUE if 'pc' of thread 'tid' is read from the replayed loop buffer */
+static int
+inLoop(const APEX_CPU *cpu, int tid, int pc)
+{
+    return cpu->loop.state == LOOP_REPLAY && cpu->loop.tid == tid
+           && pc >= cpu->loop.start && pc <= cpu->loop.end;
+}
+
 /*
- * Fetch Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
+ * Next-PC logic: appends the PC of thread 'tid' to its fetch target queue
+ * and moves the PC on to the target the BTB, the direction predictor, the
+ * return address stack or the indirect predictor chose for it. The
+ * instruction there is predecoded to tell the kind of control transfer.
  */
 static void
-APEX_fetch(APEX_CPU *cpu)
+queueTarget(APEX_CPU *cpu, int tid)
 {
-    APEX_Instruction *current_ins;
-
-    if (cpu->fetch.has_insn)
+    APEX_Context *ctx = &cpu->ctx[tid];
+    CPU_Stage *entry
+        = &ctx->ftq[(ctx->ftq_head + ctx->ftq_count) % cpu->config.ftq_size];
+    const APEX_Instruction *insn;
+
+    entry->pc = ctx->pc;
+    entry->tid = tid;
+    entry->from_loop = inLoop(cpu, tid, ctx->pc);
+    if (entry->from_loop)
     {
-        /* This fetches new branch target instruction from next cycle */
-        if (cpu->fetch_from_next_cycle == TRUE)
-        {
-            cpu->fetch_from_next_cycle = FALSE;
+        insn = &cpu->loop.body[(ctx->pc - cpu->loop.start) / 4];
+    }
+    else
+    {
+        insn = &ctx->code_memory[get_code_memory_index_from_pc(ctx->pc)];
+    }
 
-            /* Skip this cycle*/
-            return;
+    /* Control transfers that hit in the BTB continue at their predicted
+     * target */
+    bpredSelect(cpu, tid);
+    entry->bpred_history = cpu->bpred.history;
+    entry->predicted_taken = FALSE;
+    entry->target_source = TARGET_NONE;
+
+    if(isControlTransfer(insn->opcode)){
+        int target=0;
+
+        if(entry->from_loop){
+            /* The closing branch of a replayed loop goes back to the
+             * start without a BTB lookup */
+            entry->predicted_taken = TRUE;
+            target = cpu->loop.start;
+            cpu->loop.iterations++;
+            cpu->loop.btb_lookups_saved++;
+            APEX_bpred_speculate(&cpu->bpred, TRUE);
         }
+        else{
+            int btbIdx=searchBTB(cpu, tid, ctx->pc);
 
-        /* Store current PC in fetch latch */
+            cpu->btb_lookups++;
+            if(btbIdx>=0){
+                cpu->btb_hits++;
+            }
+            else{
+                cpu->btb_misses++;
+            }
 
-        cpu->fetch.pc = cpu->pc;
+            /* Conditional branches ask the direction predictor and take
+             * the target from the BTB */
+            if(isConditionalBranch(insn->opcode)){
+                target = btbIdx>=0 ? cpu->BTB[btbIdx].calculated_address : 0;
+                entry->predicted_taken = APEX_bpred_predict(&cpu->bpred, ctx->pc,
+                        btbIdx>=0 ? &cpu->BTB[btbIdx].counter : NULL)
+                        && btbIdx>=0 && inCode(ctx, target);
+
+                /* Without a BTB entry, or with a target outside the
+                 * program, there is no target, so the history records the
+                 * fall-through fetch actually takes */
+                APEX_bpred_speculate(&cpu->bpred, entry->predicted_taken);
+            }
+            else{
+                /* Returns pop the stack, other jumps try the indirect
+                 * predictor and then the BTB */
+                entry->path_history = cpu->indirect.history;
+                if(insn->opcode==OPCODE_JUMP && APEX_ras_is_return(&ctx->ras, insn->rs1)){
+                    target = APEX_ras_pop(&ctx->ras);
+                    entry->target_source = TARGET_RAS;
+                }
+                else if(APEX_indirect_predict(&cpu->indirect, tid, ctx->pc, entry->path_history, &target)){
+                    entry->target_source = TARGET_INDIRECT;
+                }
+                else if(btbIdx>=0 && cpu->BTB[btbIdx].taken==1){
+                    target = cpu->BTB[btbIdx].calculated_address;
+                    entry->target_source = TARGET_BTB;
+                }
 
-        /* Index into code memory using this pc and copy all instruction fields
-         * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.imm = current_ins->imm;
-        
-        /* Update PC for next instruction */
-        
-        if(cpu->fetch.opcode==OPCODE_BNZ || cpu->fetch.opcode==OPCODE_BZ || cpu->fetch.opcode==OPCODE_BNP|| cpu->fetch.opcode==OPCODE_BP){
-            int btbIdx=searchBTB(cpu, cpu->pc);
-            if(btbIdx>=0 && cpu->BTB[btbIdx].taken==1 && cpu->BTB[btbIdx].resolved==1 ){
+                /* A target outside the program, such as a register value
+                 * that was never a code address, falls through instead */
+                if(entry->target_source!=TARGET_NONE && !inCode(ctx, target)){
+                    entry->target_source = TARGET_NONE;
+                }
 
-                cpu->pc= cpu->BTB[btbIdx].calculated_address;
+                if(insn->opcode==OPCODE_JALR){
+                    APEX_ras_push(&ctx->ras, ctx->pc + 4, insn->rd);
+                }
+                entry->predicted_taken = entry->target_source != TARGET_NONE;
             }
-            // else if (btbIdx>=0 && cpu->BTB[btbIdx].taken==1){
+        }
 
-            // }
-            else{
-                // cpu->BTB[btbIdx].taken==1;
-                cpu->pc += 4;
-            }
+        if(entry->predicted_taken){
+
+            ctx->pc= target;
         }
         else{
-                cpu->pc += 4;
+            ctx->pc += 4;
         }
-        
-
-        /* Copy data from fetch latch to decode latch*/
-        cpu->decode = cpu->fetch;
+    }
+    else{
+            ctx->pc += 4;
+    }
+    APEX_ras_checkpoint(&ctx->ras, &entry->ras_checkpoint);
+    entry->predicted_pc = ctx->pc;
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Fetch", &cpu->fetch);
-        }
+    ctx->ftq_count++;
+    if (ctx->ftq_count > ctx->ftq_max)
+    {
+        ctx->ftq_max = ctx->ftq_count;
+    }
 
-        /* Stop fetching new instructions if HALT is fetched */
-        if (cpu->fetch.opcode == OPCODE_HALT)
-        {
-            cpu->fetch.has_insn = FALSE;
-        }
+    /* Stop queueing new targets once HALT is queued */
+    if (insn->opcode == OPCODE_HALT)
+    {
+        ctx->fetch.has_insn = FALSE;
     }
 }
 
 /*
- * Decode Stage of APEX Pipeline
+ * Fetch Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
 static void
-APEX_decode(APEX_CPU *cpu)
+APEX_fetch(APEX_CPU *cpu)
+{
+    APEX_Instruction *current_ins;
+    APEX_Context *ctx;
+    CPU_Stage *stage;
+    int tid;
+    int i;
+
+    if (cpu->loop.state == LOOP_REPLAY)
+    {
+        cpu->loop.residency++;
+    }
+
+    tid = selectThread(cpu);
+
+    /* A skipped fetch only applies to the cycle it was asked for */
+    for (i = 0; i < cpu->threads; ++i)
+    {
+        cpu->ctx[i].fetch_from_next_cycle = FALSE;
+        if (cpu->ctx[i].ibuf_count == cpu->config.ibuf_size)
+        {
+            cpu->ctx[i].ibuf_full_cycles++;
+        }
+    }
+
+    if (tid < 0)
+    {
+        cpu->fetch_idle++;
+        return;
+    }
+
+    ctx = &cpu->ctx[tid];
+
+    /* The next-PC logic queues one target per cycle, running ahead of
+     * Fetch while it waits */
+    if (ctx->fetch.has_insn && ctx->ftq_count < cpu->config.ftq_size
+        && inCode(ctx, ctx->pc))
+    {
+        queueTarget(cpu, tid);
+    }
+
+    /* A full instruction buffer holds Fetch back */
+    if (ctx->ftq_count == 0 || ctx->ibuf_count == cpu->config.ibuf_size)
+    {
+        return;
+    }
+
+    /* Store the target at the head of the queue, with its prediction, in
+     * the next instruction buffer slot */
+    stage = &ctx->ibuf[(ctx->ibuf_head + ctx->ibuf_count) % cpu->config.ibuf_size];
+    *stage = ctx->ftq[ctx->ftq_head];
+    ctx->ftq_head = (ctx->ftq_head + 1) % cpu->config.ftq_size;
+    ctx->ftq_count--;
+    ctx->fetched++;
+
+    /* Index into code memory using this pc and copy all instruction fields
+     * into the buffer */
+    if (stage->from_loop)
+    {
+        /* Inside a replayed loop the body comes from the loop buffer */
+        current_ins = &cpu->loop.body[(stage->pc - cpu->loop.start) / 4];
+        cpu->loop.replayed++;
+    }
+    else
+    {
+        current_ins = &ctx->code_memory[get_code_memory_index_from_pc(stage->pc)];
+    }
+    strcpy(stage->opcode_str, current_ins->opcode_str);
+    stage->opcode = current_ins->opcode;
+    stage->rd = current_ins->rd;
+    stage->rs1 = current_ins->rs1;
+    stage->rs2 = current_ins->rs2;
+    stage->imm = current_ins->imm;
+    stage->has_insn = TRUE;
+
+    /* Count instructions fetched while the back end was holding Decode */
+    if (ctx->decode.has_insn)
+    {
+        ctx->runahead_fetches++;
+    }
+    ctx->ibuf_count++;
+    if (ctx->ibuf_count > ctx->ibuf_max)
+    {
+        ctx->ibuf_max = ctx->ibuf_count;
+    }
+
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+    {
+        print_stage_content(cpu, "Fetch", stage);
+    }
+}
+
+/* Reads the operands of the instruction in the decode latch of 'ctx' and
+ * issues it to Execute. Returns FALSE if it stalls on the scoreboard */
+static int
+decodeThread(APEX_CPU *cpu, APEX_Context *ctx)
 {
     int stall=0;
-    if (cpu->decode.has_insn)
+
+    /* Read operands from register file based on the instruction type */
+    switch (ctx->decode.opcode)
     {
-        /* Read operands from register file based on the instruction type */
-        switch (cpu->decode.opcode)
+        case OPCODE_SUB:
+        case OPCODE_ADD:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_DIV:
+        case OPCODE_MUL:
         {
-            case OPCODE_SUB:
-            case OPCODE_ADD:
-            case OPCODE_AND:
-            case OPCODE_OR:
-            case OPCODE_XOR:
-            case OPCODE_DIV:
-            case OPCODE_MUL:
-            {
-                if(cpu->register_waiting_flag[cpu->decode.rs1]==1 || cpu->register_waiting_flag[cpu->decode.rs2]==1 || cpu->register_waiting_flag[cpu->decode.rd]==1){
-                    cpu->fetch_from_next_cycle=TRUE;
-                    stall= 1;
-                    break;
-                }
-                cpu->register_waiting_flag[cpu->decode.rd]=1;
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+            if(ctx->register_waiting_flag[ctx->decode.rs1]==1 || ctx->register_waiting_flag[ctx->decode.rs2]==1 || ctx->register_waiting_flag[ctx->decode.rd]==1){
+                stall= 1;
                 break;
             }
-            case OPCODE_STORE:
-            case OPCODE_STOREP:
-            {
-                if(cpu->register_waiting_flag[cpu->decode.rs1]==1 || cpu->register_waiting_flag[cpu->decode.rs2]==1){
-                    cpu->fetch_from_next_cycle=TRUE;
-                    stall= 1;
-                    break;
-                }
-                // cpu->register_waiting_flag[cpu->decode.rd]=1;
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                if(cpu->decode.opcode==OPCODE_STOREP){
-                    cpu->register_waiting_flag[cpu->decode.rs2]=1;
-                }
-
+            ctx->register_waiting_flag[ctx->decode.rd]=1;
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            ctx->decode.rs2_value = ctx->regs[ctx->decode.rs2];
+            break;
+        }
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+        {
+            if(ctx->register_waiting_flag[ctx->decode.rs1]==1 || ctx->register_waiting_flag[ctx->decode.rs2]==1){
+                stall= 1;
                 break;
             }
+            // ctx->register_waiting_flag[ctx->decode.rd]=1;
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            ctx->decode.rs2_value = ctx->regs[ctx->decode.rs2];
 
-            case OPCODE_SUBL:
-            case OPCODE_ADDL:
-            {
-                if(cpu->register_waiting_flag[cpu->decode.rs1]==1 || cpu->register_waiting_flag[cpu->decode.rd]==1){
-                    cpu->fetch_from_next_cycle=TRUE;
-                    stall= 1;
-                    break;
-                }
+            if(ctx->decode.opcode==OPCODE_STOREP){
+                ctx->register_waiting_flag[ctx->decode.rs2]=1;
+            }
 
-                cpu->register_waiting_flag[cpu->decode.rd]=1;
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                
+            break;
+        }
+
+        case OPCODE_SUBL:
+        case OPCODE_ADDL:
+        {
+            if(ctx->register_waiting_flag[ctx->decode.rs1]==1 || ctx->register_waiting_flag[ctx->decode.rd]==1){
+                stall= 1;
                 break;
             }
 
-            case OPCODE_LOAD:
-            case OPCODE_LOADP:
-            {
-
-                if(cpu->register_waiting_flag[cpu->decode.rs1]==1 || cpu->register_waiting_flag[cpu->decode.rd]==1){
-                    cpu->fetch_from_next_cycle=TRUE;
-                    stall= 1;
-                    break;
-                }
-                cpu->register_waiting_flag[cpu->decode.rd]=1;
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
+            ctx->register_waiting_flag[ctx->decode.rd]=1;
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            
+            break;
+        }
 
-                if(cpu->decode.opcode==OPCODE_LOADP){
-                    cpu->register_waiting_flag[cpu->decode.rs1]=1;
-                }
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        {
 
+            if(ctx->register_waiting_flag[ctx->decode.rs1]==1 || ctx->register_waiting_flag[ctx->decode.rd]==1){
+                stall= 1;
                 break;
             }
+            ctx->register_waiting_flag[ctx->decode.rd]=1;
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
 
-            case OPCODE_MOVC:
-            {
-                /* MOVC doesn't have register operands */
-                if( cpu->register_waiting_flag[cpu->decode.rd]==1){
-                    cpu->fetch_from_next_cycle=TRUE;
-                    stall= 1;
-                    break;
-                }
-                cpu->register_waiting_flag[cpu->decode.rd]=1;
+            if(ctx->decode.opcode==OPCODE_LOADP){
+                ctx->register_waiting_flag[ctx->decode.rs1]=1;
+            }
+
+            break;
+        }
+
+        case OPCODE_MOVC:
+        {
+            /* MOVC doesn't have register operands */
+            if( ctx->register_waiting_flag[ctx->decode.rd]==1){
+                stall= 1;
                 break;
             }
-            case OPCODE_CMP:
+            ctx->register_waiting_flag[ctx->decode.rd]=1;
+            break;
+        }
+        case OPCODE_CMP:
+        {
+            if (ctx->register_waiting_flag[ctx->decode.rs1] == 1 || ctx->register_waiting_flag[ctx->decode.rs2]== 1)
             {
-                if (cpu->register_waiting_flag[cpu->decode.rs1] == 1 || cpu->register_waiting_flag[cpu->decode.rs2]== 1)
-                {
-                    
-                    cpu->fetch_from_next_cycle = TRUE;
-                    stall=1;
-                    break;
-                }
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                break;
                 
+                stall=1;
+                break;
             }
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            ctx->decode.rs2_value = ctx->regs[ctx->decode.rs2];
+            break;
+            
+        }
 
-            case OPCODE_CML:
+        case OPCODE_CML:
+        {
+            if(ctx->register_waiting_flag[ctx->decode.rs1] == 1)
             {
-                if(cpu->register_waiting_flag[cpu->decode.rs1] == 1)
-                {
-                    stall=1;
-                    cpu->fetch_from_next_cycle = TRUE;
-                    break;
-                }
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
+                stall=1;
                 break;
             }
-            case OPCODE_JALR:
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            break;
+        }
+        case OPCODE_JALR:
+        {
+            if (ctx->register_waiting_flag[ctx->decode.rs1] == 1)
             {
-                if (cpu->register_waiting_flag[cpu->decode.rs1] == 1)
-                {
-                    stall=1;
-                    cpu->fetch_from_next_cycle = TRUE;
-                    break;
-                }
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->register_waiting_flag[cpu->decode.rd] = 1;
+                stall=1;
                 break;
             }
-            case OPCODE_JUMP:
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            ctx->register_waiting_flag[ctx->decode.rd] = 1;
+            break;
+        }
+        case OPCODE_JUMP:
+        {
+            if (ctx->register_waiting_flag[ctx->decode.rs1] == 1)
             {
-                if (cpu->register_waiting_flag[cpu->decode.rs1] == 1)
-                {
-                    
-                    cpu->fetch_from_next_cycle = TRUE;
-                    stall=1;
-                    break;
-                }
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
+                
+                stall=1;
                 break;
             }
-            case OPCODE_BNZ:
-            case OPCODE_BZ:
-            case OPCODE_BNP:
-            case OPCODE_BP:
-            {
-                int btbIdx=searchBTB(cpu, cpu->pc);
-                if(btbIdx==-1){
-                    addToBTB(cpu, cpu->decode.pc, -1);
-                }
-            }
+            ctx->decode.rs1_value = ctx->regs[ctx->decode.rs1];
+            break;
         }
+    }
+
+    /* Copy data from decode latch to execute latch*/
+    if(stall==0){
+        loopCapture(cpu, &ctx->decode);
+        cpu->execute = ctx->decode;
+        ctx->decode.has_insn = FALSE;
+        ctx->issued++;
+    }
+    else{
+        ctx->decode_stalls++;
+    }
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+    {
+        print_stage_content(cpu, "Decode/RF", &ctx->decode);
+    }
+    return stall==0;
+}
+
+/*
+ * Decode Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static void
+APEX_decode(APEX_CPU *cpu)
+{
+    int i;
 
+    /* An empty decode latch takes the oldest instruction in its thread's
+     * instruction buffer */
+    for (i = 0; i < cpu->threads; ++i)
+    {
+        APEX_Context *ctx = &cpu->ctx[i];
 
-        /* Copy data from decode latch to execute latch*/
-        if(stall==0){
-            cpu->execute = cpu->decode;
-            cpu->decode.has_insn = FALSE;
+        if (!ctx->decode.has_insn && ctx->ibuf_count > 0)
+        {
+            ctx->decode = ctx->ibuf[ctx->ibuf_head];
+            ctx->ibuf_head = (ctx->ibuf_head + 1) % cpu->config.ibuf_size;
+            ctx->ibuf_count--;
         }
-        if (ENABLE_DEBUG_MESSAGES)
+    }
+
+    /* One instruction issues per cycle. The threads take turns at the slot,
+     * a thread stalled on its scoreboard passes it to the next one */
+    for (i = 0; i < cpu->threads; ++i)
+    {
+        int tid = (cpu->decode_next + i) % cpu->threads;
+
+        if (cpu->ctx[tid].decode.has_insn && decodeThread(cpu, &cpu->ctx[tid]))
         {
-            print_stage_content("Decode/RF", &cpu->decode);
+            cpu->decode_next = (tid + 1) % cpu->threads;
+            break;
         }
     }
 }
@@ -395,6 +594,8 @@ APEX_decode(APEX_CPU *cpu)
 static void
 APEX_execute(APEX_CPU *cpu)
 {
+    APEX_Context *ctx = &cpu->ctx[cpu->execute.tid];
+
     if (cpu->execute.has_insn)
     {
         /* Execute logic based on instruction type */
@@ -428,7 +629,7 @@ APEX_execute(APEX_CPU *cpu)
                 }
                 else if (cpu->execute.opcode==OPCODE_AND){
                     cpu->execute.result_buffer
-                        = cpu->execute.rs1_value && cpu->execute.imm; 
+                        = cpu->execute.rs1_value & cpu->execute.rs2_value;
                 }
                 else if (cpu->execute.opcode == OPCODE_XOR){
                     cpu->execute.result_buffer = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
@@ -448,11 +649,11 @@ APEX_execute(APEX_CPU *cpu)
                 /* Set the zero flag based on the result buffer */
                 if (cpu->execute.result_buffer == 0)
                 {
-                    cpu->zero_flag = TRUE;
+                    ctx->zero_flag = TRUE;
                 } 
                 else 
                 {
-                    cpu->zero_flag = FALSE;
+                    ctx->zero_flag = FALSE;
                 }
                 break;
             }
@@ -467,155 +668,47 @@ APEX_execute(APEX_CPU *cpu)
             {
                 cpu->execute.memory_address = cpu->execute.rs1_value + cpu->execute.imm;
                 cpu->execute.aux_buffer = cpu->execute.rs1_value + 4;
+                break;
             }
 
             case OPCODE_BZ:
+            case OPCODE_BNZ:
+            case OPCODE_BP:
+            case OPCODE_BNP:
+            case OPCODE_BN:
+            case OPCODE_BNN:
             {
-                int btbIdx=searchBTB(cpu, cpu->execute.pc);
-                if (cpu->zero_flag == TRUE)
+                if (branchTaken(cpu, cpu->execute.opcode))
                 {
                     branch(cpu);
-                    // /* Calculate new PC, and send it to fetch unit */
-                    // cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    // /* Since we are using reverse callbacks for pipeline stages, 
-                    //  * this will prevent the new instruction from being fetched in the current cycle*/
-                    // cpu->fetch_from_next_cycle = TRUE;
-
-                    // /* Flush previous stages */
-                    // cpu->decode.has_insn = FALSE;
-
-                    // /* Make sure fetch stage is enabled to start fetching from new PC */
-                    // cpu->fetch.has_insn = TRUE;
-
                 }
-                
-                else if(cpu->BTB[btbIdx].resolved==1){
+                else
+                {
                     flushAndFetchNext(cpu);
                 }
                 break;
             }
-            
-            case OPCODE_BNZ:
+            case OPCODE_MOVC: 
             {
-                if (cpu->zero_flag == FALSE)
+                cpu->execute.result_buffer = cpu->execute.imm;
+
+                /* Set the zero flag based on the result buffer */
+                if (cpu->execute.result_buffer == 0)
                 {
-                    branch(cpu);
-                }
-                else{
-                    flushAndFetchNext(cpu);
+                    ctx->zero_flag = TRUE;
+                } 
+                else 
+                {
+                    ctx->zero_flag = FALSE;
                 }
                 break;
             }
-            case OPCODE_BP:
+            case OPCODE_STORE:
             {
-                if (cpu->p_flag == TRUE)
-                {
-                    branch(cpu);
-                    // /* Calculate new PC, and send it to fetch unit */
-                    // cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    // /* Since we are using reverse callbacks for pipeline stages, 
-                    //  * this will prevent the new instruction from being fetched in the current cycle*/
-                    // cpu->fetch_from_next_cycle = TRUE;
-
-                    // /* Flush previous stages */
-                    // cpu->decode.has_insn = FALSE;
-
-                    // /* Make sure fetch stage is enabled to start fetching from new PC */
-                    // cpu->fetch.has_insn = TRUE;
-                }
-                else {
-                    flushAndFetchNext(cpu);
-                }
+                cpu->execute.memory_address = cpu->execute.rs2_value + cpu->execute.imm;
                 break;
             }
-
-            case OPCODE_BNP:
-            {
-                int btbIdx=searchBTB(cpu, cpu->execute.pc);
-                if (cpu->p_flag == FALSE)
-                {
-                    branch(cpu);
-                    // /* Calculate new PC, and send it to fetch unit */
-                    // cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    // /* Since we are using reverse callbacks for pipeline stages, 
-                    //  * this will prevent the new instruction from being fetched in the current cycle*/
-                    // cpu->fetch_from_next_cycle = TRUE;
-
-                    // /* Flush previous stages */
-                    // cpu->decode.has_insn = FALSE;
-
-                    // /* Make sure fetch stage is enabled to start fetching from new PC */
-                    // cpu->fetch.has_insn = TRUE;
-                }
-                else if (cpu->BTB[btbIdx].resolved==1){
-                    flushAndFetchNext(cpu);
-                }
-                break;
-            }
-            case OPCODE_BN:
-            {
-                if (cpu->n_flag == TRUE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-
-            case OPCODE_BNN:
-            {
-                if (cpu->n_flag == FALSE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-
-            case OPCODE_MOVC: 
-            {
-                cpu->execute.result_buffer = cpu->execute.imm;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-                break;
-            }
-            case OPCODE_STORE:
-            {
-                cpu->execute.memory_address = cpu->execute.rs2_value + cpu->execute.imm;
-                break;
-            }
-            case OPCODE_STOREP:
+            case OPCODE_STOREP:
             {
                 cpu->execute.memory_address = cpu->execute.rs2_value + cpu->execute.imm;
                 cpu->execute.aux_buffer = cpu->execute.rs2_value + 4;
@@ -625,19 +718,13 @@ APEX_execute(APEX_CPU *cpu)
             {
                 int program_counter = cpu->execute.rs1_value + cpu->execute.imm;
                 cpu->execute.jump_buffer = cpu->execute.pc + 4;
-                cpu->pc = program_counter;
-                cpu->fetch_from_next_cycle = TRUE;
-                cpu->decode.has_insn = FALSE;
-                cpu->fetch.has_insn = TRUE;
+                resolveTarget(cpu, program_counter);
                 break;
             }
             
             case OPCODE_JUMP:
             {
-                cpu->pc = cpu->execute.rs1_value + cpu->execute.imm;
-                cpu->fetch_from_next_cycle = TRUE;
-                cpu->decode.has_insn = FALSE;
-                cpu->fetch.has_insn = TRUE;
+                resolveTarget(cpu, cpu->execute.rs1_value + cpu->execute.imm);
                 break;
             }
             
@@ -659,23 +746,23 @@ APEX_execute(APEX_CPU *cpu)
                 case OPCODE_XOR: // 
                 case OPCODE_DIV:
                 {
-                    cpu->zero_flag = cpu->execute.result_buffer == 0;
-                    cpu->p_flag = cpu->execute.result_buffer > 0;
-                    cpu->n_flag = cpu->execute.result_buffer < 0;
+                    ctx->zero_flag = cpu->execute.result_buffer == 0;
+                    ctx->p_flag = cpu->execute.result_buffer > 0;
+                    ctx->n_flag = cpu->execute.result_buffer < 0;
                     break;
                 }
                 case OPCODE_CMP:
                 {
-                    cpu->zero_flag = cpu->execute.rs1_value == cpu->execute.rs2_value;
-                    cpu->p_flag = cpu->execute.rs1_value > cpu->execute.rs2_value;
-                    cpu->n_flag = cpu->execute.rs1_value < cpu->execute.rs2_value;
+                    ctx->zero_flag = cpu->execute.rs1_value == cpu->execute.rs2_value;
+                    ctx->p_flag = cpu->execute.rs1_value > cpu->execute.rs2_value;
+                    ctx->n_flag = cpu->execute.rs1_value < cpu->execute.rs2_value;
                     break;
                 }
                 case OPCODE_CML:
                 {
-                    cpu->zero_flag = cpu->execute.rs1_value == cpu->execute.imm;
-                    cpu->p_flag = cpu->execute.rs1_value > cpu->execute.imm;
-                    cpu->n_flag = cpu->execute.rs1_value < cpu->execute.imm;
+                    ctx->zero_flag = cpu->execute.rs1_value == cpu->execute.imm;
+                    ctx->p_flag = cpu->execute.rs1_value > cpu->execute.imm;
+                    ctx->n_flag = cpu->execute.rs1_value < cpu->execute.imm;
                     break;
                 }
         }
@@ -685,13 +772,43 @@ APEX_execute(APEX_CPU *cpu)
         cpu->memory = cpu->execute;
         cpu->execute.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
-            print_stage_content("Execute", &cpu->execute);
+            print_stage_content(cpu, "Execute", &cpu->execute);
         }
     }
 }
 
+/*
+ * Stops the simulation at a load or store that cannot access data memory.
+ * Writeback already retired every older instruction this cycle and the
+ * faulting one stays in Memory, so registers and memory are those of the
+ * instruction before it.
+ */
+static void
+memory_fault(APEX_CPU *cpu, const char *reason)
+{
+    cpu->faulted = TRUE;
+    printf("APEX_CPU: Memory fault at pc(%d) ", cpu->memory.pc);
+    print_instruction(&cpu->memory);
+    printf(": address %d %s\n", cpu->memory.memory_address, reason);
+}
+
+/* Why a load or store cannot access 'address', or NULL if it can */
+static const char *
+address_fault(const APEX_CPU *cpu, int address)
+{
+    if (address < 0)
+    {
+        return "is negative";
+    }
+    if (!APEX_memory_in_range(&cpu->data_memory, address))
+    {
+        return "is out of range";
+    }
+    return NULL;
+}
+
 /*
  * Memory Stage of APEX Pipeline
  *
@@ -702,6 +819,9 @@ APEX_memory(APEX_CPU *cpu)
 {
     if (cpu->memory.has_insn)
     {
+        unsigned address = cpu->memory.memory_address;
+        const char *fault = address_fault(cpu, cpu->memory.memory_address);
+
         switch (cpu->memory.opcode)
         {
             case OPCODE_ADD:
@@ -713,16 +833,35 @@ APEX_memory(APEX_CPU *cpu)
             case OPCODE_LOAD:
             case OPCODE_LOADP:
             {
-                /* Read from data memory */
+                if (fault)
+                {
+                    memory_fault(cpu, fault);
+                    return;
+                }
 
+                /* Read from data memory */
                 cpu->memory.result_buffer
-                    = cpu->data_memory[cpu->memory.memory_address];
+                    = APEX_memory_read(&cpu->data_memory, address);
                 break;
             }
             case OPCODE_STORE:
             case OPCODE_STOREP:
             {
-                cpu->data_memory[cpu->memory.memory_address] = cpu->memory.rs1_value;
+                if (fault)
+                {
+                    memory_fault(cpu, fault);
+                    return;
+                }
+                if (cpu->debugger)
+                {
+                    APEX_debug_store(cpu->debugger, &cpu->memory, address);
+                }
+                if (!APEX_memory_write(&cpu->data_memory, address,
+                                       cpu->memory.rs1_value))
+                {
+                    memory_fault(cpu, "has no page, out of host memory");
+                    return;
+                }
                 break;
             }
 
@@ -732,9 +871,9 @@ APEX_memory(APEX_CPU *cpu)
         cpu->writeback = cpu->memory;
         cpu->memory.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
-            print_stage_content("Memory", &cpu->memory);
+            print_stage_content(cpu, "Memory", &cpu->memory);
         }
     }
 }
@@ -747,6 +886,9 @@ APEX_memory(APEX_CPU *cpu)
 static int
 APEX_writeback(APEX_CPU *cpu)
 {
+    APEX_Context *ctx = &cpu->ctx[cpu->writeback.tid];
+    int i;
+
     if (cpu->writeback.has_insn)
     {
         /* Write result to register file based on instruction type */
@@ -762,42 +904,42 @@ APEX_writeback(APEX_CPU *cpu)
             case OPCODE_XOR:
             case OPCODE_OR:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                cpu->register_waiting_flag[cpu->writeback.rd]=0;
+                ctx->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                ctx->register_waiting_flag[cpu->writeback.rd]=0;
                 break;
             }
 
             case OPCODE_LOAD:
             {
-                cpu->register_waiting_flag[cpu->writeback.rd]=0;
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                ctx->register_waiting_flag[cpu->writeback.rd]=0;
+                ctx->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
                 break;
             }
             case OPCODE_LOADP:
             {             
-                cpu->regs[cpu->writeback.rs1] = cpu->writeback.aux_buffer;
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                cpu->register_waiting_flag[cpu->writeback.rd] = FALSE;
-                cpu->register_waiting_flag[cpu->writeback.rs1] = FALSE;
+                ctx->regs[cpu->writeback.rs1] = cpu->writeback.aux_buffer;
+                ctx->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                ctx->register_waiting_flag[cpu->writeback.rd] = FALSE;
+                ctx->register_waiting_flag[cpu->writeback.rs1] = FALSE;
                 break;
             }
 
             case OPCODE_MOVC: 
             {
-                cpu->register_waiting_flag[cpu->writeback.rd]=0;
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+                ctx->register_waiting_flag[cpu->writeback.rd]=0;
+                ctx->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
                 break;
             }
             case OPCODE_JALR:
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.jump_buffer;
-                cpu->register_waiting_flag[cpu->writeback.rd] = FALSE;
+                ctx->regs[cpu->writeback.rd] = cpu->writeback.jump_buffer;
+                ctx->register_waiting_flag[cpu->writeback.rd] = FALSE;
                 break;
             }
             case OPCODE_STOREP:
             {             
-                cpu->regs[cpu->writeback.rs2] = cpu->writeback.aux_buffer;
-                cpu->register_waiting_flag[cpu->writeback.rs2] = 0;
+                ctx->regs[cpu->writeback.rs2] = cpu->writeback.aux_buffer;
+                ctx->register_waiting_flag[cpu->writeback.rs2] = 0;
                 break;
             }
             case OPCODE_NOP:
@@ -815,16 +957,40 @@ APEX_writeback(APEX_CPU *cpu)
         }
 
         cpu->insn_completed++;
+        ctx->insn_completed++;
         cpu->writeback.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (cpu->debugger)
+        {
+            APEX_debug_retire(cpu->debugger, &cpu->writeback);
+        }
+
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+        {
+            print_stage_content(cpu, "Writeback", &cpu->writeback);
+        }
+
+        /* Stop at the first retirement the functional model disagrees
+         * with */
+        if (ctx->checker && !APEX_check_retire(ctx->checker, cpu))
         {
-            print_stage_content("Writeback", &cpu->writeback);
+            cpu->diverged = TRUE;
+            return TRUE;
         }
 
         if (cpu->writeback.opcode == OPCODE_HALT)
         {
-            /* Stop the APEX simulator */
+            ctx->halted = TRUE;
+            ctx->halt_cycle = cpu->clock + 1;
+
+            /* Stop the APEX simulator once every thread halted */
+            for (i = 0; i < cpu->threads; ++i)
+            {
+                if (!cpu->ctx[i].halted)
+                {
+                    return 0;
+                }
+            }
             return TRUE;
         }
     }
@@ -833,15 +999,280 @@ APEX_writeback(APEX_CPU *cpu)
     return 0;
 }
 
+/* Run-time options accepted by APEX_config_set() as "name=value" */
+typedef struct APEX_Option
+{
+    const char *name;
+    size_t offset;
+    int min;
+    const char *const *names;      /* Symbolic values, or NULL */
+} APEX_Option;
+
+/* Run-time options naming a file, copied into the configuration */
+typedef struct APEX_Path_Option
+{
+    const char *name;
+    size_t offset;
+} APEX_Path_Option;
+
+static const char *const smt_policy_names[] = {"rr", "icount", "stall", NULL};
+
+static const APEX_Option apex_options[] = {
+    {"btb_sets", offsetof(APEX_Config, btb_sets), 1, NULL},
+    {"btb_ways", offsetof(APEX_Config, btb_ways), 1, NULL},
+    {"bpred", offsetof(APEX_Config, bpred), 0, APEX_bpred_names},
+    {"gshare_bits", offsetof(APEX_Config, gshare_bits), 1, NULL},
+    {"ras_depth", offsetof(APEX_Config, ras_depth), 0, NULL},
+    {"ftq_size", offsetof(APEX_Config, ftq_size), 1, NULL},
+    {"ibuf_size", offsetof(APEX_Config, ibuf_size), 1, NULL},
+    {"indirect_size", offsetof(APEX_Config, indirect_size), 0, NULL},
+    {"loop_buffer", offsetof(APEX_Config, loop_buffer), 0, NULL},
+    {"threads", offsetof(APEX_Config, threads), 1, NULL},
+    {"smt_policy", offsetof(APEX_Config, smt_policy), 0, smt_policy_names},
+    {"check", offsetof(APEX_Config, check), 0, NULL},
+    {"mem_bits", offsetof(APEX_Config, mem_bits), 1, NULL},
+    {"huge_pages", offsetof(APEX_Config, huge_pages), 0, NULL},
+    {"whatif", offsetof(APEX_Config, whatif), 0, NULL},
+    {"snap_mb", offsetof(APEX_Config, snap_mb), 0, NULL},
+};
+
+static const APEX_Path_Option apex_path_options[] = {
+    {"stats", offsetof(APEX_Config, stats)},
+};
+
+/* Fills in the default configuration */
+void
+APEX_config_init(APEX_Config *config)
+{
+    memset(config, 0, sizeof(APEX_Config));
+    config->btb_sets = BTB_SETS;
+    config->btb_ways = BTB_WAYS;
+    config->bpred = BPRED_DEFAULT;
+    config->gshare_bits = GSHARE_BITS;
+    config->ras_depth = RAS_DEPTH;
+    config->ftq_size = FTQ_SIZE;
+    config->ibuf_size = IBUF_SIZE;
+    config->indirect_size = INDIRECT_SIZE;
+    config->loop_buffer = LOOP_BUFFER_SIZE;
+    config->threads = SMT_THREADS;
+    config->smt_policy = SMT_POLICY;
+    config->check = LOCKSTEP_CHECK;
+    config->mem_bits = MEMORY_ADDRESS_BITS;
+    config->huge_pages = MEMORY_HUGE_PAGES;
+    config->whatif = WHATIF_CYCLE;
+    config->snap_mb = SNAPSHOT_MB;
+}
+
+/*
+ * Applies one "name=value" option to the configuration.
+ * Returns FALSE if the option is unknown or the value is out of range.
+ */
+int
+APEX_config_set(APEX_Config *config, const char *option)
+{
+    const char *value = strchr(option, '=');
+    size_t i;
+
+    if (!value)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < sizeof(apex_path_options) / sizeof(apex_path_options[0]);
+         ++i)
+    {
+        const APEX_Path_Option *opt = &apex_path_options[i];
+
+        if (strlen(opt->name) != (size_t)(value - option)
+            || strncmp(opt->name, option, value - option) != 0)
+        {
+            continue;
+        }
+
+        if (!value[1] || strlen(value + 1) >= STATS_PATH_SIZE)
+        {
+            return FALSE;
+        }
+        strcpy((char *)config + opt->offset, value + 1);
+        return TRUE;
+    }
+
+    for (i = 0; i < sizeof(apex_options) / sizeof(apex_options[0]); ++i)
+    {
+        const APEX_Option *opt = &apex_options[i];
+        char *end;
+        long num;
+        int max = 0x7fffffff;
+
+        if (strlen(opt->name) != (size_t)(value - option)
+            || strncmp(opt->name, option, value - option) != 0)
+        {
+            continue;
+        }
+
+        /* Symbolic values map to their position in the list, which is also
+         * the highest number accepted */
+        if (opt->names)
+        {
+            for (max = 0; opt->names[max]; ++max)
+            {
+                if (strcmp(opt->names[max], value + 1) == 0)
+                {
+                    *(int *)((char *)config + opt->offset) = max;
+                    return TRUE;
+                }
+            }
+            max--;
+        }
+
+        num = strtol(value + 1, &end, 0);
+        if (end == value + 1 || *end != '\0' || num < opt->min || num > max)
+        {
+            return FALSE;
+        }
+
+        *(int *)((char *)config + opt->offset) = (int)num;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Registers every option, symbolic ones by the index of their value */
+void
+APEX_config_register_stats(const APEX_Config *config, APEX_Stats *stats)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(apex_options) / sizeof(apex_options[0]); ++i)
+    {
+        APEX_stats_counter(stats, apex_options[i].name,
+                           (const int *)((const char *)config
+                                         + apex_options[i].offset));
+    }
+}
+
+/* Drops a thread's hold on its code memory, which forks share */
+static void
+release_code(APEX_Context *ctx)
+{
+    if (!ctx->code_refs)
+    {
+        free(ctx->code_memory);
+    }
+    else if (__atomic_sub_fetch(ctx->code_refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(ctx->code_memory);
+        free(ctx->code_refs);
+    }
+}
+
+/* Frees the code memory, front end queues, return address stacks and
+ * checkers of all threads */
+static void
+free_contexts(APEX_CPU *cpu)
+{
+    int t;
+
+    for (t = 0; cpu->ctx && t < cpu->threads; ++t)
+    {
+        APEX_check_free(cpu->ctx[t].checker);
+        APEX_ras_free(&cpu->ctx[t].ras);
+        free(cpu->ctx[t].ftq);
+        free(cpu->ctx[t].ibuf);
+        release_code(&cpu->ctx[t]);
+    }
+    free(cpu->ctx);
+    cpu->ctx = NULL;
+}
+
+/*
+ * Loads the comma separated list of programs into the threads in order, the
+ * last program also runs on any threads left over. Returns FALSE on failure,
+ * the caller frees what was set up.
+ */
+static int
+init_contexts(APEX_CPU *cpu, const char *programs)
+{
+    char *list = strdup(programs);
+    char *file = list;
+    int t;
+
+    if (!list)
+    {
+        return FALSE;
+    }
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        APEX_Context *ctx = &cpu->ctx[t];
+        char *comma = strchr(file, ',');
+
+        if (comma)
+        {
+            *comma = '\0';
+        }
+
+        /* Initialize PC, Registers and front end latches */
+        ctx->pc = 4000;
+        memset(ctx->regs, 0, sizeof(int) * REG_FILE_SIZE);
+        ctx->fetch.tid = t;
+        ctx->decode.tid = t;
+
+        if (!APEX_ras_init(&ctx->ras, cpu->config.ras_depth))
+        {
+            free(list);
+            return FALSE;
+        }
+
+        ctx->ftq = calloc(cpu->config.ftq_size, sizeof(CPU_Stage));
+        ctx->ibuf = calloc(cpu->config.ibuf_size, sizeof(CPU_Stage));
+        if (!ctx->ftq || !ctx->ibuf)
+        {
+            free(list);
+            return FALSE;
+        }
+
+        /* Parse input file and create code memory */
+        ctx->code_memory = create_code_memory(file, &ctx->code_memory_size);
+        if (!ctx->code_memory)
+        {
+            free(list);
+            return FALSE;
+        }
+
+        if (cpu->config.check)
+        {
+            ctx->checker = APEX_check_init(ctx->code_memory,
+                                           ctx->code_memory_size, ctx->pc,
+                                           cpu->config.mem_bits);
+            if (!ctx->checker)
+            {
+                free(list);
+                return FALSE;
+            }
+        }
+
+        if (comma)
+        {
+            file = comma + 1;
+        }
+    }
+
+    free(list);
+    return TRUE;
+}
+
 /*
  * This function creates and initializes APEX cpu.
  *
  * Note: You are free to edit this function according to your implementation
  */
 APEX_CPU *
-APEX_cpu_init(const char *filename)
+APEX_cpu_init(const char *filename, const APEX_Config *config)
 {
     int i;
+    int t;
     APEX_CPU *cpu;
 
     if (!filename)
@@ -856,138 +1287,1235 @@ APEX_cpu_init(const char *filename)
         return NULL;
     }
 
-    /* Initialize PC, Registers and all pipeline stages */
-    cpu->pc = 4000;
-    memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
-    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
+    if (config)
+    {
+        cpu->config = *config;
+    }
+    else
+    {
+        APEX_config_init(&cpu->config);
+    }
+
+    /* The set index is taken from PC bits */
+    if (cpu->config.btb_sets & (cpu->config.btb_sets - 1))
+    {
+        fprintf(stderr, "APEX_Error: btb_sets must be a power of two\n");
+        free(cpu);
+        return NULL;
+    }
+
+    /* Pages are only allocated once written */
+    if (!APEX_memory_init(&cpu->data_memory, cpu->config.mem_bits,
+                          cpu->config.huge_pages))
+    {
+        fprintf(stderr, "APEX_Error: mem_bits must be at most 32\n");
+        free(cpu);
+        return NULL;
+    }
+
+    cpu->BTB = calloc(cpu->config.btb_sets * cpu->config.btb_ways, sizeof(BTB_Entry));
+    if (!cpu->BTB)
+    {
+        free(cpu);
+        return NULL;
+    }
+    initBTB(cpu);
+
+    if (!APEX_bpred_init(&cpu->bpred, cpu->config.bpred, cpu->config.gshare_bits))
+    {
+        fprintf(stderr, "APEX_Error: Unable to initialize branch predictor\n");
+        free(cpu->BTB);
+        free(cpu);
+        return NULL;
+    }
+
+    /* The table is indexed by PC bits */
+    if (!APEX_indirect_init(&cpu->indirect, cpu->config.indirect_size))
+    {
+        fprintf(stderr, "APEX_Error: indirect_size must be a power of two\n");
+        APEX_bpred_free(&cpu->bpred);
+        free(cpu->BTB);
+        free(cpu);
+        return NULL;
+    }
+
+    if (cpu->config.loop_buffer)
+    {
+        cpu->loop.body = calloc(cpu->config.loop_buffer, sizeof(APEX_Instruction));
+        cpu->loop.captured = calloc(cpu->config.loop_buffer, sizeof(int));
+        if (!cpu->loop.body || !cpu->loop.captured)
+        {
+            free(cpu->loop.captured);
+            free(cpu->loop.body);
+            APEX_indirect_free(&cpu->indirect);
+            APEX_bpred_free(&cpu->bpred);
+            free(cpu->BTB);
+            free(cpu);
+            return NULL;
+        }
+    }
+
     cpu->single_step = ENABLE_SINGLE_STEP;
 
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    /* A thread per program, or more when asked for */
+    cpu->threads = 1;
+    for (i = 0; filename[i]; ++i)
+    {
+        cpu->threads += filename[i] == ',';
+    }
+    if (cpu->threads < cpu->config.threads)
+    {
+        cpu->threads = cpu->config.threads;
+    }
+
+    cpu->ctx = calloc(cpu->threads, sizeof(APEX_Context));
+    if (!cpu->ctx || !init_contexts(cpu, filename))
     {
+        free_contexts(cpu);
+        free(cpu->loop.captured);
+        free(cpu->loop.body);
+        APEX_indirect_free(&cpu->indirect);
+        APEX_bpred_free(&cpu->bpred);
+        free(cpu->BTB);
         free(cpu);
         return NULL;
     }
 
-    if (ENABLE_DEBUG_MESSAGES)
+    for (t = 0; ENABLE_DEBUG_MESSAGES && t < cpu->threads; ++t)
     {
+        const APEX_Context *ctx = &cpu->ctx[t];
+
         fprintf(stderr,
                 "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
-                cpu->code_memory_size);
-        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
+                ctx->code_memory_size);
+        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", ctx->pc);
         fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
         printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
                "imm");
 
-        for (i = 0; i < cpu->code_memory_size; ++i)
+        for (i = 0; i < ctx->code_memory_size; ++i)
         {
-            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
-                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
-                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
+            printf("%-9s %-9d %-9d %-9d %-9d\n", ctx->code_memory[i].opcode_str,
+                   ctx->code_memory[i].rd, ctx->code_memory[i].rs1,
+                   ctx->code_memory[i].rs2, ctx->code_memory[i].imm);
         }
     }
 
     /* To start fetch stage */
-    cpu->fetch.has_insn = TRUE;
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        cpu->ctx[t].fetch.has_insn = TRUE;
+    }
     return cpu;
 }
-static void print_data_memory(const APEX_CPU *cpu)
+
+/*
+ * Copies the threads of 'cpu' into 'fork', sharing their code memory and
+ * forking their checkers. Returns FALSE on failure, the caller frees what
+ * was set up.
+ */
+static int
+fork_contexts(APEX_CPU *fork, APEX_CPU *cpu)
 {
-    printf("----------\n%s\n----------\n", "NON-ZERO MEMORY VALUES");
-    for (int i = 0; i < DATA_MEMORY_SIZE; i++)
+    int t;
+
+    fork->ctx = malloc(cpu->threads * sizeof(APEX_Context));
+    if (!fork->ctx)
     {
-        if (cpu->data_memory[i] != 0)
-        {
-            printf("MEM[%d] = %d\n", i, cpu->data_memory[i]);
-        }
+        return FALSE;
     }
-    printf("\n");
-}
-
-void initBTB(APEX_CPU * cpu){
-    for(int i=0;i<BTB_SIZE;i++){
-        cpu->BTB[i].valid=0;
-        cpu->BTB[i].resolved=0;
+    memcpy(fork->ctx, cpu->ctx, cpu->threads * sizeof(APEX_Context));
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        fork->ctx[t].code_memory = NULL;
+        fork->ctx[t].code_refs = NULL;
+        fork->ctx[t].ras.entries = NULL;
+        fork->ctx[t].ftq = NULL;
+        fork->ctx[t].ibuf = NULL;
+        fork->ctx[t].checker = NULL;
     }
-    cpu->BTB_head=0;
-}
 
-void addToBTB(APEX_CPU * cpu, int instruction_address, int calculated_address){
-    cpu->BTB[cpu->BTB_head].address = instruction_address;
-    cpu->BTB[cpu->BTB_head].calculated_address = calculated_address;
-    cpu->BTB[cpu->BTB_head].valid = 1; // Mark the entry as valid
-    cpu->BTB[cpu->BTB_head].resolved = 0;
-    cpu->BTB[cpu->BTB_head].taken = 1;
-    cpu->BTB_head = (cpu->BTB_head + 1) % BTB_SIZE; // Move to the next entry using round-robin
-}
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        APEX_Context *ctx = &cpu->ctx[t];
+        APEX_Context *copy = &fork->ctx[t];
 
-int searchBTB(APEX_CPU* cpu, int instruction_address) {
-    for (int i = 0; i < BTB_SIZE; ++i) {
-        if (cpu->BTB[i].address == instruction_address) {
-            // *outcome_bits = cpu->BTB[i].outcome_bits[0];
-            // *target_address = cpu->BTB[i].target_address;
-            return i; // Entry found in BTB
+        /* Code memory is read only, counting its holders starts at the
+         * first fork */
+        if (!ctx->code_refs)
+        {
+            ctx->code_refs = malloc(sizeof(int));
+            if (!ctx->code_refs)
+            {
+                return FALSE;
+            }
+            *ctx->code_refs = 1;
         }
-    }
-    return -1; // Entry not found in BTB
-}
+        __atomic_add_fetch(ctx->code_refs, 1, __ATOMIC_RELAXED);
+        copy->code_memory = ctx->code_memory;
+        copy->code_refs = ctx->code_refs;
 
-void branch(APEX_CPU* cpu){
-    /* Calculate new PC, and send it to fetch unit */\
-    int calculated_address=cpu->execute.pc + cpu->execute.imm;
-    int btbIdx=searchBTB(cpu, cpu->execute.pc);
-    // if(btbIdx==-1){
-    //     addToBTB(cpu, cpu->execute.pc, -1);
-    // }
-
-    if(cpu->BTB[btbIdx].resolved==0){
-        cpu->BTB[btbIdx].resolved=1;
-        cpu->BTB[btbIdx].calculated_address=calculated_address;
-        // cpu->pc = cpu->execute.pc + cpu->execute.imm;
-        cpu->pc=calculated_address;
-        
-        /* Since we are using reverse callbacks for pipeline stages, 
-        * this will prevent the new instruction from being fetched in the current cycle*/
-        cpu->fetch_from_next_cycle = TRUE;
-
-        /* Flush previous stages */
-        cpu->decode.has_insn = FALSE;
-
-        /* Make sure fetch stage is enabled to start fetching from new PC */
-        cpu->fetch.has_insn = TRUE;
-    }
-    else if(cpu->BTB[btbIdx].resolved==1 && cpu->BTB[btbIdx].calculated_address!=calculated_address){
-        cpu->BTB[btbIdx].calculated_address=calculated_address;
-        // cpu->pc = cpu->execute.pc + cpu->execute.imm;
-        cpu->pc=calculated_address;
-        
-        /* Since we are using reverse callbacks for pipeline stages, 
-        * this will prevent the new instruction from being fetched in the current cycle*/
-        cpu->fetch_from_next_cycle = TRUE;
-
-        /* Flush previous stages */
-        cpu->decode.has_insn = FALSE;
-
-        /* Make sure fetch stage is enabled to start fetching from new PC */
-        cpu->fetch.has_insn = TRUE;
-    }else{
-        
+        if (!APEX_ras_copy(&copy->ras, &ctx->ras))
+        {
+            return FALSE;
+        }
+
+        copy->ftq = malloc(cpu->config.ftq_size * sizeof(CPU_Stage));
+        copy->ibuf = malloc(cpu->config.ibuf_size * sizeof(CPU_Stage));
+        if (!copy->ftq || !copy->ibuf)
+        {
+            return FALSE;
+        }
+        memcpy(copy->ftq, ctx->ftq, cpu->config.ftq_size * sizeof(CPU_Stage));
+        memcpy(copy->ibuf, ctx->ibuf, cpu->config.ibuf_size * sizeof(CPU_Stage));
+
+        if (ctx->checker)
+        {
+            copy->checker = APEX_check_fork(ctx->checker);
+            if (!copy->checker)
+            {
+                return FALSE;
+            }
+        }
     }
+    return TRUE;
 }
 
-void flushAndFetchNext(APEX_CPU* cpu){
-    int btbIdx=searchBTB(cpu, cpu->execute.pc);
-    // cpu->BTB[btbIdx].taken=0;
-    cpu->pc = cpu->execute.pc +4;
-    cpu->fetch_from_next_cycle = TRUE;
+/*
+ * Copies the BTB and predictor tables of 'cpu' into 'fork', or starts them
+ * cold where the fork's configuration changed their shape or kind. Returns
+ * FALSE on failure, the caller frees what was set up.
+ */
+static int
+fork_predictors(APEX_CPU *fork, const APEX_CPU *cpu)
+{
+    int entries = fork->config.btb_sets * fork->config.btb_ways;
+
+    fork->BTB = malloc(entries * sizeof(BTB_Entry));
+    if (!fork->BTB)
+    {
+        return FALSE;
+    }
+    if (fork->config.btb_sets == cpu->config.btb_sets
+        && fork->config.btb_ways == cpu->config.btb_ways)
+    {
+        memcpy(fork->BTB, cpu->BTB, entries * sizeof(BTB_Entry));
+    }
+    else
+    {
+        initBTB(fork);
+    }
+
+    if (fork->config.bpred == cpu->config.bpred
+        && fork->config.gshare_bits == cpu->config.gshare_bits)
+    {
+        if (!APEX_bpred_copy(&fork->bpred, &cpu->bpred))
+        {
+            return FALSE;
+        }
+    }
+    else
+    {
+        if (!APEX_bpred_init(&fork->bpred, fork->config.bpred,
+                             fork->config.gshare_bits))
+        {
+            fprintf(stderr, "APEX_Error: Unable to initialize branch predictor\n");
+            return FALSE;
+        }
+
+        /* In flight branches recover to histories taken before the fork */
+        fork->bpred.history = cpu->bpred.history;
+    }
+
+    if (fork->config.indirect_size == cpu->config.indirect_size)
+    {
+        return APEX_indirect_copy(&fork->indirect, &cpu->indirect);
+    }
+    if (!APEX_indirect_init(&fork->indirect, fork->config.indirect_size))
+    {
+        fprintf(stderr, "APEX_Error: indirect_size must be a power of two\n");
+        return FALSE;
+    }
+    fork->indirect.history = cpu->indirect.history;
+    return TRUE;
+}
 
-    /* Flush previous stages */
-    cpu->decode.has_insn = FALSE;
+/*
+ * TRUE if a fork of a CPU configured with 'from' may run with 'to': only
+ * the BTB shape, the predictors and the SMT policy can change, every other
+ * structure carries in flight state that depends on its shape.
+ */
+static int
+fork_config_valid(const APEX_Config *from, const APEX_Config *to)
+{
+    APEX_Config same = *to;
+
+    same.btb_sets = from->btb_sets;
+    same.btb_ways = from->btb_ways;
+    same.bpred = from->bpred;
+    same.gshare_bits = from->gshare_bits;
+    same.indirect_size = from->indirect_size;
+    same.smt_policy = from->smt_policy;
+    return !memcmp(&same, from, sizeof(APEX_Config));
+}
+
+/*
+ * Forks a CPU in the middle of its run. The fork gets its own copy of the
+ * latches, registers, scoreboards, predictor tables, loop buffer, checkers
+ * and statistics. Code memory and data memory pages are shared, data
+ * memory copy-on-write, so forking costs little and the fork and 'cpu' can
+ * then run on different host threads. 'cpu' must not run while it is
+ * forked.
+ *
+ * With a 'config' the fork runs with its BTB shape, predictors and SMT
+ * policy; tables that change start cold. NULL keeps the configuration of
+ * 'cpu'. Returns NULL on failure.
+ */
+APEX_CPU *
+APEX_cpu_fork(APEX_CPU *cpu, const APEX_Config *config)
+{
+    APEX_CPU *fork;
+
+    if (config && !fork_config_valid(&cpu->config, config))
+    {
+        fprintf(stderr, "APEX_Error: A fork can only change btb_sets, btb_ways, bpred, gshare_bits, indirect_size and smt_policy\n");
+        return NULL;
+    }
+    if (config && config->btb_sets & (config->btb_sets - 1))
+    {
+        fprintf(stderr, "APEX_Error: btb_sets must be a power of two\n");
+        return NULL;
+    }
+
+    fork = malloc(sizeof(APEX_CPU));
+    if (!fork)
+    {
+        return NULL;
+    }
+
+    /* Start from a copy holding no memory of its own, so stopping it
+     * frees whatever the fork got so far */
+    *fork = *cpu;
+    fork->debugger = NULL;
+    fork->ctx = NULL;
+    fork->BTB = NULL;
+    memset(&fork->bpred, 0, sizeof(APEX_BPred));
+    memset(&fork->indirect, 0, sizeof(APEX_Indirect));
+    memset(&fork->data_memory, 0, sizeof(APEX_Memory));
+    fork->loop.body = NULL;
+    fork->loop.captured = NULL;
+    if (config)
+    {
+        fork->config = *config;
+    }
+
+    if (!fork_contexts(fork, cpu)
+        || !APEX_memory_fork(&fork->data_memory, &cpu->data_memory)
+        || !fork_predictors(fork, cpu))
+    {
+        APEX_cpu_stop(fork);
+        return NULL;
+    }
+
+    if (cpu->loop.body)
+    {
+        fork->loop.body = malloc(cpu->config.loop_buffer * sizeof(APEX_Instruction));
+        fork->loop.captured = malloc(cpu->config.loop_buffer * sizeof(int));
+        if (!fork->loop.body || !fork->loop.captured)
+        {
+            APEX_cpu_stop(fork);
+            return NULL;
+        }
+        memcpy(fork->loop.body, cpu->loop.body,
+               cpu->config.loop_buffer * sizeof(APEX_Instruction));
+        memcpy(fork->loop.captured, cpu->loop.captured,
+               cpu->config.loop_buffer * sizeof(int));
+    }
+    return fork;
+}
+
+/*
+ * Bytes a fork of 'cpu' allocates for itself. The data memory pages it
+ * shares are not counted, see APEX_memory_unshared().
+ */
+size_t
+APEX_cpu_fork_size(const APEX_CPU *cpu)
+{
+    const APEX_Memory *mem = &cpu->data_memory;
+    size_t size = sizeof(APEX_CPU) + cpu->threads * sizeof(APEX_Context);
+    int t;
+
+    size += (size_t)cpu->config.btb_sets * cpu->config.btb_ways * sizeof(BTB_Entry);
+    if (cpu->bpred.pht)
+    {
+        size += 1U << cpu->bpred.gshare_bits;
+    }
+    if (cpu->bpred.base)
+    {
+        size += (1U << TAGE_BASE_BITS)
+                + TAGE_TABLES * (1U << TAGE_TABLE_BITS) * sizeof(TAGE_Entry);
+    }
+    size += cpu->indirect.size * sizeof(Indirect_Entry);
+    if (cpu->loop.body)
+    {
+        size += cpu->config.loop_buffer * (sizeof(APEX_Instruction) + sizeof(int));
+    }
+    size += mem->tables * MEMORY_DIR_SIZE * sizeof(Memory_Page *)
+            + mem->chunk_count * sizeof(Memory_Chunk *);
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        const APEX_Checker *checker = cpu->ctx[t].checker;
+
+        size += cpu->ctx[t].ras.depth * sizeof(RAS_Entry);
+        size += (size_t)(cpu->config.ftq_size + cpu->config.ibuf_size)
+                * sizeof(CPU_Stage);
+        if (checker)
+        {
+            size += sizeof(APEX_Checker)
+                    + checker->data_memory.tables * MEMORY_DIR_SIZE
+                      * sizeof(Memory_Page *);
+        }
+    }
+    return size;
+}
+static void print_data_memory(const APEX_CPU *cpu)
+{
+    const int *words;
+    unsigned page = 0;
+
+    printf("----------\n%s\n----------\n", "NON-ZERO MEMORY VALUES");
+    while ((words = APEX_memory_next_page(&cpu->data_memory, &page)))
+    {
+        for (unsigned i = 0; i < MEMORY_PAGE_WORDS; i++)
+        {
+            if (words[i] != 0)
+            {
+                printf("MEM[%u] = %d\n", page << MEMORY_PAGE_BITS | i, words[i]);
+            }
+        }
+        page++;
+    }
+    printf("\n");
+}
+
+int isControlTransfer(int opcode){
+    switch(opcode){
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+            return TRUE;
+    }
+    return FALSE;
+}
+
+int isConditionalBranch(int opcode){
+    return isControlTransfer(opcode) && opcode != OPCODE_JUMP && opcode != OPCODE_JALR;
+}
+
+/* Set index and tag of an instruction address, the low two bits are always zero */
+static int btbSet(APEX_CPU * cpu, int instruction_address){
+    return ((unsigned int)instruction_address >> 2) & (cpu->config.btb_sets - 1);
+}
+
+static int btbTag(APEX_CPU * cpu, int instruction_address){
+    return ((unsigned int)instruction_address >> 2) / cpu->config.btb_sets;
+}
+
+void initBTB(APEX_CPU * cpu){
+    for(int i=0;i<cpu->config.btb_sets * cpu->config.btb_ways;i++){
+        cpu->BTB[i].valid=0;
+        cpu->BTB[i].counter=0;
+    }
+    cpu->BTB_stamp=0;
+}
+
+/* Installs a taken control transfer of thread tid, replacing an invalid or the least recently used way */
+void addToBTB(APEX_CPU * cpu, int tid, int instruction_address, int calculated_address){
+    BTB_Entry *set = &cpu->BTB[btbSet(cpu, instruction_address) * cpu->config.btb_ways];
+    int victim = 0;
+
+    for (int i = 0; i < cpu->config.btb_ways; ++i) {
+        if (!set[i].valid) {
+            victim = i;
+            break;
+        }
+        if (set[i].last_use < set[victim].last_use) {
+            victim = i;
+        }
+    }
+
+    set[victim].tag = btbTag(cpu, instruction_address);
+    set[victim].tid = tid;
+    set[victim].calculated_address = calculated_address;
+    set[victim].valid = 1; // Mark the entry as valid
+    set[victim].taken = 1;
+    set[victim].counter = 2; // Weakly taken
+    set[victim].last_use = ++cpu->BTB_stamp;
+}
+
+/* Returns the index of the valid entry of thread tid for instruction_address, or -1. A hit makes the entry most recently used */
+int searchBTB(APEX_CPU* cpu, int tid, int instruction_address) {
+    int first = btbSet(cpu, instruction_address) * cpu->config.btb_ways;
+    int tag = btbTag(cpu, instruction_address);
+
+    for (int i = first; i < first + cpu->config.btb_ways; ++i) {
+        if (cpu->BTB[i].valid && cpu->BTB[i].tid == tid && cpu->BTB[i].tag == tag) {
+            cpu->BTB[i].last_use = ++cpu->BTB_stamp;
+            return i; // Entry found in BTB
+        }
+    }
+    return -1; // Entry not found in BTB
+}
+
+/* Evaluates the condition of a conditional branch in execute */
+static int branchTaken(APEX_CPU *cpu, int opcode){
+    const APEX_Context *ctx = &cpu->ctx[cpu->execute.tid];
+
+    switch(opcode){
+        case OPCODE_BZ: return ctx->zero_flag == TRUE;
+        case OPCODE_BNZ: return ctx->zero_flag == FALSE;
+        case OPCODE_BP: return ctx->p_flag == TRUE;
+        case OPCODE_BNP: return ctx->p_flag == FALSE;
+        case OPCODE_BN: return ctx->n_flag == TRUE;
+        case OPCODE_BNN: return ctx->n_flag == FALSE;
+    }
+    return FALSE;
+}
+
+/* Leaves the loop, fetch goes back to code memory and the BTB */
+static void loopRelease(APEX_CPU *cpu){
+    if(cpu->loop.state==LOOP_REPLAY){
+        cpu->loop.exits++;
+    }
+    cpu->loop.state = LOOP_IDLE;
+}
+
+/* A taken backward branch whose body fits in the buffer starts a capture */
+static void loopDetect(APEX_CPU *cpu, int target){
+    Loop_Buffer *loop = &cpu->loop;
+
+    if(!loop->body || loop->state!=LOOP_IDLE || target>cpu->execute.pc
+       || (cpu->execute.pc - target) / 4 >= cpu->config.loop_buffer){
+        return;
+    }
+
+    loop->state = LOOP_CAPTURE;
+    loop->tid = cpu->execute.tid;
+    loop->start = target;
+    loop->end = cpu->execute.pc;
+    loop->captured_count = 0;
+    memset(loop->captured, 0, sizeof(int) * cpu->config.loop_buffer);
+}
+
+/* Copies the instruction leaving decode into the buffer. Replay starts once
+ * the whole body was seen, a body with other control transfers is dropped */
+static void loopCapture(APEX_CPU *cpu, const CPU_Stage *stage){
+    Loop_Buffer *loop = &cpu->loop;
+    int slot;
+
+    if(loop->state!=LOOP_CAPTURE || stage->tid!=loop->tid || stage->pc<loop->start || stage->pc>loop->end){
+        return;
+    }
+
+    if(stage->opcode==OPCODE_HALT
+       || (isControlTransfer(stage->opcode) && stage->pc!=loop->end)){
+        loop->aborted++;
+        loop->state = LOOP_IDLE;
+        return;
+    }
+
+    slot = (stage->pc - loop->start) / 4;
+    if(!loop->captured[slot]){
+        strcpy(loop->body[slot].opcode_str, stage->opcode_str);
+        loop->body[slot].opcode = stage->opcode;
+        loop->body[slot].rd = stage->rd;
+        loop->body[slot].rs1 = stage->rs1;
+        loop->body[slot].rs2 = stage->rs2;
+        loop->body[slot].imm = stage->imm;
+        loop->captured[slot] = TRUE;
+        loop->captured_count++;
+    }
+
+    if(loop->captured_count == (loop->end - loop->start) / 4 + 1){
+        loop->loops++;
+        loop->state = LOOP_REPLAY;
+    }
+}
+
+/* Sends fetch to next_pc if it went somewhere else after the instruction in
+ * execute. Returns TRUE if younger instructions were flushed */
+static int redirectFetch(APEX_CPU* cpu, int next_pc){
+    APEX_Context *ctx = &cpu->ctx[cpu->execute.tid];
+
+    cpu->branches_resolved++;
+    if(cpu->execute.predicted_pc == next_pc){
+        return FALSE;
+    }
+
+    cpu->mispredictions++;
+    ctx->flushes++;
+    ctx->pc = next_pc;
+
+    if(cpu->loop.tid==cpu->execute.tid
+       && (next_pc<cpu->loop.start || next_pc>cpu->loop.end)){
+        loopRelease(cpu);
+    }
+
+    /* Since we are using reverse callbacks for pipeline stages, 
+    * this will prevent the new instruction from being fetched in the current cycle*/
+    ctx->fetch_from_next_cycle = TRUE;
+
+    /* Flush previous stages and both queues, other threads keep their
+     * instructions */
+    ctx->decode.has_insn = FALSE;
+    ctx->squashed += ctx->ftq_count + ctx->ibuf_count;
+    ctx->ftq_count = 0;
+    ctx->ibuf_count = 0;
+
+    /* Drop the history and return addresses the flushed instructions
+     * speculated on. Targets queued far down the wrong path may still
+     * have overwritten entries below the restored top of the stack */
+    bpredSelect(cpu, cpu->execute.tid);
+    APEX_bpred_recover(&cpu->bpred, cpu->execute.bpred_history);
+    APEX_ras_restore(&ctx->ras, &cpu->execute.ras_checkpoint);
 
     /* Make sure fetch stage is enabled to start fetching from new PC */
-    cpu->fetch.has_insn = TRUE;
+    ctx->fetch.has_insn = TRUE;
+    return TRUE;
+}
+
+/* JUMP and JALR: record the target and redirect if fetch did not go there */
+static void resolveTarget(APEX_CPU* cpu, int target){
+    int btbIdx=searchBTB(cpu, cpu->execute.tid, cpu->execute.pc);
+
+    if(btbIdx==-1){
+        addToBTB(cpu, cpu->execute.tid, cpu->execute.pc, target);
+    }
+    else{
+        cpu->BTB[btbIdx].calculated_address=target;
+    }
+
+    if(cpu->execute.target_source==TARGET_RAS){
+        if(cpu->execute.predicted_pc==target){
+            cpu->ctx[cpu->execute.tid].ras.correct++;
+        }
+        else{
+            cpu->ctx[cpu->execute.tid].ras.wrong++;
+        }
+    }
+    else{
+        if(cpu->execute.target_source==TARGET_INDIRECT){
+            if(cpu->execute.predicted_pc==target){
+                cpu->indirect.correct++;
+            }
+            else{
+                cpu->indirect.wrong++;
+            }
+        }
+        APEX_indirect_update(&cpu->indirect, cpu->execute.tid, cpu->execute.pc, cpu->execute.path_history, target);
+    }
+    redirectFetch(cpu, target);
+}
+
+/* Trains the direction predictor with the conditional branch in execute and
+ * redirects fetch if it went the wrong way */
+static void resolveBranch(APEX_CPU* cpu, int taken, int next_pc){
+    int btbIdx=searchBTB(cpu, cpu->execute.tid, cpu->execute.pc);
+
+    APEX_bpred_update(&cpu->bpred, cpu->execute.pc,
+                      btbIdx>=0 ? &cpu->BTB[btbIdx].counter : NULL,
+                      cpu->execute.bpred_history, taken,
+                      cpu->execute.predicted_taken);
+
+    if(taken){
+        if(btbIdx==-1){
+            addToBTB(cpu, cpu->execute.tid, cpu->execute.pc, next_pc);
+        }
+        else{
+            cpu->BTB[btbIdx].calculated_address=next_pc;
+        }
+        loopDetect(cpu, next_pc);
+    }
+    else if(cpu->loop.state!=LOOP_IDLE && cpu->loop.tid==cpu->execute.tid
+            && cpu->execute.pc==cpu->loop.end){
+        loopRelease(cpu);
+    }
+
+    if(redirectFetch(cpu, next_pc)){
+        APEX_bpred_speculate(&cpu->bpred, taken);
+    }
+}
+
+/* Taken conditional branch in execute */
+void branch(APEX_CPU* cpu){
+    /* Calculate new PC, and send it to fetch unit */
+    resolveBranch(cpu, TRUE, cpu->execute.pc + cpu->execute.imm);
+}
+
+/* Not taken conditional branch in execute */
+void flushAndFetchNext(APEX_CPU* cpu){
+    resolveBranch(cpu, FALSE, cpu->execute.pc + 4);
+}
+
+/* The predictor tables are shared but every thread keeps its own global
+ * history, swapped in whenever another thread uses the predictor */
+static void bpredSelect(APEX_CPU *cpu, int tid){
+    if(cpu->bpred_tid==tid){
+        return;
+    }
+    cpu->ctx[cpu->bpred_tid].bpred_history = cpu->bpred.history;
+    cpu->bpred.history = cpu->ctx[tid].bpred_history;
+    cpu->bpred_tid = tid;
+}
+
+/* Instructions of thread tid in the instruction buffer, Decode and the
+ * shared back end (ICOUNT) */
+static int inFlight(const APEX_CPU *cpu, int tid){
+    int count = cpu->ctx[tid].ibuf_count + cpu->ctx[tid].decode.has_insn;
+
+    count += cpu->execute.has_insn && cpu->execute.tid==tid;
+    count += cpu->memory.has_insn && cpu->memory.tid==tid;
+    count += cpu->writeback.has_insn && cpu->writeback.tid==tid;
+    return count;
+}
+
+/* TRUE if Decode would stall the next instruction of thread tid on the
+ * scoreboard as it stands now */
+static int wouldStall(const APEX_CPU *cpu, int tid){
+    const APEX_Context *ctx = &cpu->ctx[tid];
+    const int *busy = ctx->register_waiting_flag;
+    const APEX_Instruction *insn;
+    int pc = ctx->ftq_count ? ctx->ftq[ctx->ftq_head].pc : ctx->pc;
+    int index = get_code_memory_index_from_pc(pc);
+
+    if(inLoop(cpu, tid, pc)){
+        insn = &cpu->loop.body[(pc - cpu->loop.start) / 4];
+    }
+    else if(index>=0 && index<ctx->code_memory_size){
+        insn = &ctx->code_memory[index];
+    }
+    else{
+        return FALSE;
+    }
+
+    switch(insn->opcode){
+        case OPCODE_SUB:
+        case OPCODE_ADD:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_DIV:
+        case OPCODE_MUL:
+            return busy[insn->rs1] || busy[insn->rs2] || busy[insn->rd];
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+        case OPCODE_CMP:
+            return busy[insn->rs1] || busy[insn->rs2];
+        case OPCODE_SUBL:
+        case OPCODE_ADDL:
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+            return busy[insn->rs1] || busy[insn->rd];
+        case OPCODE_MOVC:
+            return busy[insn->rd];
+        case OPCODE_CML:
+        case OPCODE_JALR:
+        case OPCODE_JUMP:
+            return busy[insn->rs1];
+    }
+    return FALSE;
 }
+
+/* Picks the thread that fetches this cycle under config.smt_policy, or -1.
+ * A thread can fetch once its decode latch is free unless a redirect or a
+ * stall told it to skip the cycle, or its PC ran past its program and waits
+ * for a redirect. Ties go round-robin */
+static int selectThread(APEX_CPU *cpu){
+    int best = -1;
+    int best_count = 0;
+    int best_ready = FALSE;
+
+    for(int i=0;i<cpu->threads;i++){
+        int tid = (cpu->fetch_next + i) % cpu->threads;
+        const APEX_Context *ctx = &cpu->ctx[tid];
+        int count;
+        int ready;
+
+        /* Skip threads that can neither queue a target nor move one into
+         * the instruction buffer */
+        if(ctx->fetch_from_next_cycle
+           || !((ctx->fetch.has_insn && ctx->ftq_count<cpu->config.ftq_size
+                 && inCode(ctx, ctx->pc))
+                || (ctx->ftq_count>0 && ctx->ibuf_count<cpu->config.ibuf_size))){
+            continue;
+        }
+        if(cpu->config.smt_policy==SMT_RR){
+            best = tid;
+            break;
+        }
+
+        count = inFlight(cpu, tid);
+        ready = cpu->config.smt_policy==SMT_STALL && !wouldStall(cpu, tid);
+        if(best<0 || ready>best_ready || (ready==best_ready && count<best_count)){
+            best = tid;
+            best_count = count;
+            best_ready = ready;
+        }
+    }
+
+    if(best>=0){
+        cpu->fetch_next = (best + 1) % cpu->threads;
+    }
+    return best;
+}
+
+static void print_loop_stats(const APEX_CPU *cpu)
+{
+    printf("----------\n%s\n----------\n", "LOOP BUFFER");
+    if (!cpu->loop.body)
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    printf("Entries          : %d\n", cpu->config.loop_buffer);
+    printf("Loops captured   : %d (%d aborted)\n", cpu->loop.loops, cpu->loop.aborted);
+    printf("Replay exits     : %d\n", cpu->loop.exits);
+    printf("Residency cycles : %d\n", cpu->loop.residency);
+    printf("Iterations       : %d\n", cpu->loop.iterations);
+    printf("Fetches saved    : %d\n", cpu->loop.replayed);
+    printf("BTB lookups saved: %d\n", cpu->loop.btb_lookups_saved);
+    printf("\n");
+}
+
+/* Cycles the run took, up to the last HALT retired */
+static int cycles_run(const APEX_CPU *cpu)
+{
+    int cycles = cpu->clock;
+    int t;
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        if (cpu->ctx[t].halted && cpu->ctx[t].halt_cycle > cycles)
+        {
+            cycles = cpu->ctx[t].halt_cycle;
+        }
+    }
+    return cycles;
+}
+
+/* IPC of thread 'tid' over the cycles until its HALT retired */
+static double thread_ipc(const APEX_CPU *cpu, int tid)
+{
+    const APEX_Context *ctx = &cpu->ctx[tid];
+    int active = ctx->halted ? ctx->halt_cycle : cycles_run(cpu);
+
+    return active ? (double)ctx->insn_completed / active : 0.0;
+}
+
+/* How evenly the threads shared the pipeline: the ratio of the lowest to
+ * the highest IPC and Jain's fairness index */
+static void fairness(const APEX_CPU *cpu, double *min_max, double *jain)
+{
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    double min_ipc = 0.0;
+    double max_ipc = 0.0;
+    int t;
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        double ipc = thread_ipc(cpu, t);
+
+        sum += ipc;
+        sum_sq += ipc * ipc;
+        if (t == 0 || ipc < min_ipc)
+        {
+            min_ipc = ipc;
+        }
+        if (ipc > max_ipc)
+        {
+            max_ipc = ipc;
+        }
+    }
+    *min_max = max_ipc > 0.0 ? min_ipc / max_ipc : 0.0;
+    *jain = sum_sq > 0.0 ? sum * sum / (cpu->threads * sum_sq) : 0.0;
+}
+
+/* Per thread throughput, and how evenly the threads shared the pipeline */
+static void print_smt_stats(const APEX_CPU *cpu)
+{
+    int cycles = cycles_run(cpu);
+    double min_max;
+    double jain;
+    int t;
+
+    printf("----------\n%s\n----------\n", "SMT");
+    printf("Threads          : %d, %s fetch\n", cpu->threads,
+           smt_policy_names[cpu->config.smt_policy]);
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        const APEX_Context *ctx = &cpu->ctx[t];
+
+        printf("Thread %-10d: fetched %d, issued %d, retired %d, IPC %.3f\n",
+               t, ctx->fetched, ctx->issued, ctx->insn_completed,
+               thread_ipc(cpu, t));
+        printf("                   %d decode stalls, %d flushes\n",
+               ctx->decode_stalls, ctx->flushes);
+    }
+    fairness(cpu, &min_max, &jain);
+    printf("Total IPC        : %.3f\n",
+           cycles ? (double)cpu->insn_completed / cycles : 0.0);
+    printf("Fetch idle cycles: %d\n", cpu->fetch_idle);
+    printf("Fairness         : %.3f min/max IPC, %.3f Jain index\n", min_max,
+           jain);
+    printf("\n");
+}
+
+static void print_btb_stats(const APEX_CPU *cpu)
+{
+    printf("----------\n%s\n----------\n", "BRANCH TARGET BUFFER");
+    printf("Shape            : %d sets, %d ways\n", cpu->config.btb_sets, cpu->config.btb_ways);
+    printf("Lookups          : %d\n", cpu->btb_lookups);
+    printf("Hits / Misses    : %d / %d\n", cpu->btb_hits, cpu->btb_misses);
+    printf("Resolved         : %d\n", cpu->branches_resolved);
+    printf("Mispredictions   : %d\n", cpu->mispredictions);
+    printf("\n");
+}
+
+static void print_front_end_stats(const APEX_CPU *cpu, const APEX_Context *ctx)
+{
+    printf("----------\n%s\n----------\n", "FRONT END");
+    printf("Queues           : %d fetch targets, %d instructions\n",
+           cpu->config.ftq_size, cpu->config.ibuf_size);
+    printf("Peak occupancy   : %d / %d\n", ctx->ftq_max, ctx->ibuf_max);
+    printf("Run-ahead fetches: %d\n", ctx->runahead_fetches);
+    printf("Buffer full      : %d cycles\n", ctx->ibuf_full_cycles);
+    printf("Squashed         : %d entries\n", ctx->squashed);
+    printf("\n");
+}
+
+/* Prints the registers, data memory and flags after a cycle */
+void
+APEX_cpu_print_state(const APEX_CPU *cpu)
+{
+    int t;
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        if (cpu->threads > 1)
+        {
+            printf("Thread %d\n", t);
+        }
+        print_reg_file(&cpu->ctx[t]);
+    }
+    print_data_memory(cpu);
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        if (cpu->threads > 1)
+        {
+            printf("Thread %d\n", t);
+        }
+        print_flags(&cpu->ctx[t]);
+    }
+}
+
+/* Prints the next PC to queue, the instruction buffer and the instructions
+ * in the pipeline latches */
+void
+APEX_cpu_print_pipeline(const APEX_CPU *cpu)
+{
+    int t;
+    int i;
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        /* The fetch latch only says the thread still fetches */
+        if (cpu->ctx[t].fetch.has_insn)
+        {
+            if (cpu->threads > 1)
+            {
+                printf("T%d ", t);
+            }
+            printf("%-15s: pc(%d)\n", "Fetch", cpu->ctx[t].pc);
+        }
+        for (i = 0; i < cpu->ctx[t].ibuf_count; ++i)
+        {
+            print_stage_content(cpu, "Buffer",
+                                &cpu->ctx[t].ibuf[(cpu->ctx[t].ibuf_head + i)
+                                                  % cpu->config.ibuf_size]);
+        }
+        if (cpu->ctx[t].decode.has_insn)
+        {
+            print_stage_content(cpu, "Decode/RF", &cpu->ctx[t].decode);
+        }
+    }
+    if (cpu->execute.has_insn)
+    {
+        print_stage_content(cpu, "Execute", &cpu->execute);
+    }
+    if (cpu->memory.has_insn)
+    {
+        print_stage_content(cpu, "Memory", &cpu->memory);
+    }
+}
+
+/* Prints how the simulation ended, after APEX_cpu_step() returned TRUE */
+void
+APEX_cpu_print_result(const APEX_CPU *cpu)
+{
+    if (cpu->diverged)
+    {
+        printf("APEX_CPU: Simulation Stopped at divergence, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+    }
+    else if (cpu->faulted)
+    {
+        printf("APEX_CPU: Simulation Stopped at memory fault, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+    }
+    else
+    {
+        /* Halt in writeback stage */
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+    }
+}
+
+/* Prints the statistics printed at the end of a run */
+void
+APEX_cpu_print_stats(const APEX_CPU *cpu)
+{
+    int t;
+
+    print_btb_stats(cpu);
+    APEX_bpred_print_stats(&cpu->bpred, cpu->insn_completed);
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        if (cpu->threads > 1)
+        {
+            printf("Thread %d\n", t);
+        }
+        APEX_ras_print_stats(&cpu->ctx[t].ras);
+        print_front_end_stats(cpu, &cpu->ctx[t]);
+    }
+    APEX_indirect_print_stats(&cpu->indirect);
+    print_loop_stats(cpu);
+    print_smt_stats(cpu);
+    APEX_memory_print_stats(&cpu->data_memory);
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        if (!cpu->ctx[t].checker)
+        {
+            continue;
+        }
+        if (cpu->threads > 1)
+        {
+            printf("Thread %d\n", t);
+        }
+        APEX_check_print_stats(cpu->ctx[t].checker);
+    }
+}
+
+static double
+stat_cycles(const void *owner)
+{
+    return cycles_run(owner);
+}
+
+static double
+stat_ipc(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+    int cycles = cycles_run(cpu);
+
+    return cycles ? (double)cpu->insn_completed / cycles : 0.0;
+}
+
+static double
+stat_bpred_mpki(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return cpu->insn_completed
+               ? 1000.0 * cpu->bpred.mispredictions / cpu->insn_completed
+               : 0.0;
+}
+
+static double
+stat_min_max_ipc(const void *owner)
+{
+    double min_max;
+    double jain;
+
+    fairness(owner, &min_max, &jain);
+    return min_max;
+}
+
+static double
+stat_jain_index(const void *owner)
+{
+    double min_max;
+    double jain;
+
+    fairness(owner, &min_max, &jain);
+    return jain;
+}
+
+/*
+ * Registers the statistics of the CPU: the shared BTB, predictors, loop
+ * buffer and data memory, then those of every thread as "thread<i>.<name>"
+ */
+void
+APEX_cpu_register_stats(const APEX_CPU *cpu, APEX_Stats *stats)
+{
+    char section[24];
+    int t;
+
+    APEX_stats_enter(stats, "cpu");
+    APEX_stats_derived(stats, "cycles", stat_cycles, cpu);
+    APEX_stats_counter(stats, "instructions", &cpu->insn_completed);
+    APEX_stats_derived(stats, "ipc", stat_ipc, cpu);
+    APEX_stats_counter(stats, "diverged", &cpu->diverged);
+    APEX_stats_counter(stats, "faulted", &cpu->faulted);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "btb");
+    APEX_stats_counter(stats, "lookups", &cpu->btb_lookups);
+    APEX_stats_counter(stats, "hits", &cpu->btb_hits);
+    APEX_stats_counter(stats, "misses", &cpu->btb_misses);
+    APEX_stats_counter(stats, "resolved", &cpu->branches_resolved);
+    APEX_stats_counter(stats, "mispredictions", &cpu->mispredictions);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "bpred");
+    APEX_bpred_register_stats(&cpu->bpred, stats);
+    APEX_stats_derived(stats, "mpki", stat_bpred_mpki, cpu);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "indirect");
+    APEX_indirect_register_stats(&cpu->indirect, stats);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "loop_buffer");
+    APEX_stats_counter(stats, "loops", &cpu->loop.loops);
+    APEX_stats_counter(stats, "aborted", &cpu->loop.aborted);
+    APEX_stats_counter(stats, "exits", &cpu->loop.exits);
+    APEX_stats_counter(stats, "residency", &cpu->loop.residency);
+    APEX_stats_counter(stats, "iterations", &cpu->loop.iterations);
+    APEX_stats_counter(stats, "replayed", &cpu->loop.replayed);
+    APEX_stats_counter(stats, "btb_lookups_saved",
+                       &cpu->loop.btb_lookups_saved);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "smt");
+    APEX_stats_counter(stats, "threads", &cpu->threads);
+    APEX_stats_counter(stats, "fetch_idle", &cpu->fetch_idle);
+    APEX_stats_derived(stats, "min_max_ipc", stat_min_max_ipc, cpu);
+    APEX_stats_derived(stats, "jain_index", stat_jain_index, cpu);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "memory");
+    APEX_memory_register_stats(&cpu->data_memory, stats);
+    APEX_stats_leave(stats);
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        const APEX_Context *ctx = &cpu->ctx[t];
+
+        snprintf(section, sizeof(section), "thread%d", t);
+        APEX_stats_enter(stats, section);
+        APEX_stats_counter(stats, "fetched", &ctx->fetched);
+        APEX_stats_counter(stats, "issued", &ctx->issued);
+        APEX_stats_counter(stats, "retired", &ctx->insn_completed);
+        APEX_stats_counter(stats, "decode_stalls", &ctx->decode_stalls);
+        APEX_stats_counter(stats, "flushes", &ctx->flushes);
+        APEX_stats_counter(stats, "halted", &ctx->halted);
+        APEX_stats_counter(stats, "halt_cycle", &ctx->halt_cycle);
+
+        APEX_stats_enter(stats, "ras");
+        APEX_ras_register_stats(&ctx->ras, stats);
+        APEX_stats_leave(stats);
+
+        APEX_stats_enter(stats, "front_end");
+        APEX_stats_counter(stats, "ftq_peak", &ctx->ftq_max);
+        APEX_stats_counter(stats, "ibuf_peak", &ctx->ibuf_max);
+        APEX_stats_counter(stats, "runahead_fetches", &ctx->runahead_fetches);
+        APEX_stats_counter(stats, "ibuf_full_cycles", &ctx->ibuf_full_cycles);
+        APEX_stats_counter(stats, "squashed", &ctx->squashed);
+        APEX_stats_leave(stats);
+
+        if (ctx->checker)
+        {
+            APEX_stats_enter(stats, "checker");
+            APEX_check_register_stats(ctx->checker, stats);
+            APEX_stats_leave(stats);
+        }
+        APEX_stats_leave(stats);
+    }
+}
+
+/*
+ * Writes the configuration and the statistics of the CPU to the file of
+ * the stats= option. Returns FALSE if it could not be written.
+ */
+int
+APEX_cpu_write_stats(const APEX_CPU *cpu)
+{
+    APEX_Stats stats;
+    int ok;
+
+    APEX_stats_init(&stats);
+    APEX_stats_enter(&stats, "config");
+    APEX_config_register_stats(&cpu->config, &stats);
+    APEX_stats_leave(&stats);
+    APEX_cpu_register_stats(cpu, &stats);
+    ok = APEX_stats_write(&stats, cpu->config.stats);
+    APEX_stats_free(&stats);
+    return ok;
+}
+
+/*
+ * Simulates one clock cycle. Returns TRUE once every thread retired its
+ * HALT, the checker found a divergence or a load or store faulted, the
+ * clock is then left on the last cycle.
+ */
+int
+APEX_cpu_step(APEX_CPU *cpu)
+{
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+    {
+        printf("--------------------------------------------\n");
+        printf("Clock Cycle #: %d\n", cpu->clock+1);
+        printf("--------------------------------------------\n");
+    }
+
+    if (APEX_writeback(cpu))
+    {
+        return TRUE;
+    }
+
+    APEX_memory(cpu);
+    if (cpu->faulted)
+    {
+        return TRUE;
+    }
+    APEX_execute(cpu);
+    APEX_decode(cpu);
+    APEX_fetch(cpu);
+
+    if (!cpu->quiet)
+    {
+        APEX_cpu_print_state(cpu);
+    }
+
+    cpu->clock++;
+    return FALSE;
+}
+
 /*
  * APEX CPU simulation loop
  *
@@ -1003,28 +2531,19 @@ APEX_cpu_run(APEX_CPU *cpu)
         if(cpu->maxCycles!=0 && cpu->maxCycles<cpu->clock+1){
             break;
         }
-        if (ENABLE_DEBUG_MESSAGES)
+
+        if (APEX_stats_pending)
         {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock+1);
-            printf("--------------------------------------------\n");
+            APEX_stats_pending = FALSE;
+            APEX_cpu_write_stats(cpu);
         }
 
-        if (APEX_writeback(cpu))
+        if (APEX_cpu_step(cpu))
         {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+            APEX_cpu_print_result(cpu);
             break;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
-        print_reg_file(cpu);
-        print_data_memory(cpu);
-        print_flags(cpu);
         if (cpu->single_step)
         {
             printf("Press any key to advance CPU Clock or <q> to quit:\n");
@@ -1036,8 +2555,12 @@ APEX_cpu_run(APEX_CPU *cpu)
                 break;
             }
         }
+    }
 
-        cpu->clock++;
+    APEX_cpu_print_stats(cpu);
+    if (cpu->config.stats[0])
+    {
+        APEX_cpu_write_stats(cpu);
     }
 }
 
@@ -1049,6 +2572,12 @@ APEX_cpu_run(APEX_CPU *cpu)
 void
 APEX_cpu_stop(APEX_CPU *cpu)
 {
-    free(cpu->code_memory);
+    free(cpu->loop.captured);
+    free(cpu->loop.body);
+    APEX_indirect_free(&cpu->indirect);
+    free_contexts(cpu);
+    APEX_memory_free(&cpu->data_memory);
+    APEX_bpred_free(&cpu->bpred);
+    free(cpu->BTB);
     free(cpu);
 }
\ No newline at end of file
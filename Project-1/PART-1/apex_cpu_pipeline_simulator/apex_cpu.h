@@ -8,8 +8,65 @@
  */
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
-#define BTB_SIZE 4
+/* Default BTB shape, sets must be a power of two */
+#define BTB_SETS 16
+#define BTB_WAYS 2
 #include "apex_macros.h"
+#include "apex_bpred.h"
+#include "apex_ras.h"
+#include "apex_memory.h"
+
+struct APEX_Checker;
+struct APEX_Debugger;
+
+/* Default direction predictor */
+#define BPRED_DEFAULT BPRED_BIMODAL
+#define GSHARE_BITS 10
+
+/* Default return address stack depth and indirect target table size */
+#define RAS_DEPTH 8
+#define INDIRECT_SIZE 16
+
+/* Default fetch target queue and instruction buffer entries per thread */
+#define FTQ_SIZE 4
+#define IBUF_SIZE 4
+
+/* Default loop buffer entries, 0 disables it */
+#define LOOP_BUFFER_SIZE 16
+
+/* States of the loop buffer */
+#define LOOP_IDLE 0x0              /* Waiting for a short backward taken branch */
+#define LOOP_CAPTURE 0x1           /* Copying the body as Decode sees it */
+#define LOOP_REPLAY 0x2            /* Fetch reads the body from the buffer */
+
+/* Default data memory address bits and huge page backing */
+#define MEMORY_ADDRESS_BITS 32
+#define MEMORY_HUGE_PAGES 0
+
+/* Default cycle to fork what-if runs at, 0 disables them */
+#define WHATIF_CYCLE 0
+
+/* Default memory the debugger may keep snapshots in, 0 disables reverse
+ * execution */
+#define SNAPSHOT_MB 64
+
+/* Longest path of the file stats= writes */
+#define STATS_PATH_SIZE 256
+
+/* Default hardware thread count and fetch policy */
+#define SMT_THREADS 1
+#define SMT_POLICY SMT_ICOUNT
+
+/* Fetch policies choosing the thread that fetches each cycle */
+#define SMT_RR 0x0                 /* Threads take turns */
+#define SMT_ICOUNT 0x1             /* Fewest instructions in the pipeline */
+#define SMT_STALL 0x2              /* Next instruction can issue, then ICOUNT */
+
+/* Where fetch took the target of a JUMP or JALR from */
+#define TARGET_NONE 0x0
+#define TARGET_BTB 0x1
+#define TARGET_RAS 0x2
+#define TARGET_INDIRECT 0x3
 
 /* Format of an APEX instruction  */
 typedef struct APEX_Instruction
@@ -39,51 +96,169 @@ typedef struct CPU_Stage
     int has_insn;
     int aux_buffer;
     int jump_buffer;
+    int predicted_pc;              /* Where fetch went after this instruction */
+    int predicted_taken;           /* Direction predicted for a conditional branch */
+    unsigned long long bpred_history; /* Global history before this instruction */
+    int target_source;             /* TARGET_* of a JUMP or JALR */
+    unsigned int path_history;     /* Indirect path history at fetch */
+    RAS_Checkpoint ras_checkpoint; /* Return address stack after fetch */
+    int from_loop;                 /* Read from the loop buffer */
+    int tid;                       /* Hardware thread of the instruction */
 
 } CPU_Stage;
 
 typedef struct BTB_Entry{
-    int address;
+    int tag;                       /* PC bits above the set index */
     int calculated_address;
     int taken;
     int valid;
-    int counter;
-    int resolved;
+    int counter;                   /* 2-bit direction counter for BPRED_BIMODAL */
+    int last_use;                  /* Access stamp for LRU */
+    int tid;                       /* Thread the entry belongs to */
 } BTB_Entry;
 
-/* Model of APEX CPU */
-typedef struct APEX_CPU
-{
+/* Loop buffer holding the body of a short loop closed by a backward branch */
+typedef struct Loop_Buffer{
+    int state;                     /* LOOP_* */
+    int start;                     /* PC of the first body instruction */
+    int end;                       /* PC of the closing backward branch */
+    APEX_Instruction *body;        /* config.loop_buffer entries */
+    int *captured;                 /* Body slots filled so far */
+    int captured_count;
+    int loops;                     /* Loops captured */
+    int aborted;                   /* Captures dropped */
+    int exits;                     /* Replays ended by a redirect */
+    int residency;                 /* Cycles spent replaying */
+    int replayed;                  /* Instructions fetched from the buffer */
+    int iterations;
+    int btb_lookups_saved;
+    int tid;                       /* Thread the loop belongs to */
+} Loop_Buffer;
+
+/*
+ * Architectural state and front end of one hardware thread. Each cycle the
+ * next-PC logic of one thread queues the target the BTB and the predictors
+ * chose, and that thread fetches the oldest queued target into its
+ * instruction buffer, which feeds its decode latch. One thread issues to
+ * Execute; Execute, Memory, Writeback, the BTB, the predictor tables and
+ * the loop buffer are shared, and so is data memory. BTB and indirect
+ * target entries only hit for the thread that installed them.
+ */
+typedef struct APEX_Context{
     int pc;                        /* Current program counter */
-    int clock;                     /* Clock cycles elapsed */
-    int insn_completed;            /* Instructions retired */
     int regs[REG_FILE_SIZE];       /* Integer register file */
-    int code_memory_size;          /* Number of instruction in the input file */
-    APEX_Instruction *code_memory; /* Code Memory */
-    int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
-    int single_step;               /* Wait for user input after every cycle */
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
     int n_flag;
     int p_flag;
-    int fetch_from_next_cycle;
+    int fetch_from_next_cycle;     /* Do not fetch this thread this cycle */
     int register_waiting_flag[REG_FILE_SIZE];
-    int maxCycles;
-    /* Pipeline stages */
-    CPU_Stage fetch;
+    int code_memory_size;          /* Number of instruction in the input file */
+    APEX_Instruction *code_memory; /* Code Memory */
+    int *code_refs;                /* Forks sharing code memory, NULL if none */
+    CPU_Stage fetch;               /* has_insn is FALSE once HALT was queued */
+    CPU_Stage *ftq;                /* Fetch target queue, predicted PCs */
+    int ftq_head;
+    int ftq_count;
+    CPU_Stage *ibuf;               /* Instruction buffer between Fetch and Decode */
+    int ibuf_head;
+    int ibuf_count;
     CPU_Stage decode;
+    unsigned long long bpred_history; /* Global history while switched out */
+    APEX_RAS ras;
+    struct APEX_Checker *checker;  /* Lockstep checker, or NULL */
+    int halted;                    /* HALT retired */
+    int halt_cycle;
+
+    /* Statistics */
+    int fetched;
+    int issued;
+    int insn_completed;
+    int decode_stalls;             /* Cycles stalled on the scoreboard */
+    int flushes;
+    int ftq_max;
+    int ibuf_max;
+    int runahead_fetches;          /* Fetched while Decode was held */
+    int ibuf_full_cycles;
+    int squashed;                  /* Queue entries dropped by redirects */
+} APEX_Context;
+
+/* Run-time configuration of the simulated machine, see APEX_config_set() */
+typedef struct APEX_Config
+{
+    int btb_sets;                  /* BTB sets, a power of two */
+    int btb_ways;                  /* BTB entries per set */
+    int bpred;                     /* BPRED_* direction predictor */
+    int gshare_bits;               /* gshare history and table index bits */
+    int ras_depth;                 /* Return address stack entries, 0 disables */
+    int indirect_size;             /* Indirect target entries, 0 disables */
+    int ftq_size;                  /* Fetch target queue entries per thread */
+    int ibuf_size;                 /* Instruction buffer entries per thread */
+    int loop_buffer;               /* Loop buffer entries, 0 disables */
+    int threads;                   /* Hardware threads */
+    int smt_policy;                /* SMT_* fetch policy */
+    int check;                     /* Run the lockstep checker */
+    int mem_bits;                  /* Data memory address bits, up to 32 */
+    int huge_pages;                /* Back data memory with huge pages */
+    int whatif;                    /* Cycle to fork what-if runs at, 0 disables */
+    int snap_mb;                   /* Debugger snapshot budget, 0 disables */
+    char stats[STATS_PATH_SIZE];   /* Statistics registry file, "" for none */
+} APEX_Config;
+
+/* Model of APEX CPU */
+typedef struct APEX_CPU
+{
+    int clock;                     /* Clock cycles elapsed */
+    int insn_completed;            /* Instructions retired */
+    APEX_Memory data_memory;       /* Data Memory, shared by all threads */
+    int single_step;               /* Wait for user input after every cycle */
+    int quiet;                     /* No per-cycle output */
+    int maxCycles;
+    APEX_Context *ctx;             /* Indexed by thread */
+    int threads;
+    int fetch_next;                /* Thread fetch tries first */
+    int decode_next;               /* Thread decode tries first */
+    int bpred_tid;                 /* Thread whose history bpred holds */
+    int fetch_idle;                /* Cycles no thread could fetch */
+    int diverged;                  /* The checker stopped the simulation */
+    int faulted;                   /* A load or store left the address space */
+    struct APEX_Debugger *debugger; /* Retire and store hooks, or NULL */
+    /* Pipeline stages, Fetch and Decode are in the contexts */
     CPU_Stage execute;
     CPU_Stage memory;
     CPU_Stage writeback;
-    int BTB_head;
-    BTB_Entry BTB[BTB_SIZE];
+    APEX_Config config;
+    BTB_Entry *BTB;                /* btb_sets * btb_ways entries */
+    int BTB_stamp;
+    int btb_lookups;
+    int btb_hits;
+    int btb_misses;
+    int branches_resolved;
+    int mispredictions;
+    APEX_BPred bpred;
+    APEX_Indirect indirect;
+    Loop_Buffer loop;
 } APEX_CPU;
 
 APEX_Instruction *create_code_memory(const char *filename, int *size);
-APEX_CPU *APEX_cpu_init(const char *filename);
+void APEX_config_init(APEX_Config *config);
+int APEX_config_set(APEX_Config *config, const char *option);
+void APEX_config_register_stats(const APEX_Config *config, APEX_Stats *stats);
+APEX_CPU *APEX_cpu_init(const char *filename, const APEX_Config *config);
+APEX_CPU *APEX_cpu_fork(APEX_CPU *cpu, const APEX_Config *config);
+size_t APEX_cpu_fork_size(const APEX_CPU *cpu);
+int APEX_cpu_step(APEX_CPU *cpu);
 void APEX_cpu_run(APEX_CPU *cpu);
+void APEX_cpu_print_state(const APEX_CPU *cpu);
+void APEX_cpu_print_pipeline(const APEX_CPU *cpu);
+void APEX_cpu_print_result(const APEX_CPU *cpu);
+void APEX_cpu_print_stats(const APEX_CPU *cpu);
+void APEX_cpu_register_stats(const APEX_CPU *cpu, APEX_Stats *stats);
+int APEX_cpu_write_stats(const APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
-void addToBTB(APEX_CPU * cpu, int instruction_address, int calculated_address);
-int searchBTB(APEX_CPU* cpu, int instruction_address);
+int isControlTransfer(int opcode);
+int isConditionalBranch(int opcode);
+void addToBTB(APEX_CPU * cpu, int tid, int instruction_address, int calculated_address);
+int searchBTB(APEX_CPU* cpu, int tid, int instruction_address);
 void initBTB(APEX_CPU * cpu);
 void branch(APEX_CPU* cpu);
 void flushAndFetchNext(APEX_CPU *cpu);
@@ -0,0 +1,907 @@
+/*
+ * apex_debug.c
+ * Contains APEX debugger implementation
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_check.h"
+#include "apex_debug.h"
+
+/* Indexed by DEBUG_* */
+static const char *const kind_names[] = {"Breakpoint", "Watchpoint",
+                                         "Condition", "Cycle breakpoint",
+                                         "Instruction breakpoint"};
+static const char *const op_names[] = {"==", "!=", "<", "<=", ">", ">=", NULL};
+
+/* The last snapshot taken at or before 'clock', or -1 */
+static int
+find_snapshot(const APEX_Debugger *dbg, int clock)
+{
+    int i = dbg->snap_count - 1;
+
+    while (i >= 0 && dbg->snaps[i].cpu->clock > clock)
+    {
+        i--;
+    }
+    return i;
+}
+
+/*
+ * Bytes snapshot 'i' holds that the one before it does not: its own tables
+ * and the data memory pages written between the two
+ */
+static size_t
+snapshot_size(const APEX_Debugger *dbg, int i)
+{
+    const APEX_CPU *cpu = dbg->snaps[i].cpu;
+    const APEX_CPU *prev = i ? dbg->snaps[i - 1].cpu : NULL;
+    int pages = APEX_memory_unshared(&cpu->data_memory,
+                                     prev ? &prev->data_memory : NULL);
+    int t;
+
+    for (t = 0; t < cpu->threads; ++t)
+    {
+        if (cpu->ctx[t].checker)
+        {
+            pages += APEX_memory_unshared(
+                &cpu->ctx[t].checker->data_memory,
+                prev ? &prev->ctx[t].checker->data_memory : NULL);
+        }
+    }
+    return APEX_cpu_fork_size(cpu) + pages * sizeof(Memory_Page);
+}
+
+static void
+size_snapshots(APEX_Debugger *dbg)
+{
+    int i;
+
+    dbg->snap_bytes = 0;
+    for (i = 0; i < dbg->snap_count; ++i)
+    {
+        dbg->snaps[i].size = snapshot_size(dbg, i);
+        dbg->snap_bytes += dbg->snaps[i].size;
+    }
+}
+
+/*
+ * Drops every other snapshot, keeping the first, and doubles the interval
+ * until the snapshots fit the budget
+ */
+static void
+thin_snapshots(APEX_Debugger *dbg)
+{
+    while (dbg->snap_bytes > dbg->budget && dbg->snap_count > 1)
+    {
+        int kept = 0;
+        int i;
+
+        for (i = 0; i < dbg->snap_count; ++i)
+        {
+            if (i % 2)
+            {
+                APEX_cpu_stop(dbg->snaps[i].cpu);
+            }
+            else
+            {
+                dbg->snaps[kept++] = dbg->snaps[i];
+            }
+        }
+        dbg->snap_count = kept;
+        if (dbg->interval <= INT_MAX / 2)
+        {
+            dbg->interval *= 2;
+        }
+        size_snapshots(dbg);
+    }
+}
+
+/* Snapshots the CPU unless there already is one of this cycle */
+static void
+take_snapshot(APEX_Debugger *dbg)
+{
+    APEX_CPU *cpu = dbg->cpu;
+    int i = find_snapshot(dbg, cpu->clock);
+    APEX_CPU *snap;
+
+    if (i >= 0 && dbg->snaps[i].cpu->clock == cpu->clock)
+    {
+        dbg->next_snap = (cpu->clock / dbg->interval + 1) * dbg->interval;
+        return;
+    }
+
+    if (dbg->snap_count == dbg->snap_size)
+    {
+        int size = dbg->snap_size ? 2 * dbg->snap_size : 64;
+        Debug_Snapshot *snaps = realloc(dbg->snaps, size * sizeof(Debug_Snapshot));
+
+        if (!snaps)
+        {
+            printf("Out of memory, no more snapshots\n");
+            dbg->next_snap = INT_MAX;
+            return;
+        }
+        dbg->snaps = snaps;
+        dbg->snap_size = size;
+    }
+
+    snap = APEX_cpu_fork(cpu, NULL);
+    if (!snap)
+    {
+        printf("Out of memory, no more snapshots\n");
+        dbg->next_snap = INT_MAX;
+        return;
+    }
+
+    /* Snapshots come in order unless the CPU went back */
+    i++;
+    memmove(&dbg->snaps[i + 1], &dbg->snaps[i],
+            (dbg->snap_count - i) * sizeof(Debug_Snapshot));
+    dbg->snaps[i].cpu = snap;
+    dbg->snap_count++;
+    if (i + 1 < dbg->snap_count)
+    {
+        size_snapshots(dbg);
+    }
+    else
+    {
+        dbg->snaps[i].size = snapshot_size(dbg, i);
+        dbg->snap_bytes += dbg->snaps[i].size;
+    }
+    thin_snapshots(dbg);
+    dbg->next_snap = (cpu->clock / dbg->interval + 1) * dbg->interval;
+}
+
+APEX_Debugger *
+APEX_debug_init(APEX_CPU *cpu)
+{
+    APEX_Debugger *dbg = calloc(1, sizeof(APEX_Debugger));
+
+    if (!dbg)
+    {
+        return NULL;
+    }
+
+    dbg->cpu = cpu;
+    dbg->next_id = 1;
+    dbg->interval = DEBUG_SNAP_INTERVAL;
+    dbg->next_snap = INT_MAX;
+    dbg->budget = (size_t)cpu->config.snap_mb << 20;
+    cpu->quiet = TRUE;
+    cpu->single_step = FALSE;
+    if (dbg->budget)
+    {
+        take_snapshot(dbg);
+    }
+    return dbg;
+}
+
+/* Frees the debugger, its CPU may have been replaced, see dbg->cpu */
+void
+APEX_debug_free(APEX_Debugger *dbg)
+{
+    int i;
+
+    for (i = 0; i < dbg->snap_count; ++i)
+    {
+        APEX_cpu_stop(dbg->snaps[i].cpu);
+    }
+    dbg->cpu->debugger = NULL;
+    free(dbg->snaps);
+    free(dbg->breaks);
+    free(dbg);
+}
+
+/* Called by Writeback for every instruction it retires */
+void
+APEX_debug_retire(APEX_Debugger *dbg, const CPU_Stage *stage)
+{
+    int i;
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        Debug_Break *brk = &dbg->breaks[i];
+
+        if (brk->kind == DEBUG_PC && brk->value == stage->pc)
+        {
+            dbg->hit = TRUE;
+            if (dbg->replaying)
+            {
+                return;
+            }
+            brk->hits++;
+            printf("Breakpoint %d: T%d pc(%d) %s retired\n", brk->id,
+                   stage->tid, stage->pc, stage->opcode_str);
+        }
+    }
+}
+
+/* Called by Memory before a store writes 'address' */
+void
+APEX_debug_store(APEX_Debugger *dbg, const CPU_Stage *stage,
+                 unsigned address)
+{
+    int i;
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        Debug_Break *brk = &dbg->breaks[i];
+
+        if (brk->kind == DEBUG_WATCH && (unsigned)brk->value == address)
+        {
+            dbg->hit = TRUE;
+            if (dbg->replaying)
+            {
+                return;
+            }
+            brk->hits++;
+            printf("Watchpoint %d: MEM[%u] %d -> %d by T%d pc(%d) %s\n",
+                   brk->id, address,
+                   APEX_memory_peek(&dbg->cpu->data_memory, address),
+                   stage->rs1_value, stage->tid, stage->pc,
+                   stage->opcode_str);
+        }
+    }
+}
+
+static int
+condition_holds(const APEX_Debugger *dbg, const Debug_Break *brk)
+{
+    int reg = dbg->cpu->ctx[brk->tid].regs[brk->reg];
+
+    switch (brk->op)
+    {
+        case DEBUG_EQ: return reg == brk->value;
+        case DEBUG_NE: return reg != brk->value;
+        case DEBUG_LT: return reg < brk->value;
+        case DEBUG_LE: return reg <= brk->value;
+        case DEBUG_GT: return reg > brk->value;
+        default: return reg >= brk->value;
+    }
+}
+
+/* TRUE if a register condition turned true this cycle */
+static int
+check_conditions(APEX_Debugger *dbg)
+{
+    int stop = FALSE;
+    int i;
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        Debug_Break *brk = &dbg->breaks[i];
+        int holds;
+
+        if (brk->kind != DEBUG_COND)
+        {
+            continue;
+        }
+
+        holds = condition_holds(dbg, brk);
+        if (holds && !brk->held)
+        {
+            stop = TRUE;
+        }
+        if (holds && !brk->held && !dbg->replaying)
+        {
+            brk->hits++;
+            printf("Condition %d: T%d R%d %s %d (R%d = %d)\n", brk->id,
+                   brk->tid, brk->reg, op_names[brk->op], brk->value,
+                   brk->reg, dbg->cpu->ctx[brk->tid].regs[brk->reg]);
+        }
+        brk->held = holds;
+    }
+    return stop;
+}
+
+/*
+ * The lowest count of a cycle or instruction breakpoint of 'kind' still
+ * ahead of 'now', or INT_MAX
+ */
+static int
+next_count(const APEX_Debugger *dbg, int kind, int now)
+{
+    int next = INT_MAX;
+    int i;
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        if (dbg->breaks[i].kind == kind && dbg->breaks[i].value > now
+            && dbg->breaks[i].value < next)
+        {
+            next = dbg->breaks[i].value;
+        }
+    }
+    return next;
+}
+
+/* Reports the cycle and instruction breakpoints the run reached */
+static void
+report_counts(APEX_Debugger *dbg)
+{
+    int i;
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        Debug_Break *brk = &dbg->breaks[i];
+
+        if ((brk->kind == DEBUG_CYCLE && brk->value == dbg->cpu->clock)
+            || (brk->kind == DEBUG_INSN
+                && brk->value == dbg->cpu->insn_completed))
+        {
+            brk->hits++;
+            printf("%s %d: %d\n", kind_names[brk->kind], brk->id, brk->value);
+        }
+    }
+}
+
+/*
+ * Runs until a breakpoint stops the pipeline or the program ends, at most
+ * 'cycles' cycles unless 0
+ */
+static void
+run(APEX_Debugger *dbg, int cycles)
+{
+    APEX_CPU *cpu = dbg->cpu;
+    int stop_clock = next_count(dbg, DEBUG_CYCLE, cpu->clock);
+    int stop_insns = next_count(dbg, DEBUG_INSN, cpu->insn_completed);
+
+    if (dbg->ended)
+    {
+        printf("The program has ended\n");
+        return;
+    }
+
+    if (cycles && cycles < stop_clock - cpu->clock)
+    {
+        stop_clock = cpu->clock + cycles;
+    }
+
+    /* Writeback and Memory only call out while a hook is wanted */
+    dbg->hit = FALSE;
+    cpu->debugger = dbg->hooks ? dbg : NULL;
+
+    while (TRUE)
+    {
+        if (APEX_cpu_step(cpu))
+        {
+            dbg->ended = TRUE;
+            break;
+        }
+        if (cpu->clock >= dbg->next_snap)
+        {
+            take_snapshot(dbg);
+        }
+
+        /* Conditions are checked every cycle to follow their edges */
+        if ((dbg->conditions && check_conditions(dbg)) || dbg->hit
+            || cpu->clock >= stop_clock || cpu->insn_completed >= stop_insns)
+        {
+            break;
+        }
+    }
+    cpu->debugger = NULL;
+
+    if (dbg->ended)
+    {
+        APEX_cpu_print_result(cpu);
+        return;
+    }
+
+    report_counts(dbg);
+    printf("Stopped at cycle %d, %d instructions retired\n", cpu->clock,
+           cpu->insn_completed);
+    APEX_cpu_print_pipeline(cpu);
+}
+
+/* Starts the register conditions from the CPU's current state */
+static void
+reset_conditions(APEX_Debugger *dbg)
+{
+    int i;
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        if (dbg->breaks[i].kind == DEBUG_COND)
+        {
+            dbg->breaks[i].held = condition_holds(dbg, &dbg->breaks[i]);
+        }
+    }
+}
+
+/*
+ * Replaces the CPU with one replayed from the last snapshot up to cycle
+ * 'clock'. Returns FALSE if out of memory, the CPU is then kept.
+ */
+static int
+restore(APEX_Debugger *dbg, int clock)
+{
+    const APEX_CPU *snap = dbg->snaps[find_snapshot(dbg, clock)].cpu;
+    APEX_CPU *cpu = APEX_cpu_fork((APEX_CPU *)snap, NULL);
+
+    if (!cpu)
+    {
+        printf("Out of memory\n");
+        return FALSE;
+    }
+
+    /* The run went past 'clock' before, so it cannot end on the way */
+    dbg->replayed += clock - cpu->clock;
+    while (cpu->clock < clock)
+    {
+        APEX_cpu_step(cpu);
+    }
+
+    APEX_cpu_stop(dbg->cpu);
+    dbg->cpu = cpu;
+    dbg->ended = FALSE;
+    dbg->next_snap = (clock / dbg->interval + 1) * dbg->interval;
+    reset_conditions(dbg);
+    return TRUE;
+}
+
+/*
+ * Replays a fork of snapshot 'i' up to cycle 'to'. Returns the last cycle
+ * a breakpoint stops at, 0 if none does, -1 if out of memory.
+ */
+static int
+scan(APEX_Debugger *dbg, int i, int to)
+{
+    APEX_CPU *live = dbg->cpu;
+    APEX_CPU *cpu = APEX_cpu_fork(dbg->snaps[i].cpu, NULL);
+    int last = 0;
+
+    if (!cpu)
+    {
+        printf("Out of memory\n");
+        return -1;
+    }
+
+    /* The hooks and conditions look at dbg->cpu */
+    dbg->cpu = cpu;
+    dbg->replaying = TRUE;
+    dbg->replayed += to - cpu->clock;
+    reset_conditions(dbg);
+    cpu->debugger = dbg->hooks ? dbg : NULL;
+
+    while (cpu->clock < to)
+    {
+        int insns = cpu->insn_completed;
+        int stop;
+        int b;
+
+        dbg->hit = FALSE;
+        APEX_cpu_step(cpu);
+
+        /* Conditions are checked every cycle to follow their edges */
+        stop = dbg->conditions && check_conditions(dbg);
+        for (b = 0; b < dbg->count; ++b)
+        {
+            const Debug_Break *brk = &dbg->breaks[b];
+
+            stop |= (brk->kind == DEBUG_CYCLE && brk->value == cpu->clock)
+                    || (brk->kind == DEBUG_INSN && brk->value > insns
+                        && brk->value <= cpu->insn_completed);
+        }
+        if (dbg->hit || stop)
+        {
+            last = cpu->clock;
+        }
+    }
+
+    dbg->replaying = FALSE;
+    dbg->cpu = live;
+    APEX_cpu_stop(cpu);
+    return last;
+}
+
+/* Goes back 'cycles' cycles */
+static void
+reverse_step(APEX_Debugger *dbg, int cycles)
+{
+    int clock = dbg->cpu->clock > cycles ? dbg->cpu->clock - cycles : 0;
+
+    if (restore(dbg, clock))
+    {
+        printf("Back at cycle %d, %d instructions retired\n",
+               dbg->cpu->clock, dbg->cpu->insn_completed);
+        APEX_cpu_print_pipeline(dbg->cpu);
+    }
+}
+
+/*
+ * Goes back to the last cycle before this one a breakpoint stops at, or to
+ * the start. Each interval between snapshots is replayed once, latest
+ * first, and the one holding the stop a second time up to the cycle before
+ * it. That cycle then runs forwards, so the stop is reported as usual.
+ */
+static void
+reverse_continue(APEX_Debugger *dbg)
+{
+    int end = dbg->cpu->clock;
+    int i;
+
+    for (i = dbg->count ? find_snapshot(dbg, end - 1) : -1; i >= 0; --i)
+    {
+        int to = i + 1 < dbg->snap_count && dbg->snaps[i + 1].cpu->clock < end
+                     ? dbg->snaps[i + 1].cpu->clock
+                     : end - 1;
+        int last = scan(dbg, i, to);
+
+        if (last < 0)
+        {
+            return;
+        }
+        if (last)
+        {
+            if (restore(dbg, last - 1))
+            {
+                run(dbg, 1);
+            }
+            return;
+        }
+    }
+
+    if (restore(dbg, 0))
+    {
+        printf("No earlier stop, back at the start\n");
+    }
+}
+
+/* Parses a number in any base strtol() takes, returns FALSE if it is not */
+static int
+parse_number(const char *text, long *value)
+{
+    char *end;
+
+    *value = strtol(text, &end, 0);
+    return end != text && *end == '\0';
+}
+
+static Debug_Break *
+add_break(APEX_Debugger *dbg, int kind, int value)
+{
+    Debug_Break *brk;
+
+    if (dbg->count == dbg->size)
+    {
+        int size = dbg->size ? 2 * dbg->size : 8;
+        Debug_Break *breaks = realloc(dbg->breaks, size * sizeof(Debug_Break));
+
+        if (!breaks)
+        {
+            printf("Out of memory\n");
+            return NULL;
+        }
+        dbg->breaks = breaks;
+        dbg->size = size;
+    }
+
+    brk = &dbg->breaks[dbg->count++];
+    memset(brk, 0, sizeof(Debug_Break));
+    brk->id = dbg->next_id++;
+    brk->kind = kind;
+    brk->value = value;
+    dbg->hooks += kind == DEBUG_PC || kind == DEBUG_WATCH;
+    dbg->conditions += kind == DEBUG_COND;
+    return brk;
+}
+
+/* Deletes breakpoint 'id', or all of them if 'id' is 0 */
+static void
+delete_break(APEX_Debugger *dbg, int id)
+{
+    int i = 0;
+
+    while (i < dbg->count)
+    {
+        Debug_Break *brk = &dbg->breaks[i];
+
+        if (id && brk->id != id)
+        {
+            i++;
+            continue;
+        }
+
+        dbg->hooks -= brk->kind == DEBUG_PC || brk->kind == DEBUG_WATCH;
+        dbg->conditions -= brk->kind == DEBUG_COND;
+        memmove(brk, brk + 1, (dbg->count - i - 1) * sizeof(Debug_Break));
+        dbg->count--;
+    }
+}
+
+static void
+print_breaks(const APEX_Debugger *dbg)
+{
+    int i;
+
+    if (dbg->budget)
+    {
+        printf("%d snapshots every %d cycles, %zu of %zu KB, %lld cycles replayed\n",
+               dbg->snap_count, dbg->interval, dbg->snap_bytes >> 10,
+               dbg->budget >> 10, dbg->replayed);
+    }
+    if (!dbg->count)
+    {
+        printf("No breakpoints\n");
+        return;
+    }
+
+    for (i = 0; i < dbg->count; ++i)
+    {
+        const Debug_Break *brk = &dbg->breaks[i];
+
+        printf("%-3d %-22s ", brk->id, kind_names[brk->kind]);
+        switch (brk->kind)
+        {
+            case DEBUG_PC: printf("pc(%d)", brk->value); break;
+            case DEBUG_WATCH: printf("MEM[%u]", (unsigned)brk->value); break;
+            case DEBUG_COND:
+                printf("T%d R%d %s %d", brk->tid, brk->reg, op_names[brk->op],
+                       brk->value);
+                break;
+            default: printf("%d", brk->value); break;
+        }
+        printf(", %d hits\n", brk->hits);
+    }
+}
+
+static void
+print_regs(const APEX_CPU *cpu, int tid)
+{
+    const APEX_Context *ctx = &cpu->ctx[tid];
+    int i;
+
+    printf("T%d pc(%d) Z %d P %d N %d\n", tid, ctx->pc, ctx->zero_flag,
+           ctx->p_flag, ctx->n_flag);
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        printf("R%-3d[%-3d]%s", i, ctx->regs[i],
+               i % (REG_FILE_SIZE / 2) == REG_FILE_SIZE / 2 - 1 ? "\n" : " ");
+    }
+}
+
+static void
+print_help(void)
+{
+    printf("break <pc>             Stop when the instruction at pc retires\n");
+    printf("watch <address>        Stop when a store writes the address\n");
+    printf("cond R<n> <op> <value> [T<t>]\n");
+    printf("                       Stop when the comparison turns true\n");
+    printf("cycle <n>              Stop once n cycles have run\n");
+    printf("insns <n>              Stop once n instructions have retired\n");
+    printf("delete [id]            Delete a breakpoint, or all of them\n");
+    printf("info                   List the breakpoints\n");
+    printf("continue               Run to the next stop\n");
+    printf("step [n]               Run n cycles, 1 by default\n");
+    printf("rcontinue              Go back to the last stop\n");
+    printf("rstep [n]              Go back n cycles, 1 by default\n");
+    printf("regs [t]               Print the registers of thread t\n");
+    printf("mem <address> [n]      Print n words of data memory\n");
+    printf("pipe                   Print the pipeline latches\n");
+    printf("stats                  Print the statistics\n");
+    printf("quit                   End the session\n");
+}
+
+/* Adds the breakpoint of a break, watch, cond, cycle or insns command */
+static void
+command_break(APEX_Debugger *dbg, int kind, char args[4][64], int nargs)
+{
+    Debug_Break *brk;
+    long value;
+    long reg = 0;
+    long tid = 0;
+    int op = 0;
+
+    if (kind == DEBUG_COND)
+    {
+        if (nargs < 3 || (args[0][0] != 'R' && args[0][0] != 'r')
+            || !parse_number(args[0] + 1, &reg) || reg < 0
+            || reg >= REG_FILE_SIZE || !parse_number(args[2], &value))
+        {
+            printf("Usage: cond R<n> <op> <value> [T<t>]\n");
+            return;
+        }
+        while (op_names[op] && strcmp(op_names[op], args[1]))
+        {
+            op++;
+        }
+        if (!op_names[op])
+        {
+            printf("Comparisons are == != < <= > >=\n");
+            return;
+        }
+        if (nargs > 3
+            && ((args[3][0] != 'T' && args[3][0] != 't')
+                || !parse_number(args[3] + 1, &tid) || tid < 0
+                || tid >= dbg->cpu->threads))
+        {
+            printf("No thread %s\n", args[3]);
+            return;
+        }
+    }
+    else if (nargs < 1 || !parse_number(args[0], &value))
+    {
+        printf("Expected a number\n");
+        return;
+    }
+
+    brk = add_break(dbg, kind, (int)value);
+    if (!brk)
+    {
+        return;
+    }
+    brk->reg = (int)reg;
+    brk->tid = (int)tid;
+    brk->op = op;
+    if (kind == DEBUG_COND)
+    {
+        /* Only a change to true stops */
+        brk->held = condition_holds(dbg, brk);
+    }
+    printf("%s %d set\n", kind_names[kind], brk->id);
+}
+
+/*
+ * Reads and runs commands until quit or the end of the input, then prints
+ * the statistics. Returns FALSE if the simulation diverged or faulted.
+ */
+int
+APEX_debug_run(APEX_Debugger *dbg)
+{
+    char line[DEBUG_LINE_SIZE];
+
+    printf("APEX debugger, type help for the commands\n");
+    while (TRUE)
+    {
+        char cmd[32];
+        char args[4][64];
+        long value;
+        int nargs;
+
+        printf("(apex) ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin))
+        {
+            printf("\n");
+            break;
+        }
+
+        nargs = sscanf(line, "%31s %63s %63s %63s %63s", cmd, args[0],
+                       args[1], args[2], args[3]) - 1;
+        if (nargs < 0)
+        {
+            continue;
+        }
+
+        if (!strcmp(cmd, "break") || !strcmp(cmd, "b"))
+        {
+            command_break(dbg, DEBUG_PC, args, nargs);
+        }
+        else if (!strcmp(cmd, "watch") || !strcmp(cmd, "w"))
+        {
+            command_break(dbg, DEBUG_WATCH, args, nargs);
+        }
+        else if (!strcmp(cmd, "cond"))
+        {
+            command_break(dbg, DEBUG_COND, args, nargs);
+        }
+        else if (!strcmp(cmd, "cycle"))
+        {
+            command_break(dbg, DEBUG_CYCLE, args, nargs);
+        }
+        else if (!strcmp(cmd, "insns"))
+        {
+            command_break(dbg, DEBUG_INSN, args, nargs);
+        }
+        else if (!strcmp(cmd, "delete") || !strcmp(cmd, "d"))
+        {
+            if (nargs > 0 && !parse_number(args[0], &value))
+            {
+                printf("Expected a breakpoint number\n");
+                continue;
+            }
+            delete_break(dbg, nargs > 0 ? (int)value : 0);
+        }
+        else if (!strcmp(cmd, "info") || !strcmp(cmd, "i"))
+        {
+            print_breaks(dbg);
+        }
+        else if (!strcmp(cmd, "continue") || !strcmp(cmd, "c"))
+        {
+            run(dbg, 0);
+        }
+        else if (!strcmp(cmd, "step") || !strcmp(cmd, "s"))
+        {
+            if (nargs > 0 && (!parse_number(args[0], &value) || value < 1))
+            {
+                printf("Expected a cycle count\n");
+                continue;
+            }
+            run(dbg, nargs > 0 ? (int)value : 1);
+        }
+        else if (!dbg->budget
+                 && (!strcmp(cmd, "rcontinue") || !strcmp(cmd, "rc")
+                     || !strcmp(cmd, "rstep") || !strcmp(cmd, "rs")))
+        {
+            printf("Going backwards needs snap_mb above 0\n");
+        }
+        else if (!strcmp(cmd, "rcontinue") || !strcmp(cmd, "rc"))
+        {
+            reverse_continue(dbg);
+        }
+        else if (!strcmp(cmd, "rstep") || !strcmp(cmd, "rs"))
+        {
+            if (nargs > 0 && (!parse_number(args[0], &value) || value < 1))
+            {
+                printf("Expected a cycle count\n");
+                continue;
+            }
+            reverse_step(dbg, nargs > 0 ? (int)value : 1);
+        }
+        else if (!strcmp(cmd, "regs") || !strcmp(cmd, "r"))
+        {
+            if (nargs > 0 && (!parse_number(args[0], &value) || value < 0
+                              || value >= dbg->cpu->threads))
+            {
+                printf("No thread %s\n", args[0]);
+                continue;
+            }
+            print_regs(dbg->cpu, nargs > 0 ? (int)value : 0);
+        }
+        else if (!strcmp(cmd, "mem") || !strcmp(cmd, "x"))
+        {
+            long count = 1;
+            long i;
+
+            if (nargs < 1 || !parse_number(args[0], &value)
+                || (nargs > 1 && !parse_number(args[1], &count)))
+            {
+                printf("Usage: mem <address> [n]\n");
+                continue;
+            }
+            for (i = 0; i < count; ++i)
+            {
+                unsigned address = (unsigned)(value + i);
+
+                printf("MEM[%u] = %d\n", address,
+                       APEX_memory_peek(&dbg->cpu->data_memory, address));
+            }
+        }
+        else if (!strcmp(cmd, "pipe") || !strcmp(cmd, "p"))
+        {
+            APEX_cpu_print_pipeline(dbg->cpu);
+        }
+        else if (!strcmp(cmd, "stats"))
+        {
+            APEX_cpu_print_stats(dbg->cpu);
+        }
+        else if (!strcmp(cmd, "quit") || !strcmp(cmd, "q"))
+        {
+            break;
+        }
+        else if (!strcmp(cmd, "help") || !strcmp(cmd, "h"))
+        {
+            print_help();
+        }
+        else
+        {
+            printf("Unknown command %s, type help for the commands\n", cmd);
+        }
+    }
+
+    if (!dbg->ended)
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n",
+               dbg->cpu->clock, dbg->cpu->insn_completed);
+    }
+    APEX_cpu_print_stats(dbg->cpu);
+    if (dbg->cpu->config.stats[0])
+    {
+        APEX_cpu_write_stats(dbg->cpu);
+    }
+    return !dbg->cpu->diverged && !dbg->cpu->faulted;
+}
@@ -0,0 +1,106 @@
+/*
+ * apex_debug.h
+ * Contains APEX debugger declarations
+ *
+ * The debugger reads commands from standard input and runs the pipeline
+ * quietly between stops. It stops on:
+ *
+ *  - PC breakpoints, at the end of the cycle an instruction at the PC
+ *    retires, so its results are in the registers
+ *  - watchpoints, at the end of the cycle a store writes the address
+ *  - register conditions, at the end of the cycle a comparison of a
+ *    register with a constant turns true
+ *  - cycle and instruction count breakpoints, once the clock or the
+ *    instructions retired reach the count
+ *
+ * PC breakpoints and watchpoints hook Writeback and Memory through
+ * cpu->debugger, which is only set while one exists. With no breakpoints
+ * at all 'continue' runs the same loop as a plain run.
+ *
+ * Running backwards replays: every 'interval' cycles the CPU is forked
+ * into a snapshot that never runs. Going back to a cycle forks the last
+ * snapshot before it and runs the fork up to the cycle, which gives the
+ * same state since the pipeline is deterministic. When the snapshots
+ * outgrow config.snap_mb every other one is dropped and the interval
+ * doubles, so a replay never runs more than one interval.
+ */
+#ifndef _APEX_DEBUG_H_
+#define _APEX_DEBUG_H_
+
+#include "apex_cpu.h"
+
+/* Kinds of breakpoint */
+#define DEBUG_PC 0x0
+#define DEBUG_WATCH 0x1
+#define DEBUG_COND 0x2
+#define DEBUG_CYCLE 0x3
+#define DEBUG_INSN 0x4
+
+/* Comparisons of a register condition */
+#define DEBUG_EQ 0x0
+#define DEBUG_NE 0x1
+#define DEBUG_LT 0x2
+#define DEBUG_LE 0x3
+#define DEBUG_GT 0x4
+#define DEBUG_GE 0x5
+
+/* Cycles between snapshots until they outgrow their budget */
+#define DEBUG_SNAP_INTERVAL 4096
+
+/* Longest command line read */
+#define DEBUG_LINE_SIZE 256
+
+/* Format of a breakpoint */
+typedef struct Debug_Break
+{
+    int id;
+    int kind;                      /* DEBUG_* */
+    int value;                     /* PC, address, cycle or count */
+    int tid;                       /* Thread a condition reads */
+    int reg;                       /* Register a condition compares */
+    int op;                        /* DEBUG_EQ ... DEBUG_GE */
+    int held;                      /* The condition held last cycle */
+    int hits;
+} Debug_Break;
+
+/* Format of a snapshot */
+typedef struct Debug_Snapshot
+{
+    APEX_CPU *cpu;                 /* Fork taken at the end of a cycle */
+    size_t size;                   /* Bytes it holds the previous one does not */
+} Debug_Snapshot;
+
+/* Model of the debugger */
+typedef struct APEX_Debugger
+{
+    APEX_CPU *cpu;
+    Debug_Break *breaks;
+    int count;
+    int size;                      /* Breakpoints there is room for */
+    int next_id;
+    int hooks;                     /* PC breakpoints and watchpoints */
+    int conditions;                /* Register conditions */
+    int ended;                     /* HALT, a divergence or a fault */
+
+    /* Snapshots, oldest first */
+    Debug_Snapshot *snaps;
+    int snap_count;
+    int snap_size;                 /* Snapshots there is room for */
+    int interval;                  /* Cycles between snapshots */
+    int next_snap;                 /* Cycle of the next snapshot */
+    size_t snap_bytes;
+    size_t budget;                 /* Bytes the snapshots may hold, 0 disables */
+    int replaying;                 /* Looking for stops behind the CPU */
+    long long replayed;            /* Cycles replayed going backwards */
+
+    /* Set by the hooks during a cycle */
+    int hit;
+} APEX_Debugger;
+
+APEX_Debugger *APEX_debug_init(APEX_CPU *cpu);
+int APEX_debug_run(APEX_Debugger *dbg);
+void APEX_debug_free(APEX_Debugger *dbg);
+void APEX_debug_retire(APEX_Debugger *dbg, const CPU_Stage *stage);
+void APEX_debug_store(APEX_Debugger *dbg, const CPU_Stage *stage,
+                      unsigned address);
+#endif
@@ -12,9 +12,6 @@
 #define FALSE 0x0
 #define TRUE 0x1
 
-/* Integers */
-#define DATA_MEMORY_SIZE 4096
-
 /* Size of integer register file */
 #define REG_FILE_SIZE 16
 
@@ -46,6 +43,9 @@
 #define OPCODE_JALR 0x18
 #define OPCODE_LOADP 0x19
 
+/* Check every retirement against a functional model, 0 disables */
+#define LOCKSTEP_CHECK 0
+
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
 
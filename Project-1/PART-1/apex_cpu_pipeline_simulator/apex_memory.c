@@ -0,0 +1,516 @@
+/*
+ * apex_memory.c
+ * Contains APEX paged data memory implementation
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "apex_memory.h"
+
+#define MEMORY_DIR_MASK (MEMORY_DIR_SIZE - 1)
+
+/* Words of every page that was never written */
+static const int zero_page[MEMORY_PAGE_WORDS];
+
+int
+APEX_memory_init(APEX_Memory *mem, int address_bits, int huge_pages)
+{
+    memset(mem, 0, sizeof(APEX_Memory));
+
+    if (address_bits < 1 || address_bits > 32)
+    {
+        return FALSE;
+    }
+
+    mem->address_bits = address_bits;
+    mem->range_mask = address_bits == 32 ? 0 : ~0u << address_bits;
+    mem->huge_pages = huge_pages;
+    mem->cached_page = MEMORY_NO_PAGE;
+    mem->write_page = MEMORY_NO_PAGE;
+    return TRUE;
+}
+
+/* Drops a memory's hold on a page, freeing it with the last */
+static void
+release_page(Memory_Page *page)
+{
+    if (page && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0
+        && !page->in_chunk)
+    {
+        free(page);
+    }
+}
+
+static void
+release_chunk(Memory_Chunk *chunk)
+{
+    if (__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        munmap(chunk->base, MEMORY_HUGE_SIZE);
+        free(chunk);
+    }
+}
+
+void
+APEX_memory_free(APEX_Memory *mem)
+{
+    unsigned i;
+    unsigned j;
+    int c;
+
+    for (i = 0; i < MEMORY_DIR_SIZE; ++i)
+    {
+        if (!mem->directory[i])
+        {
+            continue;
+        }
+
+        for (j = 0; j < MEMORY_DIR_SIZE; ++j)
+        {
+            release_page(mem->directory[i][j]);
+        }
+        free(mem->directory[i]);
+        mem->directory[i] = NULL;
+    }
+
+    /* Chunks go once no memory holds pages in them */
+    for (c = 0; c < mem->chunk_count; ++c)
+    {
+        release_chunk(mem->chunks[c]);
+    }
+    free(mem->chunks);
+    mem->chunks = NULL;
+    mem->chunk_count = 0;
+    mem->carve = NULL;
+    mem->cached_page = MEMORY_NO_PAGE;
+    mem->write_page = MEMORY_NO_PAGE;
+    mem->cached = NULL;
+}
+
+/*
+ * Makes 'fork' a memory with the contents of 'mem', sharing all of its
+ * pages. Each keeps its own directory tables. Returns FALSE if out of
+ * memory, 'fork' is then empty.
+ */
+int
+APEX_memory_fork(APEX_Memory *fork, APEX_Memory *mem)
+{
+    unsigned i;
+    unsigned j;
+    int c;
+
+    APEX_memory_init(fork, mem->address_bits, mem->huge_pages);
+    fork->pages = mem->pages;
+    fork->shared = mem->pages;
+
+    if (mem->chunk_count)
+    {
+        fork->chunks = malloc(mem->chunk_count * sizeof(Memory_Chunk *));
+        if (!fork->chunks)
+        {
+            return FALSE;
+        }
+        for (c = 0; c < mem->chunk_count; ++c)
+        {
+            __atomic_add_fetch(&mem->chunks[c]->refs, 1, __ATOMIC_RELAXED);
+            fork->chunks[c] = mem->chunks[c];
+        }
+        fork->chunk_count = mem->chunk_count;
+    }
+
+    for (i = 0; i < MEMORY_DIR_SIZE; ++i)
+    {
+        if (!mem->directory[i])
+        {
+            continue;
+        }
+
+        fork->directory[i] = malloc(MEMORY_DIR_SIZE * sizeof(Memory_Page *));
+        if (!fork->directory[i])
+        {
+            APEX_memory_free(fork);
+            return FALSE;
+        }
+        fork->tables++;
+
+        for (j = 0; j < MEMORY_DIR_SIZE; ++j)
+        {
+            Memory_Page *page = mem->directory[i][j];
+
+            if (page)
+            {
+                __atomic_add_fetch(&page->refs, 1, __ATOMIC_RELAXED);
+            }
+            fork->directory[i][j] = page;
+        }
+    }
+
+    /* Every page is shared now, the next write to one copies it */
+    mem->write_page = MEMORY_NO_PAGE;
+    return TRUE;
+}
+
+/*
+ * Maps a chunk of zeroed memory backed by huge pages: reserved ones when the
+ * kernel has any, else transparent ones, which need the chunk aligned to
+ * their size. Returns NULL if nothing could be mapped.
+ */
+static char *
+map_chunk(int *hugetlb)
+{
+    char *base;
+    size_t skip;
+
+#ifdef MAP_HUGETLB
+    base = mmap(NULL, MEMORY_HUGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED)
+    {
+        *hugetlb = TRUE;
+        return base;
+    }
+#endif
+
+    base = mmap(NULL, 2 * MEMORY_HUGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    /* Trim the mapping down to one aligned chunk */
+    skip = (MEMORY_HUGE_SIZE - (uintptr_t)base % MEMORY_HUGE_SIZE)
+           % MEMORY_HUGE_SIZE;
+    if (skip)
+    {
+        munmap(base, skip);
+    }
+    munmap(base + skip + MEMORY_HUGE_SIZE, MEMORY_HUGE_SIZE - skip);
+    base += skip;
+
+#ifdef MADV_HUGEPAGE
+    madvise(base, MEMORY_HUGE_SIZE, MADV_HUGEPAGE);
+#endif
+    *hugetlb = FALSE;
+    return base;
+}
+
+/* Adds a chunk to carve pages from, returns FALSE if out of memory */
+static int
+add_chunk(APEX_Memory *mem)
+{
+    Memory_Chunk **chunks = realloc(mem->chunks, (mem->chunk_count + 1)
+                                                     * sizeof(Memory_Chunk *));
+    Memory_Chunk *chunk;
+
+    if (!chunks)
+    {
+        return FALSE;
+    }
+    mem->chunks = chunks;
+
+    chunk = calloc(1, sizeof(Memory_Chunk));
+    if (!chunk)
+    {
+        return FALSE;
+    }
+    chunk->base = map_chunk(&chunk->hugetlb);
+    if (!chunk->base)
+    {
+        free(chunk);
+        return FALSE;
+    }
+
+    chunk->refs = 1;
+    mem->chunks[mem->chunk_count++] = chunk;
+    mem->carve = chunk;
+    return TRUE;
+}
+
+/* A zeroed page held once, or NULL if out of memory */
+static Memory_Page *
+alloc_page(APEX_Memory *mem)
+{
+    Memory_Page *page;
+
+    if (!mem->huge_pages)
+    {
+        page = calloc(1, sizeof(Memory_Page));
+    }
+    else
+    {
+        /* Only the memory that added a chunk carves from it */
+        if ((!mem->carve
+             || mem->carve->used + sizeof(Memory_Page) > MEMORY_HUGE_SIZE)
+            && !add_chunk(mem))
+        {
+            return NULL;
+        }
+
+        page = (Memory_Page *)(mem->carve->base + mem->carve->used);
+        mem->carve->used += sizeof(Memory_Page);
+        page->in_chunk = TRUE;
+    }
+
+    if (page)
+    {
+        page->refs = 1;
+    }
+    return page;
+}
+
+/* The page 'page', or NULL if it was never written */
+static Memory_Page *
+find_page(const APEX_Memory *mem, unsigned page)
+{
+    Memory_Page **table = mem->directory[page >> MEMORY_DIR_BITS];
+
+    return table ? table[page & MEMORY_DIR_MASK] : NULL;
+}
+
+/* Puts a page in the page cache, writable if no fork shares it */
+static void
+cache_page(APEX_Memory *mem, unsigned number, Memory_Page *page)
+{
+    mem->cached_page = number;
+    mem->cached = page->words;
+    mem->write_page = __atomic_load_n(&page->refs, __ATOMIC_ACQUIRE) == 1
+                          ? number
+                          : MEMORY_NO_PAGE;
+}
+
+/* Read that missed the page cache */
+int
+APEX_memory_read_walk(APEX_Memory *mem, unsigned address)
+{
+    unsigned number = address >> MEMORY_PAGE_BITS;
+    Memory_Page *page = find_page(mem, number);
+
+    mem->walks++;
+    if (!page)
+    {
+        return 0;
+    }
+
+    cache_page(mem, number, page);
+    return page->words[address & MEMORY_PAGE_MASK];
+}
+
+/*
+ * Write that missed the page cache. Allocates the page and its directory
+ * table if needed, and copies a page still shared with a fork. Returns the
+ * word, or NULL if out of memory.
+ */
+int *
+APEX_memory_write_walk(APEX_Memory *mem, unsigned address)
+{
+    unsigned number = address >> MEMORY_PAGE_BITS;
+    Memory_Page ***table = &mem->directory[number >> MEMORY_DIR_BITS];
+    Memory_Page **page;
+
+    mem->walks++;
+    if (!*table)
+    {
+        *table = calloc(MEMORY_DIR_SIZE, sizeof(Memory_Page *));
+        if (!*table)
+        {
+            return NULL;
+        }
+        mem->tables++;
+    }
+
+    page = &(*table)[number & MEMORY_DIR_MASK];
+    if (!*page)
+    {
+        *page = alloc_page(mem);
+        if (!*page)
+        {
+            return NULL;
+        }
+        mem->pages++;
+    }
+    else if (__atomic_load_n(&(*page)->refs, __ATOMIC_ACQUIRE) > 1)
+    {
+        Memory_Page *copy = alloc_page(mem);
+
+        if (!copy)
+        {
+            return NULL;
+        }
+        memcpy(copy->words, (*page)->words, sizeof(copy->words));
+        release_page(*page);
+        *page = copy;
+        mem->copied++;
+    }
+
+    cache_page(mem, number, *page);
+    return &(*page)->words[address & MEMORY_PAGE_MASK];
+}
+
+/* Reads a word without touching the page cache */
+int
+APEX_memory_peek(const APEX_Memory *mem, unsigned address)
+{
+    const Memory_Page *page = find_page(mem, address >> MEMORY_PAGE_BITS);
+
+    return page ? page->words[address & MEMORY_PAGE_MASK] : 0;
+}
+
+/*
+ * The words of the first page at or after '*page', which is updated to its
+ * number. Returns NULL if there is none.
+ */
+const int *
+APEX_memory_next_page(const APEX_Memory *mem, unsigned *page)
+{
+    unsigned p = *page;
+
+    while (p < MEMORY_PAGES)
+    {
+        Memory_Page **table = mem->directory[p >> MEMORY_DIR_BITS];
+
+        if (!table)
+        {
+            /* Skip the whole table */
+            p = (p | MEMORY_DIR_MASK) + 1;
+            continue;
+        }
+        if (table[p & MEMORY_DIR_MASK])
+        {
+            *page = p;
+            return table[p & MEMORY_DIR_MASK]->words;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/*
+ * Counts the pages of 'mem' that 'other' does not share, the memory 'mem'
+ * holds on its own when both were forked from one run
+ */
+int
+APEX_memory_unshared(const APEX_Memory *mem, const APEX_Memory *other)
+{
+    int count = 0;
+    unsigned i;
+    unsigned j;
+
+    for (i = 0; i < MEMORY_DIR_SIZE; ++i)
+    {
+        Memory_Page **table = mem->directory[i];
+        Memory_Page **other_table = other ? other->directory[i] : NULL;
+
+        if (!table)
+        {
+            continue;
+        }
+        for (j = 0; j < MEMORY_DIR_SIZE; ++j)
+        {
+            count += table[j] && (!other_table || other_table[j] != table[j]);
+        }
+    }
+    return count;
+}
+
+/*
+ * Finds the first word at or after '*address' that differs between the two
+ * memories, a page missing from one reading as zeros. Returns FALSE if there
+ * is none, else updates '*address' to it.
+ */
+int
+APEX_memory_diff(const APEX_Memory *a, const APEX_Memory *b,
+                 unsigned *address)
+{
+    unsigned first = *address >> MEMORY_PAGE_BITS;
+    unsigned p = first;
+
+    while (p < MEMORY_PAGES)
+    {
+        unsigned page_a = p;
+        unsigned page_b = p;
+        const int *words_a = APEX_memory_next_page(a, &page_a);
+        const int *words_b = APEX_memory_next_page(b, &page_b);
+        unsigned i;
+
+        if (!words_a && !words_b)
+        {
+            return FALSE;
+        }
+
+        /* Compare the lower page against the other memory's same page */
+        p = !words_b || (words_a && page_a < page_b) ? page_a : page_b;
+        if (!words_a || page_a != p)
+        {
+            words_a = zero_page;
+        }
+        if (!words_b || page_b != p)
+        {
+            words_b = zero_page;
+        }
+
+        for (i = p == first ? *address & MEMORY_PAGE_MASK : 0;
+             i < MEMORY_PAGE_WORDS; ++i)
+        {
+            if (words_a[i] != words_b[i])
+            {
+                *address = p << MEMORY_PAGE_BITS | i;
+                return TRUE;
+            }
+        }
+        p++;
+    }
+    return FALSE;
+}
+
+void
+APEX_memory_print_stats(const APEX_Memory *mem)
+{
+    int hugetlb = 0;
+    int transparent = 0;
+    int c;
+
+    for (c = 0; c < mem->chunk_count; ++c)
+    {
+        hugetlb += mem->chunks[c]->hugetlb;
+        transparent += !mem->chunks[c]->hugetlb;
+    }
+
+    printf("----------\n%s\n----------\n", "DATA MEMORY");
+    printf("Address space    : %d bits, %u-word pages\n", mem->address_bits,
+           MEMORY_PAGE_WORDS);
+    printf("Pages            : %d (%lu KB), %d directory tables\n",
+           mem->pages,
+           (unsigned long)mem->pages * MEMORY_PAGE_WORDS * sizeof(int) / 1024,
+           mem->tables);
+    if (mem->huge_pages)
+    {
+        printf("Huge page chunks : %d reserved, %d transparent\n", hugetlb,
+               transparent);
+    }
+    else
+    {
+        printf("Huge page chunks : Disabled\n");
+    }
+    printf("Page walks       : %d\n", mem->walks);
+    if (mem->shared)
+    {
+        printf("Copy-on-write    : %d pages shared at fork, %d copied\n",
+               mem->shared, mem->copied);
+    }
+    printf("\n");
+}
+
+void
+APEX_memory_register_stats(const APEX_Memory *mem, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "address_bits", &mem->address_bits);
+    APEX_stats_counter(stats, "pages", &mem->pages);
+    APEX_stats_counter(stats, "tables", &mem->tables);
+    APEX_stats_counter(stats, "walks", &mem->walks);
+    APEX_stats_counter(stats, "shared", &mem->shared);
+    APEX_stats_counter(stats, "copied", &mem->copied);
+}
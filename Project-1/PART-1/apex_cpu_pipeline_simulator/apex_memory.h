@@ -0,0 +1,145 @@
+/*
+ * apex_memory.h
+ * Contains APEX paged data memory declarations
+ *
+ * Data memory is a sparse array of words covering a 32-bit address space.
+ * Addresses are split into a page number and a word within the page, and
+ * the page number into two directory indices. Directory tables and pages
+ * are allocated the first time they are written; reading a word of a page
+ * that does not exist returns zero without allocating it.
+ *
+ * Loads and stores go through a one-entry page cache holding the last page
+ * written or read, so an access to the same page as the one before is a
+ * compare and an index, as cheap as indexing a flat array. Only a miss walks
+ * the directory. With huge_pages=1 pages are carved out of 2MB chunks asked
+ * for from the kernel as huge pages, falling back to transparent huge pages
+ * and then to ordinary memory.
+ *
+ * APEX_memory_fork() gives a second memory the same contents without
+ * copying them: the two share every page, counting its holders, and the
+ * first write to a shared page copies it. Holders are counted atomically,
+ * so forks can run on different host threads. A memory must not be used
+ * by another thread while it is forked.
+ *
+ * With 'address_bits' below 32, addresses at or above 2^address_bits are out
+ * of range. The caller checks the range before the access, so the faulting
+ * instruction is known exactly.
+ */
+#ifndef _APEX_MEMORY_H_
+#define _APEX_MEMORY_H_
+
+#include <stddef.h>
+
+#include "apex_macros.h"
+#include "apex_stats.h"
+
+/* Words per page and entries per directory table, log2 */
+#define MEMORY_PAGE_BITS 10
+#define MEMORY_DIR_BITS 11
+
+#define MEMORY_PAGE_WORDS (1u << MEMORY_PAGE_BITS)
+#define MEMORY_PAGE_MASK (MEMORY_PAGE_WORDS - 1)
+#define MEMORY_DIR_SIZE (1u << MEMORY_DIR_BITS)
+
+/* Page numbers take the 22 bits above the word within the page */
+#define MEMORY_PAGES (MEMORY_DIR_SIZE * MEMORY_DIR_SIZE)
+
+/* Page number no address maps to, marks the page cache empty */
+#define MEMORY_NO_PAGE 0xffffffffu
+
+/* Bytes in a chunk of huge page backed memory */
+#define MEMORY_HUGE_SIZE (2u << 20)
+
+/* Format of a chunk of huge page backed memory pages are carved from */
+typedef struct Memory_Chunk
+{
+    char *base;
+    size_t used;                   /* Bytes handed out as pages */
+    int hugetlb;                   /* Reserved huge pages, not transparent */
+    int refs;                      /* Memories holding pages in the chunk */
+} Memory_Chunk;
+
+/* Format of a data memory page */
+typedef struct Memory_Page
+{
+    int refs;                      /* Memories holding the page */
+    int in_chunk;                  /* Carved from a Memory_Chunk */
+    int words[MEMORY_PAGE_WORDS];
+} Memory_Page;
+
+/* Model of the data memory */
+typedef struct APEX_Memory
+{
+    unsigned range_mask;           /* Bits set in out of range addresses */
+    int address_bits;
+    int huge_pages;                /* Back pages with huge pages */
+    Memory_Page **directory[MEMORY_DIR_SIZE]; /* Tables, NULL until used */
+
+    /* One-entry page cache, writes only hit a page no fork shares */
+    unsigned cached_page;
+    unsigned write_page;           /* cached_page, or MEMORY_NO_PAGE */
+    int *cached;                   /* Words of that page */
+
+    Memory_Chunk **chunks;         /* Chunks holding pages of this memory */
+    int chunk_count;
+    Memory_Chunk *carve;           /* Chunk new pages are carved from */
+
+    /* Statistics */
+    int pages;                     /* Pages held */
+    int tables;                    /* Directory tables allocated */
+    int walks;                     /* Page cache misses */
+    int shared;                    /* Pages shared with the memory forked */
+    int copied;                    /* Shared pages copied on a write */
+} APEX_Memory;
+
+int APEX_memory_init(APEX_Memory *mem, int address_bits, int huge_pages);
+void APEX_memory_free(APEX_Memory *mem);
+int APEX_memory_fork(APEX_Memory *fork, APEX_Memory *mem);
+int APEX_memory_read_walk(APEX_Memory *mem, unsigned address);
+int *APEX_memory_write_walk(APEX_Memory *mem, unsigned address);
+int APEX_memory_peek(const APEX_Memory *mem, unsigned address);
+const int *APEX_memory_next_page(const APEX_Memory *mem, unsigned *page);
+int APEX_memory_diff(const APEX_Memory *a, const APEX_Memory *b,
+                     unsigned *address);
+int APEX_memory_unshared(const APEX_Memory *mem, const APEX_Memory *other);
+void APEX_memory_print_stats(const APEX_Memory *mem);
+void APEX_memory_register_stats(const APEX_Memory *mem, APEX_Stats *stats);
+
+/* TRUE if 'address' is inside the address space */
+static inline int
+APEX_memory_in_range(const APEX_Memory *mem, unsigned address)
+{
+    return !(address & mem->range_mask);
+}
+
+static inline int
+APEX_memory_read(APEX_Memory *mem, unsigned address)
+{
+    if (address >> MEMORY_PAGE_BITS == mem->cached_page)
+    {
+        return mem->cached[address & MEMORY_PAGE_MASK];
+    }
+    return APEX_memory_read_walk(mem, address);
+}
+
+/* Returns FALSE if the page could not be allocated */
+static inline int
+APEX_memory_write(APEX_Memory *mem, unsigned address, int value)
+{
+    int *word;
+
+    if (address >> MEMORY_PAGE_BITS == mem->write_page)
+    {
+        mem->cached[address & MEMORY_PAGE_MASK] = value;
+        return TRUE;
+    }
+
+    word = APEX_memory_write_walk(mem, address);
+    if (!word)
+    {
+        return FALSE;
+    }
+    *word = value;
+    return TRUE;
+}
+#endif
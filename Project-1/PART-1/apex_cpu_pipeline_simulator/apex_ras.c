@@ -0,0 +1,184 @@
+/*
+ * apex_ras.c
+ * Contains APEX return address stack implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_ras.h"
+
+int
+APEX_ras_init(APEX_RAS *ras, int depth)
+{
+    memset(ras, 0, sizeof(APEX_RAS));
+
+    if (depth == 0)
+    {
+        return TRUE;
+    }
+
+    if (depth < 0)
+    {
+        return FALSE;
+    }
+
+    ras->entries = calloc(depth, sizeof(RAS_Entry));
+    if (!ras->entries)
+    {
+        return FALSE;
+    }
+
+    ras->depth = depth;
+    return TRUE;
+}
+
+void
+APEX_ras_free(APEX_RAS *ras)
+{
+    free(ras->entries);
+    ras->entries = NULL;
+}
+
+/* Makes 'dst' a copy of 'src' with entries of its own */
+int
+APEX_ras_copy(APEX_RAS *dst, const APEX_RAS *src)
+{
+    RAS_Entry *entries = NULL;
+
+    if (src->entries)
+    {
+        entries = malloc(src->depth * sizeof(RAS_Entry));
+        if (!entries)
+        {
+            return FALSE;
+        }
+        memcpy(entries, src->entries, src->depth * sizeof(RAS_Entry));
+    }
+
+    *dst = *src;
+    dst->entries = entries;
+    return TRUE;
+}
+
+/* TRUE if a JUMP through 'rs1' returns to the address on top of the stack */
+int
+APEX_ras_is_return(const APEX_RAS *ras, int rs1)
+{
+    if (ras->count == 0)
+    {
+        return FALSE;
+    }
+
+    return ras->entries[(ras->top + ras->depth - 1) % ras->depth].link_reg
+           == rs1;
+}
+
+void
+APEX_ras_push(APEX_RAS *ras, int return_address, int link_reg)
+{
+    if (!ras->entries)
+    {
+        return;
+    }
+
+    ras->pushes++;
+    ras->entries[ras->top].return_address = return_address;
+    ras->entries[ras->top].link_reg = link_reg;
+    ras->top = (ras->top + 1) % ras->depth;
+
+    if (ras->count < ras->depth)
+    {
+        ras->count++;
+    }
+    else
+    {
+        /* The oldest return address was just overwritten */
+        ras->overflows++;
+    }
+}
+
+/* Pops the predicted return address, the stack must not be empty */
+int
+APEX_ras_pop(APEX_RAS *ras)
+{
+    ras->pops++;
+    ras->top = (ras->top + ras->depth - 1) % ras->depth;
+    ras->count--;
+    return ras->entries[ras->top].return_address;
+}
+
+void
+APEX_ras_checkpoint(const APEX_RAS *ras, RAS_Checkpoint *checkpoint)
+{
+    checkpoint->top = ras->top;
+    checkpoint->count = ras->count;
+    if (ras->entries)
+    {
+        checkpoint->saved = ras->entries[ras->top];
+    }
+}
+
+void
+APEX_ras_restore(APEX_RAS *ras, const RAS_Checkpoint *checkpoint)
+{
+    if (!ras->entries)
+    {
+        return;
+    }
+
+    if (ras->top != checkpoint->top || ras->count != checkpoint->count)
+    {
+        ras->repairs++;
+    }
+
+    ras->top = checkpoint->top;
+    ras->count = checkpoint->count;
+    ras->entries[ras->top] = checkpoint->saved;
+}
+
+void
+APEX_ras_print_stats(const APEX_RAS *ras)
+{
+    int returns = ras->correct + ras->wrong;
+
+    printf("----------\n%s\n----------\n", "RETURN ADDRESS STACK");
+    if (!ras->entries)
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    printf("Depth            : %d\n", ras->depth);
+    printf("Pushes / Pops    : %d / %d\n", ras->pushes, ras->pops);
+    printf("Overflows        : %d\n", ras->overflows);
+    printf("Repairs          : %d\n", ras->repairs);
+    printf("Returns          : %d correct, %d wrong\n", ras->correct,
+           ras->wrong);
+    printf("Accuracy         : %.2f%%\n",
+           returns ? 100.0 * ras->correct / returns : 0.0);
+    printf("\n");
+}
+
+static double
+ras_accuracy(const void *owner)
+{
+    const APEX_RAS *ras = owner;
+    int returns = ras->correct + ras->wrong;
+
+    return returns ? (double)ras->correct / returns : 0.0;
+}
+
+void
+APEX_ras_register_stats(const APEX_RAS *ras, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "depth", &ras->depth);
+    APEX_stats_counter(stats, "pushes", &ras->pushes);
+    APEX_stats_counter(stats, "pops", &ras->pops);
+    APEX_stats_counter(stats, "overflows", &ras->overflows);
+    APEX_stats_counter(stats, "repairs", &ras->repairs);
+    APEX_stats_counter(stats, "correct", &ras->correct);
+    APEX_stats_counter(stats, "wrong", &ras->wrong);
+    APEX_stats_derived(stats, "accuracy", ras_accuracy, ras);
+}
@@ -0,0 +1,62 @@
+/*
+ * apex_ras.h
+ * Contains APEX return address stack declarations
+ *
+ * Fetch pushes the return address of every JALR together with its link
+ * register. A JUMP through the register on top of the stack is taken to be
+ * the matching return and pops its target. The stack is circular: calls
+ * nested deeper than its depth overwrite the oldest entries.
+ *
+ * Every fetched instruction carries a checkpoint of the stack as it left it.
+ * Only one younger instruction can be in flight when Execute redirects, so
+ * restoring the top, the count and the one entry a wrong path push could
+ * have overwritten undoes the wrong path exactly.
+ */
+#ifndef _APEX_RAS_H_
+#define _APEX_RAS_H_
+
+#include "apex_stats.h"
+
+/* Format of a return address stack entry */
+typedef struct RAS_Entry
+{
+    int return_address;
+    int link_reg;
+} RAS_Entry;
+
+/* State of the stack after an instruction was fetched */
+typedef struct RAS_Checkpoint
+{
+    int top;
+    int count;
+    RAS_Entry saved; /* Entry at top */
+} RAS_Checkpoint;
+
+/* Model of the return address stack, a depth of 0 disables it */
+typedef struct APEX_RAS
+{
+    RAS_Entry *entries;
+    int depth;
+    int top;   /* Slot of the next push */
+    int count; /* Valid entries below top */
+
+    /* Statistics */
+    int pushes;
+    int pops;
+    int overflows;
+    int repairs;
+    int correct;
+    int wrong;
+} APEX_RAS;
+
+int APEX_ras_init(APEX_RAS *ras, int depth);
+void APEX_ras_free(APEX_RAS *ras);
+int APEX_ras_copy(APEX_RAS *dst, const APEX_RAS *src);
+int APEX_ras_is_return(const APEX_RAS *ras, int rs1);
+void APEX_ras_push(APEX_RAS *ras, int return_address, int link_reg);
+int APEX_ras_pop(APEX_RAS *ras);
+void APEX_ras_checkpoint(const APEX_RAS *ras, RAS_Checkpoint *checkpoint);
+void APEX_ras_restore(APEX_RAS *ras, const RAS_Checkpoint *checkpoint);
+void APEX_ras_print_stats(const APEX_RAS *ras);
+void APEX_ras_register_stats(const APEX_RAS *ras, APEX_Stats *stats);
+#endif
@@ -0,0 +1,77 @@
+/*
+ * apex_stats.h
+ * Contains APEX statistics registry declarations
+ *
+ * Every subsystem registers its counters, histograms and derived metrics
+ * by name into a registry, which is then written as JSON or CSV. Entries
+ * point at the live counters, so a registry built once can be written at
+ * any time during the run and shows the values of that moment.
+ *
+ * Names are dotted paths: APEX_stats_enter() opens a section that prefixes
+ * the names registered until the matching APEX_stats_leave(), e.g.
+ * "thread1.ras.pushes".
+ */
+#ifndef _APEX_STATS_H_
+#define _APEX_STATS_H_
+
+#include <signal.h>
+#include <stdio.h>
+
+/* Kinds of entry */
+#define STAT_COUNTER 0x0           /* An int counter */
+#define STAT_REAL 0x1              /* A double */
+#define STAT_DERIVED 0x2           /* Computed from its owner when written */
+#define STAT_HISTOGRAM 0x3         /* An array of int buckets */
+
+/* Longest name of an entry, sections included */
+#define STAT_NAME_SIZE 96
+
+/* Deepest nesting of sections */
+#define STAT_DEPTH 4
+
+/* Format of a registry entry */
+typedef struct Stat_Entry
+{
+    char name[STAT_NAME_SIZE];
+    int kind;                      /* STAT_* */
+    const int *counter;            /* Counter or histogram buckets */
+    const double *real;
+    int buckets;
+    double (*derive)(const void *owner);
+    const void *owner;
+} Stat_Entry;
+
+/* Model of the registry */
+typedef struct APEX_Stats
+{
+    Stat_Entry *entries;
+    int count;
+    int size;                      /* Entries there is room for */
+    int failed;                    /* An entry did not fit in memory */
+
+    /* Section names are registered under */
+    char prefix[STAT_NAME_SIZE];
+    int depth;
+    int length[STAT_DEPTH];        /* Prefix length before each section */
+} APEX_Stats;
+
+/* Set by SIGUSR1, see APEX_stats_catch_signal() */
+extern volatile sig_atomic_t APEX_stats_pending;
+
+void APEX_stats_init(APEX_Stats *stats);
+void APEX_stats_free(APEX_Stats *stats);
+void APEX_stats_enter(APEX_Stats *stats, const char *section);
+void APEX_stats_leave(APEX_Stats *stats);
+void APEX_stats_counter(APEX_Stats *stats, const char *name,
+                        const int *counter);
+void APEX_stats_real(APEX_Stats *stats, const char *name, const double *real);
+void APEX_stats_derived(APEX_Stats *stats, const char *name,
+                        double (*derive)(const void *owner),
+                        const void *owner);
+void APEX_stats_histogram(APEX_Stats *stats, const char *name,
+                          const int *buckets, int count);
+void APEX_stats_write_json(const APEX_Stats *stats, FILE *fp);
+void APEX_stats_write_csv(const APEX_Stats *stats, FILE *fp);
+int APEX_stats_write(const APEX_Stats *stats, const char *path);
+void APEX_stats_catch_signal(void);
+#endif
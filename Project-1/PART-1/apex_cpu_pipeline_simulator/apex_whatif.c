@@ -0,0 +1,220 @@
+/*
+ * apex_whatif.c
+ * Contains APEX what-if fork implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_whatif.h"
+
+APEX_WhatIf *
+APEX_whatif_init(const char *filename, const APEX_Config *config)
+{
+    APEX_WhatIf *run = calloc(1, sizeof(APEX_WhatIf));
+    int i;
+
+    if (!run)
+    {
+        return NULL;
+    }
+
+    /* A fork per direction predictor the base does not use, and one as is */
+    for (i = 0; APEX_bpred_names[i]; ++i)
+    {
+        run->count += i != config->bpred;
+    }
+    run->count++;
+
+    run->forks = calloc(run->count, sizeof(WhatIf_Fork));
+    if (!run->forks)
+    {
+        free(run);
+        return NULL;
+    }
+
+    run->base = APEX_cpu_init(filename, config);
+    if (!run->base)
+    {
+        free(run->forks);
+        free(run);
+        return NULL;
+    }
+    run->base->quiet = TRUE;
+    run->base->single_step = FALSE;
+    return run;
+}
+
+void
+APEX_whatif_stop(APEX_WhatIf *run)
+{
+    int i;
+
+    for (i = 0; i < run->count; ++i)
+    {
+        if (run->forks[i].cpu)
+        {
+            APEX_cpu_stop(run->forks[i].cpu);
+        }
+    }
+    free(run->forks);
+    APEX_cpu_stop(run->base);
+    free(run);
+}
+
+/* Finishes the program on one fork */
+static void *
+fork_thread(void *arg)
+{
+    WhatIf_Fork *fork = arg;
+
+    while (fork->cpu->clock < WHATIF_MAX_CYCLES)
+    {
+        if (APEX_cpu_step(fork->cpu))
+        {
+            fork->finished = TRUE;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Forks the base, with the direction predictor 'bpred' unless it is -1 */
+static int
+add_fork(APEX_WhatIf *run, WhatIf_Fork *fork, int bpred)
+{
+    APEX_Config config = run->base->config;
+
+    if (bpred < 0)
+    {
+        snprintf(fork->name, sizeof(fork->name), "as is");
+    }
+    else
+    {
+        snprintf(fork->name, sizeof(fork->name), "bpred=%s",
+                 APEX_bpred_names[bpred]);
+        config.bpred = bpred;
+    }
+
+    fork->cpu = APEX_cpu_fork(run->base, &config);
+    if (!fork->cpu)
+    {
+        return FALSE;
+    }
+    fork->fork_clock = run->base->clock;
+    fork->fork_insns = run->base->insn_completed;
+    fork->fork_mispredictions = run->base->mispredictions;
+    return TRUE;
+}
+
+/*
+ * Runs the base to the fork point, then every fork to the end of the
+ * program. Returns FALSE if a step failed or a fork diverged or faulted.
+ */
+int
+APEX_whatif_run(APEX_WhatIf *run)
+{
+    int started = 0;
+    int status = TRUE;
+    int n = 0;
+    int i;
+
+    while (run->base->clock < run->base->config.whatif)
+    {
+        if (APEX_cpu_step(run->base))
+        {
+            fprintf(stderr, "APEX_Error: Program ended before the fork at cycle %d\n",
+                    run->base->config.whatif);
+            return FALSE;
+        }
+    }
+
+    if (!add_fork(run, &run->forks[n++], -1))
+    {
+        return FALSE;
+    }
+    for (i = 0; APEX_bpred_names[i]; ++i)
+    {
+        if (i != run->base->config.bpred && !add_fork(run, &run->forks[n++], i))
+        {
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < run->count; ++i)
+    {
+        if (pthread_create(&run->forks[i].thread, NULL, fork_thread,
+                           &run->forks[i]))
+        {
+            break;
+        }
+        started++;
+    }
+
+    /* Forks no thread was left for run here */
+    for (i = started; i < run->count; ++i)
+    {
+        fork_thread(&run->forks[i]);
+    }
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(run->forks[i].thread, NULL);
+    }
+
+    for (i = 0; i < run->count; ++i)
+    {
+        status &= !run->forks[i].cpu->diverged && !run->forks[i].cpu->faulted;
+    }
+    printf("APEX_CPU: What-if Forks Complete, forked at cycle = %d instructions = %d\n",
+           run->base->clock, run->base->insn_completed);
+    return status;
+}
+
+void
+APEX_whatif_print_stats(const APEX_WhatIf *run)
+{
+    int i;
+
+    printf("----------\n%s\n----------\n", "WHAT-IF FORKS");
+    printf("Forked at        : cycle %d, %d instructions retired\n",
+           run->base->clock, run->base->insn_completed);
+    for (i = 0; i < run->count; ++i)
+    {
+        const WhatIf_Fork *fork = &run->forks[i];
+        const APEX_CPU *cpu = fork->cpu;
+        int cycles;
+        int after;
+
+        if (!cpu)
+        {
+            continue;
+        }
+
+        /* A finished run ends on the cycle it stopped in */
+        cycles = fork->finished ? cpu->clock + 1 : cpu->clock;
+        after = cycles - fork->fork_clock;
+        printf("%-17s: %d cycles, %d instructions", fork->name, cycles,
+               cpu->insn_completed);
+        if (cpu->diverged)
+        {
+            printf(" (diverged)");
+        }
+        else if (cpu->faulted)
+        {
+            printf(" (memory fault)");
+        }
+        else if (!fork->finished)
+        {
+            printf(" (stopped)");
+        }
+        printf("\n");
+        printf("                   after the fork: %d cycles, IPC %.3f, "
+               "%d mispredictions, %d pages copied\n",
+               after,
+               after ? (double)(cpu->insn_completed - fork->fork_insns) / after
+                     : 0.0,
+               cpu->mispredictions - fork->fork_mispredictions,
+               cpu->data_memory.copied);
+    }
+    printf("\n");
+}
@@ -0,0 +1,47 @@
+/*
+ * apex_whatif.h
+ * Contains APEX what-if fork declarations
+ *
+ * A what-if run simulates the program for 'whatif' cycles, then forks the
+ * CPU once as it is and once per direction predictor. Every fork finishes
+ * the program on its own host thread from the same warm state: the same
+ * instructions in flight, the same caches of branch outcomes and the same
+ * data memory, which the forks share copy-on-write. A fork with a
+ * different predictor starts its predictor tables cold and keeps the rest.
+ * The base run stays at the fork point.
+ */
+#ifndef _APEX_WHATIF_H_
+#define _APEX_WHATIF_H_
+
+#include <pthread.h>
+
+#include "apex_cpu.h"
+
+/* Forks still running after this many cycles are stopped */
+#define WHATIF_MAX_CYCLES 10000000
+
+/* One fork of a what-if run */
+typedef struct WhatIf_Fork
+{
+    char name[24];
+    APEX_CPU *cpu;
+    pthread_t thread;
+    int finished;                  /* Ended at HALT, a divergence or a fault */
+    int fork_clock;                /* Clock and instructions at the fork */
+    int fork_insns;
+    int fork_mispredictions;
+} WhatIf_Fork;
+
+/* Model of a what-if run */
+typedef struct APEX_WhatIf
+{
+    APEX_CPU *base;                /* Run the forks branch off */
+    WhatIf_Fork *forks;
+    int count;
+} APEX_WhatIf;
+
+APEX_WhatIf *APEX_whatif_init(const char *filename, const APEX_Config *config);
+int APEX_whatif_run(APEX_WhatIf *run);
+void APEX_whatif_print_stats(const APEX_WhatIf *run);
+void APEX_whatif_stop(APEX_WhatIf *run);
+#endif
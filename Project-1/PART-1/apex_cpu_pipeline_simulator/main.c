@@ -9,43 +9,113 @@
 #include <stdlib.h>
 
 #include "apex_cpu.h"
+#include "apex_debug.h"
+#include "apex_stats.h"
+#include "apex_whatif.h"
 #include <string.h>
 int
 main(int argc, char const *argv[])
 {
     APEX_CPU *cpu;
+    APEX_Config config;
+    const char *args[4];
+    int nargs = 0;
+    int status = 0;
+    int i;
 
     fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
-    if (argc < 2)
+    /* Arguments of the form name=value configure the simulated machine,
+     * everything else is positional */
+    APEX_config_init(&config);
+    for (i = 1; i < argc; ++i)
     {
-        fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+        if (strchr(argv[i], '='))
+        {
+            if (!APEX_config_set(&config, argv[i]))
+            {
+                fprintf(stderr, "APEX_Error: Invalid option %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (nargs < 4)
+        {
+            args[nargs++] = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "APEX_Error: Invalid args\n");
+            exit(1);
+        }
+    }
+
+    if (nargs < 1)
+    {
+        fprintf(stderr, "APEX_Help: Usage %s <input_file>[,<input_file>...] [name=value ...]\n", argv[0]);
         exit(1);
     }
 
-    cpu = APEX_cpu_init(argv[1]);
+    /* With a statistics file, SIGUSR1 writes it during the run too */
+    if (config.stats[0])
+    {
+        APEX_stats_catch_signal();
+    }
+
+    /* What-if runs fork the CPU part way and finish every fork */
+    if (config.whatif)
+    {
+        APEX_WhatIf *run = APEX_whatif_init(args[0], &config);
+
+        if (!run)
+        {
+            fprintf(stderr, "APEX_Error: Unable to initialize what-if run\n");
+            exit(1);
+        }
+
+        status = !APEX_whatif_run(run);
+        APEX_whatif_print_stats(run);
+        APEX_whatif_stop(run);
+        return status;
+    }
+
+    cpu = APEX_cpu_init(args[0], &config);
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
-    if(argc==2){
+    if(nargs==1){
         APEX_cpu_run(cpu);
     }
 
-    else if(argc>2){
-        if( strcmp(argv[2], "simulate") == 0 && argc == 4){
-            int numCycles=atoi(argv[3]);
+    else if(nargs>1){
+        if( strcmp(args[1], "simulate") == 0 && nargs == 3){
+            int numCycles=atoi(args[2]);
             cpu->maxCycles=numCycles;
             cpu->single_step=0;
             APEX_cpu_run(cpu);
 
         }
-        else if (strcmp(argv[2], "single_step") == 0)
+        else if (strcmp(args[1], "single_step") == 0)
         {
             cpu->single_step = 1;
             APEX_cpu_run(cpu);
         }
+        else if (strcmp(args[1], "debug") == 0)
+        {
+            APEX_Debugger *dbg = APEX_debug_init(cpu);
+
+            if (!dbg)
+            {
+                fprintf(stderr, "APEX_Error: Unable to initialize debugger\n");
+                exit(1);
+            }
+            APEX_debug_run(dbg);
+
+            /* Going backwards replaces the CPU */
+            cpu = dbg->cpu;
+            APEX_debug_free(dbg);
+        }
         else{
             fprintf(stderr, "APEX_Error: Invalid args\n");
             exit(1);
@@ -53,6 +123,7 @@ main(int argc, char const *argv[])
     }
 
     
+    status = cpu->diverged || cpu->faulted;
     APEX_cpu_stop(cpu);
-    return 0;
+    return status;
 }
\ No newline at end of file
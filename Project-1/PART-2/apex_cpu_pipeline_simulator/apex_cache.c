@@ -0,0 +1,528 @@
+/*
+ * apex_cache.c
+ * Contains APEX cache model implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cache.h"
+#include "apex_coherence.h"
+#include "apex_macros.h"
+
+static int
+is_power_of_two(const int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+static int
+log2_int(int value)
+{
+    int bits = 0;
+
+    while (value > 1)
+    {
+        value >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+/*
+ * Tree pseudo-LRU: each set keeps assoc-1 bits, a bit points to the half
+ * of the subtree that should be replaced next.
+ */
+static void
+plru_touch(APEX_Cache *cache, int set, int way)
+{
+    unsigned int *bits = &cache->plru_bits[set];
+    int node = 0;
+    int level;
+
+    for (level = cache->config.assoc / 2; level > 0; level /= 2)
+    {
+        if (way & level)
+        {
+            *bits &= ~(1u << node);
+            node = 2 * node + 2;
+        }
+        else
+        {
+            *bits |= 1u << node;
+            node = 2 * node + 1;
+        }
+    }
+}
+
+static int
+plru_victim(const APEX_Cache *cache, int set)
+{
+    unsigned int bits = cache->plru_bits[set];
+    int node = 0;
+    int way = 0;
+    int level;
+
+    for (level = cache->config.assoc / 2; level > 0; level /= 2)
+    {
+        if (bits & (1u << node))
+        {
+            way |= level;
+            node = 2 * node + 2;
+        }
+        else
+        {
+            node = 2 * node + 1;
+        }
+    }
+    return way;
+}
+
+static int
+choose_victim(APEX_Cache *cache, int set)
+{
+    Cache_Line *ways = &cache->lines[set * cache->config.assoc];
+    int victim = 0;
+    int i;
+
+    /* Fill invalid ways first */
+    for (i = 0; i < cache->config.assoc; ++i)
+    {
+        if (!ways[i].valid)
+        {
+            return i;
+        }
+    }
+
+    switch (cache->config.replacement)
+    {
+        case CACHE_REPL_PLRU:
+        {
+            victim = plru_victim(cache, set);
+            break;
+        }
+
+        case CACHE_REPL_RANDOM:
+        {
+            cache->rand_state = cache->rand_state * 1103515245u + 12345u;
+            victim = (cache->rand_state >> 16) % cache->config.assoc;
+            break;
+        }
+
+        default:
+        {
+            for (i = 1; i < cache->config.assoc; ++i)
+            {
+                if (ways[i].last_use < ways[victim].last_use)
+                {
+                    victim = i;
+                }
+            }
+            break;
+        }
+    }
+
+    return victim;
+}
+
+static void
+touch(APEX_Cache *cache, int set, int way)
+{
+    cache->lines[set * cache->config.assoc + way].last_use = ++cache->stamp;
+    if (cache->config.replacement == CACHE_REPL_PLRU)
+    {
+        plru_touch(cache, set, way);
+    }
+}
+
+/* Replaces a line of 'set' with 'tag', returns the way it went into */
+static int
+fill(APEX_Cache *cache, int set, unsigned int tag, Cache_PC_Stats *pc_stats)
+{
+    Cache_Line *ways = &cache->lines[set * cache->config.assoc];
+    int way = choose_victim(cache, set);
+
+    if (ways[way].valid)
+    {
+        cache->evictions++;
+        if (pc_stats)
+        {
+            pc_stats->evictions++;
+        }
+        if (ways[way].dirty)
+        {
+            cache->writebacks++;
+        }
+        if (ways[way].prefetched)
+        {
+            cache->useless_prefetches++;
+        }
+    }
+
+    ways[way].valid = TRUE;
+    ways[way].tag = tag;
+    ways[way].dirty = FALSE;
+    ways[way].prefetched = FALSE;
+    ways[way].ready_cycle = 0;
+    touch(cache, set, way);
+
+    return way;
+}
+
+/*
+ * Sets up the cache from its configuration. A size of 0 leaves the cache
+ * disabled, every access then hits. Returns FALSE if the shape is invalid.
+ */
+int
+APEX_cache_init(APEX_Cache *cache, const char *name,
+                const Cache_Config *config, int pc_count)
+{
+    memset(cache, 0, sizeof(APEX_Cache));
+    cache->name = name;
+    cache->config = *config;
+
+    if (config->size == 0)
+    {
+        return TRUE;
+    }
+
+    if (!is_power_of_two(config->size) || !is_power_of_two(config->assoc)
+        || !is_power_of_two(config->line_size)
+        || config->assoc * config->line_size > config->size
+        || (config->replacement == CACHE_REPL_PLRU && config->assoc > 32)
+        || config->miss_latency < 0)
+    {
+        return FALSE;
+    }
+
+    cache->sets = config->size / (config->assoc * config->line_size);
+    cache->offset_bits = log2_int(config->line_size);
+    cache->index_bits = log2_int(cache->sets);
+    cache->rand_state = 1;
+
+    cache->lines = calloc(cache->sets * config->assoc, sizeof(Cache_Line));
+    cache->plru_bits = calloc(cache->sets, sizeof(unsigned int));
+    cache->pc_stats = calloc(pc_count > 0 ? pc_count : 1,
+                             sizeof(Cache_PC_Stats));
+    if (!cache->lines || !cache->plru_bits || !cache->pc_stats)
+    {
+        APEX_cache_free(cache);
+        return FALSE;
+    }
+    cache->pc_count = pc_count;
+
+    return TRUE;
+}
+
+void
+APEX_cache_free(APEX_Cache *cache)
+{
+    free(cache->lines);
+    free(cache->plru_bits);
+    free(cache->pc_stats);
+    cache->lines = NULL;
+    cache->plru_bits = NULL;
+    cache->pc_stats = NULL;
+}
+
+int
+APEX_cache_enabled(const APEX_Cache *cache)
+{
+    return cache->lines != NULL;
+}
+
+/* Counts a demand miss of the cache and of the accessing instruction */
+static void
+count_miss(APEX_Cache *cache, int is_write, Cache_PC_Stats *pc_stats)
+{
+    cache->misses++;
+    if (is_write)
+    {
+        cache->write_misses++;
+    }
+    else
+    {
+        cache->read_misses++;
+    }
+    if (pc_stats)
+    {
+        pc_stats->misses++;
+    }
+}
+
+/*
+ * Looks up 'address' and updates tags, replacement and dirty state.
+ * 'pc_index' is the code memory index of the accessing instruction, or -1,
+ * 'now' is the current cycle. Returns the extra cycles the access takes.
+ *
+ * Read misses and allocating write misses fetch the line and cost
+ * miss_latency. Non-allocating write misses, write-through traffic and
+ * dirty evictions go through a write buffer and cost nothing extra. An
+ * access to a prefetched line that has not arrived yet counts as a (late)
+ * miss and waits for the rest of it.
+ */
+int
+APEX_cache_access(APEX_Cache *cache, int address, int is_write, int pc_index,
+                  int now)
+{
+    int latency = 0;
+    int state;
+    unsigned int block;
+    unsigned int tag;
+    Cache_PC_Stats *pc_stats = NULL;
+    Cache_Line *ways;
+    int set;
+    int way;
+
+    if (!APEX_cache_enabled(cache))
+    {
+        return 0;
+    }
+
+    block = (unsigned int)address >> cache->offset_bits;
+    set = block & (cache->sets - 1);
+    tag = block >> cache->index_bits;
+    ways = &cache->lines[set * cache->config.assoc];
+
+    if (pc_index >= 0 && pc_index < cache->pc_count)
+    {
+        pc_stats = &cache->pc_stats[pc_index];
+    }
+
+    cache->accesses++;
+    if (is_write && cache->config.write_policy == CACHE_WRITE_THROUGH)
+    {
+        cache->write_throughs++;
+    }
+
+    for (way = 0; way < cache->config.assoc; ++way)
+    {
+        if (ways[way].valid && ways[way].tag == tag)
+        {
+            /* A prefetch still on its way is a miss that waits less */
+            int late = ways[way].prefetched && ways[way].ready_cycle > now;
+
+            if (late)
+            {
+                count_miss(cache, is_write, pc_stats);
+            }
+            else
+            {
+                cache->hits++;
+                if (pc_stats)
+                {
+                    pc_stats->hits++;
+                }
+            }
+            if (is_write && cache->config.write_policy == CACHE_WRITE_BACK)
+            {
+                ways[way].dirty = TRUE;
+            }
+            if (is_write && cache->coherence)
+            {
+                /* Exclusive lines are written silently, shared copies
+                 * elsewhere must be invalidated first */
+                if (ways[way].state == MESI_SHARED)
+                {
+                    latency += APEX_coherence_request(
+                        cache->coherence, cache, address, BUS_UPGRADE, now,
+                        &ways[way].state);
+                }
+                ways[way].state = MESI_MODIFIED;
+            }
+            if (ways[way].prefetched)
+            {
+                cache->useful_prefetches++;
+                ways[way].prefetched = FALSE;
+                if (late)
+                {
+                    cache->late_prefetches++;
+                    latency = ways[way].ready_cycle - now;
+                }
+            }
+            touch(cache, set, way);
+            return latency;
+        }
+    }
+
+    count_miss(cache, is_write, pc_stats);
+
+    state = is_write ? MESI_MODIFIED : MESI_EXCLUSIVE;
+    if (cache->coherence)
+    {
+        latency = APEX_coherence_request(
+            cache->coherence, cache, address,
+            is_write ? BUS_READ_EXCLUSIVE : BUS_READ, now, &state);
+    }
+
+    if (is_write && !cache->config.write_allocate)
+    {
+        if (cache->config.write_policy == CACHE_WRITE_BACK)
+        {
+            /* Without a line to hold it, the write goes to memory */
+            cache->write_throughs++;
+        }
+        return latency;
+    }
+
+    way = fill(cache, set, tag, pc_stats);
+    ways[way].dirty = is_write
+                      && cache->config.write_policy == CACHE_WRITE_BACK;
+    ways[way].state = state;
+
+    return cache->config.miss_latency + latency;
+}
+
+/*
+ * Brings the line holding 'address' into the cache without a demand
+ * access, the data arrives at 'ready_cycle'. Returns TRUE if a fill was
+ * issued, FALSE if the line was already present or the cache is disabled.
+ */
+int
+APEX_cache_prefetch(APEX_Cache *cache, int address, int ready_cycle)
+{
+    unsigned int block;
+    unsigned int tag;
+    Cache_Line *ways;
+    int set;
+    int way;
+
+    if (!APEX_cache_enabled(cache))
+    {
+        return FALSE;
+    }
+
+    block = (unsigned int)address >> cache->offset_bits;
+    set = block & (cache->sets - 1);
+    tag = block >> cache->index_bits;
+    ways = &cache->lines[set * cache->config.assoc];
+
+    for (way = 0; way < cache->config.assoc; ++way)
+    {
+        if (ways[way].valid && ways[way].tag == tag)
+        {
+            return FALSE;
+        }
+    }
+
+    way = fill(cache, set, tag, NULL);
+    ways[way].state = MESI_EXCLUSIVE;
+    if (cache->coherence)
+    {
+        /* The snoop latency hides behind the fill */
+        APEX_coherence_prefetch(cache->coherence, cache, address,
+                                ready_cycle - cache->config.miss_latency,
+                                &ways[way].state);
+    }
+    ways[way].prefetched = TRUE;
+    ways[way].ready_cycle = ready_cycle;
+    cache->prefetches++;
+
+    return TRUE;
+}
+
+/* Returns the valid line holding 'address' without touching replacement
+ * state or statistics, or NULL */
+Cache_Line *
+APEX_cache_lookup(APEX_Cache *cache, int address)
+{
+    unsigned int block;
+    unsigned int tag;
+    Cache_Line *ways;
+    int way;
+
+    if (!APEX_cache_enabled(cache))
+    {
+        return NULL;
+    }
+
+    block = (unsigned int)address >> cache->offset_bits;
+    tag = block >> cache->index_bits;
+    ways = &cache->lines[(block & (cache->sets - 1)) * cache->config.assoc];
+
+    for (way = 0; way < cache->config.assoc; ++way)
+    {
+        if (ways[way].valid && ways[way].tag == tag)
+        {
+            return &ways[way];
+        }
+    }
+    return NULL;
+}
+
+void
+APEX_cache_print_stats(const APEX_Cache *cache)
+{
+    static const char *repl_names[] = {"LRU", "PLRU", "Random"};
+    int i;
+
+    printf("----------\n%s\n----------\n", cache->name);
+    if (!APEX_cache_enabled(cache))
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    printf("Shape            : %d bytes, %d-way, %d byte lines, %d sets\n",
+           cache->config.size, cache->config.assoc, cache->config.line_size,
+           cache->sets);
+    printf("Policies         : %s, %s, %s, miss latency %d\n",
+           repl_names[cache->config.replacement],
+           cache->config.write_policy == CACHE_WRITE_THROUGH
+               ? "write-through" : "write-back",
+           cache->config.write_allocate ? "write-allocate"
+                                        : "no-write-allocate",
+           cache->config.miss_latency);
+    printf("Accesses         : %d\n", cache->accesses);
+    printf("Hits / Misses    : %d / %d (read %d, write %d)\n", cache->hits,
+           cache->misses, cache->read_misses, cache->write_misses);
+    printf("Evictions        : %d (dirty writebacks %d)\n", cache->evictions,
+           cache->writebacks);
+    printf("Write-throughs   : %d\n", cache->write_throughs);
+    if (cache->prefetches)
+    {
+        printf("Prefetches       : %d (useful %d, late %d, evicted unused %d)\n",
+               cache->prefetches, cache->useful_prefetches,
+               cache->late_prefetches, cache->useless_prefetches);
+    }
+
+    printf("%-9s %-9s %-9s %-9s\n", "pc", "hits", "misses", "evictions");
+    for (i = 0; i < cache->pc_count; ++i)
+    {
+        const Cache_PC_Stats *stats = &cache->pc_stats[i];
+
+        if (stats->hits || stats->misses)
+        {
+            printf("%-9d %-9d %-9d %-9d\n", 4000 + 4 * i, stats->hits,
+                   stats->misses, stats->evictions);
+        }
+    }
+    printf("\n");
+}
+
+static double
+miss_rate(const void *owner)
+{
+    const APEX_Cache *cache = owner;
+
+    return cache->accesses ? (double)cache->misses / cache->accesses : 0.0;
+}
+
+void
+APEX_cache_register_stats(const APEX_Cache *cache, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "size", &cache->config.size);
+    APEX_stats_counter(stats, "accesses", &cache->accesses);
+    APEX_stats_counter(stats, "hits", &cache->hits);
+    APEX_stats_counter(stats, "misses", &cache->misses);
+    APEX_stats_counter(stats, "read_misses", &cache->read_misses);
+    APEX_stats_counter(stats, "write_misses", &cache->write_misses);
+    APEX_stats_counter(stats, "evictions", &cache->evictions);
+    APEX_stats_counter(stats, "writebacks", &cache->writebacks);
+    APEX_stats_counter(stats, "write_throughs", &cache->write_throughs);
+    APEX_stats_counter(stats, "prefetches", &cache->prefetches);
+    APEX_stats_counter(stats, "useful_prefetches", &cache->useful_prefetches);
+    APEX_stats_counter(stats, "late_prefetches", &cache->late_prefetches);
+    APEX_stats_counter(stats, "useless_prefetches", &cache->useless_prefetches);
+    APEX_stats_derived(stats, "miss_rate", miss_rate, cache);
+}
@@ -0,0 +1,100 @@
+/*
+ * apex_cache.h
+ * Contains APEX cache model declarations
+ *
+ * The cache is a timing model only: it tracks tags, replacement and dirty
+ * state, while the values themselves stay in data memory. An access returns
+ * the number of extra cycles it takes, 0 on a hit.
+ *
+ * A cache attached to a coherence bus keeps a MESI state per line and asks
+ * the bus before it fills a line or writes a line it does not own.
+ */
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+
+#include "apex_stats.h"
+
+/* Replacement policies */
+#define CACHE_REPL_LRU 0x0
+#define CACHE_REPL_PLRU 0x1
+#define CACHE_REPL_RANDOM 0x2
+
+/* Write policies */
+#define CACHE_WRITE_BACK 0x0
+#define CACHE_WRITE_THROUGH 0x1
+
+/* Shape and policies of a cache, a size of 0 disables the cache */
+typedef struct Cache_Config
+{
+    int size;           /* Capacity in bytes */
+    int assoc;          /* Ways per set */
+    int line_size;      /* Bytes per line */
+    int replacement;    /* CACHE_REPL_* */
+    int write_policy;   /* CACHE_WRITE_* */
+    int write_allocate; /* Allocate a line on a write miss */
+    int miss_latency;   /* Extra cycles taken by a miss */
+} Cache_Config;
+
+/* Format of a cache line */
+typedef struct Cache_Line
+{
+    int valid;
+    int dirty;
+    unsigned int tag;
+    unsigned int last_use; /* Access stamp for LRU */
+    int prefetched;        /* Filled by a prefetch, not yet referenced */
+    int ready_cycle;       /* Cycle a prefetched line arrives */
+    int state;             /* MESI_* when on a coherence bus */
+} Cache_Line;
+
+/* Per instruction statistics, indexed by code memory index */
+typedef struct Cache_PC_Stats
+{
+    int hits;
+    int misses;
+    int evictions;
+} Cache_PC_Stats;
+
+/* Model of a set-associative cache */
+typedef struct APEX_Cache
+{
+    const char *name;
+    Cache_Config config;
+    int sets;
+    int offset_bits;
+    int index_bits;
+    Cache_Line *lines;        /* sets * assoc lines */
+    unsigned int *plru_bits;  /* One tree per set for PLRU */
+    unsigned int stamp;
+    unsigned int rand_state;
+    Cache_PC_Stats *pc_stats;
+    int pc_count;
+    struct APEX_Coherence *coherence; /* Snooping bus, or NULL */
+    int core;                         /* Index of the cache on the bus */
+
+    /* Statistics */
+    int accesses;
+    int hits;
+    int misses;
+    int read_misses;
+    int write_misses;
+    int evictions;
+    int writebacks;
+    int write_throughs;
+    int prefetches;
+    int useful_prefetches;
+    int useless_prefetches;
+    int late_prefetches;
+} APEX_Cache;
+
+int APEX_cache_init(APEX_Cache *cache, const char *name,
+                    const Cache_Config *config, int pc_count);
+void APEX_cache_free(APEX_Cache *cache);
+int APEX_cache_enabled(const APEX_Cache *cache);
+int APEX_cache_access(APEX_Cache *cache, int address, int is_write,
+                      int pc_index, int now);
+int APEX_cache_prefetch(APEX_Cache *cache, int address, int ready_cycle);
+Cache_Line *APEX_cache_lookup(APEX_Cache *cache, int address);
+void APEX_cache_print_stats(const APEX_Cache *cache);
+void APEX_cache_register_stats(const APEX_Cache *cache, APEX_Stats *stats);
+#endif
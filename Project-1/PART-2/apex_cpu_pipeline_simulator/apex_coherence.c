@@ -0,0 +1,422 @@
+/*
+ * apex_coherence.c
+ * Contains APEX snooping MESI coherence implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_coherence.h"
+#include "apex_macros.h"
+
+int
+APEX_coherence_init(APEX_Coherence *bus, int cores, int latency)
+{
+    memset(bus, 0, sizeof(APEX_Coherence));
+
+    if (cores < 1 || latency < 0)
+    {
+        return FALSE;
+    }
+
+    bus->caches = calloc(cores, sizeof(APEX_Cache *));
+    bus->queues = calloc(cores, sizeof(Coherence_Queue));
+    if (!bus->caches || !bus->queues)
+    {
+        APEX_coherence_free(bus);
+        return FALSE;
+    }
+
+    bus->cores = cores;
+    bus->latency = latency;
+    return TRUE;
+}
+
+void
+APEX_coherence_free(APEX_Coherence *bus)
+{
+    int i;
+
+    for (i = 0; bus->queues && i < bus->cores; ++i)
+    {
+        free(bus->queues[i].events);
+    }
+
+    free(bus->caches);
+    free(bus->queues);
+    free(bus->merged);
+    free(bus->victims);
+    bus->caches = NULL;
+    bus->queues = NULL;
+    bus->merged = NULL;
+    bus->victims = NULL;
+}
+
+/* Puts the data cache of 'core' on the bus */
+void
+APEX_coherence_attach(APEX_Coherence *bus, int core, APEX_Cache *cache)
+{
+    bus->caches[core] = cache;
+    cache->coherence = bus;
+    cache->core = core;
+}
+
+/* Remembers that an exchange invalidated 'line' of 'core' */
+static void
+add_victim(APEX_Coherence *bus, int core, int address, Cache_Line *line)
+{
+    Coherence_Victim *victim;
+
+    if (bus->victim_count == bus->victim_size)
+    {
+        int size = bus->victim_size ? 2 * bus->victim_size : 64;
+        Coherence_Victim *victims
+            = realloc(bus->victims, size * sizeof(Coherence_Victim));
+
+        if (!victims)
+        {
+            fprintf(stderr, "APEX_Error: Out of memory for bus requests\n");
+            exit(1);
+        }
+        bus->victims = victims;
+        bus->victim_size = size;
+    }
+
+    victim = &bus->victims[bus->victim_count++];
+    victim->core = core;
+    victim->block = (unsigned int)address >> bus->caches[core]->offset_bits;
+    victim->line = line;
+}
+
+/*
+ * Returns the line of 'core' holding 'address' that an earlier request of
+ * the current exchange invalidated, and forgets it, or NULL
+ */
+static Cache_Line *
+take_victim(APEX_Coherence *bus, int core, int address)
+{
+    unsigned int block
+        = (unsigned int)address >> bus->caches[core]->offset_bits;
+    int i;
+
+    for (i = 0; i < bus->victim_count; ++i)
+    {
+        if (bus->victims[i].core == core && bus->victims[i].block == block)
+        {
+            Cache_Line *line = bus->victims[i].line;
+
+            bus->victims[i] = bus->victims[--bus->victim_count];
+            return line;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Lets every cache but the one of 'core' snoop 'request' for the line
+ * holding 'address'. Sets '*shared' if another cache held the line and
+ * returns the latency of flushing a Modified copy.
+ */
+static int
+snoop(APEX_Coherence *bus, int core, int address, int request, int *shared)
+{
+    int latency = 0;
+    int i;
+
+    *shared = FALSE;
+    for (i = 0; i < bus->cores; ++i)
+    {
+        Cache_Line *line;
+
+        if (!bus->caches[i] || i == core)
+        {
+            continue;
+        }
+
+        line = APEX_cache_lookup(bus->caches[i], address);
+        if (!line)
+        {
+            continue;
+        }
+
+        bus->snoop_hits++;
+        *shared = TRUE;
+
+        /* The owner supplies its dirty copy before anyone else uses it */
+        if (line->state == MESI_MODIFIED)
+        {
+            bus->flushes++;
+            if (line->dirty)
+            {
+                bus->caches[i]->writebacks++;
+                line->dirty = FALSE;
+            }
+            latency = bus->latency;
+        }
+
+        if (request == BUS_READ)
+        {
+            if (line->state != MESI_SHARED)
+            {
+                bus->downgrades++;
+            }
+            line->state = MESI_SHARED;
+        }
+        else
+        {
+            bus->invalidations++;
+            line->valid = FALSE;
+            line->state = MESI_INVALID;
+            if (bus->deferred)
+            {
+                add_victim(bus, i, address, line);
+            }
+        }
+    }
+
+    return latency;
+}
+
+/*
+ * Broadcasts 'request' for the line holding 'address' from 'cache' at cycle
+ * 'now' and lets every other cache snoop it. Sets '*state' to the state the
+ * requester takes the line in and returns the extra cycles the request
+ * costs. A deferred bus only queues the request for the next exchange, and
+ * owes the requester its latency then unless the request is 'hidden'.
+ */
+static int
+request_line(APEX_Coherence *bus, const APEX_Cache *cache, int address,
+             int request, int now, int hidden, int *state)
+{
+    int latency = 0;
+    int shared = FALSE;
+
+    *state = request == BUS_READ ? MESI_EXCLUSIVE : MESI_MODIFIED;
+
+    if (bus->deferred)
+    {
+        Coherence_Queue *queue = &bus->queues[cache->core];
+
+        if (queue->count == queue->size)
+        {
+            int size = queue->size ? 2 * queue->size : 64;
+            Coherence_Event *events
+                = realloc(queue->events, size * sizeof(Coherence_Event));
+
+            if (!events)
+            {
+                fprintf(stderr, "APEX_Error: Out of memory for bus requests\n");
+                exit(1);
+            }
+            queue->events = events;
+            queue->size = size;
+        }
+
+        queue->events[queue->count].cycle = now;
+        queue->events[queue->count].core = cache->core;
+        queue->events[queue->count].seq = queue->count;
+        queue->events[queue->count].address = address;
+        queue->events[queue->count].request = request;
+        queue->events[queue->count].hidden = hidden;
+        queue->count++;
+
+        /* An upgrade does not depend on what the other caches hold */
+        return request == BUS_UPGRADE ? bus->latency : 0;
+    }
+
+    bus->requests[request]++;
+    latency = snoop(bus, cache->core, address, request, &shared);
+
+    if (request == BUS_UPGRADE)
+    {
+        latency = bus->latency;
+    }
+
+    if (request == BUS_READ && shared)
+    {
+        *state = MESI_SHARED;
+    }
+
+    if (!hidden)
+    {
+        bus->stall_cycles += latency;
+    }
+    return latency;
+}
+
+int
+APEX_coherence_request(APEX_Coherence *bus, const APEX_Cache *cache,
+                       int address, int request, int now, int *state)
+{
+    return request_line(bus, cache, address, request, now, FALSE, state);
+}
+
+/* Reads the line holding 'address' for a prefetch of 'cache' at cycle
+ * 'now'. The snoop latency hides behind the fill, so nobody pays it. */
+void
+APEX_coherence_prefetch(APEX_Coherence *bus, const APEX_Cache *cache,
+                        int address, int now, int *state)
+{
+    request_line(bus, cache, address, BUS_READ, now, TRUE, state);
+}
+
+static int
+compare_events(const void *a, const void *b)
+{
+    const Coherence_Event *x = a;
+    const Coherence_Event *y = b;
+
+    if (x->cycle != y->cycle)
+    {
+        return x->cycle - y->cycle;
+    }
+    if (x->core != y->core)
+    {
+        return x->core - y->core;
+    }
+    return x->seq - y->seq;
+}
+
+/*
+ * Snoops the requests queued by all cores since the last exchange in cycle
+ * order, ties going to the lower core. Flush latency is added to 'owed',
+ * indexed by core. Returns the number of requests exchanged.
+ */
+int
+APEX_coherence_exchange(APEX_Coherence *bus, int *owed)
+{
+    int count = 0;
+    int i;
+
+    for (i = 0; i < bus->cores; ++i)
+    {
+        count += bus->queues[i].count;
+    }
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    if (count > bus->merged_size)
+    {
+        Coherence_Event *merged
+            = realloc(bus->merged, count * sizeof(Coherence_Event));
+
+        if (!merged)
+        {
+            fprintf(stderr, "APEX_Error: Out of memory for bus requests\n");
+            exit(1);
+        }
+        bus->merged = merged;
+        bus->merged_size = count;
+    }
+
+    count = 0;
+    for (i = 0; i < bus->cores; ++i)
+    {
+        if (bus->queues[i].count)
+        {
+            memcpy(&bus->merged[count], bus->queues[i].events,
+                   bus->queues[i].count * sizeof(Coherence_Event));
+            count += bus->queues[i].count;
+            bus->queues[i].count = 0;
+        }
+    }
+    qsort(bus->merged, count, sizeof(Coherence_Event), compare_events);
+    bus->victim_count = 0;
+
+    for (i = 0; i < count; ++i)
+    {
+        const Coherence_Event *event = &bus->merged[i];
+        APEX_Cache *cache = bus->caches[event->core];
+        Cache_Line *reclaimed;
+        int request = event->request;
+        int shared;
+        int latency = 0;
+
+        /* An earlier request of this batch took the line away before the
+         * requester used it, so it is requested again. Without its Shared
+         * copy an upgrade misses and asks for the line exclusively, on top
+         * of the upgrade latency the core already paid. */
+        reclaimed = take_victim(bus, event->core, event->address);
+        if (reclaimed)
+        {
+            bus->reclaims++;
+            reclaimed->valid = TRUE;
+            if (request == BUS_UPGRADE)
+            {
+                request = BUS_READ_EXCLUSIVE;
+                latency = cache->config.miss_latency;
+            }
+        }
+
+        bus->requests[request]++;
+        latency += snoop(bus, event->core, event->address, request, &shared);
+
+        /* Like on a direct bus, an upgrade costs its latency and no more,
+         * and nobody waits for a prefetch */
+        if (request == BUS_UPGRADE || event->hidden)
+        {
+            latency = 0;
+        }
+
+        if (reclaimed)
+        {
+            reclaimed->state = request == BUS_READ
+                                   ? shared ? MESI_SHARED : MESI_EXCLUSIVE
+                                   : MESI_MODIFIED;
+        }
+        else if (request == BUS_READ && shared)
+        {
+            /* The requester took a read miss Exclusive without knowing */
+            Cache_Line *line = APEX_cache_lookup(cache, event->address);
+
+            if (line && line->state == MESI_EXCLUSIVE)
+            {
+                line->state = MESI_SHARED;
+            }
+        }
+
+        owed[event->core] += latency;
+        bus->stall_cycles += request == BUS_UPGRADE ? bus->latency : latency;
+    }
+
+    return count;
+}
+
+void
+APEX_coherence_print_stats(const APEX_Coherence *bus)
+{
+    printf("----------\n%s\n----------\n", "COHERENCE");
+    printf("Protocol         : MESI snooping, %d caches, latency %d\n",
+           bus->cores, bus->latency);
+    printf("Bus requests     : %d read, %d read-exclusive, %d upgrade\n",
+           bus->requests[BUS_READ], bus->requests[BUS_READ_EXCLUSIVE],
+           bus->requests[BUS_UPGRADE]);
+    printf("Snoop hits       : %d\n", bus->snoop_hits);
+    printf("Flushes          : %d\n", bus->flushes);
+    printf("Invalidations    : %d\n", bus->invalidations);
+    printf("Downgrades       : %d\n", bus->downgrades);
+    if (bus->deferred)
+    {
+        printf("Reclaimed lines  : %d\n", bus->reclaims);
+    }
+    printf("Stall cycles     : %d\n", bus->stall_cycles);
+    printf("\n");
+}
+
+void
+APEX_coherence_register_stats(const APEX_Coherence *bus, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "reads", &bus->requests[BUS_READ]);
+    APEX_stats_counter(stats, "read_exclusives",
+                       &bus->requests[BUS_READ_EXCLUSIVE]);
+    APEX_stats_counter(stats, "upgrades", &bus->requests[BUS_UPGRADE]);
+    APEX_stats_counter(stats, "snoop_hits", &bus->snoop_hits);
+    APEX_stats_counter(stats, "flushes", &bus->flushes);
+    APEX_stats_counter(stats, "invalidations", &bus->invalidations);
+    APEX_stats_counter(stats, "downgrades", &bus->downgrades);
+    APEX_stats_counter(stats, "reclaims", &bus->reclaims);
+    APEX_stats_counter(stats, "stall_cycles", &bus->stall_cycles);
+}
@@ -0,0 +1,104 @@
+/*
+ * apex_coherence.h
+ * Contains APEX snooping MESI coherence declarations
+ *
+ * The L1 data caches of all cores sit on one snooping bus in front of the
+ * shared data memory. Like the caches themselves the protocol models timing
+ * and line state only: values always live in the shared memory, so the
+ * cores see each other's stores as soon as they drain from the load/store
+ * queue.
+ *
+ * A cache that misses, or writes a line it only holds shared, puts a
+ * request on the bus. Every other cache snoops it: a Modified copy is
+ * flushed to memory, and exclusive requests invalidate all other copies.
+ * A flush makes the requester wait 'latency' extra cycles, and so does an
+ * upgrade of a Shared line.
+ *
+ * When the cores run on separate host threads the bus is deferred: a core
+ * only records its requests, taking read misses Exclusive, and the other
+ * caches snoop them at the next barrier in cycle order. Flush latency found
+ * then is owed to the requester and paid in the following quantum. A core
+ * may have used a line during the quantum after a request snooped earlier
+ * in the same batch invalidated it. Its own request then takes the line
+ * back: an upgrade becomes a read-exclusive, which also costs the miss it
+ * would have taken, and the line is valid in the requester's cache again.
+ */
+#ifndef _APEX_COHERENCE_H_
+#define _APEX_COHERENCE_H_
+
+#include "apex_cache.h"
+
+/* MESI states of a cache line */
+#define MESI_INVALID 0x0
+#define MESI_SHARED 0x1
+#define MESI_EXCLUSIVE 0x2
+#define MESI_MODIFIED 0x3
+
+/* Bus requests */
+#define BUS_READ 0x0           /* Read miss */
+#define BUS_READ_EXCLUSIVE 0x1 /* Write miss */
+#define BUS_UPGRADE 0x2        /* Write hit on a Shared line */
+
+/* Bus request recorded by a core in deferred mode */
+typedef struct Coherence_Event
+{
+    int cycle;
+    int core;
+    int seq;             /* Order of the request within the core */
+    int address;
+    int request;
+    int hidden;          /* Nobody waits for it, as for a prefetch */
+} Coherence_Event;
+
+/* Requests of one core waiting for the next barrier */
+typedef struct Coherence_Queue
+{
+    Coherence_Event *events;
+    int count;
+    int size;
+} Coherence_Queue;
+
+/* Line invalidated during an exchange, until its core requests it again */
+typedef struct Coherence_Victim
+{
+    int core;
+    unsigned int block;  /* Address >> offset bits of the core's cache */
+    Cache_Line *line;
+} Coherence_Victim;
+
+/* Model of the snooping bus shared by the L1 data caches */
+typedef struct APEX_Coherence
+{
+    APEX_Cache **caches; /* Indexed by core */
+    int cores;
+    int latency;         /* Extra cycles of a flush or an upgrade */
+    int deferred;        /* Record requests until APEX_coherence_exchange() */
+    Coherence_Queue *queues; /* Indexed by core */
+    Coherence_Event *merged;
+    int merged_size;
+    Coherence_Victim *victims; /* Invalidated during the current exchange */
+    int victim_count;
+    int victim_size;
+
+    /* Statistics */
+    int requests[3];     /* Indexed by BUS_* */
+    int snoop_hits;      /* Other caches holding the requested line */
+    int flushes;         /* Modified lines written back by a snoop */
+    int invalidations;
+    int downgrades;      /* Modified or Exclusive lines demoted to Shared */
+    int reclaims;        /* Lines taken back after an earlier invalidation */
+    int stall_cycles;
+} APEX_Coherence;
+
+int APEX_coherence_init(APEX_Coherence *bus, int cores, int latency);
+void APEX_coherence_free(APEX_Coherence *bus);
+void APEX_coherence_attach(APEX_Coherence *bus, int core, APEX_Cache *cache);
+int APEX_coherence_request(APEX_Coherence *bus, const APEX_Cache *cache,
+                           int address, int request, int now, int *state);
+void APEX_coherence_prefetch(APEX_Coherence *bus, const APEX_Cache *cache,
+                             int address, int now, int *state);
+int APEX_coherence_exchange(APEX_Coherence *bus, int *owed);
+void APEX_coherence_print_stats(const APEX_Coherence *bus);
+void APEX_coherence_register_stats(const APEX_Coherence *bus,
+                                   APEX_Stats *stats);
+#endif
@@ -6,11 +6,13 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "apex_cpu.h"
+#include "apex_check.h"
 #include "apex_macros.h"
 
 /* Converts the PC(4000 series) into array index for code memory
@@ -96,6 +98,14 @@ print_instruction(const CPU_Stage *stage)
     }
 }
 
+/* Returns TRUE for instructions that access data memory */
+static int
+is_memory_insn(const int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_LOADP
+           || opcode == OPCODE_STORE || opcode == OPCODE_STOREP;
+}
+
 static void 
 print_flags(const APEX_CPU *cpu)
 {
@@ -113,6 +123,10 @@ print_stage_content(const char *name, const CPU_Stage *stage)
 {
     printf("%-15s: pc(%d) ", name, stage->pc);
     print_instruction(stage);
+    if (stage->fused)
+    {
+        printf("+ %s,#%d ", stage->fused_opcode_str, stage->fused_imm);
+    }
     printf("\n");
 }
 
@@ -142,6 +156,94 @@ print_reg_file(const APEX_CPU *cpu)
     printf("\n");
 }
 
+static int
+is_conditional_branch(const int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ || opcode == OPCODE_BP
+           || opcode == OPCODE_BNP || opcode == OPCODE_BN
+           || opcode == OPCODE_BNN;
+}
+
+/*
+ * Macro-op fusion: when Fetch reads a flag producer whose next instruction,
+ * in the same i-cache line, is a conditional branch, both are read
+ * together. They travel through the pipeline as one operation, which sets
+ * the flags and resolves the branch in the same Execute cycle.
+ */
+static void
+fuse_with_branch(APEX_CPU *cpu)
+{
+    const APEX_Instruction *next;
+    int next_pc = cpu->fetch.pc + 4;
+
+    switch (cpu->fetch.opcode)
+    {
+        case OPCODE_CMP:
+        case OPCODE_CML:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+            break;
+
+        default:
+            return;
+    }
+
+    if (get_code_memory_index_from_pc(next_pc) >= cpu->code_memory_size)
+    {
+        return;
+    }
+
+    next = &cpu->code_memory[get_code_memory_index_from_pc(next_pc)];
+    if (!is_conditional_branch(next->opcode))
+    {
+        return;
+    }
+
+    if (APEX_cache_enabled(&cpu->icache)
+        && next_pc / cpu->config.icache.line_size
+               != cpu->fetch.pc / cpu->config.icache.line_size)
+    {
+        return;
+    }
+
+    /* The branch is the next fetch target, queued or not yet */
+    if (cpu->ftq_count && cpu->ftq[cpu->ftq_head] == next_pc)
+    {
+        cpu->ftq_head = (cpu->ftq_head + 1) % cpu->config.ftq_size;
+        cpu->ftq_count--;
+    }
+    else if (cpu->pc == next_pc)
+    {
+        cpu->pc += 4;
+    }
+    else
+    {
+        return;
+    }
+
+    cpu->fetch.fused = TRUE;
+    cpu->fetch.fused_pc = next_pc;
+    cpu->fetch.fused_opcode = next->opcode;
+    cpu->fetch.fused_imm = next->imm;
+    strcpy(cpu->fetch.fused_opcode_str, next->opcode_str);
+
+    switch (cpu->fetch.opcode)
+    {
+        case OPCODE_CMP:
+            cpu->fused_cmp++;
+            break;
+        case OPCODE_CML:
+            cpu->fused_cml++;
+            break;
+        case OPCODE_ADDL:
+            cpu->fused_addl++;
+            break;
+        case OPCODE_SUBL:
+            cpu->fused_subl++;
+            break;
+    }
+}
+
 /*
  * Fetch Stage of APEX Pipeline
  *
@@ -151,6 +253,8 @@ static void
 APEX_fetch(APEX_CPU *cpu)
 {
     APEX_Instruction *current_ins;
+    int latency;
+    int fetch_pc;
 
     if (cpu->fetch.has_insn)
     {
@@ -163,26 +267,101 @@ APEX_fetch(APEX_CPU *cpu)
             return;
         }
 
+        /* The next-PC logic queues one fetch target per cycle, running
+         * ahead of Fetch while it waits. There is no branch predictor, so
+         * it only follows the sequential path until a redirect */
+        if (cpu->ftq_count < cpu->config.ftq_size
+            && get_code_memory_index_from_pc(cpu->pc) < cpu->code_memory_size)
+        {
+            cpu->ftq[(cpu->ftq_head + cpu->ftq_count) % cpu->config.ftq_size]
+                = cpu->pc;
+            cpu->ftq_count++;
+            if (cpu->ftq_count > cpu->ftq_max)
+            {
+                cpu->ftq_max = cpu->ftq_count;
+            }
+
+            /* Sequential prefetch of the queued target's line */
+            if (cpu->config.seq_prefetch)
+            {
+                APEX_cache_prefetch(&cpu->icache, cpu->pc,
+                                    cpu->clock
+                                        + cpu->config.icache.miss_latency);
+            }
+
+            /* Update PC for next instruction */
+            cpu->pc += 4;
+        }
+
+        /* Back-pressure from a full instruction buffer */
+        if (cpu->ibuf_count == cpu->config.ibuf_size)
+        {
+            cpu->ibuf_full_cycles++;
+            return;
+        }
+
+        /* Wait for an instruction cache fill */
+        if (cpu->ftq_count == 0 || cpu->clock < cpu->icache_ready_cycle)
+        {
+            return;
+        }
+
+        fetch_pc = cpu->ftq[cpu->ftq_head];
+        latency = APEX_cache_access(&cpu->icache, fetch_pc, FALSE,
+                                    get_code_memory_index_from_pc(fetch_pc),
+                                    cpu->clock);
+        if (latency)
+        {
+            cpu->icache_ready_cycle = cpu->clock + latency;
+
+            /* The next line arrives together with the missing one */
+            if (cpu->config.icache_prefetch)
+            {
+                APEX_cache_prefetch(&cpu->icache,
+                                    fetch_pc + cpu->config.icache.line_size,
+                                    cpu->icache_ready_cycle);
+            }
+            return;
+        }
+
+        cpu->ftq_head = (cpu->ftq_head + 1) % cpu->config.ftq_size;
+        cpu->ftq_count--;
+
         /* Store current PC in fetch latch */
-        cpu->fetch.pc = cpu->pc;
+        cpu->fetch.pc = fetch_pc;
 
         /* Index into code memory using this pc and copy all instruction fields
          * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
+        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(fetch_pc)];
         strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
         cpu->fetch.opcode = current_ins->opcode;
         cpu->fetch.rd = current_ins->rd;
         cpu->fetch.rs1 = current_ins->rs1;
         cpu->fetch.rs2 = current_ins->rs2;
         cpu->fetch.imm = current_ins->imm;
-        
-        /* Update PC for next instruction */
-        cpu->pc += 4;
+        cpu->fetch.fused = FALSE;
+        cpu->fetch.taken = FALSE;
+
+        if (cpu->config.fusion)
+        {
+            fuse_with_branch(cpu);
+        }
 
-        /* Copy data from fetch latch to decode latch*/
-        cpu->decode = cpu->fetch;
+        /* Copy data from fetch latch to the instruction buffer, counting
+         * instructions fetched while the back end was holding Decode */
+        if (cpu->decode.has_insn)
+        {
+            cpu->runahead_fetches++;
+        }
+        cpu->ibuf[(cpu->ibuf_head + cpu->ibuf_count) % cpu->config.ibuf_size]
+            = cpu->fetch;
+        cpu->ibuf_count++;
+        if (cpu->ibuf_count > cpu->ibuf_max)
+        {
+            cpu->ibuf_max = cpu->ibuf_count;
+        }
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
             print_stage_content("Fetch", &cpu->fetch);
         }
@@ -195,6 +374,72 @@ APEX_fetch(APEX_CPU *cpu)
     }
 }
 
+/*
+ * Redirects the front end to 'pc'. Everything queued in the fetch target
+ * queue and the instruction buffer is on the wrong path and is dropped.
+ */
+static void
+redirect_front_end(APEX_CPU *cpu, int pc)
+{
+    cpu->squashed += cpu->ftq_count + cpu->ibuf_count;
+    cpu->ftq_count = 0;
+    cpu->ibuf_count = 0;
+    cpu->pc = pc;
+
+    /* Since we are using reverse callbacks for pipeline stages, 
+     * this will prevent the new instruction from being fetched in the current cycle*/
+    cpu->fetch_from_next_cycle = TRUE;
+
+    /* Make sure fetch stage is enabled to start fetching from new PC */
+    cpu->fetch.has_insn = TRUE;
+}
+
+/* Evaluates the condition of a conditional branch against the flags */
+static int
+branch_taken(const APEX_CPU *cpu, int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_BZ:
+            return cpu->zero_flag == TRUE;
+        case OPCODE_BNZ:
+            return cpu->zero_flag == FALSE;
+        case OPCODE_BP:
+            return cpu->p_flag == TRUE;
+        case OPCODE_BNP:
+            return cpu->p_flag == FALSE;
+        case OPCODE_BN:
+            return cpu->n_flag == TRUE;
+        case OPCODE_BNN:
+            return cpu->n_flag == FALSE;
+    }
+    return FALSE;
+}
+
+/*
+ * Resolves the conditional branch in Decode. Decode only issues into an
+ * empty Execute, and Execute runs earlier in the same cycle, so the flags
+ * of the closest older producer (CMP, CML or an ALU op) have just been
+ * forwarded from its Execute result. A taken branch sends Fetch to the
+ * PC-relative target one cycle sooner than Execute would.
+ */
+static void
+resolve_branch_in_decode(APEX_CPU *cpu)
+{
+    cpu->branches_decode++;
+    cpu->decode.branch_resolved = TRUE;
+
+    if (branch_taken(cpu, cpu->decode.opcode))
+    {
+        cpu->taken_decode++;
+        cpu->decode.taken = TRUE;
+
+        /* The fall-through instruction Fetch would read this cycle is the
+         * only one lost */
+        redirect_front_end(cpu, cpu->decode.pc + cpu->decode.imm);
+    }
+}
+
 /*
  * Decode Stage of APEX Pipeline
  *
@@ -209,8 +454,6 @@ static int forwardRs1(APEX_CPU * cpu){
         cpu->decode.rs1_value=cpu->memStageBuggerRegisterValue;
     }
     else if(cpu->register_waiting_flag[cpu->decode.rs1]){
-
-        cpu->fetch_from_next_cycle=TRUE;
         return 1;
     }
     else{
@@ -230,8 +473,6 @@ static int forwardRs2(APEX_CPU * cpu){
         cpu->decode.rs2_value=cpu->memStageBuggerRegisterValue;
     }
     else if(cpu->register_waiting_flag[cpu->decode.rs2]){
-
-        cpu->fetch_from_next_cycle=TRUE;
         return 1;
     }
     else{
@@ -264,8 +505,36 @@ static void
 APEX_decode(APEX_CPU *cpu)
 {
     int stall=0;
+
+    /* Take the next instruction from the instruction buffer once the
+     * previous one has been issued */
+    if (!cpu->decode.has_insn)
+    {
+        if (cpu->ibuf_count == 0)
+        {
+            cpu->frontend_starved++;
+            return;
+        }
+
+        cpu->decode = cpu->ibuf[cpu->ibuf_head];
+        cpu->ibuf_head = (cpu->ibuf_head + 1) % cpu->config.ibuf_size;
+        cpu->ibuf_count--;
+    }
+
     if (cpu->decode.has_insn)
     {
+        /* Execute is still holding its instruction because of back-pressure
+         * from the memory side, nothing can be issued this cycle */
+        if (cpu->execute.has_insn)
+        {
+            cpu->backpressure_stalls++;
+            if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+            {
+                print_stage_content("Decode/RF", &cpu->decode);
+            }
+            return;
+        }
+
         /* Read operands from register file based on the instruction type */
         switch (cpu->decode.opcode)
         {
@@ -308,7 +577,6 @@ APEX_decode(APEX_CPU *cpu)
                     else if(cpu->register_waiting_flag[cpu->decode.rd])
                     {
                         stall = 1;
-                        cpu->fetch_from_next_cycle = TRUE;
                         break;
                     }
                     else{
@@ -390,7 +658,6 @@ APEX_decode(APEX_CPU *cpu)
                 else if (cpu->register_waiting_flag[cpu->decode.rd])
                 {
                     stall=1;
-                    cpu->fetch_from_next_cycle = TRUE;
                     
                     break;
                 }
@@ -411,7 +678,6 @@ APEX_decode(APEX_CPU *cpu)
                 else if (cpu->register_waiting_flag[cpu->decode.rd]==1)
                 {
                     stall= 1;
-                    cpu->fetch_from_next_cycle = TRUE;
                     break;
                 }
                 else
@@ -438,7 +704,6 @@ APEX_decode(APEX_CPU *cpu)
                 if (cpu->register_waiting_flag[cpu->decode.rd]==1)
                     {
                         stall = 1;
-                        cpu->fetch_from_next_cycle = TRUE;
                         break;
                     }
                     else
@@ -456,7 +721,6 @@ APEX_decode(APEX_CPU *cpu)
             {
                 /* MOVC doesn't have register operands */
                 if( cpu->register_waiting_flag[cpu->decode.rd]==1){
-                    cpu->fetch_from_next_cycle=TRUE;
                     stall= 1;
                     break;
                 }
@@ -525,7 +789,6 @@ APEX_decode(APEX_CPU *cpu)
                 }
                 else if (cpu->register_waiting_flag[cpu->decode.rd]){
                     stall=1;
-                    cpu->fetch_from_next_cycle=TRUE;
                     break;
                 }
                 else{
@@ -538,6 +801,19 @@ APEX_decode(APEX_CPU *cpu)
 
                 break;
             }
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            case OPCODE_BP:
+            case OPCODE_BNP:
+            case OPCODE_BN:
+            case OPCODE_BNN:
+            {
+                if (cpu->config.early_branch)
+                {
+                    resolve_branch_in_decode(cpu);
+                }
+                break;
+            }
             case OPCODE_JUMP:
             {
                 // if (cpu->register_waiting_flag[cpu->decode.rs1] == 1)
@@ -565,7 +841,10 @@ APEX_decode(APEX_CPU *cpu)
             cpu->execute = cpu->decode;
             cpu->decode.has_insn = FALSE;
         }
-        if (ENABLE_DEBUG_MESSAGES)
+        else{
+            cpu->dependency_stalls++;
+        }
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
             print_stage_content("Decode/RF", &cpu->decode);
         }
@@ -582,6 +861,25 @@ APEX_execute(APEX_CPU *cpu)
 {
     if (cpu->execute.has_insn)
     {
+        /* Memory stage is still holding its instruction (data cache miss),
+         * or memory instructions wait here until the load/store queue has
+         * room */
+        if (cpu->memory.has_insn
+            || (is_memory_insn(cpu->execute.opcode)
+                && APEX_lsq_full(&cpu->lsq)))
+        {
+            if (!cpu->memory.has_insn)
+            {
+                cpu->lsq.full_stalls++;
+            }
+
+            if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+            {
+                print_stage_content("Execute", &cpu->execute);
+            }
+            return;
+        }
+
         /* Execute logic based on instruction type */
         switch (cpu->execute.opcode)
         {   
@@ -613,7 +911,7 @@ APEX_execute(APEX_CPU *cpu)
                 }
                 else if (cpu->execute.opcode==OPCODE_AND){
                     cpu->execute.result_buffer
-                        = cpu->execute.rs1_value && cpu->execute.imm; 
+                        = cpu->execute.rs1_value & cpu->execute.rs2_value;
                 }
                 else if (cpu->execute.opcode == OPCODE_XOR){
                     cpu->execute.result_buffer = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
@@ -659,119 +957,29 @@ APEX_execute(APEX_CPU *cpu)
             }
 
             case OPCODE_BZ:
-            {
-                if (cpu->zero_flag == TRUE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-            
             case OPCODE_BNZ:
-            {
-                if (cpu->zero_flag == FALSE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
             case OPCODE_BP:
-            {
-                if (cpu->p_flag == TRUE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-
             case OPCODE_BNP:
-            {
-                if (cpu->p_flag == FALSE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
             case OPCODE_BN:
+            case OPCODE_BNN:
             {
-                if (cpu->n_flag == TRUE)
+                /* Already redirected from Decode */
+                if (cpu->execute.branch_resolved)
                 {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
+                    break;
                 }
-                break;
-            }
 
-            case OPCODE_BNN:
-            {
-                if (cpu->n_flag == FALSE)
+                cpu->branches_execute++;
+                if (branch_taken(cpu, cpu->execute.opcode))
                 {
+                    cpu->taken_execute++;
+                    cpu->execute.taken = TRUE;
+
                     /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
+                    redirect_front_end(cpu, cpu->execute.pc + cpu->execute.imm);
 
                     /* Flush previous stages */
                     cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
                 }
                 break;
             }
@@ -801,22 +1009,20 @@ APEX_execute(APEX_CPU *cpu)
                 int program_counter = cpu->execute.rs1_value + cpu->execute.imm;
                 cpu->execute.jump_buffer = cpu->execute.pc + 4;
 
-                cpu->pc = program_counter;
                 cpu->executeStageBuggerRegisterValue=cpu->execute.jump_buffer;
                 cpu->executeStageBufferRegister=cpu->execute.rd;
-                cpu->fetch_from_next_cycle = TRUE;
+                redirect_front_end(cpu, program_counter);
+                cpu->execute.taken = TRUE;
                 cpu->decode.has_insn = FALSE;
-                cpu->fetch.has_insn = TRUE;
                 break;
             }
             
             case OPCODE_JUMP:
             {
-                cpu->pc = cpu->execute.rs1_value + cpu->execute.imm;
-                cpu->fetch_from_next_cycle = TRUE;
-                cpu->fetch.has_insn = TRUE;
+                redirect_front_end(cpu, cpu->execute.rs1_value + cpu->execute.imm);
+                cpu->execute.taken = TRUE;
                 cpu->decode.has_insn = FALSE;
-                
+
                 break;
             }
             
@@ -860,17 +1066,75 @@ APEX_execute(APEX_CPU *cpu)
         }
     }  
 
+        /* A fused branch resolves with the flags set just above */
+        if (cpu->execute.fused
+            && branch_taken(cpu, cpu->execute.fused_opcode))
+        {
+            cpu->fused_taken++;
+            redirect_front_end(cpu,
+                               cpu->execute.fused_pc + cpu->execute.fused_imm);
+            cpu->execute.taken = TRUE;
+
+            /* Flush previous stages */
+            cpu->decode.has_insn = FALSE;
+        }
+
+        /* Memory instructions enter the load/store queue in program order */
+        if (is_memory_insn(cpu->execute.opcode))
+        {
+            int is_store = cpu->execute.opcode == OPCODE_STORE
+                           || cpu->execute.opcode == OPCODE_STOREP;
+
+            cpu->execute.lsq_index = APEX_lsq_allocate(
+                &cpu->lsq, is_store, cpu->execute.pc,
+                cpu->execute.memory_address, cpu->execute.rs1_value);
+
+            /* Train the stride prefetcher as soon as the address is known */
+            APEX_prefetcher_access(&cpu->prefetcher, &cpu->dcache,
+                                   cpu->execute.pc,
+                                   cpu->execute.memory_address, cpu->clock);
+        }
+
         /* Copy data from execute latch to memory latch*/
         cpu->memory = cpu->execute;
         cpu->execute.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
             print_stage_content("Execute", &cpu->execute);
         }
     }
 }
 
+/* Keeps a drained store for the next barrier when the core runs on its
+ * own host thread, see APEX_System */
+static void
+log_store(APEX_CPU *cpu, const LSQ_Entry *store)
+{
+    if (!cpu->write_log)
+    {
+        return;
+    }
+
+    if (cpu->write_log_count == cpu->write_log_size)
+    {
+        Memory_Write *log = realloc(cpu->write_log, 2 * cpu->write_log_size
+                                                       * sizeof(Memory_Write));
+
+        if (!log)
+        {
+            fprintf(stderr, "APEX_Error: Out of memory for the write log\n");
+            exit(1);
+        }
+        cpu->write_log = log;
+        cpu->write_log_size *= 2;
+    }
+
+    cpu->write_log[cpu->write_log_count].address = store->address;
+    cpu->write_log[cpu->write_log_count].value = store->data;
+    cpu->write_log_count++;
+}
+
 /*
  * Memory Stage of APEX Pipeline
  *
@@ -879,6 +1143,17 @@ APEX_execute(APEX_CPU *cpu)
 static void
 APEX_memory(APEX_CPU *cpu)
 {
+    int port_busy = FALSE;
+    int stalled = FALSE;
+    int forwarded = FALSE;
+
+    /* An outstanding data cache miss keeps the memory port busy */
+    if (cpu->dcache_busy_cycles > 0)
+    {
+        cpu->dcache_busy_cycles--;
+        port_busy = TRUE;
+    }
+
     if (cpu->memory.has_insn)
     {
         switch (cpu->memory.opcode)
@@ -904,18 +1179,55 @@ APEX_memory(APEX_CPU *cpu)
             case OPCODE_LOAD:
             case OPCODE_LOADP:
             {
-                /* Read from data memory */
+                if (port_busy)
+                {
+                    /* Waiting for the port, or for this load's own miss */
+                    stalled = TRUE;
+                    cpu->memStageBufferRegister = -1;
+                    break;
+                }
 
-                cpu->memory.result_buffer
-                    = cpu->data_memory[cpu->memory.memory_address];
-                cpu->memStageBufferRegister = cpu->memory.rd;
-                cpu->memStageBuggerRegisterValue = cpu->memory.result_buffer;
-                break;
-            }
-            case OPCODE_STORE:
-            case OPCODE_STOREP:
+                /* Take the value from an older store in the load/store queue
+                 * if there is one, otherwise read through the data cache */
+                if (!cpu->memory.mem_pending)
+                {
+                    forwarded = APEX_lsq_load(&cpu->lsq, cpu->memory.lsq_index,
+                                              &cpu->memory.result_buffer)
+                                == LSQ_LOAD_FORWARDED;
+                    if (cpu->trace)
+                    {
+                        APEX_trace_put(cpu->trace, cpu->clock, cpu->memory.pc,
+                                       cpu->memory.memory_address,
+                                       forwarded ? TRACE_FORWARDED : 0, 4);
+                    }
+                }
+                if (!cpu->memory.mem_pending && !forwarded)
+                {
+                    cpu->memory.result_buffer
+                        = cpu->data_memory[cpu->memory.memory_address];
+                    port_busy = TRUE;
+
+                    cpu->dcache_busy_cycles = APEX_cache_access(
+                        &cpu->dcache, cpu->memory.memory_address, FALSE,
+                        get_code_memory_index_from_pc(cpu->memory.pc),
+                        cpu->clock);
+                    if (cpu->dcache_busy_cycles)
+                    {
+                        cpu->memory.mem_pending = TRUE;
+                        stalled = TRUE;
+                        cpu->memStageBufferRegister = -1;
+                        break;
+                    }
+                }
+                cpu->memory.mem_pending = FALSE;
+                cpu->memStageBufferRegister = cpu->memory.rd;
+                cpu->memStageBuggerRegisterValue = cpu->memory.result_buffer;
+                break;
+            }
+            case OPCODE_STORE:
+            case OPCODE_STOREP:
             {
-                cpu->data_memory[cpu->memory.memory_address] = cpu->memory.rs1_value;
+                /* Store data waits in the load/store queue until retirement */
                 cpu->memStageBufferRegister = cpu->memory.rd;
                 cpu->memStageBuggerRegisterValue = cpu->memory.result_buffer;
                 break;
@@ -924,14 +1236,64 @@ APEX_memory(APEX_CPU *cpu)
         }
 
         /* Copy data from memory latch to writeback latch*/
-        cpu->writeback = cpu->memory;
-        cpu->memory.has_insn = FALSE;
+        if (!stalled)
+        {
+            cpu->writeback = cpu->memory;
+            cpu->memory.has_insn = FALSE;
+        }
+        else
+        {
+            cpu->memory_stalls++;
+        }
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
             print_stage_content("Memory", &cpu->memory);
         }
     }
+
+    /* Retired stores use the memory port when no load needs it */
+    if (!port_busy)
+    {
+        const LSQ_Entry *store = APEX_lsq_drain(&cpu->lsq, cpu->data_memory);
+
+        if (store)
+        {
+            log_store(cpu, store);
+            if (cpu->trace)
+            {
+                APEX_trace_put(cpu->trace, cpu->clock, store->pc,
+                               store->address, TRACE_STORE, 4);
+            }
+            cpu->dcache_busy_cycles = APEX_cache_access(
+                &cpu->dcache, store->address, TRUE,
+                get_code_memory_index_from_pc(store->pc), cpu->clock);
+        }
+    }
+}
+
+/*
+ * Puts the instruction retiring from 'stage' in the instruction trace. A
+ * fused pair goes in as its two instructions, the branch taking the
+ * outcome, so the trace is the same with and without fusion.
+ */
+static void
+trace_retired(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int memory = is_memory_insn(stage->opcode);
+
+    APEX_trace_put_insn(cpu->itrace, cpu->clock, stage->pc, stage->opcode,
+                        stage->rd, stage->rs1, stage->rs2,
+                        memory ? stage->memory_address : 0,
+                        (memory ? TRACE_ADDRESS : 0)
+                            | (stage->taken && !stage->fused ? TRACE_TAKEN
+                                                             : 0));
+    if (stage->fused)
+    {
+        APEX_trace_put_insn(cpu->itrace, cpu->clock, stage->fused_pc,
+                            stage->fused_opcode, -1, -1, -1, 0,
+                            stage->taken ? TRACE_TAKEN : 0);
+    }
 }
 
 /*
@@ -994,10 +1356,38 @@ APEX_writeback(APEX_CPU *cpu)
             {             
                 cpu->regs[cpu->writeback.rs2] = cpu->writeback.aux_buffer;
                 cpu->register_waiting_flag[cpu->writeback.rs2] = 0;
+                APEX_lsq_commit(&cpu->lsq, cpu->writeback.lsq_index);
+                break;
+            }
+            case OPCODE_STORE:
+            {
+                APEX_lsq_commit(&cpu->lsq, cpu->writeback.lsq_index);
                 break;
             }
-            case OPCODE_NOP:
             case OPCODE_HALT:
+            {
+                /* Make all retired stores visible before stopping */
+                if (cpu->write_log)
+                {
+                    while (cpu->lsq.count
+                           && cpu->lsq.entries[cpu->lsq.head].performed)
+                    {
+                        const LSQ_Entry *store
+                            = APEX_lsq_drain(&cpu->lsq, cpu->data_memory);
+
+                        if (store)
+                        {
+                            log_store(cpu, store);
+                        }
+                    }
+                }
+                else
+                {
+                    APEX_lsq_drain_all(&cpu->lsq, cpu->data_memory);
+                }
+                break;
+            }
+            case OPCODE_NOP:
             case OPCODE_BNN:
             case OPCODE_BNP:
             case OPCODE_BN:
@@ -1010,14 +1400,26 @@ APEX_writeback(APEX_CPU *cpu)
             }
         }
 
-        cpu->insn_completed++;
+        cpu->insn_completed += cpu->writeback.fused ? 2 : 1;
         cpu->writeback.has_insn = FALSE;
+        if (cpu->itrace)
+        {
+            trace_retired(cpu, &cpu->writeback);
+        }
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
         {
             print_stage_content("Writeback", &cpu->writeback);
         }
 
+        /* Stop at the first retirement the functional model disagrees
+         * with */
+        if (cpu->checker && !APEX_check_retire(cpu->checker, cpu))
+        {
+            cpu->diverged = TRUE;
+            return TRUE;
+        }
+
         if (cpu->writeback.opcode == OPCODE_HALT)
         {
             /* Stop the APEX simulator */
@@ -1029,43 +1431,360 @@ APEX_writeback(APEX_CPU *cpu)
     return 0;
 }
 
+/* Run-time options accepted by APEX_config_set() as "name=value".
+ * Options with a name list take one of the names, or its index. */
+typedef struct APEX_Option
+{
+    const char *name;
+    size_t offset;
+    int min;
+    const char *const *names;
+} APEX_Option;
+
+/* Options naming a file rather than a number, STATS_PATH_SIZE chars */
+typedef struct APEX_Path_Option
+{
+    const char *name;
+    size_t offset;
+} APEX_Path_Option;
+
+static const char *const replacement_names[] = {"lru", "plru", "random", NULL};
+static const char *const write_policy_names[] = {"wb", "wt", NULL};
+
+static const APEX_Option apex_options[] = {
+    {"lsq_size", offsetof(APEX_Config, lsq_size), 1, NULL},
+    {"dcache_size", offsetof(APEX_Config, dcache.size), 0, NULL},
+    {"dcache_assoc", offsetof(APEX_Config, dcache.assoc), 1, NULL},
+    {"dcache_line", offsetof(APEX_Config, dcache.line_size), 1, NULL},
+    {"dcache_repl", offsetof(APEX_Config, dcache.replacement), 0,
+     replacement_names},
+    {"dcache_write", offsetof(APEX_Config, dcache.write_policy), 0,
+     write_policy_names},
+    {"dcache_alloc", offsetof(APEX_Config, dcache.write_allocate), 0, NULL},
+    {"dcache_latency", offsetof(APEX_Config, dcache.miss_latency), 0, NULL},
+    {"icache_size", offsetof(APEX_Config, icache.size), 0, NULL},
+    {"icache_assoc", offsetof(APEX_Config, icache.assoc), 1, NULL},
+    {"icache_line", offsetof(APEX_Config, icache.line_size), 1, NULL},
+    {"icache_repl", offsetof(APEX_Config, icache.replacement), 0,
+     replacement_names},
+    {"icache_latency", offsetof(APEX_Config, icache.miss_latency), 0, NULL},
+    {"icache_prefetch", offsetof(APEX_Config, icache_prefetch), 0, NULL},
+    {"prefetch_table", offsetof(APEX_Config, prefetch_table_size), 0, NULL},
+    {"prefetch_degree", offsetof(APEX_Config, prefetch_degree), 1, NULL},
+    {"prefetch_distance", offsetof(APEX_Config, prefetch_distance), 1, NULL},
+    {"early_branch", offsetof(APEX_Config, early_branch), 0, NULL},
+    {"ftq_size", offsetof(APEX_Config, ftq_size), 1, NULL},
+    {"ibuf_size", offsetof(APEX_Config, ibuf_size), 1, NULL},
+    {"seq_prefetch", offsetof(APEX_Config, seq_prefetch), 0, NULL},
+    {"fusion", offsetof(APEX_Config, fusion), 0, NULL},
+    {"cores", offsetof(APEX_Config, cores), 1, NULL},
+    {"coherence_latency", offsetof(APEX_Config, coherence_latency), 0, NULL},
+    {"parallel", offsetof(APEX_Config, parallel), 0, NULL},
+    {"quantum", offsetof(APEX_Config, quantum), 1, NULL},
+    {"parallel_verify", offsetof(APEX_Config, parallel_verify), 0, NULL},
+    {"check", offsetof(APEX_Config, check), 0, NULL},
+    {"sample", offsetof(APEX_Config, sample_interval), 0, NULL},
+    {"sample_phases", offsetof(APEX_Config, sample_phases), 1, NULL},
+    {"sample_warmup", offsetof(APEX_Config, sample_warmup), 0, NULL},
+    {"sample_verify", offsetof(APEX_Config, sample_verify), 0, NULL},
+    {"interval", offsetof(APEX_Config, interval_size), 0, NULL},
+    {"interval_warmup", offsetof(APEX_Config, interval_warmup), 0, NULL},
+    {"interval_threads", offsetof(APEX_Config, interval_threads), 1, NULL},
+    {"interval_verify", offsetof(APEX_Config, interval_verify), 0, NULL},
+};
+
+static const APEX_Path_Option apex_path_options[] = {
+    {"stats", offsetof(APEX_Config, stats)},
+    {"trace", offsetof(APEX_Config, trace)},
+    {"itrace", offsetof(APEX_Config, itrace)},
+};
+
+/* Fills in the default configuration from apex_macros.h */
+void
+APEX_config_init(APEX_Config *config)
+{
+    memset(config, 0, sizeof(APEX_Config));
+    config->lsq_size = LSQ_SIZE;
+
+    config->dcache.size = DCACHE_SIZE;
+    config->dcache.assoc = DCACHE_ASSOC;
+    config->dcache.line_size = DCACHE_LINE_SIZE;
+    config->dcache.replacement = DCACHE_REPLACEMENT;
+    config->dcache.write_policy = DCACHE_WRITE_POLICY;
+    config->dcache.write_allocate = DCACHE_WRITE_ALLOCATE;
+    config->dcache.miss_latency = DCACHE_MISS_LATENCY;
+
+    config->icache.size = ICACHE_SIZE;
+    config->icache.assoc = ICACHE_ASSOC;
+    config->icache.line_size = ICACHE_LINE_SIZE;
+    config->icache.replacement = ICACHE_REPLACEMENT;
+    config->icache.miss_latency = ICACHE_MISS_LATENCY;
+    config->icache_prefetch = ICACHE_NEXT_LINE_PREFETCH;
+
+    config->prefetch_table_size = PREFETCH_TABLE_SIZE;
+    config->prefetch_degree = PREFETCH_DEGREE;
+    config->prefetch_distance = PREFETCH_DISTANCE;
+
+    config->early_branch = EARLY_BRANCH_RESOLUTION;
+
+    config->ftq_size = FTQ_SIZE;
+    config->ibuf_size = IBUF_SIZE;
+    config->seq_prefetch = SEQ_PREFETCH;
+    config->fusion = MACRO_OP_FUSION;
+    config->cores = CORES;
+    config->coherence_latency = COHERENCE_LATENCY;
+    config->parallel = PARALLEL;
+    config->quantum = QUANTUM;
+    config->parallel_verify = PARALLEL_VERIFY;
+    config->check = LOCKSTEP_CHECK;
+    config->sample_interval = SAMPLE_INTERVAL;
+    config->sample_phases = SAMPLE_PHASES;
+    config->sample_warmup = SAMPLE_WARMUP;
+    config->sample_verify = SAMPLE_VERIFY;
+    config->interval_size = INTERVAL_SIZE;
+    config->interval_warmup = INTERVAL_WARMUP;
+    config->interval_threads = INTERVAL_THREADS;
+    config->interval_verify = INTERVAL_VERIFY;
+}
+
 /*
- * This function creates and initializes APEX cpu.
- *
- * Note: You are free to edit this function according to your implementation
+ * Applies one "name=value" option to the configuration.
+ * Returns FALSE if the option is unknown or the value is out of range.
  */
-APEX_CPU *
-APEX_cpu_init(const char *filename)
+int
+APEX_config_set(APEX_Config *config, const char *option)
 {
-    int i;
-    APEX_CPU *cpu;
+    const char *value = strchr(option, '=');
+    size_t i;
 
-    if (!filename)
+    if (!value)
     {
-        return NULL;
+        return FALSE;
+    }
+
+    for (i = 0; i < sizeof(apex_path_options) / sizeof(apex_path_options[0]);
+         ++i)
+    {
+        const APEX_Path_Option *opt = &apex_path_options[i];
+
+        if (strlen(opt->name) != (size_t)(value - option)
+            || strncmp(opt->name, option, value - option) != 0)
+        {
+            continue;
+        }
+
+        if (!value[1] || strlen(value + 1) >= STATS_PATH_SIZE)
+        {
+            return FALSE;
+        }
+        strcpy((char *)config + opt->offset, value + 1);
+        return TRUE;
     }
 
-    cpu = calloc(1, sizeof(APEX_CPU));
+    for (i = 0; i < sizeof(apex_options) / sizeof(apex_options[0]); ++i)
+    {
+        const APEX_Option *opt = &apex_options[i];
+        char *end;
+        long num;
+        int max = 0x7fffffff;
+
+        if (strlen(opt->name) != (size_t)(value - option)
+            || strncmp(opt->name, option, value - option) != 0)
+        {
+            continue;
+        }
+
+        if (opt->names)
+        {
+            for (max = 0; opt->names[max]; ++max)
+            {
+                if (strcmp(opt->names[max], value + 1) == 0)
+                {
+                    *(int *)((char *)config + opt->offset) = max;
+                    return TRUE;
+                }
+            }
+            max--;
+        }
+
+        num = strtol(value + 1, &end, 0);
+        if (end == value + 1 || *end != '\0' || num < opt->min || num > max)
+        {
+            return FALSE;
+        }
+
+        *(int *)((char *)config + opt->offset) = (int)num;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Registers every option, symbolic ones by the index of their value */
+void
+APEX_config_register_stats(const APEX_Config *config, APEX_Stats *stats)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(apex_options) / sizeof(apex_options[0]); ++i)
+    {
+        APEX_stats_counter(stats, apex_options[i].name,
+                           (const int *)((const char *)config
+                                         + apex_options[i].offset));
+    }
+}
+
+/*
+ * Creates a CPU around 'code_memory', which it takes over, and the given
+ * configuration. Frees the code memory on failure.
+ */
+static APEX_CPU *
+create_cpu(APEX_Instruction *code_memory, int code_memory_size,
+           const APEX_Config *config)
+{
+    APEX_CPU *cpu = calloc(1, sizeof(APEX_CPU));
 
     if (!cpu)
     {
         return NULL;
     }
 
+    if (config)
+    {
+        cpu->config = *config;
+    }
+    else
+    {
+        APEX_config_init(&cpu->config);
+    }
+
     /* Initialize PC, Registers and all pipeline stages */
     cpu->pc = 4000;
     memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
-    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
     cpu->single_step = ENABLE_SINGLE_STEP;
+    cpu->code_memory = code_memory;
+    cpu->code_memory_size = code_memory_size;
 
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    cpu->data_memory = calloc(DATA_MEMORY_SIZE, sizeof(int));
+    if (!cpu->data_memory)
+    {
+        free(cpu);
+        return NULL;
+    }
+
+    if (!APEX_lsq_init(&cpu->lsq, cpu->config.lsq_size))
+    {
+        free(cpu->data_memory);
+        free(cpu);
+        return NULL;
+    }
+
+    if (!APEX_cache_init(&cpu->dcache, "L1 DATA CACHE", &cpu->config.dcache,
+                         cpu->code_memory_size))
     {
+        fprintf(stderr, "APEX_Error: Invalid data cache configuration\n");
+        APEX_lsq_free(&cpu->lsq);
+        free(cpu->data_memory);
         free(cpu);
         return NULL;
     }
 
+    if (!APEX_cache_init(&cpu->icache, "L1 INSTRUCTION CACHE",
+                         &cpu->config.icache, cpu->code_memory_size))
+    {
+        fprintf(stderr,
+                "APEX_Error: Invalid instruction cache configuration\n");
+        APEX_cache_free(&cpu->dcache);
+        APEX_lsq_free(&cpu->lsq);
+        free(cpu->data_memory);
+        free(cpu);
+        return NULL;
+    }
+
+    if (!APEX_prefetcher_init(&cpu->prefetcher,
+                              cpu->config.prefetch_table_size,
+                              cpu->config.prefetch_degree,
+                              cpu->config.prefetch_distance))
+    {
+        fprintf(stderr, "APEX_Error: Invalid prefetcher configuration\n");
+        APEX_cache_free(&cpu->icache);
+        APEX_cache_free(&cpu->dcache);
+        APEX_lsq_free(&cpu->lsq);
+        free(cpu->data_memory);
+        free(cpu);
+        return NULL;
+    }
+
+    cpu->ftq = calloc(cpu->config.ftq_size, sizeof(int));
+    cpu->ibuf = calloc(cpu->config.ibuf_size, sizeof(CPU_Stage));
+    if (!cpu->ftq || !cpu->ibuf)
+    {
+        free(cpu->ftq);
+        free(cpu->ibuf);
+        APEX_prefetcher_free(&cpu->prefetcher);
+        APEX_cache_free(&cpu->icache);
+        APEX_cache_free(&cpu->dcache);
+        APEX_lsq_free(&cpu->lsq);
+        free(cpu->data_memory);
+        free(cpu);
+        return NULL;
+    }
+
+    if (cpu->config.check)
+    {
+        cpu->checker = APEX_check_init(cpu->code_memory,
+                                       cpu->code_memory_size, cpu->pc);
+        if (!cpu->checker)
+        {
+            free(cpu->ftq);
+            free(cpu->ibuf);
+            APEX_prefetcher_free(&cpu->prefetcher);
+            APEX_cache_free(&cpu->icache);
+            APEX_cache_free(&cpu->dcache);
+            APEX_lsq_free(&cpu->lsq);
+                free(cpu->data_memory);
+            free(cpu);
+            return NULL;
+        }
+    }
+
+    /* To start fetch stage */
+    cpu->fetch.has_insn = TRUE;
+    return cpu;
+}
+
+/*
+ * This function creates and initializes APEX cpu.
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+APEX_CPU *
+APEX_cpu_init(const char *filename, const APEX_Config *config)
+{
+    APEX_Instruction *code_memory;
+    int code_memory_size;
+    int i;
+    APEX_CPU *cpu;
+
+    if (!filename)
+    {
+        return NULL;
+    }
+
+    /* Parse input file and create code memory */
+    code_memory = create_code_memory(filename, &code_memory_size);
+    if (!code_memory)
+    {
+        return NULL;
+    }
+
+    cpu = create_cpu(code_memory, code_memory_size, config);
+    if (!cpu)
+    {
+        free(code_memory);
+        return NULL;
+    }
+
     if (ENABLE_DEBUG_MESSAGES)
     {
         fprintf(stderr,
@@ -1084,10 +1803,30 @@ APEX_cpu_init(const char *filename)
         }
     }
 
-    /* To start fetch stage */
-    cpu->fetch.has_insn = TRUE;
     return cpu;
 }
+
+/*
+ * Creates a CPU running 'code_memory' without printing anything, for runs
+ * that build many CPUs from a program already parsed. The code memory is
+ * shared read-only, it must outlive the CPU.
+ */
+APEX_CPU *
+APEX_cpu_init_code(const APEX_Instruction *code_memory, int code_memory_size,
+                   const APEX_Config *config)
+{
+    /* Nothing writes code memory after parsing */
+    APEX_CPU *cpu = create_cpu((APEX_Instruction *)code_memory,
+                               code_memory_size, config);
+
+    if (cpu)
+    {
+        cpu->shared_code = TRUE;
+        cpu->quiet = TRUE;
+    }
+    return cpu;
+}
+
 static void print_data_memory(const APEX_CPU *cpu)
 {
     printf("----------\n%s\n----------\n", "NON-ZERO MEMORY VALUES");
@@ -1100,6 +1839,435 @@ static void print_data_memory(const APEX_CPU *cpu)
     }
     printf("\n");
 }
+static void
+print_branch_stats(const APEX_CPU *cpu)
+{
+    printf("----------\n%s\n----------\n", "CONDITIONAL BRANCHES");
+    printf("Resolved         : %d in Decode, %d in Execute\n",
+           cpu->branches_decode, cpu->branches_execute);
+    printf("Taken            : %d in Decode, %d in Execute\n",
+           cpu->taken_decode, cpu->taken_execute);
+
+    /* A taken branch costs two bubbles from Execute and one from Decode */
+    printf("Penalty cycles   : %d paid, %d recovered\n",
+           cpu->taken_decode + 2 * cpu->taken_execute, cpu->taken_decode);
+    printf("\n");
+}
+
+static void
+print_front_end_stats(const APEX_CPU *cpu)
+{
+    printf("----------\n%s\n----------\n", "FRONT END");
+    printf("Queues           : %d fetch targets, %d instructions\n",
+           cpu->config.ftq_size, cpu->config.ibuf_size);
+    printf("Peak occupancy   : %d / %d\n", cpu->ftq_max, cpu->ibuf_max);
+    printf("Run-ahead fetches: %d\n", cpu->runahead_fetches);
+    printf("Buffer full      : %d cycles\n", cpu->ibuf_full_cycles);
+    printf("Decode starved   : %d cycles\n", cpu->frontend_starved);
+    printf("Squashed         : %d entries\n", cpu->squashed);
+    printf("\n");
+}
+
+/* Cycles each stage could not pass its instruction on, by cause */
+static void
+print_stall_stats(const APEX_CPU *cpu)
+{
+    printf("----------\n%s\n----------\n", "STALL CYCLES");
+    printf("Decode starved   : %d\n", cpu->frontend_starved);
+    printf("Dependency       : %d\n", cpu->dependency_stalls);
+    printf("Back-pressure    : %d\n", cpu->backpressure_stalls);
+    printf("Load/store queue : %d\n", cpu->lsq.full_stalls);
+    printf("Data cache       : %d\n", cpu->memory_stalls);
+    printf("\n");
+}
+
+static void
+print_fusion_stats(const APEX_CPU *cpu)
+{
+    int pairs = cpu->fused_cmp + cpu->fused_cml + cpu->fused_addl
+                + cpu->fused_subl;
+
+    printf("----------\n%s\n----------\n", "MACRO-OP FUSION");
+    if (!cpu->config.fusion)
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    printf("Fused pairs      : %d (CMP %d, CML %d, ADDL %d, SUBL %d)\n", pairs,
+           cpu->fused_cmp, cpu->fused_cml, cpu->fused_addl, cpu->fused_subl);
+    printf("Taken            : %d\n", cpu->fused_taken);
+    printf("Slots saved      : %d\n", pairs);
+    printf("IPC              : %.3f\n",
+           cpu->clock ? (double)cpu->insn_completed / (cpu->clock + 1) : 0.0);
+    printf("\n");
+}
+
+/* Prints end of run statistics of the CPU subsystems */
+void
+APEX_cpu_print_stats(const APEX_CPU *cpu)
+{
+    print_front_end_stats(cpu);
+    print_stall_stats(cpu);
+    print_branch_stats(cpu);
+    print_fusion_stats(cpu);
+    APEX_lsq_print_stats(&cpu->lsq);
+    APEX_cache_print_stats(&cpu->dcache);
+    APEX_prefetcher_print_stats(&cpu->prefetcher, &cpu->dcache);
+    APEX_cache_print_stats(&cpu->icache);
+    if (cpu->checker)
+    {
+        APEX_check_print_stats(cpu->checker);
+    }
+    if (cpu->trace)
+    {
+        APEX_trace_print_stats(cpu->trace);
+    }
+    if (cpu->itrace)
+    {
+        APEX_trace_print_stats(cpu->itrace);
+    }
+}
+
+/* Cycles run, counting the one HALT retired in */
+static int
+cycles_run(const APEX_CPU *cpu)
+{
+    return cpu->halted ? cpu->clock + 1 : cpu->clock;
+}
+
+/* 'count' per cycle run */
+static double
+per_cycle(const APEX_CPU *cpu, int count)
+{
+    return cycles_run(cpu) ? (double)count / cycles_run(cpu) : 0.0;
+}
+
+/* 'count' per thousand instructions retired */
+static double
+per_kilo_insn(const APEX_CPU *cpu, int count)
+{
+    return cpu->insn_completed ? 1000.0 * count / cpu->insn_completed : 0.0;
+}
+
+static double
+stat_cycles(const void *owner)
+{
+    return cycles_run(owner);
+}
+
+static double
+stat_ipc(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_cycle(cpu, cpu->insn_completed);
+}
+
+static double
+stat_starved_fraction(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_cycle(cpu, cpu->frontend_starved);
+}
+
+static double
+stat_dependency_fraction(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_cycle(cpu, cpu->dependency_stalls);
+}
+
+static double
+stat_backpressure_fraction(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_cycle(cpu, cpu->backpressure_stalls);
+}
+
+static double
+stat_lsq_full_fraction(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_cycle(cpu, cpu->lsq.full_stalls);
+}
+
+static double
+stat_memory_fraction(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_cycle(cpu, cpu->memory_stalls);
+}
+
+static double
+stat_branch_penalty(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return cpu->taken_decode + 2 * cpu->taken_execute;
+}
+
+static double
+stat_dcache_mpki(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_kilo_insn(cpu, cpu->dcache.misses);
+}
+
+static double
+stat_icache_mpki(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return per_kilo_insn(cpu, cpu->icache.misses);
+}
+
+static double
+stat_prefetch_accuracy(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+
+    return cpu->prefetcher.issued
+               ? (double)cpu->dcache.useful_prefetches / cpu->prefetcher.issued
+               : 0.0;
+}
+
+static double
+stat_prefetch_coverage(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+    int useful = cpu->dcache.useful_prefetches;
+    int uncovered = cpu->dcache.misses - cpu->dcache.late_prefetches;
+
+    return useful + uncovered ? (double)useful / (useful + uncovered) : 0.0;
+}
+
+static double
+stat_prefetch_timeliness(const void *owner)
+{
+    const APEX_CPU *cpu = owner;
+    int useful = cpu->dcache.useful_prefetches;
+
+    return useful ? (double)(useful - cpu->dcache.late_prefetches) / useful
+                  : 0.0;
+}
+
+/* Registers the counters and derived metrics of the CPU subsystems */
+void
+APEX_cpu_register_stats(const APEX_CPU *cpu, APEX_Stats *stats)
+{
+    APEX_stats_enter(stats, "cpu");
+    APEX_stats_derived(stats, "cycles", stat_cycles, cpu);
+    APEX_stats_counter(stats, "instructions", &cpu->insn_completed);
+    APEX_stats_derived(stats, "ipc", stat_ipc, cpu);
+    APEX_stats_counter(stats, "halted", &cpu->halted);
+    APEX_stats_counter(stats, "diverged", &cpu->diverged);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "front_end");
+    APEX_stats_counter(stats, "ftq_peak", &cpu->ftq_max);
+    APEX_stats_counter(stats, "ibuf_peak", &cpu->ibuf_max);
+    APEX_stats_counter(stats, "runahead_fetches", &cpu->runahead_fetches);
+    APEX_stats_counter(stats, "ibuf_full_cycles", &cpu->ibuf_full_cycles);
+    APEX_stats_counter(stats, "squashed", &cpu->squashed);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "stalls");
+    APEX_stats_counter(stats, "starved", &cpu->frontend_starved);
+    APEX_stats_counter(stats, "dependency", &cpu->dependency_stalls);
+    APEX_stats_counter(stats, "backpressure", &cpu->backpressure_stalls);
+    APEX_stats_counter(stats, "lsq_full", &cpu->lsq.full_stalls);
+    APEX_stats_counter(stats, "dcache", &cpu->memory_stalls);
+    APEX_stats_derived(stats, "starved_fraction", stat_starved_fraction, cpu);
+    APEX_stats_derived(stats, "dependency_fraction", stat_dependency_fraction,
+                       cpu);
+    APEX_stats_derived(stats, "backpressure_fraction",
+                       stat_backpressure_fraction, cpu);
+    APEX_stats_derived(stats, "lsq_full_fraction", stat_lsq_full_fraction,
+                       cpu);
+    APEX_stats_derived(stats, "dcache_fraction", stat_memory_fraction, cpu);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "branches");
+    APEX_stats_counter(stats, "resolved_decode", &cpu->branches_decode);
+    APEX_stats_counter(stats, "resolved_execute", &cpu->branches_execute);
+    APEX_stats_counter(stats, "taken_decode", &cpu->taken_decode);
+    APEX_stats_counter(stats, "taken_execute", &cpu->taken_execute);
+    APEX_stats_derived(stats, "penalty_cycles", stat_branch_penalty, cpu);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "fusion");
+    APEX_stats_counter(stats, "cmp", &cpu->fused_cmp);
+    APEX_stats_counter(stats, "cml", &cpu->fused_cml);
+    APEX_stats_counter(stats, "addl", &cpu->fused_addl);
+    APEX_stats_counter(stats, "subl", &cpu->fused_subl);
+    APEX_stats_counter(stats, "taken", &cpu->fused_taken);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "lsq");
+    APEX_lsq_register_stats(&cpu->lsq, stats);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "dcache");
+    APEX_cache_register_stats(&cpu->dcache, stats);
+    APEX_stats_derived(stats, "mpki", stat_dcache_mpki, cpu);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "prefetcher");
+    APEX_prefetcher_register_stats(&cpu->prefetcher, stats);
+    APEX_stats_derived(stats, "accuracy", stat_prefetch_accuracy, cpu);
+    APEX_stats_derived(stats, "coverage", stat_prefetch_coverage, cpu);
+    APEX_stats_derived(stats, "timeliness", stat_prefetch_timeliness, cpu);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "icache");
+    APEX_cache_register_stats(&cpu->icache, stats);
+    APEX_stats_derived(stats, "mpki", stat_icache_mpki, cpu);
+    APEX_stats_leave(stats);
+
+    if (cpu->checker)
+    {
+        APEX_stats_enter(stats, "checker");
+        APEX_check_register_stats(cpu->checker, stats);
+        APEX_stats_leave(stats);
+    }
+
+    if (cpu->trace)
+    {
+        APEX_stats_enter(stats, "trace");
+        APEX_trace_register_stats(cpu->trace, stats);
+        APEX_stats_leave(stats);
+    }
+
+    if (cpu->itrace)
+    {
+        APEX_stats_enter(stats, "itrace");
+        APEX_trace_register_stats(cpu->itrace, stats);
+        APEX_stats_leave(stats);
+    }
+}
+
+/*
+ * Writes the configuration and the statistics of the CPU to the file of
+ * the stats= option. Returns FALSE if it could not be written.
+ */
+int
+APEX_cpu_write_stats(const APEX_CPU *cpu)
+{
+    APEX_Stats stats;
+    int ok;
+
+    APEX_stats_init(&stats);
+    APEX_stats_enter(&stats, "config");
+    APEX_config_register_stats(&cpu->config, &stats);
+    APEX_stats_leave(&stats);
+    APEX_cpu_register_stats(cpu, &stats);
+    ok = APEX_stats_write(&stats, cpu->config.stats);
+    APEX_stats_free(&stats);
+    return ok;
+}
+
+/*
+ * Moves a core that is part of an APEX_System onto the shared data memory
+ * and puts its data cache on the coherence bus
+ */
+void
+APEX_cpu_attach(APEX_CPU *cpu, int core, int *memory,
+                APEX_Coherence *coherence)
+{
+    if (!cpu->shared_memory)
+    {
+        free(cpu->data_memory);
+    }
+
+    cpu->core = core;
+    cpu->data_memory = memory;
+    cpu->shared_memory = TRUE;
+
+    if (APEX_cache_enabled(&cpu->dcache))
+    {
+        APEX_coherence_attach(coherence, core, &cpu->dcache);
+    }
+}
+
+/*
+ * Starts a CPU that has not run yet from the architectural state of a
+ * functional model: PC, registers, flags and data memory. Its own checker,
+ * if any, continues from the same state.
+ */
+void
+APEX_cpu_load_state(APEX_CPU *cpu, const APEX_Checker *model)
+{
+    cpu->pc = model->pc;
+    memcpy(cpu->regs, model->regs, sizeof(cpu->regs));
+    cpu->zero_flag = model->zero_flag;
+    cpu->n_flag = model->n_flag;
+    cpu->p_flag = model->p_flag;
+    memcpy(cpu->data_memory, model->data_memory,
+           DATA_MEMORY_SIZE * sizeof(int));
+
+    if (cpu->checker)
+    {
+        APEX_check_copy_state(cpu->checker, model);
+    }
+}
+
+/* Prints the register file, the non-zero data memory and the flags */
+void
+APEX_cpu_print_state(const APEX_CPU *cpu)
+{
+    print_reg_file(cpu);
+    print_data_memory(cpu);
+    print_flags(cpu);
+}
+
+/*
+ * Simulates one clock cycle. Returns TRUE once HALT has reached Writeback,
+ * or the checker found a divergence, the clock is then left on the last
+ * cycle.
+ */
+int
+APEX_cpu_step(APEX_CPU *cpu)
+{
+    if (ENABLE_DEBUG_MESSAGES && !cpu->quiet)
+    {
+        printf("--------------------------------------------\n");
+        if (cpu->config.cores > 1)
+        {
+            printf("Core #: %d\n", cpu->core);
+        }
+        printf("Clock Cycle #: %d\n", cpu->clock+1);
+        printf("--------------------------------------------\n");
+    }
+
+    if (APEX_writeback(cpu))
+    {
+        /* Halt in writeback stage */
+        cpu->halted = TRUE;
+        return TRUE;
+    }
+
+    APEX_memory(cpu);
+    APEX_execute(cpu);
+    APEX_decode(cpu);
+    APEX_fetch(cpu);
+
+    if (!cpu->quiet)
+    {
+        APEX_cpu_print_state(cpu);
+    }
+
+    cpu->lsq.occupancy[cpu->lsq.count]++;
+    cpu->clock++;
+    return FALSE;
+}
+
 /*
  * APEX CPU simulation loop
  *
@@ -1115,28 +2283,24 @@ APEX_cpu_run(APEX_CPU *cpu)
         if(cpu->maxCycles!=0 && cpu->maxCycles<cpu->clock+1){
             break;
         }
-        if (ENABLE_DEBUG_MESSAGES)
+
+        if (APEX_stats_pending)
         {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock+1);
-            printf("--------------------------------------------\n");
+            APEX_stats_pending = FALSE;
+            APEX_cpu_write_stats(cpu);
         }
 
-        if (APEX_writeback(cpu))
+        if (APEX_cpu_step(cpu))
         {
-            /* Halt in writeback stage */
+            if (cpu->diverged)
+            {
+                printf("APEX_CPU: Simulation Stopped at divergence, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+                break;
+            }
             printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
             break;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
-        print_reg_file(cpu);
-        print_data_memory(cpu);
-        print_flags(cpu);
         if (cpu->single_step)
         {
             printf("Press any key to advance CPU Clock or <q> to quit:\n");
@@ -1148,8 +2312,20 @@ APEX_cpu_run(APEX_CPU *cpu)
                 break;
             }
         }
+    }
 
-        cpu->clock++;
+    if (cpu->trace)
+    {
+        APEX_trace_close(cpu->trace);
+    }
+    if (cpu->itrace)
+    {
+        APEX_trace_close(cpu->itrace);
+    }
+    APEX_cpu_print_stats(cpu);
+    if (cpu->config.stats[0])
+    {
+        APEX_cpu_write_stats(cpu);
     }
 }
 
@@ -1161,6 +2337,23 @@ APEX_cpu_run(APEX_CPU *cpu)
 void
 APEX_cpu_stop(APEX_CPU *cpu)
 {
-    free(cpu->code_memory);
+    APEX_lsq_free(&cpu->lsq);
+    APEX_cache_free(&cpu->dcache);
+    APEX_cache_free(&cpu->icache);
+    APEX_prefetcher_free(&cpu->prefetcher);
+    free(cpu->ftq);
+    free(cpu->ibuf);
+    APEX_check_free(cpu->checker);
+    APEX_trace_free(cpu->trace);
+    APEX_trace_free(cpu->itrace);
+    if (!cpu->shared_code)
+    {
+        free(cpu->code_memory);
+    }
+    free(cpu->write_log);
+    if (!cpu->shared_memory)
+    {
+        free(cpu->data_memory);
+    }
     free(cpu);
 }
\ No newline at end of file
@@ -10,6 +10,13 @@
 #define _APEX_CPU_H_
 
 #include "apex_macros.h"
+#include "apex_lsq.h"
+#include "apex_cache.h"
+#include "apex_prefetch.h"
+#include "apex_coherence.h"
+#include "apex_trace.h"
+
+struct APEX_Checker;
 
 /* Format of an APEX instruction  */
 typedef struct APEX_Instruction
@@ -39,18 +46,80 @@ typedef struct CPU_Stage
     int has_insn;
     int aux_buffer;
     int jump_buffer;
+    int lsq_index;
+    int mem_pending;               /* Data cache miss in flight */
+    int branch_resolved;           /* Branch already redirected from Decode */
+    int taken;                     /* Redirected Fetch when it resolved */
+    int fused;                     /* A conditional branch is fused to this op */
+    int fused_pc;
+    int fused_opcode;
+    int fused_imm;
+    char fused_opcode_str[128];
 } CPU_Stage;
 
+/* Store drained by a core between two barriers of a parallel run */
+typedef struct Memory_Write
+{
+    int address;
+    int value;
+} Memory_Write;
+
+/* Run-time configuration of the simulated machine, see APEX_config_set() */
+typedef struct APEX_Config
+{
+    int lsq_size;                  /* Entries in the load/store queue */
+    Cache_Config dcache;           /* L1 data cache */
+    Cache_Config icache;           /* L1 instruction cache */
+    int icache_prefetch;           /* Next-line prefetch on i-cache misses */
+    int prefetch_table_size;       /* Stride prefetcher table entries */
+    int prefetch_degree;           /* Lines prefetched per trigger */
+    int prefetch_distance;         /* Strides ahead of the demand address */
+    int early_branch;              /* Resolve conditional branches in Decode */
+    int ftq_size;                  /* Fetch target queue entries */
+    int ibuf_size;                 /* Instruction buffer entries */
+    int seq_prefetch;              /* Prefetch the lines of queued sequential targets */
+    int fusion;                    /* Fuse compare/ADDL/SUBL with a branch */
+    int cores;                     /* Cores sharing data memory */
+    int coherence_latency;         /* Extra cycles of a flush or an upgrade */
+    int parallel;                  /* Step each core on its own host thread */
+    int quantum;                   /* Cycles between barriers of a parallel run */
+    int parallel_verify;           /* Also step the cores sequentially */
+    int check;                     /* Run the lockstep checker */
+    int sample_interval;           /* Instructions per sampling interval */
+    int sample_phases;             /* Most phases the intervals cluster into */
+    int sample_warmup;             /* Detailed warm-up before each sample */
+    int sample_verify;             /* Also run in full to measure the error */
+    int interval_size;             /* Instructions per parallel interval */
+    int interval_warmup;           /* Detailed warm-up before each interval */
+    int interval_threads;          /* Host threads simulating intervals */
+    int interval_verify;           /* Also run in full to measure the error */
+    char stats[STATS_PATH_SIZE];   /* Statistics registry file, "" for none */
+    char trace[STATS_PATH_SIZE];   /* Memory trace file, "" for none */
+    char itrace[STATS_PATH_SIZE];  /* Instruction trace file, "" for none */
+} APEX_Config;
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
-    int pc;                        /* Current program counter */
+    int pc;                        /* Next PC to queue for fetch */
     int clock;                     /* Clock cycles elapsed */
     int insn_completed;            /* Instructions retired */
     int regs[REG_FILE_SIZE];       /* Integer register file */
     int code_memory_size;          /* Number of instruction in the input file */
     APEX_Instruction *code_memory; /* Code Memory */
-    int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
+    int shared_code;               /* code_memory belongs to the caller */
+    int *data_memory;              /* Data Memory, possibly shared */
+    int shared_memory;             /* data_memory belongs to an APEX_System */
+    int core;                      /* Index of this core in the system */
+    int halted;                    /* HALT reached Writeback */
+    int quiet;                     /* No per-cycle output */
+    struct APEX_Checker *checker;  /* Lockstep checker, or NULL */
+    APEX_Trace *trace;             /* Memory trace being written, or NULL */
+    APEX_Trace *itrace;            /* Instruction trace being written, or NULL */
+    int diverged;                  /* The checker stopped the simulation */
+    Memory_Write *write_log;       /* Stores for the next barrier, or NULL */
+    int write_log_count;
+    int write_log_size;
     int single_step;               /* Wait for user input after every cycle */
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
     int n_flag;
@@ -62,6 +131,37 @@ typedef struct APEX_CPU
     int executeStageBuggerRegisterValue;
     int memStageBufferRegister;
     int memStageBuggerRegisterValue;
+    APEX_Config config;
+    APEX_LSQ lsq;                  /* Load/store queue between EX and MEM */
+    APEX_Cache dcache;             /* L1 data cache in front of data_memory */
+    int dcache_busy_cycles;        /* Cycles until the data cache port frees */
+    APEX_Prefetcher prefetcher;    /* Stride prefetcher into the data cache */
+    APEX_Cache icache;             /* L1 instruction cache in front of code_memory */
+    int icache_ready_cycle;        /* Fetch waits for an i-cache fill until then */
+    int *ftq;                      /* Fetch target queue, sequential PCs to fetch */
+    int ftq_head;
+    int ftq_count;
+    CPU_Stage *ibuf;               /* Instruction buffer between Fetch and Decode */
+    int ibuf_head;
+    int ibuf_count;
+    int ftq_max;
+    int ibuf_max;
+    int runahead_fetches;          /* Fetched while Decode was held */
+    int ibuf_full_cycles;
+    int frontend_starved;          /* Cycles Decode found the buffer empty */
+    int dependency_stalls;         /* Cycles Decode waited for an operand */
+    int backpressure_stalls;       /* Cycles Decode waited for Execute */
+    int memory_stalls;             /* Cycles Memory waited for the data cache */
+    int squashed;                  /* Queue entries dropped by redirects */
+    int fused_cmp;                 /* Fused pairs by flag producer */
+    int fused_cml;
+    int fused_addl;
+    int fused_subl;
+    int fused_taken;
+    int branches_decode;           /* Conditional branches resolved in Decode */
+    int branches_execute;          /* Conditional branches resolved in Execute */
+    int taken_decode;
+    int taken_execute;
     /* Pipeline stages */
     CPU_Stage fetch;
     CPU_Stage decode;
@@ -71,7 +171,20 @@ typedef struct APEX_CPU
 } APEX_CPU;
 
 APEX_Instruction *create_code_memory(const char *filename, int *size);
-APEX_CPU *APEX_cpu_init(const char *filename);
+void APEX_config_init(APEX_Config *config);
+int APEX_config_set(APEX_Config *config, const char *option);
+void APEX_config_register_stats(const APEX_Config *config, APEX_Stats *stats);
+APEX_CPU *APEX_cpu_init(const char *filename, const APEX_Config *config);
+APEX_CPU *APEX_cpu_init_code(const APEX_Instruction *code_memory,
+                             int code_memory_size, const APEX_Config *config);
+void APEX_cpu_load_state(APEX_CPU *cpu, const struct APEX_Checker *model);
+void APEX_cpu_attach(APEX_CPU *cpu, int core, int *memory,
+                     APEX_Coherence *coherence);
+int APEX_cpu_step(APEX_CPU *cpu);
+void APEX_cpu_print_state(const APEX_CPU *cpu);
+void APEX_cpu_print_stats(const APEX_CPU *cpu);
+void APEX_cpu_register_stats(const APEX_CPU *cpu, APEX_Stats *stats);
+int APEX_cpu_write_stats(const APEX_CPU *cpu);
 void APEX_cpu_run(APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
 #endif
@@ -0,0 +1,670 @@
+/*
+ * apex_dse.c
+ * Design-space exploration driver for the APEX pipeline
+ *
+ * Runs every combination of the given machine parameters over a set of
+ * programs, on all host cores, and writes one CSV row per run to stdout:
+ *
+ *   ./apex_dse a.asm,b.asm dcache_size=256:4096:x2 lsq_size=4,8,16 > out.csv
+ *
+ * A parameter is any apex_sim option followed by a comma separated list of
+ * values and ranges. A range is lo:hi with an optional step, lo:hi:s adds s
+ * and lo:hi:xs multiplies by s. jobs=N sets the host threads and cycles=N
+ * stops runs that have not halted after N cycles. Every program is parsed
+ * once and its code memory is shared read-only by all the runs.
+ *
+ * A program may also be an instruction trace apex_sim recorded with its
+ * itrace= option. Its runs use the trace-driven model of apex_replay.h,
+ * which gives the same cycles in a fraction of the time.
+ *
+ * The Pareto front of the configurations, trading the storage they cost
+ * against the cycles all programs take, is printed to stderr.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_replay.h"
+
+/* Default cycle limit of a run */
+#define DSE_MAX_CYCLES 1000000
+
+/* A swept parameter and the values it takes */
+typedef struct DSE_Param
+{
+    char name[64];
+    char **values;
+    int count;
+} DSE_Param;
+
+/* Outcome of one program on one configuration */
+typedef struct DSE_Run
+{
+    int status;                    /* DSE_* */
+    int cycles;
+    int instructions;
+    int starved;
+    int dependency;
+    int backpressure;
+    int lsq_full;
+    int memory;
+    int dcache_misses;
+    int icache_misses;
+} DSE_Run;
+
+enum
+{
+    DSE_HALTED,
+    DSE_CYCLE_LIMIT,
+    DSE_FAILED,
+    DSE_DIVERGED
+};
+
+static const char *const status_names[] = {"halted", "cycle limit", "failed",
+                                           "diverged"};
+
+/* The whole sweep, shared by the host threads */
+typedef struct APEX_DSE
+{
+    APEX_Config base;              /* Defaults the parameters apply to */
+    DSE_Param *param;
+    int params;
+    char **program;                /* File names */
+    APEX_Instruction **code_memory; /* Parsed once per program */
+    int *code_memory_size;
+    Trace_Record **trace;          /* Or loaded once, NULL for a program */
+    int *trace_size;
+    int programs;
+    int configs;                   /* Product of the value counts */
+    DSE_Run *run;                  /* Indexed by config * programs + program */
+    int max_cycles;
+
+    pthread_mutex_t lock;
+    int next;                      /* Next run to simulate */
+} APEX_DSE;
+
+static double
+host_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Appends one value to a parameter */
+static int
+add_value(DSE_Param *param, const char *value)
+{
+    char **values = realloc(param->values, (param->count + 1) * sizeof(char *));
+
+    if (!values)
+    {
+        return FALSE;
+    }
+    param->values = values;
+    param->values[param->count] = strdup(value);
+    return param->values[param->count++] != NULL;
+}
+
+/*
+ * Expands "name=item,item,..." into the values of a parameter, an item is a
+ * value or a lo:hi[:step] range. Every value is checked against the option
+ * table. Returns FALSE on a malformed or invalid value.
+ */
+static int
+parse_param(DSE_Param *param, const char *arg)
+{
+    const char *eq = strchr(arg, '=');
+    char *list;
+    char *item;
+    char *save;
+    int ok = TRUE;
+    int i;
+
+    if (eq - arg >= (long)sizeof(param->name))
+    {
+        return FALSE;
+    }
+    memcpy(param->name, arg, eq - arg);
+    param->name[eq - arg] = '\0';
+
+    list = strdup(eq + 1);
+    if (!list)
+    {
+        return FALSE;
+    }
+
+    for (item = strtok_r(list, ",", &save); item && ok;
+         item = strtok_r(NULL, ",", &save))
+    {
+        long lo, hi, step = 1;
+        int multiply = FALSE;
+        char *end;
+
+        if (!strchr(item, ':'))
+        {
+            ok = add_value(param, item);
+            continue;
+        }
+
+        lo = strtol(item, &end, 0);
+        hi = *end == ':' ? strtol(end + 1, &end, 0) : lo - 1;
+        if (*end == ':')
+        {
+            multiply = end[1] == 'x';
+            step = strtol(end + 1 + multiply, &end, 0);
+        }
+        if (*end != '\0' || hi < lo || (multiply ? step < 2 || lo < 1
+                                                 : step < 1))
+        {
+            ok = FALSE;
+            break;
+        }
+
+        for (; lo <= hi && ok; lo = multiply ? lo * step : lo + step)
+        {
+            char value[32];
+
+            snprintf(value, sizeof(value), "%ld", lo);
+            ok = add_value(param, value);
+        }
+    }
+    free(list);
+
+    /* Check every value now rather than in the middle of the sweep */
+    for (i = 0; ok && i < param->count; ++i)
+    {
+        APEX_Config config;
+        char option[128];
+
+        APEX_config_init(&config);
+        snprintf(option, sizeof(option), "%s=%s", param->name,
+                 param->values[i]);
+        ok = APEX_config_set(&config, option);
+    }
+    return ok && param->count > 0;
+}
+
+/* Value of parameter 'p' in configuration 'config', the digits of a mixed
+ * radix number with the last parameter changing fastest */
+static const char *
+param_value(const APEX_DSE *dse, int config, int p)
+{
+    int q;
+
+    for (q = dse->params - 1; q > p; --q)
+    {
+        config /= dse->param[q].count;
+    }
+    return dse->param[p].values[config % dse->param[p].count];
+}
+
+/* Builds configuration 'index' */
+static void
+make_config(const APEX_DSE *dse, int index, APEX_Config *config)
+{
+    int p;
+
+    *config = dse->base;
+    for (p = 0; p < dse->params; ++p)
+    {
+        char option[128];
+
+        snprintf(option, sizeof(option), "%s=%s", dse->param[p].name,
+                 param_value(dse, index, p));
+        APEX_config_set(config, option);
+    }
+}
+
+/* Times an instruction trace on one configuration */
+static void
+replay(const APEX_DSE *dse, int program, const APEX_Config *config,
+       DSE_Run *run)
+{
+    APEX_Replay replay;
+
+    if (!APEX_replay_init(&replay, config))
+    {
+        run->status = DSE_FAILED;
+        return;
+    }
+
+    if (!APEX_replay_run(&replay, dse->trace[program],
+                         dse->trace_size[program], dse->max_cycles))
+    {
+        run->status = DSE_FAILED;
+    }
+    else
+    {
+        run->status = replay.status == REPLAY_HALTED ? DSE_HALTED
+                                                     : DSE_CYCLE_LIMIT;
+    }
+    run->cycles = replay.status == REPLAY_DEADLOCK ? dse->max_cycles
+                                                   : replay.cycles;
+    run->instructions = replay.insn_completed;
+    run->starved = replay.frontend_starved;
+    run->dependency = replay.dependency_stalls;
+    run->backpressure = replay.backpressure_stalls;
+    run->lsq_full = replay.lsq_full_stalls;
+    run->memory = replay.memory_stalls;
+    run->dcache_misses = replay.dcache.misses;
+    run->icache_misses = replay.icache.misses;
+    APEX_replay_free(&replay);
+}
+
+/* Simulates one program on one configuration */
+static void
+simulate(const APEX_DSE *dse, int index, DSE_Run *run)
+{
+    int program = index % dse->programs;
+    APEX_Config config;
+    APEX_CPU *cpu;
+    int halted = FALSE;
+
+    make_config(dse, index / dse->programs, &config);
+    if (dse->trace[program])
+    {
+        replay(dse, program, &config, run);
+        return;
+    }
+
+    cpu = APEX_cpu_init_code(dse->code_memory[program],
+                             dse->code_memory_size[program], &config);
+    if (!cpu)
+    {
+        run->status = DSE_FAILED;
+        return;
+    }
+
+    while (!halted && cpu->clock < dse->max_cycles)
+    {
+        halted = APEX_cpu_step(cpu);
+    }
+
+    run->status = cpu->diverged ? DSE_DIVERGED
+                  : halted      ? DSE_HALTED
+                                : DSE_CYCLE_LIMIT;
+    run->cycles = halted ? cpu->clock + 1 : cpu->clock;
+    run->instructions = cpu->insn_completed;
+    run->starved = cpu->frontend_starved;
+    run->dependency = cpu->dependency_stalls;
+    run->backpressure = cpu->backpressure_stalls;
+    run->lsq_full = cpu->lsq.full_stalls;
+    run->memory = cpu->memory_stalls;
+    run->dcache_misses = cpu->dcache.misses;
+    run->icache_misses = cpu->icache.misses;
+    APEX_cpu_stop(cpu);
+}
+
+/* Simulates runs until none are left */
+static void *
+dse_thread(void *arg)
+{
+    APEX_DSE *dse = arg;
+
+    while (TRUE)
+    {
+        int index;
+
+        pthread_mutex_lock(&dse->lock);
+        index = dse->next++;
+        pthread_mutex_unlock(&dse->lock);
+        if (index >= dse->configs * dse->programs)
+        {
+            break;
+        }
+        simulate(dse, index, &dse->run[index]);
+    }
+    return NULL;
+}
+
+/*
+ * Rough storage cost of a configuration in bytes: both caches, plus an
+ * address and a data word per load/store queue and prefetcher entry and a
+ * word per fetch target and instruction buffer entry
+ */
+static int
+storage_cost(const APEX_Config *config)
+{
+    return config->dcache.size + config->icache.size
+           + 8 * (config->lsq_size + config->prefetch_table_size)
+           + 4 * (config->ftq_size + config->ibuf_size);
+}
+
+static void
+print_csv(const APEX_DSE *dse)
+{
+    int index;
+    int p;
+
+    printf("program");
+    for (p = 0; p < dse->params; ++p)
+    {
+        printf(",%s", dse->param[p].name);
+    }
+    printf(",status,cycles,instructions,ipc,decode_starved,dependency,"
+           "backpressure,lsq_full,dcache_stall,dcache_misses,"
+           "icache_misses\n");
+
+    for (index = 0; index < dse->configs * dse->programs; ++index)
+    {
+        const DSE_Run *run = &dse->run[index];
+
+        printf("%s", dse->program[index % dse->programs]);
+        for (p = 0; p < dse->params; ++p)
+        {
+            printf(",%s", param_value(dse, index / dse->programs, p));
+        }
+        printf(",%s,%d,%d,%.4f,%d,%d,%d,%d,%d,%d,%d\n",
+               status_names[run->status], run->cycles, run->instructions,
+               run->cycles ? (double)run->instructions / run->cycles : 0.0,
+               run->starved, run->dependency, run->backpressure,
+               run->lsq_full, run->memory, run->dcache_misses,
+               run->icache_misses);
+    }
+}
+
+/*
+ * Prints the configurations no other one beats on both cost and total
+ * cycles, cheapest first. Configurations where a program did not halt are
+ * left out.
+ */
+static void
+print_pareto(const APEX_DSE *dse, int jobs, double seconds)
+{
+    int *cycles = calloc(dse->configs, sizeof(int));
+    int *insns = calloc(dse->configs, sizeof(int));
+    int *cost = calloc(dse->configs, sizeof(int));
+    int *order = calloc(dse->configs, sizeof(int));
+    int valid = 0;
+    int best = 0;
+    int c, i, j, p;
+
+    if (!cycles || !insns || !cost || !order)
+    {
+        free(cycles);
+        free(insns);
+        free(cost);
+        free(order);
+        return;
+    }
+
+    for (c = 0; c < dse->configs; ++c)
+    {
+        APEX_Config config;
+        int complete = TRUE;
+
+        make_config(dse, c, &config);
+        cost[c] = storage_cost(&config);
+        for (i = 0; i < dse->programs; ++i)
+        {
+            const DSE_Run *run = &dse->run[c * dse->programs + i];
+
+            complete = complete && run->status == DSE_HALTED;
+            cycles[c] += run->cycles;
+            insns[c] += run->instructions;
+        }
+        if (complete)
+        {
+            order[valid++] = c;
+        }
+    }
+
+    /* Insertion sort by cost, then cycles */
+    for (i = 1; i < valid; ++i)
+    {
+        int key = order[i];
+
+        for (j = i - 1; j >= 0
+                        && (cost[order[j]] > cost[key]
+                            || (cost[order[j]] == cost[key]
+                                && cycles[order[j]] > cycles[key]));
+             --j)
+        {
+            order[j + 1] = order[j];
+        }
+        order[j + 1] = key;
+    }
+
+    fprintf(stderr, "----------\n%s\n----------\n", "PARETO FRONT");
+    fprintf(stderr, "Runs             : %d (%d configurations x %d programs) "
+                    "on %d host threads\n",
+            dse->configs * dse->programs, dse->configs, dse->programs, jobs);
+    fprintf(stderr, "Complete configs : %d\n", valid);
+    fprintf(stderr, "Host time        : %.3f s\n", seconds);
+    fprintf(stderr, "%10s %12s %8s  %s\n", "bytes", "cycles", "IPC",
+            "configuration");
+
+    /* Walking up in cost, a configuration is on the front when it is
+     * faster than every cheaper one */
+    for (i = 0; i < valid; ++i)
+    {
+        c = order[i];
+        if (i > 0 && cycles[c] >= best)
+        {
+            continue;
+        }
+        best = cycles[c];
+
+        fprintf(stderr, "%10d %12d %8.3f ", cost[c], cycles[c],
+                cycles[c] ? (double)insns[c] / cycles[c] : 0.0);
+        for (p = 0; p < dse->params; ++p)
+        {
+            fprintf(stderr, " %s=%s", dse->param[p].name,
+                    param_value(dse, c, p));
+        }
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "\n");
+
+    free(cycles);
+    free(insns);
+    free(cost);
+    free(order);
+}
+
+/* Parses every program of the comma separated list once, or loads the
+ * instruction traces among them */
+static int
+load_programs(APEX_DSE *dse, const char *list)
+{
+    char *copy = strdup(list);
+    char *file;
+    char *save;
+
+    if (!copy)
+    {
+        return FALSE;
+    }
+
+    for (file = strtok_r(copy, ",", &save); file;
+         file = strtok_r(NULL, ",", &save))
+    {
+        int i = dse->programs;
+
+        dse->program = realloc(dse->program, (i + 1) * sizeof(char *));
+        dse->code_memory = realloc(dse->code_memory,
+                                   (i + 1) * sizeof(APEX_Instruction *));
+        dse->code_memory_size = realloc(dse->code_memory_size,
+                                        (i + 1) * sizeof(int));
+        dse->trace = realloc(dse->trace, (i + 1) * sizeof(Trace_Record *));
+        dse->trace_size = realloc(dse->trace_size, (i + 1) * sizeof(int));
+        if (!dse->program || !dse->code_memory || !dse->code_memory_size
+            || !dse->trace || !dse->trace_size)
+        {
+            free(copy);
+            return FALSE;
+        }
+
+        dse->program[i] = strdup(file);
+        dse->code_memory[i] = NULL;
+        dse->trace[i] = NULL;
+        if (APEX_trace_kind(file) == TRACE_INSN)
+        {
+            dse->trace[i] = APEX_trace_load(file, TRACE_INSN,
+                                            &dse->trace_size[i]);
+        }
+        else
+        {
+            dse->code_memory[i] = create_code_memory(
+                file, &dse->code_memory_size[i]);
+        }
+        if (!dse->program[i] || (!dse->code_memory[i] && !dse->trace[i]))
+        {
+            fprintf(stderr, "APEX_Error: Unable to load %s\n", file);
+            free(dse->program[i]);
+            free(dse->code_memory[i]);
+            free(dse->trace[i]);
+            free(copy);
+            return FALSE;
+        }
+        dse->programs++;
+    }
+
+    free(copy);
+    return dse->programs > 0;
+}
+
+static void
+free_dse(APEX_DSE *dse)
+{
+    int i, v;
+
+    for (i = 0; i < dse->params; ++i)
+    {
+        for (v = 0; v < dse->param[i].count; ++v)
+        {
+            free(dse->param[i].values[v]);
+        }
+        free(dse->param[i].values);
+    }
+    for (i = 0; i < dse->programs; ++i)
+    {
+        free(dse->program[i]);
+        free(dse->code_memory[i]);
+        free(dse->trace[i]);
+    }
+    free(dse->param);
+    free(dse->program);
+    free(dse->code_memory);
+    free(dse->code_memory_size);
+    free(dse->trace);
+    free(dse->trace_size);
+    free(dse->run);
+    pthread_mutex_destroy(&dse->lock);
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_DSE dse;
+    pthread_t *threads;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double start;
+    int i;
+
+    memset(&dse, 0, sizeof(dse));
+    APEX_config_init(&dse.base);
+    dse.max_cycles = DSE_MAX_CYCLES;
+    dse.configs = 1;
+    pthread_mutex_init(&dse.lock, NULL);
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "APEX_Help: Usage %s <input_file>[,<input_file> ...] "
+                        "[name=v1,lo:hi[:step] ...] [jobs=n] [cycles=n]\n",
+                argv[0]);
+        exit(1);
+    }
+
+    if (!load_programs(&dse, argv[1]))
+    {
+        free_dse(&dse);
+        exit(1);
+    }
+
+    for (i = 2; i < argc; ++i)
+    {
+        DSE_Param *param;
+
+        if (strncmp(argv[i], "jobs=", 5) == 0)
+        {
+            jobs = atoi(argv[i] + 5);
+            continue;
+        }
+        if (strncmp(argv[i], "cycles=", 7) == 0)
+        {
+            dse.max_cycles = atoi(argv[i] + 7);
+            continue;
+        }
+
+        param = realloc(dse.param, (dse.params + 1) * sizeof(DSE_Param));
+        if (!param)
+        {
+            free_dse(&dse);
+            exit(1);
+        }
+        dse.param = param;
+        param = &dse.param[dse.params++];
+        memset(param, 0, sizeof(DSE_Param));
+
+        if (!strchr(argv[i], '=') || !parse_param(param, argv[i]))
+        {
+            fprintf(stderr, "APEX_Error: Invalid parameter %s\n", argv[i]);
+            free_dse(&dse);
+            exit(1);
+        }
+        dse.configs *= param->count;
+    }
+
+    if (jobs < 1 || dse.max_cycles < 1)
+    {
+        fprintf(stderr, "APEX_Error: Invalid args\n");
+        free_dse(&dse);
+        exit(1);
+    }
+    if (jobs > dse.configs * dse.programs)
+    {
+        jobs = dse.configs * dse.programs;
+    }
+
+    dse.run = calloc((size_t)dse.configs * dse.programs, sizeof(DSE_Run));
+    threads = calloc(jobs, sizeof(pthread_t));
+    if (!dse.run || !threads)
+    {
+        free(threads);
+        free_dse(&dse);
+        exit(1);
+    }
+
+    start = host_time();
+    for (i = 0; i < jobs; ++i)
+    {
+        if (pthread_create(&threads[i], NULL, dse_thread, &dse))
+        {
+            /* Threads already started finish the sweep */
+            jobs = i;
+            break;
+        }
+    }
+    if (!jobs)
+    {
+        dse_thread(&dse);
+    }
+    for (i = 0; i < jobs; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    print_csv(&dse);
+    print_pareto(&dse, jobs ? jobs : 1, host_time() - start);
+
+    free(threads);
+    free_dse(&dse);
+    return 0;
+}
@@ -0,0 +1,548 @@
+/*
+ * apex_interval.c
+ * Contains APEX interval-parallel simulation implementation
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_interval.h"
+#include "apex_check.h"
+
+/* Host thread simulating intervals */
+typedef struct Interval_Thread
+{
+    APEX_Intervals *run;
+    int index;
+    pthread_t thread;
+} Interval_Thread;
+
+static double
+host_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* CPU time the calling host thread has used */
+static double
+thread_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+APEX_Intervals *
+APEX_intervals_init(const char *filename, const APEX_Config *config)
+{
+    APEX_Intervals *run;
+
+    if (config->cores > 1)
+    {
+        fprintf(stderr,
+                "APEX_Error: Interval simulation runs a single core\n");
+        return NULL;
+    }
+
+    run = calloc(1, sizeof(APEX_Intervals));
+    if (!run)
+    {
+        return NULL;
+    }
+
+    run->config = *config;
+    run->interval_size = config->interval_size;
+    run->warmup = config->interval_warmup;
+    run->host_threads = config->interval_threads;
+    run->code_memory = create_code_memory(filename, &run->code_memory_size);
+    if (!run->code_memory)
+    {
+        free(run);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&run->lock, NULL))
+    {
+        free(run->code_memory);
+        free(run);
+        return NULL;
+    }
+
+    if (ENABLE_DEBUG_MESSAGES)
+    {
+        fprintf(stderr,
+                "APEX_CPU: Initialized interval simulation, loaded %d "
+                "instructions\n",
+                run->code_memory_size);
+    }
+    return run;
+}
+
+void
+APEX_intervals_stop(APEX_Intervals *run)
+{
+    int i;
+
+    for (i = 0; i < run->count; ++i)
+    {
+        APEX_check_free(run->checkpoint[i]);
+    }
+    free(run->checkpoint);
+    free(run->checkpoint_at);
+    free(run->result);
+    free(run->full_cycles);
+    free(run->thread_seconds);
+    pthread_mutex_destroy(&run->lock);
+    free(run->code_memory);
+    free(run);
+}
+
+/* Copies the state of 'model' into the checkpoint of the next interval */
+static int
+add_checkpoint(APEX_Intervals *run, const APEX_Checker *model, int position)
+{
+    APEX_Checker *checkpoint;
+
+    if (run->count == run->checkpoint_size)
+    {
+        int size = run->checkpoint_size ? 2 * run->checkpoint_size : 64;
+        APEX_Checker **checkpoints = realloc(run->checkpoint,
+                                             size * sizeof(APEX_Checker *));
+        int *at;
+
+        if (!checkpoints)
+        {
+            return FALSE;
+        }
+        run->checkpoint = checkpoints;
+
+        at = realloc(run->checkpoint_at, size * sizeof(int));
+        if (!at)
+        {
+            return FALSE;
+        }
+        run->checkpoint_at = at;
+        run->checkpoint_size = size;
+    }
+
+    checkpoint = APEX_check_init(run->code_memory, run->code_memory_size,
+                                 model->pc);
+    if (!checkpoint)
+    {
+        return FALSE;
+    }
+    APEX_check_copy_state(checkpoint, model);
+
+    run->checkpoint[run->count] = checkpoint;
+    run->checkpoint_at[run->count++] = position;
+    return TRUE;
+}
+
+/*
+ * Runs the program on the functional model, dropping a checkpoint where
+ * the warm-up of every interval starts
+ */
+static int
+functional_pass(APEX_Intervals *run)
+{
+    APEX_Checker *model = APEX_check_init(run->code_memory,
+                                          run->code_memory_size, 4000);
+    int position = 0;
+
+    if (!model)
+    {
+        return FALSE;
+    }
+
+    while (position < SAMPLE_MAX_INSTRUCTIONS)
+    {
+        int pc = model->pc;
+        int opcode;
+
+        /* A warm-up longer than an interval starts several at once */
+        while ((long)run->count * run->interval_size - run->warmup
+               <= position)
+        {
+            if (!add_checkpoint(run, model, position))
+            {
+                APEX_check_free(model);
+                return FALSE;
+            }
+        }
+
+        opcode = APEX_check_step(model);
+        if (opcode < 0)
+        {
+            fprintf(stderr, "APEX_Error: Program faulted at pc %d in the "
+                            "functional pass\n", pc);
+            APEX_check_free(model);
+            return FALSE;
+        }
+
+        position++;
+        if (opcode == OPCODE_HALT)
+        {
+            run->halted = TRUE;
+            break;
+        }
+    }
+    APEX_check_free(model);
+    run->instructions = position;
+
+    /* Drop the checkpoints of intervals past the end of the program */
+    while (run->count > 0
+           && (long)(run->count - 1) * run->interval_size >= position)
+    {
+        APEX_check_free(run->checkpoint[--run->count]);
+    }
+    return TRUE;
+}
+
+/* Simulates intervals until none are left */
+static void *
+interval_thread(void *arg)
+{
+    Interval_Thread *thread = arg;
+    APEX_Intervals *run = thread->run;
+    double start = thread_time();
+
+    while (TRUE)
+    {
+        int interval;
+        int first;
+        int length;
+
+        pthread_mutex_lock(&run->lock);
+        interval = run->failed ? run->count : run->next++;
+        pthread_mutex_unlock(&run->lock);
+        if (interval >= run->count)
+        {
+            break;
+        }
+
+        first = interval * run->interval_size;
+        length = run->instructions - first < run->interval_size
+                     ? run->instructions - first
+                     : run->interval_size;
+        if (!APEX_sample_measure(run->code_memory, run->code_memory_size,
+                                 &run->config, run->checkpoint[interval],
+                                 first - run->checkpoint_at[interval], length,
+                                 &run->result[interval]))
+        {
+            pthread_mutex_lock(&run->lock);
+            run->failed = TRUE;
+            pthread_mutex_unlock(&run->lock);
+        }
+    }
+
+    run->thread_seconds[thread->index] = thread_time() - start;
+    return NULL;
+}
+
+/*
+ * Simulates the whole program in detail on one pipeline and records the
+ * cycles each interval took in it
+ */
+static int
+simulate_full(APEX_Intervals *run)
+{
+    APEX_CPU *cpu = APEX_cpu_init_code(run->code_memory,
+                                       run->code_memory_size, &run->config);
+    int boundary = 1;
+    int last = 0;
+    int cycles = 0;
+    int halted = FALSE;
+
+    if (!cpu)
+    {
+        return FALSE;
+    }
+
+    while (!halted && cpu->insn_completed < run->instructions)
+    {
+        halted = APEX_cpu_step(cpu);
+        cycles = halted ? cpu->clock + 1 : cpu->clock;
+        if (cpu->diverged)
+        {
+            APEX_cpu_stop(cpu);
+            return FALSE;
+        }
+
+        while (boundary < run->count
+               && cpu->insn_completed >= boundary * run->interval_size)
+        {
+            run->full_cycles[boundary - 1] = cycles - last;
+            last = cycles;
+            boundary++;
+        }
+    }
+
+    /* The last interval ends with the run */
+    run->full_cycles[boundary - 1] = cycles - last;
+    APEX_cpu_stop(cpu);
+    return TRUE;
+}
+
+/*
+ * Takes the checkpoints, then simulates every interval in detail on the
+ * host threads. Returns FALSE if a step failed or the checker stopped an
+ * interval.
+ */
+int
+APEX_intervals_run(APEX_Intervals *run)
+{
+    Interval_Thread *threads;
+    double start = host_time();
+    int cycles = 0;
+    int count;
+    int i;
+
+    if (!functional_pass(run))
+    {
+        fprintf(stderr, "APEX_Error: Unable to checkpoint the program\n");
+        return FALSE;
+    }
+    run->functional_seconds = host_time() - start;
+
+    count = run->host_threads < run->count ? run->host_threads : run->count;
+    run->result = calloc(run->count, sizeof(Sample_Measure));
+    run->full_cycles = calloc(run->count, sizeof(int));
+    run->thread_seconds = calloc(count, sizeof(double));
+    threads = calloc(count, sizeof(Interval_Thread));
+    if (!run->result || !run->full_cycles || !run->thread_seconds
+        || !threads)
+    {
+        free(threads);
+        return FALSE;
+    }
+
+    start = host_time();
+    for (i = 0; i < count; ++i)
+    {
+        threads[i].run = run;
+        threads[i].index = i;
+        if (pthread_create(&threads[i].thread, NULL, interval_thread,
+                           &threads[i]))
+        {
+            /* Threads already started finish the work */
+            count = i;
+            break;
+        }
+    }
+    if (!count)
+    {
+        free(threads);
+        return FALSE;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+    run->host_threads = count;
+    run->detailed_seconds = host_time() - start;
+    free(threads);
+
+    if (run->failed)
+    {
+        return FALSE;
+    }
+
+    if (run->config.interval_verify)
+    {
+        start = host_time();
+        if (!simulate_full(run))
+        {
+            return FALSE;
+        }
+        run->full_seconds = host_time() - start;
+        run->verified = TRUE;
+    }
+
+    for (i = 0; i < run->count; ++i)
+    {
+        cycles += run->result[i].cycles;
+    }
+    printf("APEX_CPU: Interval Simulation Complete, cycles = %d instructions "
+           "= %d\n",
+           cycles, run->instructions);
+    return TRUE;
+}
+
+/* Relative difference of an interval's cycles from the full run */
+static double
+interval_error(const APEX_Intervals *run, int interval)
+{
+    int full = run->full_cycles[interval];
+
+    if (!full)
+    {
+        return 0.0;
+    }
+    return fabs((double)run->result[interval].cycles - full) / full;
+}
+
+/* Prints how far the intervals drift from the same stretches of the full
+ * run */
+static void
+print_boundary_error(const APEX_Intervals *run, int cycles)
+{
+    int full = 0;
+    int worst = 0;
+    double mean = 0.0;
+    int i;
+
+    for (i = 0; i < run->count; ++i)
+    {
+        full += run->full_cycles[i];
+        mean += interval_error(run, i) / run->count;
+        if (interval_error(run, i) > interval_error(run, worst))
+        {
+            worst = i;
+        }
+    }
+
+    printf("Full run cycles  : %d (CPI %.3f)\n", full,
+           run->instructions ? (double)full / run->instructions : 0.0);
+    printf("Boundary error   : %.2f%% of all cycles, %.2f%% mean per "
+           "interval\n",
+           full ? 100.0 * fabs((double)cycles - full) / full : 0.0,
+           100.0 * mean);
+    printf("Worst interval   : #%d, %d cycles, %d in the full run\n", worst,
+           run->result[worst].cycles, run->full_cycles[worst]);
+}
+
+/* Sums the measurements of all intervals */
+static Sample_Measure
+total_measure(const APEX_Intervals *run)
+{
+    Sample_Measure total;
+    int i;
+
+    memset(&total, 0, sizeof(Sample_Measure));
+    for (i = 0; i < run->count && run->result; ++i)
+    {
+        total.warmed += run->result[i].warmed;
+        total.instructions += run->result[i].instructions;
+        total.cycles += run->result[i].cycles;
+        total.dcache_accesses += run->result[i].dcache_accesses;
+        total.dcache_misses += run->result[i].dcache_misses;
+        total.icache_accesses += run->result[i].icache_accesses;
+        total.icache_misses += run->result[i].icache_misses;
+    }
+    return total;
+}
+
+void
+APEX_intervals_print_stats(const APEX_Intervals *run)
+{
+    Sample_Measure total = total_measure(run);
+    double thread_seconds = 0.0;
+    int i;
+
+    for (i = 0; i < run->host_threads && run->thread_seconds; ++i)
+    {
+        thread_seconds += run->thread_seconds[i];
+    }
+
+    printf("----------\n%s\n----------\n", "INTERVAL SIMULATION");
+    printf("Instructions     : %d in %d intervals of %d%s\n",
+           run->instructions, run->count, run->interval_size,
+           run->halted ? "" : " (no HALT)");
+    printf("Warm-up          : %d instructions (%.1f%% extra)\n",
+           total.warmed,
+           total.instructions ? 100.0 * total.warmed / total.instructions
+                              : 0.0);
+    printf("Cycles           : %d\n", total.cycles);
+    printf("CPI              : %.3f\n",
+           total.instructions ? (double)total.cycles / total.instructions
+                              : 0.0);
+    printf("L1 data cache    : %d accesses, %d misses\n",
+           total.dcache_accesses, total.dcache_misses);
+    printf("L1 instr cache   : %d accesses, %d misses\n",
+           total.icache_accesses, total.icache_misses);
+    if (run->verified)
+    {
+        print_boundary_error(run, total.cycles);
+    }
+    printf("Host threads     : %d\n", run->host_threads);
+    printf("Host time        : %.3f s functional, %.3f s detailed",
+           run->functional_seconds, run->detailed_seconds);
+    if (run->verified)
+    {
+        printf(", %.3f s full", run->full_seconds);
+    }
+    printf("\n");
+
+    /* Only the full run measures a speedup. The CPU time the threads spent
+     * simulating over the wall time shows how busy they kept the host,
+     * which is no speedup on a host with fewer CPUs. */
+    printf("Thread CPU time  : %.3f s\n", thread_seconds);
+    printf("CPU / wall time  : %.2f\n",
+           run->detailed_seconds > 0 ? thread_seconds / run->detailed_seconds
+                                     : 0.0);
+    if (run->verified)
+    {
+        printf("Parallel speedup : %.2fx over the full run\n",
+               run->detailed_seconds > 0
+                   ? run->full_seconds / run->detailed_seconds
+                   : 0.0);
+    }
+    printf("\n");
+}
+
+static double
+stat_cycles(const void *owner)
+{
+    return total_measure(owner).cycles;
+}
+
+static double
+stat_warmed(const void *owner)
+{
+    return total_measure(owner).warmed;
+}
+
+static double
+stat_cpi(const void *owner)
+{
+    Sample_Measure total = total_measure(owner);
+
+    return total.instructions ? (double)total.cycles / total.instructions
+                              : 0.0;
+}
+
+static double
+stat_dcache_misses(const void *owner)
+{
+    return total_measure(owner).dcache_misses;
+}
+
+static double
+stat_icache_misses(const void *owner)
+{
+    return total_measure(owner).icache_misses;
+}
+
+void
+APEX_intervals_register_stats(const APEX_Intervals *run, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "instructions", &run->instructions);
+    APEX_stats_counter(stats, "intervals", &run->count);
+    APEX_stats_counter(stats, "interval_size", &run->interval_size);
+    APEX_stats_counter(stats, "halted", &run->halted);
+    APEX_stats_derived(stats, "cycles", stat_cycles, run);
+    APEX_stats_derived(stats, "cpi", stat_cpi, run);
+    APEX_stats_derived(stats, "warmed", stat_warmed, run);
+    APEX_stats_derived(stats, "dcache_misses", stat_dcache_misses, run);
+    APEX_stats_derived(stats, "icache_misses", stat_icache_misses, run);
+    APEX_stats_counter(stats, "host_threads", &run->host_threads);
+    APEX_stats_real(stats, "functional_seconds", &run->functional_seconds);
+    APEX_stats_real(stats, "detailed_seconds", &run->detailed_seconds);
+    APEX_stats_real(stats, "full_seconds", &run->full_seconds);
+}
@@ -0,0 +1,67 @@
+/*
+ * apex_interval.h
+ * Contains APEX interval-parallel simulation declarations
+ *
+ * An interval-parallel run simulates all of one long program in detail, on
+ * several host threads at once. A functional pass on the lockstep checker's
+ * model cuts the program into intervals of 'interval' instructions and
+ * drops an architectural checkpoint (PC, registers, flags and data memory)
+ * 'interval_warmup' instructions before the start of each. The intervals
+ * are then handed out to 'interval_threads' host threads. Every interval
+ * runs on its own pipeline, which starts empty at its checkpoint, warms its
+ * caches, prefetcher and queues over the warm-up instructions and is then
+ * measured over the interval. The measurements add up to the whole run.
+ *
+ * Every interval is simulated from the same checkpoint whichever thread
+ * runs it, so the results do not depend on the number of threads. What a
+ * real pipeline would carry across a boundary and a short warm-up does not
+ * rebuild is lost, which is the error of the method. With interval_verify=1
+ * the program is also simulated in full, and the cycles of every interval
+ * are compared with the same stretch of the full run.
+ */
+#ifndef _APEX_INTERVAL_H_
+#define _APEX_INTERVAL_H_
+
+#include <pthread.h>
+
+#include "apex_cpu.h"
+#include "apex_sample.h"
+
+/* Model of an interval-parallel simulation of one program */
+typedef struct APEX_Intervals
+{
+    APEX_Config config;
+    APEX_Instruction *code_memory;
+    int code_memory_size;
+    int interval_size;             /* Instructions per interval */
+    int warmup;                    /* Warm-up instructions before each */
+    int host_threads;
+    int count;                     /* Intervals */
+    int instructions;              /* Instructions in the whole program */
+    int halted;                    /* The functional pass ended at HALT */
+    struct APEX_Checker **checkpoint; /* State at each warm-up start */
+    int *checkpoint_at;            /* Instruction each checkpoint is taken at */
+    int checkpoint_size;           /* Checkpoints there is room for */
+    Sample_Measure *result;        /* Detailed measurement of each interval */
+    int *full_cycles;              /* Cycles of each interval in a full run */
+    int verified;                  /* The full run completed */
+
+    /* Work shared by the host threads */
+    pthread_mutex_t lock;
+    int next;                      /* Next interval to simulate */
+    int failed;
+    double *thread_seconds;        /* CPU time each thread spent simulating */
+
+    double functional_seconds;     /* Host time of each step */
+    double detailed_seconds;
+    double full_seconds;
+} APEX_Intervals;
+
+APEX_Intervals *APEX_intervals_init(const char *filename,
+                                    const APEX_Config *config);
+int APEX_intervals_run(APEX_Intervals *run);
+void APEX_intervals_print_stats(const APEX_Intervals *run);
+void APEX_intervals_register_stats(const APEX_Intervals *run,
+                                   APEX_Stats *stats);
+void APEX_intervals_stop(APEX_Intervals *run);
+#endif
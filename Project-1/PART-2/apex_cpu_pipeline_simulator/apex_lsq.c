@@ -0,0 +1,215 @@
+/*
+ * apex_lsq.c
+ * Contains APEX load/store queue implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_lsq.h"
+#include "apex_macros.h"
+
+/* Index of the entry following 'index' in the circular queue */
+static int
+lsq_next(const APEX_LSQ *lsq, int index)
+{
+    return (index + 1) % lsq->size;
+}
+
+/* Index of the entry preceding 'index' in the circular queue */
+static int
+lsq_prev(const APEX_LSQ *lsq, int index)
+{
+    return (index + lsq->size - 1) % lsq->size;
+}
+
+int
+APEX_lsq_init(APEX_LSQ *lsq, int size)
+{
+    memset(lsq, 0, sizeof(APEX_LSQ));
+
+    if (size <= 0)
+    {
+        return FALSE;
+    }
+
+    lsq->entries = calloc(size, sizeof(LSQ_Entry));
+    lsq->occupancy = calloc(size + 1, sizeof(int));
+    if (!lsq->entries || !lsq->occupancy)
+    {
+        APEX_lsq_free(lsq);
+        return FALSE;
+    }
+
+    lsq->size = size;
+    return TRUE;
+}
+
+void
+APEX_lsq_free(APEX_LSQ *lsq)
+{
+    free(lsq->entries);
+    free(lsq->occupancy);
+    lsq->entries = NULL;
+    lsq->occupancy = NULL;
+}
+
+int
+APEX_lsq_full(const APEX_LSQ *lsq)
+{
+    return lsq->count == lsq->size;
+}
+
+/*
+ * Allocates a new entry at the tail of the queue, returns its index.
+ * Caller must check APEX_lsq_full() first.
+ */
+int
+APEX_lsq_allocate(APEX_LSQ *lsq, int is_store, int pc, int address, int data)
+{
+    int index = lsq->tail;
+    LSQ_Entry *entry = &lsq->entries[index];
+
+    entry->valid = 1;
+    entry->is_store = is_store;
+    entry->pc = pc;
+    entry->address = address;
+    entry->data = data;
+    entry->performed = 0;
+
+    lsq->tail = lsq_next(lsq, lsq->tail);
+    lsq->count++;
+    if (lsq->count > lsq->max_count)
+    {
+        lsq->max_count = lsq->count;
+    }
+
+    if (is_store)
+    {
+        lsq->stores++;
+    }
+    else
+    {
+        lsq->loads++;
+    }
+
+    return index;
+}
+
+/*
+ * Performs the load at 'index'. Older stores are searched from youngest to
+ * oldest; on an address match the store data is forwarded into *data.
+ * Otherwise the caller reads data memory.
+ */
+int
+APEX_lsq_load(APEX_LSQ *lsq, int index, int *data)
+{
+    LSQ_Entry *load = &lsq->entries[index];
+    int older_stores = 0;
+    int i;
+
+    load->performed = 1;
+
+    for (i = index; i != lsq->head;)
+    {
+        i = lsq_prev(lsq, i);
+        if (!lsq->entries[i].valid || !lsq->entries[i].is_store)
+        {
+            continue;
+        }
+
+        if (lsq->entries[i].address == load->address)
+        {
+            *data = lsq->entries[i].data;
+            lsq->forwards++;
+            return LSQ_LOAD_FORWARDED;
+        }
+
+        older_stores++;
+    }
+
+    if (older_stores)
+    {
+        lsq->bypasses++;
+        return LSQ_LOAD_BYPASSED;
+    }
+
+    return LSQ_LOAD_MEMORY;
+}
+
+/* Marks the store at 'index' as retired, it may now drain to memory */
+void
+APEX_lsq_commit(APEX_LSQ *lsq, int index)
+{
+    lsq->entries[index].performed = 1;
+}
+
+/*
+ * Frees completed loads at the head of the queue and writes at most one
+ * retired store to data memory. Returns the drained store, or NULL if the
+ * memory port was not used.
+ */
+const LSQ_Entry *
+APEX_lsq_drain(APEX_LSQ *lsq, int *data_memory)
+{
+    while (lsq->count)
+    {
+        LSQ_Entry *entry = &lsq->entries[lsq->head];
+
+        if (!entry->performed)
+        {
+            return NULL;
+        }
+
+        entry->valid = 0;
+        lsq->head = lsq_next(lsq, lsq->head);
+        lsq->count--;
+
+        if (entry->is_store)
+        {
+            data_memory[entry->address] = entry->data;
+            lsq->drained++;
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Writes back every retired store, used when the simulation halts */
+void
+APEX_lsq_drain_all(APEX_LSQ *lsq, int *data_memory)
+{
+    while (lsq->count && lsq->entries[lsq->head].performed)
+    {
+        APEX_lsq_drain(lsq, data_memory);
+    }
+}
+
+void
+APEX_lsq_print_stats(const APEX_LSQ *lsq)
+{
+    printf("----------\n%s\n----------\n", "LOAD/STORE QUEUE");
+    printf("Size             : %d (peak occupancy %d)\n", lsq->size,
+           lsq->max_count);
+    printf("Loads / Stores   : %d / %d\n", lsq->loads, lsq->stores);
+    printf("Forwarded loads  : %d\n", lsq->forwards);
+    printf("Bypassing loads  : %d\n", lsq->bypasses);
+    printf("Full stalls      : %d\n", lsq->full_stalls);
+    printf("Drained stores   : %d\n", lsq->drained);
+    printf("\n");
+}
+
+void
+APEX_lsq_register_stats(const APEX_LSQ *lsq, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "size", &lsq->size);
+    APEX_stats_counter(stats, "peak", &lsq->max_count);
+    APEX_stats_counter(stats, "loads", &lsq->loads);
+    APEX_stats_counter(stats, "stores", &lsq->stores);
+    APEX_stats_counter(stats, "forwards", &lsq->forwards);
+    APEX_stats_counter(stats, "bypasses", &lsq->bypasses);
+    APEX_stats_counter(stats, "full_stalls", &lsq->full_stalls);
+    APEX_stats_counter(stats, "drained", &lsq->drained);
+    APEX_stats_histogram(stats, "occupancy", lsq->occupancy, lsq->size + 1);
+}
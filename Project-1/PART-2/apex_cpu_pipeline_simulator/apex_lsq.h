@@ -0,0 +1,68 @@
+/*
+ * apex_lsq.h
+ * Contains APEX load/store queue declarations
+ *
+ * The load/store queue sits between Execute and Memory. Entries are
+ * allocated in program order when a memory instruction computes its address
+ * in Execute. Loads search older stores for a matching address and take the
+ * store data directly (store-to-load forwarding), or bypass older stores to
+ * different addresses. Stores leave the queue only after they retire in
+ * Writeback, draining to data memory when the memory port is free.
+ *
+ * Entries are allocated in program order with their address already known,
+ * so no load can read memory ahead of an older store whose address is still
+ * unknown, and there are no ordering violations to detect.
+ */
+#ifndef _APEX_LSQ_H_
+#define _APEX_LSQ_H_
+
+#include "apex_stats.h"
+
+/* Result of a load lookup in the load/store queue */
+#define LSQ_LOAD_MEMORY 0x0    /* No older pending store, read data memory */
+#define LSQ_LOAD_FORWARDED 0x1 /* Data forwarded from an older store */
+#define LSQ_LOAD_BYPASSED 0x2  /* Read data memory past older stores */
+
+/* Format of a load/store queue entry */
+typedef struct LSQ_Entry
+{
+    int valid;
+    int is_store;
+    int pc;
+    int address;
+    int data;
+    int performed; /* Load has read its value, store has retired */
+} LSQ_Entry;
+
+/* Model of the load/store queue */
+typedef struct APEX_LSQ
+{
+    LSQ_Entry *entries;
+    int size;
+    int head;
+    int tail;
+    int count;
+    int max_count;
+
+    /* Statistics */
+    int loads;
+    int stores;
+    int forwards;
+    int bypasses;
+    int full_stalls;
+    int drained;
+    int *occupancy;  /* Cycles spent holding each count, size + 1 buckets */
+} APEX_LSQ;
+
+int APEX_lsq_init(APEX_LSQ *lsq, int size);
+void APEX_lsq_free(APEX_LSQ *lsq);
+int APEX_lsq_full(const APEX_LSQ *lsq);
+int APEX_lsq_allocate(APEX_LSQ *lsq, int is_store, int pc, int address,
+                      int data);
+int APEX_lsq_load(APEX_LSQ *lsq, int index, int *data);
+void APEX_lsq_commit(APEX_LSQ *lsq, int index);
+const LSQ_Entry *APEX_lsq_drain(APEX_LSQ *lsq, int *data_memory);
+void APEX_lsq_drain_all(APEX_LSQ *lsq, int *data_memory);
+void APEX_lsq_print_stats(const APEX_LSQ *lsq);
+void APEX_lsq_register_stats(const APEX_LSQ *lsq, APEX_Stats *stats);
+#endif
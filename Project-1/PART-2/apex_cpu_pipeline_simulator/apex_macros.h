@@ -18,6 +18,78 @@
 /* Size of integer register file */
 #define REG_FILE_SIZE 32
 
+/* Default number of load/store queue entries */
+#define LSQ_SIZE 8
+
+/* Default L1 data cache, a size of 0 disables it */
+#define DCACHE_SIZE 1024
+#define DCACHE_ASSOC 2
+#define DCACHE_LINE_SIZE 16
+#define DCACHE_REPLACEMENT CACHE_REPL_LRU
+#define DCACHE_WRITE_POLICY CACHE_WRITE_BACK
+#define DCACHE_WRITE_ALLOCATE 1
+#define DCACHE_MISS_LATENCY 10
+
+/* Default L1 instruction cache, a size of 0 disables it */
+#define ICACHE_SIZE 256
+#define ICACHE_ASSOC 2
+#define ICACHE_LINE_SIZE 16
+#define ICACHE_REPLACEMENT CACHE_REPL_LRU
+#define ICACHE_MISS_LATENCY 10
+#define ICACHE_NEXT_LINE_PREFETCH 1
+
+/* Default stride prefetcher into the data cache, a table size of 0
+ * disables it */
+#define PREFETCH_TABLE_SIZE 16
+#define PREFETCH_DEGREE 2
+#define PREFETCH_DISTANCE 1
+
+/* Resolve conditional branches in Decode instead of Execute, 0 disables */
+#define EARLY_BRANCH_RESOLUTION 0
+
+/* Decoupled front end: fetch target queue and instruction buffer entries,
+ * and sequential prefetching of queued fetch targets into the i-cache */
+#define FTQ_SIZE 4
+#define IBUF_SIZE 4
+#define SEQ_PREFETCH 1
+
+/* Fuse CMP/CML/ADDL/SUBL with a following conditional branch, 0 disables */
+#define MACRO_OP_FUSION 0
+
+/* Default number of cores sharing data memory, and the extra cycles of a
+ * coherence flush or upgrade on the snooping bus */
+#define CORES 1
+#define COHERENCE_LATENCY 4
+
+/* Step the cores of a multicore system on separate host threads, 0
+ * disables, the cycles they run between two barriers, and a sequential run
+ * to measure the error of the parallel one */
+#define PARALLEL 0
+#define QUANTUM 100
+#define PARALLEL_VERIFY 0
+
+/* Check every retirement against a functional model, 0 disables */
+#define LOCKSTEP_CHECK 0
+
+/* Sampled simulation: instructions per interval, 0 disables, the most
+ * phases tried, detailed warm-up instructions before each interval, and a
+ * full detailed run to measure the error of the estimate */
+#define SAMPLE_INTERVAL 0
+#define SAMPLE_PHASES 10
+#define SAMPLE_WARMUP 100
+#define SAMPLE_VERIFY 0
+
+/* Interval-parallel simulation: instructions per interval, 0 disables,
+ * detailed warm-up instructions before each interval, host threads, and a
+ * full detailed run to measure the error at interval boundaries */
+#define INTERVAL_SIZE 0
+#define INTERVAL_WARMUP 100
+#define INTERVAL_THREADS 4
+#define INTERVAL_VERIFY 0
+
+/* Longest path of the files stats=, trace= and itrace= write */
+#define STATS_PATH_SIZE 256
+
 /* Numeric OPCODE identifiers for instructions */
 #define OPCODE_ADD 0x0
 #define OPCODE_SUB 0x1
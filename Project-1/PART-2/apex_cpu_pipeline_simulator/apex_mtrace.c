@@ -0,0 +1,216 @@
+/*
+ * apex_mtrace.c
+ * Memory trace tool for the APEX pipeline
+ *
+ * Reads a trace apex_sim wrote with its trace= option and either prints
+ * every record:
+ *
+ *   ./apex_mtrace run.trace dump
+ *
+ * which also prints the instruction traces of the itrace= option, or
+ * replays the accesses through a data cache and stride prefetcher set
+ * up by the dcache_* and prefetch_* options of apex_sim, which explores
+ * cache shapes without simulating the program again:
+ *
+ *   ./apex_mtrace run.trace dcache_size=4096 dcache_assoc=4 stats=out.json
+ *
+ * Loads the load/store queue forwarded did not reach the cache and are
+ * skipped by the replay. The pipeline trains the prefetcher in Execute,
+ * the replay just before each access, so prefetches arrive relatively
+ * later here and a few more of them are late.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "APEX_Help: Usage %s <trace> [dump] [name=value ...]\n",
+            name);
+    exit(1);
+}
+
+static int
+dump_trace(APEX_Trace_Reader *reader)
+{
+    Trace_Record record;
+    int status;
+
+    if (reader->kind == TRACE_INSN)
+    {
+        printf("%-9s %-9s %-9s %-5s %-5s %-5s %-9s %s\n", "cycle", "pc",
+               "opcode", "rd", "rs1", "rs2", "address", "taken");
+        while ((status = APEX_trace_read(reader, &record)) > 0)
+        {
+            printf("%-9d %-9d %-9d %-5d %-5d %-5d ", record.cycle, record.pc,
+                   record.opcode, record.rd, record.rs1, record.rs2);
+            if (record.flags & TRACE_ADDRESS)
+            {
+                printf("%-9d ", record.address);
+            }
+            else
+            {
+                printf("%-9s ", "-");
+            }
+            printf("%s\n", record.flags & TRACE_TAKEN ? "yes" : "no");
+        }
+        return status == 0;
+    }
+
+    printf("%-9s %-9s %-9s %-9s %s\n", "cycle", "access", "pc", "address",
+           "size");
+    while ((status = APEX_trace_read(reader, &record)) > 0)
+    {
+        printf("%-9d %-9s %-9d %-9d %d\n", record.cycle,
+               record.flags & TRACE_STORE       ? "store"
+               : record.flags & TRACE_FORWARDED ? "forwarded"
+                                                : "load",
+               record.pc, record.address, record.size);
+    }
+    return status == 0;
+}
+
+static int
+replay_trace(APEX_Trace_Reader *reader, const APEX_Config *config)
+{
+    APEX_Cache cache;
+    APEX_Prefetcher prefetcher;
+    Trace_Record record;
+    int loads = 0;
+    int stores = 0;
+    int forwarded = 0;
+    int last_cycle = 0;
+    int status;
+
+    if (!APEX_cache_init(&cache, "L1 DATA CACHE", &config->dcache, 0))
+    {
+        fprintf(stderr, "APEX_Error: Invalid data cache configuration\n");
+        return FALSE;
+    }
+    if (!APEX_prefetcher_init(&prefetcher, config->prefetch_table_size,
+                              config->prefetch_degree,
+                              config->prefetch_distance))
+    {
+        fprintf(stderr, "APEX_Error: Invalid prefetcher configuration\n");
+        APEX_cache_free(&cache);
+        return FALSE;
+    }
+
+    while ((status = APEX_trace_read(reader, &record)) > 0)
+    {
+        last_cycle = record.cycle;
+        APEX_prefetcher_access(&prefetcher, &cache, record.pc, record.address,
+                               record.cycle);
+        if (record.flags & TRACE_FORWARDED)
+        {
+            forwarded++;
+            continue;
+        }
+
+        if (record.flags & TRACE_STORE)
+        {
+            stores++;
+        }
+        else
+        {
+            loads++;
+        }
+        APEX_cache_access(&cache, record.address, record.flags & TRACE_STORE,
+                          -1, record.cycle);
+    }
+
+    printf("----------\n%s\n----------\n", "TRACE REPLAY");
+    printf("Records          : %d (loads %d, stores %d, forwarded %d)\n",
+           loads + stores + forwarded, loads, stores, forwarded);
+    printf("Last cycle       : %d\n", last_cycle);
+    printf("\n");
+    APEX_cache_print_stats(&cache);
+    APEX_prefetcher_print_stats(&prefetcher, &cache);
+
+    if (config->stats[0])
+    {
+        APEX_Stats stats;
+
+        APEX_stats_init(&stats);
+        APEX_stats_enter(&stats, "config");
+        APEX_config_register_stats(config, &stats);
+        APEX_stats_leave(&stats);
+        APEX_stats_enter(&stats, "replay");
+        APEX_stats_counter(&stats, "loads", &loads);
+        APEX_stats_counter(&stats, "stores", &stores);
+        APEX_stats_counter(&stats, "forwarded", &forwarded);
+        APEX_stats_leave(&stats);
+        APEX_stats_enter(&stats, "dcache");
+        APEX_cache_register_stats(&cache, &stats);
+        APEX_stats_leave(&stats);
+        APEX_stats_enter(&stats, "prefetcher");
+        APEX_prefetcher_register_stats(&prefetcher, &stats);
+        APEX_stats_leave(&stats);
+        APEX_stats_write(&stats, config->stats);
+        APEX_stats_free(&stats);
+    }
+
+    APEX_prefetcher_free(&prefetcher);
+    APEX_cache_free(&cache);
+    return status == 0;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_Config config;
+    APEX_Trace_Reader *reader;
+    const char *path = NULL;
+    int dump = FALSE;
+    int ok;
+    int i;
+
+    APEX_config_init(&config);
+    for (i = 1; i < argc; ++i)
+    {
+        if (strchr(argv[i], '='))
+        {
+            if (!APEX_config_set(&config, argv[i]))
+            {
+                fprintf(stderr, "APEX_Error: Invalid option %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (!path)
+        {
+            path = argv[i];
+        }
+        else if (strcmp(argv[i], "dump") == 0 && !dump)
+        {
+            dump = TRUE;
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    if (!path)
+    {
+        usage(argv[0]);
+    }
+
+    reader = APEX_trace_reader_open(path);
+    if (!reader)
+    {
+        exit(1);
+    }
+    if (!dump && reader->kind != TRACE_MEMORY)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a memory trace\n", path);
+        APEX_trace_reader_close(reader);
+        exit(1);
+    }
+
+    ok = dump ? dump_trace(reader) : replay_trace(reader, &config);
+    APEX_trace_reader_close(reader);
+    return !ok;
+}
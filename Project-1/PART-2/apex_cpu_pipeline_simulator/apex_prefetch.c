@@ -0,0 +1,206 @@
+/*
+ * apex_prefetch.c
+ * Contains APEX stride prefetcher implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_prefetch.h"
+
+int
+APEX_prefetcher_init(APEX_Prefetcher *prefetcher, int size, int degree,
+                     int distance)
+{
+    memset(prefetcher, 0, sizeof(APEX_Prefetcher));
+
+    if (size == 0)
+    {
+        return TRUE;
+    }
+
+    if (size < 0 || degree < 1 || distance < 1)
+    {
+        return FALSE;
+    }
+
+    prefetcher->table = calloc(size, sizeof(RPT_Entry));
+    if (!prefetcher->table)
+    {
+        return FALSE;
+    }
+
+    prefetcher->size = size;
+    prefetcher->degree = degree;
+    prefetcher->distance = distance;
+    return TRUE;
+}
+
+void
+APEX_prefetcher_free(APEX_Prefetcher *prefetcher)
+{
+    free(prefetcher->table);
+    prefetcher->table = NULL;
+}
+
+/*
+ * Trains the table with a load/store of 'pc' to 'address' and issues
+ * prefetches into 'cache' for steady entries. Prefetched lines arrive one
+ * cache miss latency after 'now'.
+ */
+void
+APEX_prefetcher_access(APEX_Prefetcher *prefetcher, APEX_Cache *cache,
+                       int pc, int address, int now)
+{
+    RPT_Entry *entry;
+    int stride;
+    int correct;
+    int line;
+    int step;
+    int i;
+
+    if (!prefetcher->table)
+    {
+        return;
+    }
+
+    prefetcher->lookups++;
+    entry = &prefetcher->table[((unsigned int)pc >> 2) % prefetcher->size];
+
+    if (!entry->valid || entry->pc != pc)
+    {
+        entry->valid = TRUE;
+        entry->pc = pc;
+        entry->prev_address = address;
+        entry->stride = 0;
+        entry->state = RPT_INITIAL;
+        entry->last_line = -1;
+        return;
+    }
+
+    stride = address - entry->prev_address;
+    correct = stride == entry->stride;
+    entry->prev_address = address;
+
+    switch (entry->state)
+    {
+        case RPT_INITIAL:
+        case RPT_TRANSIENT:
+        {
+            if (correct)
+            {
+                entry->state = RPT_STEADY;
+            }
+            else
+            {
+                entry->stride = stride;
+                entry->state = entry->state == RPT_INITIAL
+                                   ? RPT_TRANSIENT : RPT_NO_PREDICTION;
+            }
+            break;
+        }
+
+        case RPT_STEADY:
+        {
+            if (!correct)
+            {
+                entry->state = RPT_INITIAL;
+            }
+            break;
+        }
+
+        case RPT_NO_PREDICTION:
+        {
+            if (correct)
+            {
+                entry->state = RPT_TRANSIENT;
+            }
+            else
+            {
+                entry->stride = stride;
+            }
+            break;
+        }
+    }
+
+    if (entry->state != RPT_STEADY || entry->stride == 0)
+    {
+        return;
+    }
+
+    /* 'degree' consecutive lines in the direction of the stride, starting
+     * with the one 'distance' strides ahead. A stride shorter than a line
+     * triggers several times per line, only the first one prefetches. */
+    prefetcher->steady_hits++;
+    step = 1 << cache->offset_bits;
+    line = (address + entry->stride * prefetcher->distance) & -step;
+    if (line == entry->last_line)
+    {
+        return;
+    }
+    entry->last_line = line;
+    if (entry->stride < 0)
+    {
+        step = -step;
+    }
+
+    for (i = 0; i < prefetcher->degree; ++i)
+    {
+        int target = line + step * i;
+
+        prefetcher->candidates++;
+        if (APEX_cache_prefetch(cache, target,
+                                now + cache->config.miss_latency))
+        {
+            prefetcher->issued++;
+        }
+    }
+}
+
+void
+APEX_prefetcher_print_stats(const APEX_Prefetcher *prefetcher,
+                            const APEX_Cache *cache)
+{
+    int useful = cache->useful_prefetches;
+    int uncovered = cache->misses - cache->late_prefetches;
+
+    printf("----------\n%s\n----------\n", "STRIDE PREFETCHER");
+    if (!prefetcher->table)
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    printf("Table            : %d entries, degree %d, distance %d\n",
+           prefetcher->size, prefetcher->degree, prefetcher->distance);
+    printf("Lookups          : %d (steady %d)\n", prefetcher->lookups,
+           prefetcher->steady_hits);
+    printf("Prefetches       : %d issued, %d already cached\n",
+           prefetcher->issued, prefetcher->candidates - prefetcher->issued);
+    printf("Useful / Late    : %d / %d\n", useful, cache->late_prefetches);
+
+    /* Accuracy: issued prefetches that were used. Coverage: misses removed
+     * out of the misses there would have been, late ones being counted as
+     * misses by the cache already. Timeliness: used prefetches that arrived
+     * before the demand access. */
+    printf("Accuracy         : %.2f%%\n",
+           prefetcher->issued ? 100.0 * useful / prefetcher->issued : 0.0);
+    printf("Coverage         : %.2f%%\n",
+           useful + uncovered ? 100.0 * useful / (useful + uncovered) : 0.0);
+    printf("Timeliness       : %.2f%%\n",
+           useful ? 100.0 * (useful - cache->late_prefetches) / useful : 0.0);
+    printf("\n");
+}
+
+/* Accuracy and the other rates need the cache, the CPU registers them */
+void
+APEX_prefetcher_register_stats(const APEX_Prefetcher *prefetcher,
+                               APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "table_size", &prefetcher->size);
+    APEX_stats_counter(stats, "lookups", &prefetcher->lookups);
+    APEX_stats_counter(stats, "steady_hits", &prefetcher->steady_hits);
+    APEX_stats_counter(stats, "candidates", &prefetcher->candidates);
+    APEX_stats_counter(stats, "issued", &prefetcher->issued);
+}
@@ -0,0 +1,57 @@
+/*
+ * apex_prefetch.h
+ * Contains APEX stride prefetcher declarations
+ *
+ * A reference prediction table (RPT) indexed by the PC of a load or store
+ * remembers the last address and stride of that instruction. Once the same
+ * stride has been seen twice in a row the entry is steady and prefetches
+ * 'degree' consecutive lines in the direction of the stride into the data
+ * cache, the first one holding the address 'distance' strides ahead.
+ */
+#ifndef _APEX_PREFETCH_H_
+#define _APEX_PREFETCH_H_
+
+#include "apex_cache.h"
+
+/* States of a reference prediction table entry */
+#define RPT_INITIAL 0x0
+#define RPT_TRANSIENT 0x1
+#define RPT_STEADY 0x2
+#define RPT_NO_PREDICTION 0x3
+
+/* Format of a reference prediction table entry */
+typedef struct RPT_Entry
+{
+    int valid;
+    int pc;
+    int prev_address;
+    int stride;
+    int state;
+    int last_line;       /* First line the last prefetch asked for */
+} RPT_Entry;
+
+/* Model of the stride prefetcher, a table size of 0 disables it */
+typedef struct APEX_Prefetcher
+{
+    RPT_Entry *table;
+    int size;
+    int degree;
+    int distance;
+
+    /* Statistics */
+    int lookups;
+    int steady_hits;
+    int candidates;
+    int issued;
+} APEX_Prefetcher;
+
+int APEX_prefetcher_init(APEX_Prefetcher *prefetcher, int size, int degree,
+                         int distance);
+void APEX_prefetcher_free(APEX_Prefetcher *prefetcher);
+void APEX_prefetcher_access(APEX_Prefetcher *prefetcher, APEX_Cache *cache,
+                            int pc, int address, int now);
+void APEX_prefetcher_print_stats(const APEX_Prefetcher *prefetcher,
+                                 const APEX_Cache *cache);
+void APEX_prefetcher_register_stats(const APEX_Prefetcher *prefetcher,
+                                    APEX_Stats *stats);
+#endif
@@ -0,0 +1,1215 @@
+/*
+ * apex_replay.c
+ * Contains APEX trace-driven timing model implementation
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_replay.h"
+
+/* Cycle of an event that does not happen */
+#define REPLAY_NEVER (INT_MAX / 2)
+
+/* Registers an instruction reads or writes */
+#define USES_RD 0x1
+#define USES_RS1 0x2
+#define USES_RS2 0x4
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static double
+host_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int
+code_index(int pc)
+{
+    return (pc - 4000) / 4;
+}
+
+static int
+is_conditional_branch(int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ || opcode == OPCODE_BP
+           || opcode == OPCODE_BNP || opcode == OPCODE_BN
+           || opcode == OPCODE_BNN;
+}
+
+static int
+is_memory_insn(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_LOADP
+           || opcode == OPCODE_STORE || opcode == OPCODE_STOREP;
+}
+
+static int
+is_load(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_LOADP;
+}
+
+static int
+operands(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+            return USES_RD | USES_RS1 | USES_RS2;
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+        case OPCODE_CMP:
+            return USES_RS1 | USES_RS2;
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        case OPCODE_JALR:
+            return USES_RD | USES_RS1;
+        case OPCODE_MOVC:
+            return USES_RD;
+        case OPCODE_CML:
+        case OPCODE_JUMP:
+            return USES_RS1;
+    }
+    return 0;
+}
+
+/* Registers whose flags Writeback clears, as APEX_writeback() does */
+static void
+flags_cleared(const Trace_Record *insn, int clear[2])
+{
+    clear[0] = -1;
+    clear[1] = -1;
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LOAD:
+        case OPCODE_MOVC:
+        case OPCODE_JALR:
+            clear[0] = insn->rd;
+            break;
+        case OPCODE_LOADP:
+            clear[0] = insn->rd;
+            clear[1] = insn->rs1;
+            break;
+        case OPCODE_STOREP:
+            clear[0] = insn->rs2;
+            break;
+    }
+}
+
+/* executeStageBufferRegister once 'insn' has executed */
+static int
+execute_register(const Trace_Record *insn, int reg)
+{
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_MOVC:
+        case OPCODE_JALR:
+            return insn->rd;
+        case OPCODE_LOADP:
+            return insn->rs1;
+        case OPCODE_STOREP:
+            return insn->rs2;
+    }
+    return reg;
+}
+
+/* memStageBufferRegister once 'insn' has left Memory */
+static int
+memory_register(const Trace_Record *insn, int reg)
+{
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_MOVC:
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+            return insn->rd;
+    }
+    return reg;
+}
+
+static Replay_Op *
+history_op(const APEX_Replay *replay, int age)
+{
+    return &replay->history[(replay->ops - age) & (replay->history_size - 1)];
+}
+
+/*
+ * Fills the code map from the instructions of the trace, checking each
+ * one could be an instruction of a program.
+ */
+static int
+build_code_map(APEX_Replay *replay, const Trace_Record *records, int count)
+{
+    int size = 0;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        const Trace_Record *insn = &records[i];
+        int uses = operands(insn->opcode);
+
+        if (insn->pc < 4000 || (insn->pc - 4000) % 4 || insn->opcode < 0
+            || insn->opcode > OPCODE_LOADP
+            || ((uses & USES_RD)
+                && (insn->rd < 0 || insn->rd >= REG_FILE_SIZE))
+            || ((uses & USES_RS1)
+                && (insn->rs1 < 0 || insn->rs1 >= REG_FILE_SIZE))
+            || ((uses & USES_RS2)
+                && (insn->rs2 < 0 || insn->rs2 >= REG_FILE_SIZE)))
+        {
+            fprintf(stderr, "APEX_Error: Invalid instruction %d in the trace\n",
+                    i);
+            return FALSE;
+        }
+        if (code_index(insn->pc) >= size)
+        {
+            size = code_index(insn->pc) + 1;
+        }
+    }
+
+    free(replay->code);
+    replay->code = malloc((size ? size : 1) * sizeof(int));
+    if (!replay->code)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for the code map\n");
+        return FALSE;
+    }
+    memset(replay->code, 0xff, size * sizeof(int));
+    replay->code_size = size;
+
+    for (i = 0; i < count; ++i)
+    {
+        int *opcode = &replay->code[code_index(records[i].pc)];
+
+        if (*opcode >= 0 && *opcode != records[i].opcode)
+        {
+            fprintf(stderr, "APEX_Error: Two instructions at PC %d in the "
+                            "trace\n", records[i].pc);
+            return FALSE;
+        }
+        *opcode = records[i].opcode;
+    }
+    return TRUE;
+}
+
+/*
+ * Instructions in the instruction buffer when Fetch runs in 'cycle', and
+ * in *next the cycle Decode takes the oldest of them. The right path ones
+ * are those Decode takes after 'cycle'.
+ */
+static int
+ibuf_count(const APEX_Replay *replay, int cycle, int *next)
+{
+    int count = 0;
+    int age;
+
+    *next = REPLAY_NEVER;
+    for (age = 1; age <= replay->ops && age <= replay->config.ibuf_size; ++age)
+    {
+        const Replay_Op *op = history_op(replay, age);
+
+        if (op->take <= cycle)
+        {
+            break;
+        }
+        count++;
+        *next = op->take;
+    }
+
+    if (replay->wrong_fetched)
+    {
+        count += replay->wrong_fetched;
+        if (replay->wrong_take <= cycle)
+        {
+            count--;
+        }
+        else if (replay->wrong_take < *next)
+        {
+            *next = replay->wrong_take;
+        }
+    }
+    return count;
+}
+
+/* Fuses the instruction Fetch read at 'pc' with the next, as
+ * fuse_with_branch() does */
+static int
+fuse_with_branch(APEX_Replay *replay, int pc, int opcode)
+{
+    int next_pc = pc + 4;
+
+    switch (opcode)
+    {
+        case OPCODE_CMP:
+        case OPCODE_CML:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+            break;
+
+        default:
+            return FALSE;
+    }
+
+    if (code_index(next_pc) >= replay->code_size
+        || !is_conditional_branch(replay->code[code_index(next_pc)]))
+    {
+        return FALSE;
+    }
+
+    if (APEX_cache_enabled(&replay->icache)
+        && next_pc / replay->config.icache.line_size
+               != pc / replay->config.icache.line_size)
+    {
+        return FALSE;
+    }
+
+    if (replay->ftq_count && replay->ftq[replay->ftq_head] == next_pc)
+    {
+        replay->ftq_head = (replay->ftq_head + 1) % replay->config.ftq_size;
+        replay->ftq_count--;
+    }
+    else if (replay->fetch_pc == next_pc)
+    {
+        replay->fetch_pc += 4;
+    }
+    else
+    {
+        return FALSE;
+    }
+
+    switch (opcode)
+    {
+        case OPCODE_CMP:
+            replay->fused_cmp++;
+            break;
+        case OPCODE_CML:
+            replay->fused_cml++;
+            break;
+        case OPCODE_ADDL:
+            replay->fused_addl++;
+            break;
+        case OPCODE_SUBL:
+            replay->fused_subl++;
+            break;
+    }
+    return TRUE;
+}
+
+/*
+ * Runs Fetch as APEX_fetch() does, from replay->fetch_cycle. On the right
+ * path ('until' is REPLAY_NEVER) it stops once it has fetched 'pc' and
+ * returns that cycle, -1 if Fetch reads something else or nothing at all.
+ * On the wrong path it runs up to 'until' and returns 0.
+ *
+ * Cycles in which nothing can change are skipped over at once.
+ */
+static int
+run_fetch(APEX_Replay *replay, int pc, int until, int *fused)
+{
+    int wrong = until != REPLAY_NEVER;
+
+    while (replay->fetch_cycle <= until)
+    {
+        int cycle = replay->fetch_cycle;
+        int queued = FALSE;
+        int count, next, fetch_pc, opcode;
+
+        if (!replay->fetching)
+        {
+            if (!wrong)
+            {
+                return -1;
+            }
+            replay->fetch_cycle = until + 1;
+            break;
+        }
+
+        /* Queue the next sequential fetch target */
+        if (replay->ftq_count < replay->config.ftq_size
+            && code_index(replay->fetch_pc) < replay->code_size)
+        {
+            replay->ftq[(replay->ftq_head + replay->ftq_count)
+                        % replay->config.ftq_size]
+                = replay->fetch_pc;
+            replay->ftq_count++;
+            if (replay->config.seq_prefetch)
+            {
+                APEX_cache_prefetch(&replay->icache, replay->fetch_pc,
+                                    cycle + replay->config.icache.miss_latency);
+            }
+            replay->fetch_pc += 4;
+            queued = TRUE;
+        }
+
+        /* Back-pressure from a full instruction buffer, until Decode takes
+         * its oldest instruction */
+        count = ibuf_count(replay, cycle, &next);
+        if (count >= replay->config.ibuf_size)
+        {
+            next = queued ? cycle + 1 : next;
+            next = next < until + 1 ? next : until + 1;
+            replay->ibuf_full_cycles += next - cycle;
+            replay->fetch_cycle = next;
+            continue;
+        }
+
+        /* Wait for an instruction cache fill */
+        if (replay->ftq_count == 0 || cycle < replay->icache_ready_cycle)
+        {
+            next = queued ? cycle + 1
+                   : replay->ftq_count ? replay->icache_ready_cycle
+                                       : REPLAY_NEVER;
+            if (next == REPLAY_NEVER && !wrong)
+            {
+                return -1;
+            }
+            replay->fetch_cycle = next < until + 1 ? next : until + 1;
+            continue;
+        }
+
+        fetch_pc = replay->ftq[replay->ftq_head];
+        replay->fetch_cycle = cycle + 1;
+        next = APEX_cache_access(&replay->icache, fetch_pc, FALSE, -1, cycle);
+        if (next)
+        {
+            replay->icache_ready_cycle = cycle + next;
+            if (replay->config.icache_prefetch)
+            {
+                APEX_cache_prefetch(&replay->icache,
+                                    fetch_pc + replay->config.icache.line_size,
+                                    replay->icache_ready_cycle);
+            }
+            continue;
+        }
+
+        replay->ftq_head = (replay->ftq_head + 1) % replay->config.ftq_size;
+        replay->ftq_count--;
+
+        opcode = replay->code[code_index(fetch_pc)];
+        *fused = replay->config.fusion
+                 && fuse_with_branch(replay, fetch_pc, opcode);
+        if (opcode == OPCODE_HALT)
+        {
+            replay->fetching = FALSE;
+        }
+
+        if (!wrong)
+        {
+            return fetch_pc == pc ? cycle : -1;
+        }
+
+        /* Decode takes the first wrong-path instruction once it is free */
+        if (!replay->wrong_fetched++)
+        {
+            replay->wrong_take = MAX(replay->wrong_take, cycle + 1);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Sends Fetch to 'pc' in 'cycle', after it fetched down the wrong path from
+ * the cycle after the redirecting operation was fetched. 'decode_free' is
+ * the first cycle Decode could take a wrong-path instruction, REPLAY_NEVER
+ * if the redirect comes from Decode.
+ */
+static void
+redirect_front_end(APEX_Replay *replay, int cycle, int decode_free, int pc)
+{
+    int fused;
+
+    replay->wrong_fetched = 0;
+    replay->wrong_take = decode_free;
+    run_fetch(replay, 0, cycle - 1, &fused);
+
+    replay->squashed += replay->ftq_count + replay->wrong_fetched;
+    if (replay->wrong_fetched && replay->wrong_take < cycle)
+    {
+        /* Taken by Decode, which Execute held until the redirect */
+        replay->squashed--;
+        replay->wrong_decode = cycle - replay->wrong_take;
+        replay->backpressure_stalls += replay->wrong_decode;
+    }
+
+    replay->wrong_fetched = 0;
+    replay->ftq_count = 0;
+    replay->fetch_pc = pc;
+    replay->fetching = TRUE;
+    replay->fetch_cycle = cycle + 1;
+}
+
+static int
+flag_is_set(const APEX_Replay *replay, int reg, int cycle)
+{
+    return replay->flag_set[reg] >= 0 && cycle < replay->flag_clear[reg];
+}
+
+/* Sets the flag of 'reg' in 'cycle'. It clears at the first Writeback
+ * after that of an older operation clearing it, if one is in flight. */
+static void
+set_flag(APEX_Replay *replay, int reg, int cycle)
+{
+    int age;
+
+    replay->flag_set[reg] = cycle;
+    replay->flag_clear[reg] = REPLAY_NEVER;
+    for (age = 1; age <= replay->ops && age <= replay->history_size; ++age)
+    {
+        const Replay_Op *op = history_op(replay, age);
+
+        if (op->retire <= cycle)
+        {
+            break;
+        }
+        if (op->clear[0] == reg || op->clear[1] == reg)
+        {
+            replay->flag_clear[reg] = op->retire;
+        }
+    }
+}
+
+/* forwardRs1() and forwardRs2() */
+static int
+operand_ready(const APEX_Replay *replay, int reg, int cycle)
+{
+    int mem_register = cycle <= replay->last_execute ? replay->mem_register_before
+                       : cycle < replay->last_done   ? -1
+                                                     : replay->mem_register;
+
+    return reg == replay->exec_register || reg == mem_register
+           || !flag_is_set(replay, reg, cycle);
+}
+
+/* Whether Decode issues 'insn' in 'cycle', setting flags on the way as
+ * APEX_decode() does */
+static int
+decode_issue(APEX_Replay *replay, const Trace_Record *insn, int cycle)
+{
+    switch (insn->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+            if (!operand_ready(replay, insn->rs1, cycle)
+                || !operand_ready(replay, insn->rs2, cycle))
+            {
+                return FALSE;
+            }
+            if (insn->rd == insn->rs1 || insn->rd == insn->rs2)
+            {
+                return TRUE;
+            }
+            if (flag_is_set(replay, insn->rd, cycle))
+            {
+                return FALSE;
+            }
+            set_flag(replay, insn->rd, cycle);
+            return TRUE;
+
+        case OPCODE_STORE:
+        case OPCODE_CMP:
+            return operand_ready(replay, insn->rs1, cycle)
+                   && operand_ready(replay, insn->rs2, cycle);
+
+        case OPCODE_STOREP:
+            if (!operand_ready(replay, insn->rs1, cycle)
+                || !operand_ready(replay, insn->rs2, cycle))
+            {
+                return FALSE;
+            }
+            set_flag(replay, insn->rs2, cycle);
+            return TRUE;
+
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+            if (!operand_ready(replay, insn->rs1, cycle))
+            {
+                return FALSE;
+            }
+            if (insn->rd == insn->rs1)
+            {
+                return TRUE;
+            }
+            if (flag_is_set(replay, insn->rd, cycle))
+            {
+                return FALSE;
+            }
+            set_flag(replay, insn->rd, cycle);
+            return TRUE;
+
+        case OPCODE_LOAD:
+        case OPCODE_JALR:
+            /* The flag of rd is set before rs1 is checked */
+            if (insn->rd != insn->rs1)
+            {
+                if (flag_is_set(replay, insn->rd, cycle))
+                {
+                    return FALSE;
+                }
+                set_flag(replay, insn->rd, cycle);
+            }
+            return operand_ready(replay, insn->rs1, cycle);
+
+        case OPCODE_LOADP:
+            if (!operand_ready(replay, insn->rs1, cycle)
+                || flag_is_set(replay, insn->rd, cycle))
+            {
+                return FALSE;
+            }
+            set_flag(replay, insn->rd, cycle);
+            set_flag(replay, insn->rs1, cycle);
+            return TRUE;
+
+        case OPCODE_MOVC:
+            if (flag_is_set(replay, insn->rd, cycle))
+            {
+                return FALSE;
+            }
+            set_flag(replay, insn->rd, cycle);
+            return TRUE;
+
+        case OPCODE_CML:
+        case OPCODE_JUMP:
+            return operand_ready(replay, insn->rs1, cycle);
+    }
+    return TRUE;
+}
+
+/* Next cycle after 'cycle' in which Decode could issue 'insn' once it
+ * stalled: a flag it checks clears or a forwarding buffer changes */
+static int
+decode_event(const APEX_Replay *replay, const Trace_Record *insn, int cycle)
+{
+    int uses = operands(insn->opcode);
+    int events[5];
+    int next = REPLAY_NEVER;
+    int i;
+
+    events[0] = uses & USES_RD ? replay->flag_clear[insn->rd] : REPLAY_NEVER;
+    events[1] = uses & USES_RS1 ? replay->flag_clear[insn->rs1] : REPLAY_NEVER;
+    events[2] = uses & USES_RS2 ? replay->flag_clear[insn->rs2] : REPLAY_NEVER;
+    events[3] = replay->last_execute + 1;
+    events[4] = replay->last_done;
+    for (i = 0; i < 5; ++i)
+    {
+        if (events[i] > cycle && events[i] < next)
+        {
+            next = events[i];
+        }
+    }
+    return next;
+}
+
+/* One APEX_lsq_drain() call in 'cycle': frees the finished loads at the
+ * head and the first retired store, which writes through the data cache */
+static void
+lsq_drain_once(APEX_Replay *replay, int cycle)
+{
+    while (replay->lsq_count)
+    {
+        Replay_LSQ_Entry *entry = &replay->lsq[replay->lsq_head];
+
+        if (entry->ready > cycle)
+        {
+            break;
+        }
+        replay->lsq_head = (replay->lsq_head + 1) % replay->config.lsq_size;
+        replay->lsq_count--;
+
+        if (entry->is_store)
+        {
+            replay->port_free_cycle
+                = cycle + 1
+                  + APEX_cache_access(&replay->dcache, entry->address, TRUE,
+                                      -1, cycle);
+            replay->drained++;
+            break;
+        }
+    }
+    replay->drain_cycle = cycle + 1;
+}
+
+/* Cycle of the next drain, once the port is free and the head is done */
+static int
+lsq_drain_cycle(const APEX_Replay *replay)
+{
+    int cycle = MAX(replay->drain_cycle, replay->port_free_cycle);
+
+    return MAX(cycle, replay->lsq[replay->lsq_head].ready);
+}
+
+/* Runs the drains of every cycle up to 'until' */
+static void
+lsq_drain(APEX_Replay *replay, int until)
+{
+    while (replay->lsq_count && lsq_drain_cycle(replay) <= until)
+    {
+        lsq_drain_once(replay, lsq_drain_cycle(replay));
+    }
+}
+
+/* Puts 'insn' in the load/store queue in 'cycle', or the first cycle after
+ * it a drain has made room, and returns that cycle */
+static int
+lsq_allocate(APEX_Replay *replay, const Trace_Record *insn, int cycle)
+{
+    Replay_LSQ_Entry *entry;
+
+    lsq_drain(replay, cycle);
+    while (replay->lsq_count == replay->config.lsq_size)
+    {
+        cycle = MAX(cycle, lsq_drain_cycle(replay));
+        lsq_drain_once(replay, lsq_drain_cycle(replay));
+    }
+
+    entry = &replay->lsq[(replay->lsq_head + replay->lsq_count)
+                         % replay->config.lsq_size];
+    entry->is_store = !is_load(insn->opcode);
+    entry->address = insn->address;
+    entry->ready = REPLAY_NEVER;
+    replay->lsq_count++;
+    if (entry->is_store)
+    {
+        replay->stores++;
+    }
+    else
+    {
+        replay->loads++;
+    }
+    return cycle;
+}
+
+/* The youngest entry of the load/store queue */
+static Replay_LSQ_Entry *
+lsq_tail(APEX_Replay *replay)
+{
+    return &replay->lsq[(replay->lsq_head + replay->lsq_count - 1)
+                        % replay->config.lsq_size];
+}
+
+/*
+ * Memory stage of the load just put in the queue, reaching it in 'cycle'.
+ * Returns the cycle it leaves Memory, once it had the port and its value,
+ * from an older store or through the data cache.
+ */
+static int
+memory_load(APEX_Replay *replay, int cycle)
+{
+    Replay_LSQ_Entry *load = lsq_tail(replay);
+    int older_stores = 0;
+    int latency;
+    int i;
+
+    lsq_drain(replay, cycle - 1);
+    cycle = MAX(cycle, replay->port_free_cycle);
+    load->ready = cycle;
+
+    for (i = replay->lsq_count - 2; i >= 0; --i)
+    {
+        const Replay_LSQ_Entry *entry
+            = &replay->lsq[(replay->lsq_head + i) % replay->config.lsq_size];
+
+        if (!entry->is_store)
+        {
+            continue;
+        }
+        if (entry->address == load->address)
+        {
+            /* The port stays free for a drain this cycle */
+            replay->forwards++;
+            return cycle;
+        }
+        older_stores++;
+    }
+
+    if (older_stores)
+    {
+        replay->bypasses++;
+    }
+    latency = APEX_cache_access(&replay->dcache, load->address, FALSE, -1,
+                                cycle);
+    replay->drain_cycle = MAX(replay->drain_cycle, cycle + 1);
+    replay->port_free_cycle = cycle + latency + 1;
+    return latency ? cycle + latency + 1 : cycle;
+}
+
+static void
+invalid_trace(APEX_Replay *replay, int index)
+{
+    fprintf(stderr, "APEX_Error: Instruction %d of the trace does not follow "
+                    "the ones before it\n", index);
+    replay->status = REPLAY_MISMATCH;
+}
+
+int
+APEX_replay_init(APEX_Replay *replay, const APEX_Config *config)
+{
+    int reg;
+
+    memset(replay, 0, sizeof(APEX_Replay));
+    replay->config = *config;
+
+    if (!APEX_cache_init(&replay->dcache, "L1 DATA CACHE", &config->dcache, 0))
+    {
+        fprintf(stderr, "APEX_Error: Invalid data cache configuration\n");
+        return FALSE;
+    }
+    if (!APEX_cache_init(&replay->icache, "L1 INSTRUCTION CACHE",
+                         &config->icache, 0))
+    {
+        fprintf(stderr,
+                "APEX_Error: Invalid instruction cache configuration\n");
+        APEX_cache_free(&replay->dcache);
+        return FALSE;
+    }
+    if (!APEX_prefetcher_init(&replay->prefetcher, config->prefetch_table_size,
+                              config->prefetch_degree,
+                              config->prefetch_distance))
+    {
+        fprintf(stderr, "APEX_Error: Invalid prefetcher configuration\n");
+        APEX_cache_free(&replay->icache);
+        APEX_cache_free(&replay->dcache);
+        return FALSE;
+    }
+
+    /* Enough history for a full instruction buffer and what is past it */
+    replay->history_size = 8;
+    while (replay->history_size < config->ibuf_size + 8)
+    {
+        replay->history_size *= 2;
+    }
+    replay->history = calloc(replay->history_size, sizeof(Replay_Op));
+    replay->ftq = calloc(config->ftq_size, sizeof(int));
+    replay->lsq = calloc(config->lsq_size, sizeof(Replay_LSQ_Entry));
+    if (!replay->history || !replay->ftq || !replay->lsq)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for the timing model\n");
+        APEX_replay_free(replay);
+        return FALSE;
+    }
+
+    for (reg = 0; reg < REG_FILE_SIZE; ++reg)
+    {
+        replay->flag_set[reg] = -1;
+        replay->flag_clear[reg] = REPLAY_NEVER;
+    }
+    replay->last_issue = -1;
+    replay->last_execute = -1;
+    replay->fetching = TRUE;
+    replay->fetch_pc = 4000;
+    replay->wrong_take = REPLAY_NEVER;
+    return TRUE;
+}
+
+void
+APEX_replay_free(APEX_Replay *replay)
+{
+    free(replay->code);
+    free(replay->history);
+    free(replay->ftq);
+    free(replay->lsq);
+    replay->code = NULL;
+    replay->history = NULL;
+    replay->ftq = NULL;
+    replay->lsq = NULL;
+    APEX_prefetcher_free(&replay->prefetcher);
+    APEX_cache_free(&replay->icache);
+    APEX_cache_free(&replay->dcache);
+}
+
+/*
+ * Times the 'count' instructions of an instruction trace, stopping at
+ * 'max_cycles' if it is not 0. Returns FALSE if the trace cannot be the
+ * path of a program.
+ */
+int
+APEX_replay_run(APEX_Replay *replay, const Trace_Record *records, int count,
+                int max_cycles)
+{
+    double start = host_time();
+    int i = 0;
+
+    replay->status = REPLAY_TRACE_END;
+    if (!build_code_map(replay, records, count))
+    {
+        replay->status = REPLAY_MISMATCH;
+        return FALSE;
+    }
+    if (count)
+    {
+        replay->fetch_pc = records[0].pc;
+    }
+
+    while (i < count)
+    {
+        const Trace_Record *insn = &records[i];
+        const Trace_Record *branch = insn;
+        Replay_Op *op;
+        int fused = FALSE;
+        int redirect = -1;
+        int decode_free = REPLAY_NEVER;
+        int fetch, take, issue, execute, done, retire, k;
+
+        /* Fetch */
+        fetch = run_fetch(replay, insn->pc, REPLAY_NEVER, &fused);
+        if (fetch < 0 || (fused && (i + 1 == count
+                                    || records[i + 1].pc != insn->pc + 4)))
+        {
+            invalid_trace(replay, i);
+            break;
+        }
+        if (fused)
+        {
+            branch = &records[i + 1];
+        }
+
+        /* Decode */
+        take = MAX(fetch + 1, replay->last_issue + 1);
+        replay->frontend_starved
+            += take - replay->last_issue - 1 - replay->wrong_decode;
+        replay->wrong_decode = 0;
+
+        issue = MAX(take, replay->last_execute);
+        while (issue != REPLAY_NEVER && !decode_issue(replay, insn, issue))
+        {
+            issue = decode_event(replay, insn, issue);
+        }
+        if (issue == REPLAY_NEVER)
+        {
+            replay->status = REPLAY_DEADLOCK;
+            break;
+        }
+        replay->backpressure_stalls += MAX(0, replay->last_execute - take);
+        replay->dependency_stalls += issue - MAX(take, replay->last_execute);
+
+        if (!fused && is_conditional_branch(insn->opcode)
+            && replay->config.early_branch)
+        {
+            replay->branches_decode++;
+            if (insn->flags & TRACE_TAKEN)
+            {
+                replay->taken_decode++;
+                redirect = issue;
+            }
+        }
+
+        /* Execute, where a redirect lets Decode take a wrong-path
+         * instruction the cycle after this one issued */
+        if (redirect < 0)
+        {
+            decode_free = issue + 1;
+        }
+        execute = MAX(issue + 1, replay->last_done);
+        if (is_memory_insn(insn->opcode))
+        {
+            int ready = execute;
+
+            execute = lsq_allocate(replay, insn, execute);
+            replay->lsq_full_stalls += execute - ready;
+            APEX_prefetcher_access(&replay->prefetcher, &replay->dcache,
+                                   insn->pc, insn->address, execute);
+        }
+        replay->exec_register = execute_register(insn, replay->exec_register);
+
+        if (fused)
+        {
+            if (branch->flags & TRACE_TAKEN)
+            {
+                replay->fused_taken++;
+                redirect = execute;
+            }
+        }
+        else if (is_conditional_branch(insn->opcode))
+        {
+            if (!replay->config.early_branch)
+            {
+                replay->branches_execute++;
+                if (insn->flags & TRACE_TAKEN)
+                {
+                    replay->taken_execute++;
+                    redirect = execute;
+                }
+            }
+        }
+        else if (insn->opcode == OPCODE_JUMP || insn->opcode == OPCODE_JALR)
+        {
+            redirect = execute;
+        }
+
+        /* Memory */
+        done = is_load(insn->opcode) ? memory_load(replay, execute + 1)
+                                     : execute + 1;
+        replay->memory_stalls += done - execute - 1;
+
+        /* Writeback */
+        retire = done + 1;
+        if (max_cycles && retire >= max_cycles)
+        {
+            replay->status = REPLAY_CYCLE_LIMIT;
+            replay->cycles = max_cycles;
+            break;
+        }
+        if (is_memory_insn(insn->opcode) && !is_load(insn->opcode))
+        {
+            lsq_tail(replay)->ready = retire;
+        }
+
+        op = &replay->history[replay->ops & (replay->history_size - 1)];
+        op->take = take;
+        op->retire = retire;
+        flags_cleared(insn, op->clear);
+        replay->ops++;
+        for (k = 0; k < 2; ++k)
+        {
+            int reg = op->clear[k];
+
+            if (reg >= 0 && replay->flag_set[reg] >= 0
+                && retire > replay->flag_set[reg]
+                && retire < replay->flag_clear[reg])
+            {
+                replay->flag_clear[reg] = retire;
+            }
+        }
+
+        replay->mem_register_before = replay->mem_register;
+        replay->mem_register = memory_register(insn, replay->mem_register);
+        replay->last_issue = issue;
+        replay->last_execute = execute;
+        replay->last_done = done;
+        replay->insn_completed += fused ? 2 : 1;
+        replay->cycles = retire + 1;
+        i += fused ? 2 : 1;
+
+        if (insn->opcode == OPCODE_HALT)
+        {
+            /* Decode sits idle until HALT retires */
+            replay->frontend_starved += retire - issue - 1;
+            replay->status = REPLAY_HALTED;
+
+            /* Stores drain until then, and HALT drains the rest without
+             * the cache */
+            lsq_drain(replay, retire - 1);
+            while (replay->lsq_count
+                   && replay->lsq[replay->lsq_head].ready <= retire)
+            {
+                replay->drained += replay->lsq[replay->lsq_head].is_store;
+                replay->lsq_head
+                    = (replay->lsq_head + 1) % replay->config.lsq_size;
+                replay->lsq_count--;
+            }
+            break;
+        }
+
+        if (redirect >= 0 && i < count)
+        {
+            redirect_front_end(replay, redirect, decode_free, records[i].pc);
+        }
+    }
+
+    replay->host_seconds = host_time() - start;
+    return replay->status != REPLAY_MISMATCH;
+}
+
+static const char *
+status_name(int status)
+{
+    switch (status)
+    {
+        case REPLAY_HALTED:
+            return "halted";
+        case REPLAY_TRACE_END:
+            return "end of trace";
+        case REPLAY_CYCLE_LIMIT:
+            return "cycle limit";
+        case REPLAY_DEADLOCK:
+            return "deadlock";
+    }
+    return "invalid trace";
+}
+
+/* Prints the cycles of the replay and the statistics of its subsystems */
+void
+APEX_replay_print_stats(const APEX_Replay *replay)
+{
+    int pairs = replay->fused_cmp + replay->fused_cml + replay->fused_addl
+                + replay->fused_subl;
+
+    printf("----------\n%s\n----------\n", "TRACE REPLAY");
+    printf("Instructions     : %d\n", replay->insn_completed);
+    printf("Cycles           : %d\n", replay->cycles);
+    printf("IPC              : %.3f\n",
+           replay->cycles ? (double)replay->insn_completed / replay->cycles
+                          : 0.0);
+    printf("Outcome          : %s\n", status_name(replay->status));
+    printf("Host time        : %.3f s\n", replay->host_seconds);
+    printf("\n");
+
+    printf("----------\n%s\n----------\n", "FRONT END");
+    printf("Queues           : %d fetch targets, %d instructions\n",
+           replay->config.ftq_size, replay->config.ibuf_size);
+    printf("Buffer full      : %d cycles\n", replay->ibuf_full_cycles);
+    printf("Squashed         : %d entries\n", replay->squashed);
+    printf("\n");
+
+    printf("----------\n%s\n----------\n", "STALL CYCLES");
+    printf("Decode starved   : %d\n", replay->frontend_starved);
+    printf("Dependency       : %d\n", replay->dependency_stalls);
+    printf("Back-pressure    : %d\n", replay->backpressure_stalls);
+    printf("Load/store queue : %d\n", replay->lsq_full_stalls);
+    printf("Data cache       : %d\n", replay->memory_stalls);
+    printf("\n");
+
+    printf("----------\n%s\n----------\n", "CONDITIONAL BRANCHES");
+    printf("Resolved         : %d in Decode, %d in Execute\n",
+           replay->branches_decode, replay->branches_execute);
+    printf("Taken            : %d in Decode, %d in Execute\n",
+           replay->taken_decode, replay->taken_execute);
+    printf("\n");
+
+    printf("----------\n%s\n----------\n", "MACRO-OP FUSION");
+    if (replay->config.fusion)
+    {
+        printf("Fused pairs      : %d (CMP %d, CML %d, ADDL %d, SUBL %d)\n",
+               pairs, replay->fused_cmp, replay->fused_cml, replay->fused_addl,
+               replay->fused_subl);
+        printf("Taken            : %d\n", replay->fused_taken);
+        printf("\n");
+    }
+    else
+    {
+        printf("Disabled\n\n");
+    }
+
+    printf("----------\n%s\n----------\n", "LOAD/STORE QUEUE");
+    printf("Size             : %d\n", replay->config.lsq_size);
+    printf("Loads / Stores   : %d / %d\n", replay->loads, replay->stores);
+    printf("Forwarded loads  : %d\n", replay->forwards);
+    printf("Bypassing loads  : %d\n", replay->bypasses);
+    printf("Full stalls      : %d\n", replay->lsq_full_stalls);
+    printf("Drained stores   : %d\n", replay->drained);
+    printf("\n");
+
+    APEX_cache_print_stats(&replay->dcache);
+    APEX_prefetcher_print_stats(&replay->prefetcher, &replay->dcache);
+    APEX_cache_print_stats(&replay->icache);
+}
+
+static double
+stat_ipc(const void *owner)
+{
+    const APEX_Replay *replay = owner;
+
+    return replay->cycles ? (double)replay->insn_completed / replay->cycles
+                          : 0.0;
+}
+
+/* Registers the statistics of the replay under the names the pipeline
+ * uses, so the two can be compared entry by entry */
+void
+APEX_replay_register_stats(const APEX_Replay *replay, APEX_Stats *stats)
+{
+    APEX_stats_enter(stats, "replay");
+    APEX_stats_counter(stats, "cycles", &replay->cycles);
+    APEX_stats_counter(stats, "instructions", &replay->insn_completed);
+    APEX_stats_derived(stats, "ipc", stat_ipc, replay);
+    APEX_stats_counter(stats, "status", &replay->status);
+    APEX_stats_real(stats, "host_seconds", &replay->host_seconds);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "front_end");
+    APEX_stats_counter(stats, "ibuf_full_cycles", &replay->ibuf_full_cycles);
+    APEX_stats_counter(stats, "squashed", &replay->squashed);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "stalls");
+    APEX_stats_counter(stats, "starved", &replay->frontend_starved);
+    APEX_stats_counter(stats, "dependency", &replay->dependency_stalls);
+    APEX_stats_counter(stats, "backpressure", &replay->backpressure_stalls);
+    APEX_stats_counter(stats, "lsq_full", &replay->lsq_full_stalls);
+    APEX_stats_counter(stats, "dcache", &replay->memory_stalls);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "branches");
+    APEX_stats_counter(stats, "resolved_decode", &replay->branches_decode);
+    APEX_stats_counter(stats, "resolved_execute", &replay->branches_execute);
+    APEX_stats_counter(stats, "taken_decode", &replay->taken_decode);
+    APEX_stats_counter(stats, "taken_execute", &replay->taken_execute);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "fusion");
+    APEX_stats_counter(stats, "cmp", &replay->fused_cmp);
+    APEX_stats_counter(stats, "cml", &replay->fused_cml);
+    APEX_stats_counter(stats, "addl", &replay->fused_addl);
+    APEX_stats_counter(stats, "subl", &replay->fused_subl);
+    APEX_stats_counter(stats, "taken", &replay->fused_taken);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "lsq");
+    APEX_stats_counter(stats, "loads", &replay->loads);
+    APEX_stats_counter(stats, "stores", &replay->stores);
+    APEX_stats_counter(stats, "forwards", &replay->forwards);
+    APEX_stats_counter(stats, "bypasses", &replay->bypasses);
+    APEX_stats_counter(stats, "full_stalls", &replay->lsq_full_stalls);
+    APEX_stats_counter(stats, "drained", &replay->drained);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "dcache");
+    APEX_cache_register_stats(&replay->dcache, stats);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "prefetcher");
+    APEX_prefetcher_register_stats(&replay->prefetcher, stats);
+    APEX_stats_leave(stats);
+
+    APEX_stats_enter(stats, "icache");
+    APEX_cache_register_stats(&replay->icache, stats);
+    APEX_stats_leave(stats);
+}
@@ -0,0 +1,136 @@
+/*
+ * apex_replay.h
+ * Contains APEX trace-driven timing model declarations
+ *
+ * The model times an instruction trace, recorded with the itrace= option,
+ * on any configuration of the pipeline without simulating the program: no
+ * register or memory values are computed, the trace already holds the
+ * addresses and branch outcomes they would give.
+ *
+ * Rather than stepping every stage every cycle, it follows the trace one
+ * operation at a time and works out the cycle each stage passes it on,
+ * from the cycles of the operations before it:
+ *
+ *   Fetch      queue and cache timing of the instruction, replayed cycle
+ *              by cycle, as are the wrong-path fetches after a redirect
+ *   Decode     first cycle its operands are forwarded or their flags clear
+ *   Execute    Memory free and, for loads and stores, a free queue entry
+ *   Memory     data cache port and misses, load/store queue forwarding
+ *   Writeback  the cycle after Memory
+ *
+ * Each rule mirrors the pipeline in apex_cpu.c, including the register
+ * flags and forwarding buffers Decode checks, so the cycles match it. The
+ * instructions the trace never retired are not known, so the wrong path
+ * cannot fuse or stop at an instruction that never retired.
+ */
+#ifndef _APEX_REPLAY_H_
+#define _APEX_REPLAY_H_
+
+#include "apex_cpu.h"
+
+/* Outcome of a replay */
+#define REPLAY_HALTED 0x0          /* HALT retired */
+#define REPLAY_TRACE_END 0x1       /* The trace stopped before HALT */
+#define REPLAY_CYCLE_LIMIT 0x2     /* Stopped at the cycle limit */
+#define REPLAY_DEADLOCK 0x3        /* Decode waits on a flag nothing clears */
+#define REPLAY_MISMATCH 0x4        /* The trace is not a path of the program */
+
+/* Format of an operation timed by the model, one instruction or a fused
+ * pair, as far as later operations need it */
+typedef struct Replay_Op
+{
+    int take;                      /* Cycle Decode took it from the buffer */
+    int retire;                    /* Cycle Writeback retired it */
+    int clear[2];                  /* Registers whose flags it clears, or -1 */
+} Replay_Op;
+
+/* Format of a load/store queue entry of the model */
+typedef struct Replay_LSQ_Entry
+{
+    int is_store;
+    int address;
+    int ready;                     /* Cycle it may drain, load done or store retired */
+} Replay_LSQ_Entry;
+
+/* Model of the pipeline timing an instruction trace */
+typedef struct APEX_Replay
+{
+    APEX_Config config;
+    APEX_Cache icache;
+    APEX_Cache dcache;
+    APEX_Prefetcher prefetcher;
+
+    /* Static code seen in the trace, opcode by code memory index or -1 */
+    int *code;
+    int code_size;
+
+    /* Operations timed so far, the last history_size of them */
+    Replay_Op *history;
+    int history_size;              /* Power of two */
+    int ops;
+    int last_issue;                /* Cycles of the last operation */
+    int last_execute;
+    int last_done;
+
+    /* Register flags: set by Decode in flag_set, clear from flag_clear on */
+    int flag_set[REG_FILE_SIZE];
+    int flag_clear[REG_FILE_SIZE];
+    int exec_register;             /* executeStageBufferRegister */
+    int mem_register_before;       /* memStageBufferRegister before the
+                                      last operation reached Memory */
+    int mem_register;              /* and once it has left */
+    int wrong_decode;              /* Decode cycles a wrong-path op took */
+
+    /* Front end */
+    int fetch_cycle;               /* Next cycle Fetch runs */
+    int fetch_pc;                  /* Next fetch target to queue */
+    int fetching;                  /* HALT has not been fetched */
+    int *ftq;
+    int ftq_head;
+    int ftq_count;
+    int icache_ready_cycle;
+    int wrong_fetched;             /* Wrong-path instructions buffered */
+    int wrong_take;                /* Cycle Decode takes the first one */
+
+    /* Load/store queue and data cache port */
+    Replay_LSQ_Entry *lsq;
+    int lsq_head;
+    int lsq_count;
+    int drain_cycle;               /* Earliest cycle of the next drain */
+    int port_free_cycle;
+
+    /* Statistics, named like those of APEX_CPU */
+    int status;                    /* REPLAY_* */
+    int cycles;
+    int insn_completed;
+    int squashed;
+    int ibuf_full_cycles;
+    int frontend_starved;
+    int dependency_stalls;
+    int backpressure_stalls;
+    int lsq_full_stalls;
+    int memory_stalls;
+    int branches_decode;
+    int branches_execute;
+    int taken_decode;
+    int taken_execute;
+    int fused_cmp;
+    int fused_cml;
+    int fused_addl;
+    int fused_subl;
+    int fused_taken;
+    int loads;
+    int stores;
+    int forwards;
+    int bypasses;
+    int drained;
+    double host_seconds;
+} APEX_Replay;
+
+int APEX_replay_init(APEX_Replay *replay, const APEX_Config *config);
+void APEX_replay_free(APEX_Replay *replay);
+int APEX_replay_run(APEX_Replay *replay, const Trace_Record *records,
+                    int count, int max_cycles);
+void APEX_replay_print_stats(const APEX_Replay *replay);
+void APEX_replay_register_stats(const APEX_Replay *replay, APEX_Stats *stats);
+#endif
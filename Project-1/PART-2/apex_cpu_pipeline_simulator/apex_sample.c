@@ -0,0 +1,853 @@
+/*
+ * apex_sample.c
+ * Contains APEX sampled simulation implementation
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_sample.h"
+#include "apex_check.h"
+
+/* Dimensions the basic block vectors are projected to before clustering */
+#define SAMPLE_DIMENSIONS 15
+
+static double
+host_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Instructions that end a basic block */
+static int
+ends_block(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+        case OPCODE_HALT:
+            return TRUE;
+    }
+    return FALSE;
+}
+
+APEX_Sampler *
+APEX_sample_init(const char *filename, const APEX_Config *config)
+{
+    APEX_Sampler *sampler;
+
+    if (config->cores > 1 || config->interval_size)
+    {
+        fprintf(stderr, "APEX_Error: Sampled simulation runs a single core "
+                        "without intervals\n");
+        return NULL;
+    }
+
+    sampler = calloc(1, sizeof(APEX_Sampler));
+    if (!sampler)
+    {
+        return NULL;
+    }
+
+    sampler->config = *config;
+    sampler->interval_size = config->sample_interval;
+    sampler->code_memory = create_code_memory(filename,
+                                              &sampler->code_memory_size);
+    if (!sampler->code_memory)
+    {
+        free(sampler);
+        return NULL;
+    }
+
+    if (ENABLE_DEBUG_MESSAGES)
+    {
+        fprintf(stderr,
+                "APEX_CPU: Initialized sampled simulation, loaded %d "
+                "instructions\n",
+                sampler->code_memory_size);
+    }
+    return sampler;
+}
+
+void
+APEX_sample_stop(APEX_Sampler *sampler)
+{
+    free(sampler->code_memory);
+    free(sampler->bbv);
+    free(sampler->interval_insns);
+    free(sampler->cluster);
+    free(sampler->phase);
+    free(sampler);
+}
+
+/* Makes room for the vector of one more interval, zeroed */
+static int
+add_interval(APEX_Sampler *sampler)
+{
+    int size = sampler->code_memory_size;
+
+    if (sampler->intervals == sampler->bbv_size)
+    {
+        int count = sampler->bbv_size ? 2 * sampler->bbv_size : 64;
+        int *bbv = realloc(sampler->bbv, (size_t)count * size * sizeof(int));
+        int *insns;
+
+        if (!bbv)
+        {
+            return FALSE;
+        }
+        sampler->bbv = bbv;
+
+        insns = realloc(sampler->interval_insns, count * sizeof(int));
+        if (!insns)
+        {
+            return FALSE;
+        }
+        sampler->interval_insns = insns;
+        sampler->bbv_size = count;
+    }
+
+    memset(sampler->bbv + (size_t)sampler->intervals * size, 0,
+           size * sizeof(int));
+    sampler->interval_insns[sampler->intervals++] = 0;
+    return TRUE;
+}
+
+/*
+ * Runs the whole program on the functional model and records the basic
+ * block vector of every interval. Each instruction counts towards the
+ * leader of its basic block, so a block weighs as much as the instructions
+ * it executed.
+ */
+static int
+profile(APEX_Sampler *sampler)
+{
+    APEX_Checker *model = APEX_check_init(sampler->code_memory,
+                                          sampler->code_memory_size, 4000);
+    int leader = 4000;
+
+    if (!model)
+    {
+        return FALSE;
+    }
+
+    while (sampler->instructions < SAMPLE_MAX_INSTRUCTIONS)
+    {
+        int pc = model->pc;
+        int opcode;
+        int *bbv;
+
+        if (sampler->instructions
+                == sampler->intervals * sampler->interval_size
+            && !add_interval(sampler))
+        {
+            APEX_check_free(model);
+            return FALSE;
+        }
+
+        opcode = APEX_check_step(model);
+        if (opcode < 0)
+        {
+            fprintf(stderr, "APEX_Error: Program faulted at pc %d while "
+                            "profiling\n", pc);
+            APEX_check_free(model);
+            return FALSE;
+        }
+
+        bbv = sampler->bbv
+              + (size_t)(sampler->intervals - 1) * sampler->code_memory_size;
+        bbv[(leader - 4000) / 4]++;
+        sampler->interval_insns[sampler->intervals - 1]++;
+        sampler->instructions++;
+
+        if (opcode == OPCODE_HALT)
+        {
+            sampler->halted = TRUE;
+            break;
+        }
+        if (ends_block(opcode))
+        {
+            leader = model->pc;
+        }
+    }
+
+    APEX_check_free(model);
+    return TRUE;
+}
+
+/*
+ * Normalizes every vector to a sum of one, so intervals compare by where
+ * they spend their time, and projects it onto SAMPLE_DIMENSIONS random
+ * directions when the program has more basic block leaders than that.
+ */
+static double *
+project(const APEX_Sampler *sampler, int *dims)
+{
+    int size = sampler->code_memory_size;
+    double *points;
+    double *matrix = NULL;
+    unsigned int rand_state = 1;
+    int i, j, d;
+
+    *dims = size > SAMPLE_DIMENSIONS ? SAMPLE_DIMENSIONS : size;
+    points = calloc((size_t)sampler->intervals * *dims, sizeof(double));
+    if (!points)
+    {
+        return NULL;
+    }
+
+    if (*dims < size)
+    {
+        matrix = malloc((size_t)size * *dims * sizeof(double));
+        if (!matrix)
+        {
+            free(points);
+            return NULL;
+        }
+        for (j = 0; j < size * *dims; ++j)
+        {
+            rand_state = rand_state * 1103515245u + 12345u;
+            matrix[j] = ((rand_state >> 16) & 0x7fff) / 16383.5 - 1.0;
+        }
+    }
+
+    for (i = 0; i < sampler->intervals; ++i)
+    {
+        const int *bbv = sampler->bbv + (size_t)i * size;
+        double *point = points + (size_t)i * *dims;
+        double total = sampler->interval_insns[i];
+
+        for (j = 0; j < size; ++j)
+        {
+            if (!bbv[j])
+            {
+                continue;
+            }
+            if (!matrix)
+            {
+                point[j] = bbv[j] / total;
+                continue;
+            }
+            for (d = 0; d < *dims; ++d)
+            {
+                point[d] += bbv[j] / total * matrix[j * *dims + d];
+            }
+        }
+    }
+
+    free(matrix);
+    return points;
+}
+
+/* Squared euclidean distance */
+static double
+distance(const double *a, const double *b, int dims)
+{
+    double sum = 0.0;
+    int d;
+
+    for (d = 0; d < dims; ++d)
+    {
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return sum;
+}
+
+/*
+ * Groups the points into 'k' clusters. The first centre is the first
+ * interval and every next one the point furthest from the centres so far,
+ * which keeps the result the same on every run. Returns the distortion, the
+ * sum of squared distances of the points to their centres, and fills in
+ * 'assign', 'centres' and 'sizes'.
+ */
+static double
+kmeans(const double *points, int count, int dims, int k, int *assign,
+       double *centres, int *sizes, double *nearest)
+{
+    double distortion = 0.0;
+    int iteration;
+    int i, c, d;
+
+    memcpy(centres, points, dims * sizeof(double));
+    for (i = 0; i < count; ++i)
+    {
+        nearest[i] = distance(points + (size_t)i * dims, centres, dims);
+        assign[i] = -1;
+    }
+
+    for (c = 1; c < k; ++c)
+    {
+        int furthest = 0;
+
+        for (i = 1; i < count; ++i)
+        {
+            if (nearest[i] > nearest[furthest])
+            {
+                furthest = i;
+            }
+        }
+
+        memcpy(centres + (size_t)c * dims, points + (size_t)furthest * dims,
+               dims * sizeof(double));
+        for (i = 0; i < count; ++i)
+        {
+            double dist = distance(points + (size_t)i * dims,
+                                   centres + (size_t)c * dims, dims);
+
+            if (dist < nearest[i])
+            {
+                nearest[i] = dist;
+            }
+        }
+    }
+
+    for (iteration = 0; iteration < SAMPLE_KMEANS_ITERATIONS; ++iteration)
+    {
+        int changed = FALSE;
+
+        for (i = 0; i < count; ++i)
+        {
+            int best = 0;
+
+            nearest[i] = distance(points + (size_t)i * dims, centres, dims);
+            for (c = 1; c < k; ++c)
+            {
+                double dist = distance(points + (size_t)i * dims,
+                                       centres + (size_t)c * dims, dims);
+
+                if (dist < nearest[i])
+                {
+                    nearest[i] = dist;
+                    best = c;
+                }
+            }
+
+            if (assign[i] != best)
+            {
+                assign[i] = best;
+                changed = TRUE;
+            }
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+
+        /* Move every centre that kept points to their mean */
+        memset(sizes, 0, k * sizeof(int));
+        for (i = 0; i < count; ++i)
+        {
+            sizes[assign[i]]++;
+        }
+        for (c = 0; c < k; ++c)
+        {
+            if (sizes[c])
+            {
+                memset(centres + (size_t)c * dims, 0, dims * sizeof(double));
+            }
+        }
+        for (i = 0; i < count; ++i)
+        {
+            for (d = 0; d < dims; ++d)
+            {
+                centres[(size_t)assign[i] * dims + d]
+                    += points[(size_t)i * dims + d] / sizes[assign[i]];
+            }
+        }
+    }
+
+    memset(sizes, 0, k * sizeof(int));
+    for (i = 0; i < count; ++i)
+    {
+        sizes[assign[i]]++;
+        distortion += nearest[i];
+    }
+    return distortion;
+}
+
+/*
+ * Bayesian information criterion of a clustering: the log-likelihood of
+ * the points under spherical gaussians around the centres, less a penalty
+ * for the parameters of every cluster (Pelleg and Moore, X-means).
+ */
+static double
+bic(int count, int dims, int k, const int *sizes, double distortion)
+{
+    double variance = count > k ? distortion / (count - k) : 0.0;
+    double likelihood = 0.0;
+    int params = (k - 1) + dims * k + 1;
+    int c;
+
+    /* Identical intervals fit perfectly, keep the logarithm finite */
+    if (variance < 1e-12)
+    {
+        variance = 1e-12;
+    }
+
+    for (c = 0; c < k; ++c)
+    {
+        double n = sizes[c];
+
+        if (!sizes[c])
+        {
+            continue;
+        }
+        likelihood += n * log(n) - n * log(count)
+                      - n / 2 * log(2 * M_PI) - n * dims / 2 * log(variance)
+                      - (n - k) / 2;
+    }
+
+    return likelihood - params / 2.0 * log(count);
+}
+
+static int
+compare_phases(const void *a, const void *b)
+{
+    return ((const Sample_Phase *)a)->interval
+           - ((const Sample_Phase *)b)->interval;
+}
+
+/*
+ * Clusters the interval vectors into phases and picks the representative
+ * and weight of each phase
+ */
+static int
+cluster(APEX_Sampler *sampler)
+{
+    int count = sampler->intervals;
+    int max_k = sampler->config.sample_phases < count
+                    ? sampler->config.sample_phases
+                    : count;
+    double *score = calloc(max_k + 1, sizeof(double));
+    double *centres = calloc((size_t)max_k * SAMPLE_DIMENSIONS,
+                             sizeof(double));
+    double *nearest = calloc(count, sizeof(double));
+    int *sizes = calloc(max_k, sizeof(int));
+    int *phase_of = calloc(max_k, sizeof(int));
+    double *points;
+    double best, worst;
+    int dims;
+    int k, i, c;
+
+    sampler->cluster = calloc(count, sizeof(int));
+    sampler->phase = calloc(max_k, sizeof(Sample_Phase));
+    points = project(sampler, &dims);
+    if (!score || !centres || !nearest || !sizes || !phase_of
+        || !sampler->cluster || !sampler->phase || !points)
+    {
+        free(score);
+        free(centres);
+        free(nearest);
+        free(sizes);
+        free(phase_of);
+        free(points);
+        return FALSE;
+    }
+
+    for (k = 1; k <= max_k; ++k)
+    {
+        double distortion = kmeans(points, count, dims, k, sampler->cluster,
+                                   centres, sizes, nearest);
+
+        score[k] = bic(count, dims, k, sizes, distortion);
+    }
+
+    /* The fewest phases scoring within 90% of the best */
+    best = worst = score[1];
+    for (k = 2; k <= max_k; ++k)
+    {
+        best = score[k] > best ? score[k] : best;
+        worst = score[k] < worst ? score[k] : worst;
+    }
+    for (k = 1; k < max_k; ++k)
+    {
+        if (score[k] >= worst + 0.9 * (best - worst))
+        {
+            break;
+        }
+    }
+    kmeans(points, count, dims, k, sampler->cluster, centres, sizes,
+           nearest);
+
+    /* Clusters that kept intervals become phases, represented by their
+     * interval closest to the centre */
+    for (c = 0; c < k; ++c)
+    {
+        Sample_Phase *phase = &sampler->phase[sampler->phases];
+
+        if (!sizes[c])
+        {
+            continue;
+        }
+
+        phase->interval = -1;
+        for (i = 0; i < count; ++i)
+        {
+            if (sampler->cluster[i] != c)
+            {
+                continue;
+            }
+            if (phase->interval < 0
+                || nearest[i] < nearest[phase->interval])
+            {
+                phase->interval = i;
+            }
+            phase->intervals++;
+            phase->instructions += sampler->interval_insns[i];
+        }
+        phase->weight = (double)phase->instructions / sampler->instructions;
+        sampler->phases++;
+    }
+
+    /* Representatives are simulated in program order */
+    qsort(sampler->phase, sampler->phases, sizeof(Sample_Phase),
+          compare_phases);
+    for (c = 0; c < sampler->phases; ++c)
+    {
+        phase_of[sampler->cluster[sampler->phase[c].interval]] = c;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        sampler->cluster[i] = phase_of[sampler->cluster[i]];
+    }
+
+    free(score);
+    free(centres);
+    free(nearest);
+    free(sizes);
+    free(phase_of);
+    free(points);
+    return TRUE;
+}
+
+/* Reads the counters a measurement is the difference of */
+static void
+read_counters(const APEX_CPU *cpu, int cycles, Sample_Measure *counters)
+{
+    counters->cycles = cycles;
+    counters->instructions = cpu->insn_completed;
+    counters->dcache_accesses = cpu->dcache.accesses;
+    counters->dcache_misses = cpu->dcache.misses;
+    counters->icache_accesses = cpu->icache.accesses;
+    counters->icache_misses = cpu->icache.misses;
+}
+
+/*
+ * Starts a new pipeline from the architectural state of 'start', simulates
+ * 'warmup' instructions to warm its caches and queues, then measures the
+ * next 'length' instructions, or up to HALT. Returns FALSE if the CPU could
+ * not be created or the checker stopped it. Safe to call from several host
+ * threads at once.
+ */
+int
+APEX_sample_measure(const APEX_Instruction *code_memory, int code_memory_size,
+                    const APEX_Config *config,
+                    const struct APEX_Checker *start, int warmup, int length,
+                    Sample_Measure *measure)
+{
+    APEX_CPU *cpu = APEX_cpu_init_code(code_memory, code_memory_size, config);
+    Sample_Measure begin;
+    int begun = !warmup;
+    int halted = FALSE;
+
+    memset(measure, 0, sizeof(Sample_Measure));
+    memset(&begin, 0, sizeof(Sample_Measure));
+    if (!cpu)
+    {
+        return FALSE;
+    }
+    APEX_cpu_load_state(cpu, start);
+
+    while (!halted)
+    {
+        int cycles;
+
+        halted = APEX_cpu_step(cpu);
+        cycles = halted ? cpu->clock + 1 : cpu->clock;
+        if (cpu->diverged)
+        {
+            measure->diverged = TRUE;
+            APEX_cpu_stop(cpu);
+            return FALSE;
+        }
+
+        if (!begun && (halted || cpu->insn_completed >= warmup))
+        {
+            read_counters(cpu, cycles, &begin);
+            begun = TRUE;
+        }
+
+        if (halted
+            || (begun && cpu->insn_completed - begin.instructions >= length))
+        {
+            read_counters(cpu, cycles, measure);
+        }
+        else
+        {
+            continue;
+        }
+
+        measure->cycles -= begin.cycles;
+        measure->instructions -= begin.instructions;
+        measure->dcache_accesses -= begin.dcache_accesses;
+        measure->dcache_misses -= begin.dcache_misses;
+        measure->icache_accesses -= begin.icache_accesses;
+        measure->icache_misses -= begin.icache_misses;
+        measure->warmed = begin.instructions;
+        measure->halted = halted;
+        break;
+    }
+
+    APEX_cpu_stop(cpu);
+    return TRUE;
+}
+
+/*
+ * Fast-forwards 'model' from instruction '*position' to the start of the
+ * warm-up of the representative of 'phase', then simulates the warm-up and
+ * the interval in detail.
+ */
+static int
+simulate_phase(APEX_Sampler *sampler, APEX_Checker *model, int *position,
+               Sample_Phase *phase)
+{
+    int start = phase->interval * sampler->interval_size;
+    int warm_start = start > sampler->config.sample_warmup
+                         ? start - sampler->config.sample_warmup
+                         : 0;
+    Sample_Measure measure;
+
+    while (*position < warm_start)
+    {
+        APEX_check_step(model);
+        (*position)++;
+    }
+
+    if (!APEX_sample_measure(sampler->code_memory, sampler->code_memory_size,
+                             &sampler->config, model, start - warm_start,
+                             sampler->interval_insns[phase->interval],
+                             &measure))
+    {
+        sampler->diverged = measure.diverged;
+        return FALSE;
+    }
+
+    phase->cycles = measure.cycles;
+    phase->measured = measure.instructions;
+    phase->cpi = phase->measured ? (double)phase->cycles / phase->measured
+                                 : 0.0;
+    sampler->warmed += measure.warmed;
+    sampler->detailed += phase->measured;
+    return TRUE;
+}
+
+/* Simulates the whole program in detail, for the error of the estimate */
+static int
+simulate_full(APEX_Sampler *sampler)
+{
+    APEX_CPU *cpu = APEX_cpu_init_code(sampler->code_memory,
+                                       sampler->code_memory_size,
+                                       &sampler->config);
+    int halted = FALSE;
+
+    if (!cpu)
+    {
+        return FALSE;
+    }
+
+    while (!halted && cpu->insn_completed < sampler->instructions)
+    {
+        halted = APEX_cpu_step(cpu);
+    }
+
+    sampler->diverged = cpu->diverged;
+    sampler->full_cycles = halted ? cpu->clock + 1 : cpu->clock;
+    sampler->full_instructions = cpu->insn_completed;
+    APEX_cpu_stop(cpu);
+    return !sampler->diverged;
+}
+
+/*
+ * Profiles and clusters the program, then simulates the representative of
+ * every phase in detail. Returns FALSE if a step failed or the checker
+ * stopped a detailed run.
+ */
+int
+APEX_sample_run(APEX_Sampler *sampler)
+{
+    APEX_Checker *model;
+    double start = host_time();
+    int position = 0;
+    int i;
+
+    if (!profile(sampler) || !cluster(sampler))
+    {
+        fprintf(stderr, "APEX_Error: Unable to profile the program\n");
+        return FALSE;
+    }
+    sampler->profile_seconds = host_time() - start;
+
+    start = host_time();
+    model = APEX_check_init(sampler->code_memory, sampler->code_memory_size,
+                            4000);
+    if (!model)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < sampler->phases; ++i)
+    {
+        if (!simulate_phase(sampler, model, &position, &sampler->phase[i]))
+        {
+            APEX_check_free(model);
+            return FALSE;
+        }
+        sampler->estimated_cpi += sampler->phase[i].weight
+                                  * sampler->phase[i].cpi;
+    }
+    APEX_check_free(model);
+    sampler->sample_seconds = host_time() - start;
+
+    if (sampler->config.sample_verify)
+    {
+        start = host_time();
+        if (!simulate_full(sampler))
+        {
+            return FALSE;
+        }
+        sampler->full_seconds = host_time() - start;
+    }
+
+    printf("APEX_CPU: Sampled Simulation Complete, estimated cycles = %.0f "
+           "instructions = %d\n",
+           sampler->estimated_cpi * sampler->instructions,
+           sampler->instructions);
+    return TRUE;
+}
+
+void
+APEX_sample_print_stats(const APEX_Sampler *sampler)
+{
+    int i;
+
+    printf("----------\n%s\n----------\n", "SAMPLED SIMULATION");
+    printf("Instructions     : %d in %d intervals of %d%s\n",
+           sampler->instructions, sampler->intervals, sampler->interval_size,
+           sampler->halted ? "" : " (no HALT)");
+    printf("Phases           : %d of at most %d\n", sampler->phases,
+           sampler->config.sample_phases);
+    for (i = 0; i < sampler->phases; ++i)
+    {
+        const Sample_Phase *phase = &sampler->phase[i];
+        char label[24];
+
+        snprintf(label, sizeof(label), "Phase %d", i);
+        printf("%-17s: %d intervals, sample %d, weight %.3f, CPI %.3f\n",
+               label, phase->intervals, phase->interval, phase->weight,
+               phase->cpi);
+    }
+    printf("Detailed         : %d instructions, %d warm-up (%.1f%%)\n",
+           sampler->detailed, sampler->warmed,
+           sampler->instructions
+               ? 100.0 * (sampler->detailed + sampler->warmed)
+                     / sampler->instructions
+               : 0.0);
+    printf("Estimated CPI    : %.3f\n", sampler->estimated_cpi);
+    printf("Estimated cycles : %.0f\n",
+           sampler->estimated_cpi * sampler->instructions);
+
+    if (sampler->full_instructions)
+    {
+        double full_cpi = (double)sampler->full_cycles
+                          / sampler->full_instructions;
+
+        printf("Full run CPI     : %.3f (%d cycles)\n", full_cpi,
+               sampler->full_cycles);
+        printf("CPI error        : %.2f%%\n",
+               100.0 * fabs(sampler->estimated_cpi - full_cpi) / full_cpi);
+        printf("Host time        : %.3f s profile, %.3f s sampled, "
+               "%.3f s full\n",
+               sampler->profile_seconds, sampler->sample_seconds,
+               sampler->full_seconds);
+    }
+    else
+    {
+        printf("Host time        : %.3f s profile, %.3f s sampled\n",
+               sampler->profile_seconds, sampler->sample_seconds);
+    }
+    printf("\n");
+}
+
+static double
+stat_estimated_cycles(const void *owner)
+{
+    const APEX_Sampler *sampler = owner;
+
+    return sampler->estimated_cpi * sampler->instructions;
+}
+
+/* Error of the estimate against the full run, 0 without one */
+static double
+stat_cpi_error(const void *owner)
+{
+    const APEX_Sampler *sampler = owner;
+    double full_cpi;
+
+    if (!sampler->full_instructions)
+    {
+        return 0.0;
+    }
+    full_cpi = (double)sampler->full_cycles / sampler->full_instructions;
+    return fabs(sampler->estimated_cpi - full_cpi) / full_cpi;
+}
+
+void
+APEX_sample_register_stats(const APEX_Sampler *sampler, APEX_Stats *stats)
+{
+    char section[16];
+    int i;
+
+    APEX_stats_counter(stats, "instructions", &sampler->instructions);
+    APEX_stats_counter(stats, "intervals", &sampler->intervals);
+    APEX_stats_counter(stats, "interval_size", &sampler->interval_size);
+    APEX_stats_counter(stats, "halted", &sampler->halted);
+    APEX_stats_counter(stats, "diverged", &sampler->diverged);
+    APEX_stats_counter(stats, "phases", &sampler->phases);
+    APEX_stats_counter(stats, "detailed", &sampler->detailed);
+    APEX_stats_counter(stats, "warmed", &sampler->warmed);
+    APEX_stats_real(stats, "estimated_cpi", &sampler->estimated_cpi);
+    APEX_stats_derived(stats, "estimated_cycles", stat_estimated_cycles,
+                       sampler);
+    APEX_stats_counter(stats, "full_cycles", &sampler->full_cycles);
+    APEX_stats_counter(stats, "full_instructions",
+                       &sampler->full_instructions);
+    APEX_stats_derived(stats, "cpi_error", stat_cpi_error, sampler);
+    APEX_stats_real(stats, "profile_seconds", &sampler->profile_seconds);
+    APEX_stats_real(stats, "sample_seconds", &sampler->sample_seconds);
+    APEX_stats_real(stats, "full_seconds", &sampler->full_seconds);
+
+    for (i = 0; i < sampler->phases; ++i)
+    {
+        const Sample_Phase *phase = &sampler->phase[i];
+
+        snprintf(section, sizeof(section), "phase%d", i);
+        APEX_stats_enter(stats, section);
+        APEX_stats_counter(stats, "intervals", &phase->intervals);
+        APEX_stats_counter(stats, "sample", &phase->interval);
+        APEX_stats_real(stats, "weight", &phase->weight);
+        APEX_stats_real(stats, "cpi", &phase->cpi);
+        APEX_stats_leave(stats);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * apex_sample.h
+ * Contains APEX sampled simulation declarations
+ *
+ * A sampled run estimates the CPI of a whole program from a few short
+ * detailed simulations, in the style of SimPoint. A profiling pass runs the
+ * program on the functional model of the lockstep checker and splits it into
+ * intervals of 'sample' instructions. For every interval it counts the
+ * instructions executed in each basic block, the basic block vector (BBV).
+ * Intervals with similar vectors execute the same code in the same
+ * proportions, so k-means groups the vectors into phases, trying 1 to
+ * 'sample_phases' clusters and keeping the smallest count that scores within
+ * 90% of the best Bayesian information criterion (BIC).
+ *
+ * Each phase is represented by the interval closest to the centre of its
+ * cluster. The functional model fast-forwards to each representative in
+ * program order, then a fresh pipeline starts from the model's state, runs
+ * 'sample_warmup' instructions to warm its caches and queues and is measured
+ * over the interval. The CPI of every representative is weighted by the
+ * share of the program's instructions in its phase. With sample_verify=1 the
+ * program is also simulated in full to report the error of the estimate.
+ */
+#ifndef _APEX_SAMPLE_H_
+#define _APEX_SAMPLE_H_
+
+#include "apex_cpu.h"
+
+/* Stop profiling a program that has not halted after this many
+ * instructions */
+#define SAMPLE_MAX_INSTRUCTIONS 100000000
+
+/* k-means gives up on converging after this many iterations */
+#define SAMPLE_KMEANS_ITERATIONS 100
+
+/* Intervals of the program sharing one representative */
+typedef struct Sample_Phase
+{
+    int interval;                  /* Representative interval */
+    int intervals;                 /* Intervals in the phase */
+    int instructions;              /* Instructions in those intervals */
+    double weight;                 /* Share of the program's instructions */
+    int cycles;                    /* Measured over the representative */
+    int measured;                  /* Instructions measured */
+    double cpi;
+} Sample_Phase;
+
+/* Counters of a detailed simulation over a stretch of the program */
+typedef struct Sample_Measure
+{
+    int warmed;                    /* Warm-up instructions before it */
+    int instructions;
+    int cycles;
+    int dcache_accesses;
+    int dcache_misses;
+    int icache_accesses;
+    int icache_misses;
+    int halted;                    /* Ended at HALT */
+    int diverged;                  /* The checker stopped the simulation */
+} Sample_Measure;
+
+/* Model of a sampled simulation of one program */
+typedef struct APEX_Sampler
+{
+    APEX_Config config;
+    APEX_Instruction *code_memory;
+    int code_memory_size;
+    int interval_size;             /* Instructions per interval */
+    int intervals;
+    int instructions;              /* Instructions in the whole program */
+    int *bbv;                      /* intervals x code_memory_size counts,
+                                      indexed by basic block leader */
+    int bbv_size;                  /* Intervals the vectors have room for */
+    int *interval_insns;           /* Instructions in each interval */
+    int *cluster;                  /* Phase of each interval */
+    int phases;
+    Sample_Phase *phase;
+    int halted;                    /* The profile ended at HALT */
+    int diverged;                  /* The checker stopped a detailed run */
+
+    /* Results */
+    int warmed;                    /* Warm-up instructions simulated */
+    int detailed;                  /* Instructions measured in detail */
+    double estimated_cpi;
+    int full_cycles;               /* Full detailed run, sample_verify=1 */
+    int full_instructions;
+    double profile_seconds;        /* Host time of each step */
+    double sample_seconds;
+    double full_seconds;
+} APEX_Sampler;
+
+APEX_Sampler *APEX_sample_init(const char *filename, const APEX_Config *config);
+int APEX_sample_run(APEX_Sampler *sampler);
+void APEX_sample_print_stats(const APEX_Sampler *sampler);
+void APEX_sample_register_stats(const APEX_Sampler *sampler,
+                                APEX_Stats *stats);
+void APEX_sample_stop(APEX_Sampler *sampler);
+int APEX_sample_measure(const APEX_Instruction *code_memory,
+                        int code_memory_size, const APEX_Config *config,
+                        const struct APEX_Checker *start, int warmup,
+                        int length, Sample_Measure *measure);
+#endif
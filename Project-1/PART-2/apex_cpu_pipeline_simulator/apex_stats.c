@@ -0,0 +1,292 @@
+/*
+ * apex_stats.c
+ * Contains APEX statistics registry implementation
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_stats.h"
+
+volatile sig_atomic_t APEX_stats_pending;
+
+void
+APEX_stats_init(APEX_Stats *stats)
+{
+    memset(stats, 0, sizeof(APEX_Stats));
+}
+
+void
+APEX_stats_free(APEX_Stats *stats)
+{
+    free(stats->entries);
+    stats->entries = NULL;
+    stats->count = 0;
+    stats->size = 0;
+}
+
+/* Opens a section, nested deeper than STAT_DEPTH ones are ignored */
+void
+APEX_stats_enter(APEX_Stats *stats, const char *section)
+{
+    size_t length = strlen(stats->prefix);
+
+    if (stats->depth == STAT_DEPTH)
+    {
+        stats->failed = TRUE;
+        return;
+    }
+    stats->length[stats->depth++] = (int)length;
+    snprintf(stats->prefix + length, sizeof(stats->prefix) - length, "%s.",
+             section);
+}
+
+void
+APEX_stats_leave(APEX_Stats *stats)
+{
+    if (stats->depth)
+    {
+        stats->prefix[stats->length[--stats->depth]] = '\0';
+    }
+}
+
+/* Adds an entry named 'name' in the current section, or NULL if out of memory */
+static Stat_Entry *
+add_entry(APEX_Stats *stats, const char *name, int kind)
+{
+    Stat_Entry *entry;
+
+    if (stats->count == stats->size)
+    {
+        int size = stats->size ? 2 * stats->size : 64;
+        Stat_Entry *entries = realloc(stats->entries, size * sizeof(Stat_Entry));
+
+        if (!entries)
+        {
+            stats->failed = TRUE;
+            return NULL;
+        }
+        stats->entries = entries;
+        stats->size = size;
+    }
+
+    entry = &stats->entries[stats->count++];
+    memset(entry, 0, sizeof(Stat_Entry));
+    snprintf(entry->name, sizeof(entry->name), "%s%s", stats->prefix, name);
+    entry->kind = kind;
+    return entry;
+}
+
+void
+APEX_stats_counter(APEX_Stats *stats, const char *name, const int *counter)
+{
+    Stat_Entry *entry = add_entry(stats, name, STAT_COUNTER);
+
+    if (entry)
+    {
+        entry->counter = counter;
+    }
+}
+
+void
+APEX_stats_real(APEX_Stats *stats, const char *name, const double *real)
+{
+    Stat_Entry *entry = add_entry(stats, name, STAT_REAL);
+
+    if (entry)
+    {
+        entry->real = real;
+    }
+}
+
+/* 'derive' is called with 'owner' every time the entry is written */
+void
+APEX_stats_derived(APEX_Stats *stats, const char *name,
+                   double (*derive)(const void *owner), const void *owner)
+{
+    Stat_Entry *entry = add_entry(stats, name, STAT_DERIVED);
+
+    if (entry)
+    {
+        entry->derive = derive;
+        entry->owner = owner;
+    }
+}
+
+void
+APEX_stats_histogram(APEX_Stats *stats, const char *name, const int *buckets,
+                     int count)
+{
+    Stat_Entry *entry = add_entry(stats, name, STAT_HISTOGRAM);
+
+    if (entry)
+    {
+        entry->counter = buckets;
+        entry->buckets = count;
+    }
+}
+
+/* Writes a real value, 'none' stands for the ones that are not finite */
+static void
+write_real(FILE *fp, double value, const char *none)
+{
+    if (isfinite(value))
+    {
+        fprintf(fp, "%.10g", value);
+    }
+    else
+    {
+        fputs(none, fp);
+    }
+}
+
+static void
+write_value(FILE *fp, const Stat_Entry *entry, const char *none)
+{
+    switch (entry->kind)
+    {
+        case STAT_COUNTER: fprintf(fp, "%d", *entry->counter); break;
+        case STAT_REAL: write_real(fp, *entry->real, none); break;
+        default: write_real(fp, entry->derive(entry->owner), none); break;
+    }
+}
+
+/* One object, names as keys, histograms as arrays */
+void
+APEX_stats_write_json(const APEX_Stats *stats, FILE *fp)
+{
+    int i;
+    int b;
+
+    fprintf(fp, "{");
+    for (i = 0; i < stats->count; ++i)
+    {
+        const Stat_Entry *entry = &stats->entries[i];
+
+        fprintf(fp, "%s\n  \"%s\": ", i ? "," : "", entry->name);
+        if (entry->kind != STAT_HISTOGRAM)
+        {
+            write_value(fp, entry, "null");
+            continue;
+        }
+
+        fprintf(fp, "[");
+        for (b = 0; b < entry->buckets; ++b)
+        {
+            fprintf(fp, "%s%d", b ? ", " : "", entry->counter[b]);
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "\n}\n");
+}
+
+/* One name,value row per entry, histograms one row per bucket */
+void
+APEX_stats_write_csv(const APEX_Stats *stats, FILE *fp)
+{
+    int i;
+    int b;
+
+    fprintf(fp, "name,value\n");
+    for (i = 0; i < stats->count; ++i)
+    {
+        const Stat_Entry *entry = &stats->entries[i];
+
+        if (entry->kind != STAT_HISTOGRAM)
+        {
+            fprintf(fp, "%s,", entry->name);
+            write_value(fp, entry, "");
+            fprintf(fp, "\n");
+            continue;
+        }
+
+        for (b = 0; b < entry->buckets; ++b)
+        {
+            fprintf(fp, "%s[%d],%d\n", entry->name, b, entry->counter[b]);
+        }
+    }
+}
+
+/*
+ * Writes the registry to 'path', as CSV if it ends in .csv and as JSON
+ * otherwise, or as JSON to stdout if it is "-". A file is written next to
+ * 'path' and renamed over it, so readers never see half of it. Returns
+ * FALSE if it could not be written.
+ */
+int
+APEX_stats_write(const APEX_Stats *stats, const char *path)
+{
+    size_t length = strlen(path);
+    int csv = length >= 4 && !strcmp(path + length - 4, ".csv");
+    char *temp;
+    FILE *fp;
+    int ok;
+
+    if (stats->failed)
+    {
+        fprintf(stderr, "APEX_Error: Statistics registry out of memory\n");
+        return FALSE;
+    }
+
+    if (!strcmp(path, "-"))
+    {
+        APEX_stats_write_json(stats, stdout);
+        fflush(stdout);
+        return TRUE;
+    }
+
+    temp = malloc(length + 5);
+    if (!temp)
+    {
+        return FALSE;
+    }
+    snprintf(temp, length + 5, "%s.tmp", path);
+
+    fp = fopen(temp, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        free(temp);
+        return FALSE;
+    }
+    if (csv)
+    {
+        APEX_stats_write_csv(stats, fp);
+    }
+    else
+    {
+        APEX_stats_write_json(stats, fp);
+    }
+
+    ok = !ferror(fp);
+    ok &= !fclose(fp);
+    ok = ok && !rename(temp, path);
+    if (!ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", path);
+        remove(temp);
+    }
+    free(temp);
+    return ok;
+}
+
+static void
+request_stats(int sig)
+{
+    (void)sig;
+    APEX_stats_pending = TRUE;
+}
+
+/* SIGUSR1 asks a running simulation to write its statistics */
+void
+APEX_stats_catch_signal(void)
+{
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stats;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
@@ -0,0 +1,896 @@
+/*
+ * apex_system.c
+ * Contains APEX multicore system implementation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_system.h"
+#include "apex_check.h"
+
+static double
+host_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* CPU time the calling host thread has used */
+static double
+thread_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Splits the next "file[@pc]" entry off a comma separated program list.
+ * Returns FALSE at the end of the list, '*entry' is 0 without an @pc.
+ */
+static int
+next_program(char **list, char **file, int *entry)
+{
+    char *at;
+
+    if (!*list)
+    {
+        return FALSE;
+    }
+
+    *file = *list;
+    *list = strchr(*list, ',');
+    if (*list)
+    {
+        *(*list)++ = '\0';
+    }
+
+    *entry = 0;
+    at = strchr(*file, '@');
+    if (at)
+    {
+        *at = '\0';
+        *entry = atoi(at + 1);
+    }
+    return TRUE;
+}
+
+/*
+ * Creates a system stepping the same cores as 'system' sequentially, from
+ * the same entry PCs. Nothing it does is printed or written to a file.
+ */
+static APEX_System *
+create_reference(const APEX_System *system, const APEX_Config *config)
+{
+    APEX_System *reference;
+    APEX_Config reference_config = *config;
+    int i;
+
+    reference_config.parallel = FALSE;
+    reference_config.parallel_verify = FALSE;
+    reference_config.stats[0] = '\0';
+    reference_config.trace[0] = '\0';
+    reference_config.itrace[0] = '\0';
+
+    reference = calloc(1, sizeof(APEX_System));
+    if (!reference)
+    {
+        return NULL;
+    }
+
+    reference->cores = system->cores;
+    reference->cpu = calloc(reference->cores, sizeof(APEX_CPU *));
+    reference->data_memory = calloc(DATA_MEMORY_SIZE, sizeof(int));
+    if (!reference->cpu || !reference->data_memory
+        || !APEX_coherence_init(&reference->coherence, reference->cores,
+                                reference_config.coherence_latency))
+    {
+        APEX_system_stop(reference);
+        return NULL;
+    }
+
+    for (i = 0; i < reference->cores; ++i)
+    {
+        const APEX_CPU *core = system->cpu[i];
+        APEX_CPU *cpu = APEX_cpu_init_code(core->code_memory,
+                                           core->code_memory_size,
+                                           &reference_config);
+
+        if (!cpu)
+        {
+            APEX_system_stop(reference);
+            return NULL;
+        }
+        reference->cpu[i] = cpu;
+
+        cpu->pc = core->pc;
+        if (cpu->checker)
+        {
+            cpu->checker->pc = core->pc;
+        }
+        APEX_cpu_attach(cpu, i, reference->data_memory, &reference->coherence);
+    }
+
+    return reference;
+}
+
+/*
+ * Creates the cores of a system. 'programs' is a comma separated list of
+ * "file[@pc]" entries, one per core; an optional @pc sets the entry PC of
+ * that core. Cores beyond the end of the list run the last entry. The
+ * number of cores is the larger of config->cores and the list length.
+ */
+APEX_System *
+APEX_system_init(const char *programs, const APEX_Config *config)
+{
+    APEX_System *system;
+    APEX_Config core_config;
+    char *list;
+    char *next;
+    char *file = NULL;
+    int entry = 0;
+    int count = 1;
+    int i;
+
+    if (!programs)
+    {
+        return NULL;
+    }
+
+    for (i = 0; programs[i]; ++i)
+    {
+        if (programs[i] == ',')
+        {
+            count++;
+        }
+    }
+
+    core_config = *config;
+    if (core_config.cores < count)
+    {
+        core_config.cores = count;
+    }
+
+    system = calloc(1, sizeof(APEX_System));
+    list = strdup(programs);
+    if (!system || !list)
+    {
+        free(system);
+        free(list);
+        return NULL;
+    }
+
+    system->cores = core_config.cores;
+    system->single_step = ENABLE_SINGLE_STEP;
+    system->cpu = calloc(system->cores, sizeof(APEX_CPU *));
+    system->data_memory = calloc(DATA_MEMORY_SIZE, sizeof(int));
+    if (!system->cpu || !system->data_memory
+        || !APEX_coherence_init(&system->coherence, system->cores,
+                                core_config.coherence_latency))
+    {
+        free(list);
+        APEX_system_stop(system);
+        return NULL;
+    }
+
+    next = list;
+    for (i = 0; i < system->cores; ++i)
+    {
+        APEX_CPU *cpu;
+
+        /* Past the end of the list 'file' and 'entry' keep the last entry */
+        next_program(&next, &file, &entry);
+
+        cpu = APEX_cpu_init(file, &core_config);
+        if (!cpu)
+        {
+            free(list);
+            APEX_system_stop(system);
+            return NULL;
+        }
+        system->cpu[i] = cpu;
+
+        if (entry)
+        {
+            if (entry < 4000 || entry % 4
+                || entry >= 4000 + 4 * cpu->code_memory_size)
+            {
+                fprintf(stderr, "APEX_Error: Invalid entry PC %d for core %d\n",
+                        entry, i);
+                free(list);
+                APEX_system_stop(system);
+                return NULL;
+            }
+            cpu->pc = entry;
+            if (cpu->checker)
+            {
+                cpu->checker->pc = entry;
+            }
+        }
+
+        APEX_cpu_attach(cpu, i, system->data_memory, &system->coherence);
+
+        /* Each core traces its own accesses, to <trace>.core<i>, and its
+         * own instructions, to <itrace>.core<i> */
+        if (core_config.trace[0])
+        {
+            char path[STATS_PATH_SIZE + 16];
+
+            snprintf(path, sizeof(path), "%s.core%d", core_config.trace, i);
+            cpu->trace = APEX_trace_open(path, TRACE_MEMORY);
+            if (!cpu->trace)
+            {
+                free(list);
+                APEX_system_stop(system);
+                return NULL;
+            }
+        }
+        if (core_config.itrace[0])
+        {
+            char path[STATS_PATH_SIZE + 16];
+
+            snprintf(path, sizeof(path), "%s.core%d", core_config.itrace, i);
+            cpu->itrace = APEX_trace_open(path, TRACE_INSN);
+            if (!cpu->itrace)
+            {
+                free(list);
+                APEX_system_stop(system);
+                return NULL;
+            }
+        }
+    }
+    free(list);
+
+    if (core_config.parallel)
+    {
+        system->parallel = TRUE;
+        system->quantum = core_config.quantum;
+        system->coherence.deferred = TRUE;
+        system->threads = calloc(system->cores, sizeof(Core_Thread));
+        system->owed = calloc(system->cores, sizeof(int));
+        if (!system->threads || !system->owed)
+        {
+            APEX_system_stop(system);
+            return NULL;
+        }
+
+        /* Between barriers each core works on its own copy of memory */
+        for (i = 0; i < system->cores; ++i)
+        {
+            APEX_CPU *cpu = system->cpu[i];
+
+            cpu->quiet = TRUE;
+            cpu->data_memory = malloc(DATA_MEMORY_SIZE * sizeof(int));
+            cpu->shared_memory = FALSE;
+            cpu->write_log = malloc(64 * sizeof(Memory_Write));
+            cpu->write_log_size = 64;
+            if (!cpu->data_memory || !cpu->write_log)
+            {
+                APEX_system_stop(system);
+                return NULL;
+            }
+            memcpy(cpu->data_memory, system->data_memory,
+                   DATA_MEMORY_SIZE * sizeof(int));
+        }
+
+        if (core_config.parallel_verify)
+        {
+            system->reference = create_reference(system, &core_config);
+            if (!system->reference)
+            {
+                APEX_system_stop(system);
+                return NULL;
+            }
+        }
+    }
+
+    return system;
+}
+
+static void
+print_system_stats(const APEX_System *system)
+{
+    int instructions = 0;
+    int i;
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        instructions += system->cpu[i]->insn_completed;
+    }
+
+    printf("----------\n%s\n----------\n", "SYSTEM");
+    printf("Cores            : %d\n", system->cores);
+    printf("Cycles           : %d\n", system->clock + 1);
+    printf("Instructions     : %d\n", instructions);
+    printf("IPC              : %.3f\n",
+           (double)instructions / (system->clock + 1));
+    printf("Host time        : %.3f s\n", system->host_seconds);
+    printf("%-9s %-9s %-9s %-9s %-9s %-9s\n", "core", "cycles", "insns",
+           "IPC", "d-hits", "d-misses");
+    for (i = 0; i < system->cores; ++i)
+    {
+        const APEX_CPU *cpu = system->cpu[i];
+        int cycles = cpu->halted ? cpu->clock + 1 : cpu->clock;
+
+        printf("%-9d %-9d %-9d %-9.3f %-9d %-9d\n", i, cycles,
+               cpu->insn_completed,
+               cycles ? (double)cpu->insn_completed / cycles : 0.0,
+               cpu->dcache.hits, cpu->dcache.misses);
+    }
+    printf("\n");
+}
+
+/* Cycles until the last core halted, or the system stopped */
+static int
+system_cycles(const APEX_System *system)
+{
+    int cycles = 0;
+    int i;
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        const APEX_CPU *cpu = system->cpu[i];
+
+        if (cpu->clock + cpu->halted > cycles)
+        {
+            cycles = cpu->clock + cpu->halted;
+        }
+    }
+    return cycles;
+}
+
+/* Data cache misses of all cores */
+static int
+system_dcache_misses(const APEX_System *system)
+{
+    int misses = 0;
+    int i;
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        misses += system->cpu[i]->dcache.misses;
+    }
+    return misses;
+}
+
+static void
+print_parallel_stats(const APEX_System *system)
+{
+    double core_seconds = 0;
+    int i;
+
+    printf("----------\n%s\n----------\n", "PARALLEL SIMULATION");
+    if (!system->parallel)
+    {
+        printf("Disabled\n\n");
+        return;
+    }
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        core_seconds += system->threads[i].seconds;
+    }
+
+    printf("Host threads     : %d, quantum %d%s\n", system->cores,
+           system->quantum, system->quantum == 1 ? " (strict)" : "");
+    printf("Barriers         : %d\n", system->barriers);
+    printf("Exchanged        : %d stores, %d bus requests\n",
+           system->exchanged_stores, system->exchanged_requests);
+    if (system->reference)
+    {
+        int cycles = system_cycles(system);
+        int sequential = system_cycles(system->reference);
+
+        printf("Parallel run     : %d cycles, %d data cache misses\n", cycles,
+               system_dcache_misses(system));
+        printf("Sequential run   : %d cycles, %d data cache misses\n",
+               sequential, system_dcache_misses(system->reference));
+        printf("Cycle error      : %.2f%%\n",
+               sequential ? 100.0 * abs(cycles - sequential) / sequential
+                          : 0.0);
+    }
+    printf("Host time        : %.3f s", system->host_seconds);
+    if (system->reference)
+    {
+        printf(", %.3f s sequential", system->reference->host_seconds);
+    }
+    printf("\n");
+
+    /* Only the sequential run measures a speedup. The CPU time the threads
+     * spent stepping cores over the wall time shows how busy they kept
+     * the host, which is no speedup on a host with fewer CPUs. */
+    printf("Core CPU time    : %.3f s\n", core_seconds);
+    printf("CPU / wall time  : %.2f\n",
+           system->host_seconds > 0 ? core_seconds / system->host_seconds
+                                    : 0.0);
+    if (system->reference)
+    {
+        printf("Speedup          : %.2fx over sequential stepping\n",
+               system->host_seconds > 0
+                   ? system->reference->host_seconds / system->host_seconds
+                   : 0.0);
+    }
+    printf("\n");
+}
+
+static double
+stat_system_cycles(const void *owner)
+{
+    const APEX_System *system = owner;
+
+    return system->clock + 1;
+}
+
+static double
+stat_system_instructions(const void *owner)
+{
+    const APEX_System *system = owner;
+    double instructions = 0;
+    int i;
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        instructions += system->cpu[i]->insn_completed;
+    }
+    return instructions;
+}
+
+static double
+stat_system_ipc(const void *owner)
+{
+    return stat_system_instructions(owner) / stat_system_cycles(owner);
+}
+
+static double
+stat_sequential_cycles(const void *owner)
+{
+    return system_cycles(((const APEX_System *)owner)->reference);
+}
+
+static double
+stat_sequential_misses(const void *owner)
+{
+    return system_dcache_misses(((const APEX_System *)owner)->reference);
+}
+
+/*
+ * Writes the configuration, the system and coherence statistics and those
+ * of every core, as "core<i>.<name>", to the file of the stats= option
+ */
+static void
+write_stats(const APEX_System *system)
+{
+    APEX_Stats stats;
+    char section[16];
+    int i;
+
+    APEX_stats_init(&stats);
+    APEX_stats_enter(&stats, "config");
+    APEX_config_register_stats(&system->cpu[0]->config, &stats);
+    APEX_stats_leave(&stats);
+
+    APEX_stats_enter(&stats, "system");
+    APEX_stats_counter(&stats, "cores", &system->cores);
+    APEX_stats_derived(&stats, "cycles", stat_system_cycles, system);
+    APEX_stats_derived(&stats, "instructions", stat_system_instructions,
+                       system);
+    APEX_stats_derived(&stats, "ipc", stat_system_ipc, system);
+    APEX_stats_real(&stats, "host_seconds", &system->host_seconds);
+    APEX_stats_counter(&stats, "barriers", &system->barriers);
+    APEX_stats_counter(&stats, "exchanged_stores", &system->exchanged_stores);
+    APEX_stats_counter(&stats, "exchanged_requests",
+                       &system->exchanged_requests);
+    if (system->reference)
+    {
+        APEX_stats_derived(&stats, "sequential_cycles", stat_sequential_cycles,
+                           system);
+        APEX_stats_derived(&stats, "sequential_dcache_misses",
+                           stat_sequential_misses, system);
+        APEX_stats_real(&stats, "sequential_seconds",
+                        &system->reference->host_seconds);
+    }
+    APEX_stats_leave(&stats);
+
+    APEX_stats_enter(&stats, "coherence");
+    APEX_coherence_register_stats(&system->coherence, &stats);
+    APEX_stats_leave(&stats);
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        snprintf(section, sizeof(section), "core%d", i);
+        APEX_stats_enter(&stats, section);
+        APEX_cpu_register_stats(system->cpu[i], &stats);
+        APEX_stats_leave(&stats);
+    }
+
+    APEX_stats_write(&stats, system->cpu[0]->config.stats);
+    APEX_stats_free(&stats);
+}
+
+/* Runs the core of 'arg' one quantum at a time until told to stop */
+static void *
+core_thread(void *arg)
+{
+    Core_Thread *thread = arg;
+    APEX_System *system = thread->system;
+    APEX_CPU *cpu = system->cpu[thread->core];
+
+    while (TRUE)
+    {
+        double start;
+
+        pthread_barrier_wait(&system->start);
+        if (system->done)
+        {
+            break;
+        }
+
+        start = thread_time();
+        while (!cpu->halted && cpu->clock < system->limit)
+        {
+            APEX_cpu_step(cpu);
+        }
+        thread->seconds += thread_time() - start;
+
+        pthread_barrier_wait(&system->end);
+    }
+
+    return NULL;
+}
+
+/*
+ * Makes what the cores did during the last quantum visible to each other:
+ * stores are published in core order, so the higher core wins when two
+ * cores wrote the same word, and the queued bus requests are snooped
+ */
+static void
+exchange(APEX_System *system)
+{
+    int i;
+    int j;
+    int k;
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        APEX_CPU *cpu = system->cpu[i];
+
+        for (k = 0; k < cpu->write_log_count; ++k)
+        {
+            const Memory_Write *write = &cpu->write_log[k];
+
+            system->data_memory[write->address] = write->value;
+            for (j = 0; j < system->cores; ++j)
+            {
+                system->cpu[j]->data_memory[write->address] = write->value;
+            }
+        }
+        system->exchanged_stores += cpu->write_log_count;
+        cpu->write_log_count = 0;
+    }
+
+    memset(system->owed, 0, system->cores * sizeof(int));
+    system->exchanged_requests
+        += APEX_coherence_exchange(&system->coherence, system->owed);
+
+    /* Latency of flushes found at the barrier is paid at the memory port */
+    for (i = 0; i < system->cores; ++i)
+    {
+        system->cpu[i]->dcache_busy_cycles += system->owed[i];
+    }
+    system->barriers++;
+}
+
+static void
+run_parallel(APEX_System *system)
+{
+    char user_prompt_val;
+    int *reported;
+    int diverged = FALSE;
+    int i;
+
+    reported = calloc(system->cores, sizeof(int));
+    if (!reported
+        || pthread_barrier_init(&system->start, NULL, system->cores + 1)
+        || pthread_barrier_init(&system->end, NULL, system->cores + 1))
+    {
+        fprintf(stderr, "APEX_Error: Unable to start host threads\n");
+        exit(1);
+    }
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        system->threads[i].system = system;
+        system->threads[i].core = i;
+        if (pthread_create(&system->threads[i].thread, NULL, core_thread,
+                           &system->threads[i]))
+        {
+            fprintf(stderr, "APEX_Error: Unable to start host threads\n");
+            exit(1);
+        }
+    }
+
+    while (TRUE)
+    {
+        int running = 0;
+        int cycles = 0;
+
+        system->limit = system->clock + system->quantum;
+        if (system->max_cycles != 0 && system->limit > system->max_cycles)
+        {
+            system->limit = system->max_cycles;
+        }
+
+        pthread_barrier_wait(&system->start);
+        pthread_barrier_wait(&system->end);
+        exchange(system);
+        system->clock = system->limit;
+
+        /* The cores wait at the barrier, their counters hold still */
+        if (APEX_stats_pending)
+        {
+            APEX_stats_pending = FALSE;
+            write_stats(system);
+        }
+
+        for (i = 0; i < system->cores; ++i)
+        {
+            APEX_CPU *cpu = system->cpu[i];
+
+            if (!cpu->halted)
+            {
+                running++;
+            }
+            else if (!reported[i])
+            {
+                reported[i] = TRUE;
+                printf("APEX_CPU: Core %d %s, cycles = %d instructions = %d\n",
+                       i, cpu->diverged ? "Stopped at divergence" : "Complete",
+                       cpu->clock + 1, cpu->insn_completed);
+                diverged |= cpu->diverged;
+            }
+
+            if (cpu->clock + cpu->halted > cycles)
+            {
+                cycles = cpu->clock + cpu->halted;
+            }
+        }
+
+        if (diverged)
+        {
+            system->clock = cycles - 1;
+            printf("APEX_CPU: Simulation Stopped at divergence, cycles = %d\n",
+                   cycles);
+            break;
+        }
+
+        if (!running)
+        {
+            system->clock = cycles - 1;
+            printf("APEX_CPU: Simulation Complete, cycles = %d\n", cycles);
+            break;
+        }
+
+        if (system->max_cycles != 0 && system->clock >= system->max_cycles)
+        {
+            system->clock = cycles - 1;
+            break;
+        }
+
+        if (system->single_step)
+        {
+            printf("Press any key to advance CPU Clock or <q> to quit:\n");
+            scanf("%c", &user_prompt_val);
+
+            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
+            {
+                printf("APEX_CPU: Simulation Stopped, cycles = %d\n",
+                       system->clock);
+                system->clock--;
+                break;
+            }
+        }
+    }
+
+    system->done = TRUE;
+    pthread_barrier_wait(&system->start);
+    for (i = 0; i < system->cores; ++i)
+    {
+        pthread_join(system->threads[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&system->start);
+    pthread_barrier_destroy(&system->end);
+    free(reported);
+}
+
+/* Steps every core that has not halted once per cycle, in core order */
+static void
+run_sequential(APEX_System *system)
+{
+    char user_prompt_val;
+    int diverged = FALSE;
+    int i;
+
+    while (TRUE)
+    {
+        int running = 0;
+
+        if (system->max_cycles != 0 && system->max_cycles < system->clock + 1)
+        {
+            break;
+        }
+
+        if (APEX_stats_pending)
+        {
+            APEX_stats_pending = FALSE;
+            write_stats(system);
+        }
+
+        for (i = 0; i < system->cores; ++i)
+        {
+            APEX_CPU *cpu = system->cpu[i];
+
+            if (cpu->halted)
+            {
+                continue;
+            }
+
+            if (APEX_cpu_step(cpu))
+            {
+                printf("APEX_CPU: Core %d %s, cycles = %d instructions = %d\n",
+                       i, cpu->diverged ? "Stopped at divergence" : "Complete",
+                       cpu->clock + 1, cpu->insn_completed);
+                diverged |= cpu->diverged;
+            }
+            else
+            {
+                running++;
+            }
+        }
+
+        if (diverged)
+        {
+            printf("APEX_CPU: Simulation Stopped at divergence, cycles = %d\n",
+                   system->clock + 1);
+            break;
+        }
+
+        if (!running)
+        {
+            printf("APEX_CPU: Simulation Complete, cycles = %d\n",
+                   system->clock + 1);
+            break;
+        }
+
+        if (system->single_step)
+        {
+            printf("Press any key to advance CPU Clock or <q> to quit:\n");
+            scanf("%c", &user_prompt_val);
+
+            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
+            {
+                printf("APEX_CPU: Simulation Stopped, cycles = %d\n",
+                       system->clock + 1);
+                break;
+            }
+        }
+
+        system->clock++;
+    }
+}
+
+/*
+ * Steps the cores of the reference system like run_sequential(), for as
+ * many cycles as the parallel run was allowed
+ */
+static void
+run_reference(const APEX_System *system)
+{
+    APEX_System *reference = system->reference;
+    double start = host_time();
+    int running = TRUE;
+    int i;
+
+    while (running
+           && (system->max_cycles == 0 || reference->clock < system->max_cycles))
+    {
+        running = FALSE;
+        for (i = 0; i < reference->cores; ++i)
+        {
+            APEX_CPU *cpu = reference->cpu[i];
+
+            if (!cpu->halted && !APEX_cpu_step(cpu))
+            {
+                running = TRUE;
+            }
+        }
+        reference->clock++;
+    }
+    reference->host_seconds = host_time() - start;
+}
+
+/*
+ * Runs the system until every core has halted or max_cycles have elapsed,
+ * then prints the statistics of each core and of the whole system
+ */
+void
+APEX_system_run(APEX_System *system)
+{
+    double start = host_time();
+    int i;
+
+    if (system->parallel)
+    {
+        run_parallel(system);
+    }
+    else
+    {
+        run_sequential(system);
+    }
+    system->host_seconds = host_time() - start;
+
+    if (system->reference)
+    {
+        run_reference(system);
+    }
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        if (system->cpu[i]->trace)
+        {
+            APEX_trace_close(system->cpu[i]->trace);
+        }
+        if (system->cpu[i]->itrace)
+        {
+            APEX_trace_close(system->cpu[i]->itrace);
+        }
+    }
+
+    for (i = 0; i < system->cores; ++i)
+    {
+        printf("==========\nCORE %d\n==========\n\n", i);
+        if (system->cpu[i]->quiet)
+        {
+            APEX_cpu_print_state(system->cpu[i]);
+        }
+        APEX_cpu_print_stats(system->cpu[i]);
+    }
+    print_system_stats(system);
+    APEX_coherence_print_stats(&system->coherence);
+    print_parallel_stats(system);
+    if (system->cpu[0]->config.stats[0])
+    {
+        write_stats(system);
+    }
+}
+
+void
+APEX_system_stop(APEX_System *system)
+{
+    int i;
+
+    /* The reference cores share the code memory of these */
+    if (system->reference)
+    {
+        APEX_system_stop(system->reference);
+    }
+
+    for (i = 0; system->cpu && i < system->cores; ++i)
+    {
+        if (system->cpu[i])
+        {
+            APEX_cpu_stop(system->cpu[i]);
+        }
+    }
+
+    APEX_coherence_free(&system->coherence);
+    free(system->threads);
+    free(system->owed);
+    free(system->cpu);
+    free(system->data_memory);
+    free(system);
+}
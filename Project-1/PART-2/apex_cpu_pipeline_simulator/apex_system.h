@@ -0,0 +1,68 @@
+/*
+ * apex_system.h
+ * Contains APEX multicore system declarations
+ *
+ * A system is a set of APEX cores, each with its own program, pipeline and
+ * L1 caches, sharing one data memory. The data caches are kept coherent by
+ * a snooping MESI bus. Every cycle the cores are stepped one after another
+ * in core order, so a store drained by a lower numbered core is visible to
+ * the loads of higher numbered cores in the same cycle.
+ *
+ * With parallel=1 every core runs on its own host thread for 'quantum'
+ * cycles, then all threads meet at a barrier. During a quantum a core reads
+ * and writes a private copy of data memory and only queues its coherence
+ * requests. At the barrier the main thread publishes the stores of each
+ * core in core order, and the bus snoops the queued requests in cycle
+ * order. Nothing a thread does depends on the others until then, so every
+ * quantum gives the same results on every run; quantum=1 exchanges every
+ * cycle and is the strict mode.
+ */
+#ifndef _APEX_SYSTEM_H_
+#define _APEX_SYSTEM_H_
+
+#include <pthread.h>
+
+#include "apex_cpu.h"
+
+struct APEX_System;
+
+/* Host thread stepping one core of a parallel run */
+typedef struct Core_Thread
+{
+    struct APEX_System *system;
+    int core;
+    pthread_t thread;
+    double seconds;                /* Thread CPU time spent stepping the core */
+} Core_Thread;
+
+/* Model of a multicore APEX system */
+typedef struct APEX_System
+{
+    int cores;
+    APEX_CPU **cpu;                /* Indexed by core */
+    int *data_memory;              /* Shared by all cores */
+    APEX_Coherence coherence;      /* Snooping bus between the data caches */
+    int clock;                     /* Clock cycles elapsed */
+    int max_cycles;                /* Stop after this many cycles, 0 runs to HALT */
+    int single_step;               /* Wait for user input after every cycle */
+    double host_seconds;           /* Wall clock time of the run */
+
+    /* Parallel run */
+    int parallel;
+    int quantum;
+    int limit;                     /* Cycle the current quantum ends at */
+    int done;                      /* Tells the threads to exit */
+    Core_Thread *threads;
+    pthread_barrier_t start;
+    pthread_barrier_t end;
+    int *owed;                     /* Coherence latency owed per core */
+    int barriers;
+    int exchanged_stores;
+    int exchanged_requests;
+    struct APEX_System *reference; /* Stepped sequentially, or NULL */
+} APEX_System;
+
+APEX_System *APEX_system_init(const char *programs, const APEX_Config *config);
+void APEX_system_run(APEX_System *system);
+void APEX_system_stop(APEX_System *system);
+#endif
@@ -0,0 +1,826 @@
+/*
+ * apex_trace.c
+ * Contains APEX memory and instruction trace implementation
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_trace.h"
+
+/* Shortest match the LZ77 coder looks for */
+#define LZ_MIN_MATCH 4
+
+/* Farthest back a match can start, offsets are 16-bit */
+#define LZ_MAX_OFFSET 65535
+
+/* Magic of each kind of trace, TRACE_MAGIC_SIZE bytes */
+static const char *const trace_magic[] = {"APEXMTR1", "APEXITR1"};
+
+/* Name of each kind of trace in messages */
+static const char *const trace_name[] = {"memory", "instruction"};
+
+static unsigned
+read_u32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static void
+write_u32(unsigned char *p, unsigned value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = value >> 24;
+}
+
+/* Writes a length nibble overflow as a run of 255s and the remainder */
+static unsigned char *
+put_length(unsigned char *out, int length)
+{
+    while (length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+/*
+ * Writes one sequence: a token with the literal count and match length in
+ * its nibbles, the literals, then the match offset. The last sequence of a
+ * block has no match, which the reader knows by running out of input.
+ */
+static unsigned char *
+put_sequence(unsigned char *out, const unsigned char *literals, int count,
+             int offset, int length)
+{
+    unsigned char *token = out++;
+    int match = length ? length - LZ_MIN_MATCH : 0;
+
+    *token = (unsigned char)((count < 15 ? count : 15) << 4
+                             | (match < 15 ? match : 15));
+    if (count >= 15)
+    {
+        out = put_length(out, count - 15);
+    }
+    memcpy(out, literals, count);
+    out += count;
+
+    if (length)
+    {
+        *out++ = offset & 0xff;
+        *out++ = offset >> 8;
+        if (match >= 15)
+        {
+            out = put_length(out, match - 15);
+        }
+    }
+    return out;
+}
+
+/*
+ * Compresses 'size' bytes of 'in' into 'out', which has room for
+ * LZ_PACK_BOUND(size) bytes. 'hash' is scratch space of LZ_HASH_SIZE ints.
+ * Returns the compressed size.
+ */
+int
+APEX_lz_pack(const unsigned char *in, int size, unsigned char *out, int *hash)
+{
+    unsigned char *start = out;
+    int anchor = 0;
+    int i = 0;
+
+    memset(hash, -1, LZ_HASH_SIZE * sizeof(int));
+    while (i + LZ_MIN_MATCH <= size)
+    {
+        unsigned sequence = read_u32(in + i);
+        unsigned h = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int candidate = hash[h];
+        int length = LZ_MIN_MATCH;
+
+        hash[h] = i;
+        if (candidate < 0 || i - candidate > LZ_MAX_OFFSET
+            || read_u32(in + candidate) != sequence)
+        {
+            i++;
+            continue;
+        }
+
+        while (i + length < size && in[candidate + length] == in[i + length])
+        {
+            length++;
+        }
+        out = put_sequence(out, in + anchor, i - anchor, i - candidate,
+                           length);
+        i += length;
+        anchor = i;
+    }
+
+    out = put_sequence(out, in + anchor, size - anchor, 0, 0);
+    return (int)(out - start);
+}
+
+/* Reads a length nibble overflow, or returns -1 past the end of input */
+static int
+get_length(const unsigned char **in, const unsigned char *end, int length)
+{
+    int byte;
+
+    do
+    {
+        if (*in == end)
+        {
+            return -1;
+        }
+        byte = *(*in)++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+/*
+ * Decompresses 'size' bytes of 'in' into 'out', which has room for
+ * 'out_size' bytes. Returns the decompressed size, or -1 if the input is
+ * corrupt.
+ */
+int
+APEX_lz_unpack(const unsigned char *in, int size, unsigned char *out,
+               int out_size)
+{
+    const unsigned char *end = in + size;
+    int o = 0;
+
+    while (in < end)
+    {
+        int token = *in++;
+        int count = token >> 4;
+        int length = token & 0xf;
+        int offset;
+
+        if (count == 15 && (count = get_length(&in, end, 15)) < 0)
+        {
+            return -1;
+        }
+        if (count > end - in || count > out_size - o)
+        {
+            return -1;
+        }
+        memcpy(out + o, in, count);
+        in += count;
+        o += count;
+
+        /* The last sequence has no match */
+        if (in == end)
+        {
+            break;
+        }
+
+        if (end - in < 2)
+        {
+            return -1;
+        }
+        offset = in[0] | in[1] << 8;
+        in += 2;
+        if (length == 15 && (length = get_length(&in, end, 15)) < 0)
+        {
+            return -1;
+        }
+        length += LZ_MIN_MATCH;
+        if (!offset || offset > o || length > out_size - o)
+        {
+            return -1;
+        }
+
+        /* Byte by byte, a match may overlap what it copies */
+        while (length--)
+        {
+            out[o] = out[o - offset];
+            o++;
+        }
+    }
+    return o;
+}
+
+static unsigned char *
+put_varint(unsigned char *out, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char)value;
+    return out;
+}
+
+/* Maps small negative deltas to small unsigned values */
+static unsigned
+zigzag(unsigned delta)
+{
+    return delta << 1 ^ (unsigned)((int)delta >> 31);
+}
+
+static unsigned
+unzigzag(unsigned value)
+{
+    return value >> 1 ^ -(value & 1);
+}
+
+static int
+log2_size(int size)
+{
+    int shift = 0;
+
+    while (size > 1 && shift < 3)
+    {
+        size >>= 1;
+        shift++;
+    }
+    return shift;
+}
+
+/* Compresses and writes out the block being filled */
+static void
+write_block(APEX_Trace *trace)
+{
+    unsigned char header[TRACE_HEADER_SIZE];
+    const unsigned char *data = trace->packed;
+    int size;
+
+    if (!trace->block_records)
+    {
+        return;
+    }
+
+    size = APEX_lz_pack(trace->raw, trace->raw_size, trace->packed,
+                        trace->hash);
+    if (size >= trace->raw_size)
+    {
+        data = trace->raw;
+        size = trace->raw_size;
+    }
+
+    write_u32(header, trace->raw_size);
+    write_u32(header + 4, size);
+    write_u32(header + 8, trace->block_records);
+    if (fwrite(header, sizeof(header), 1, trace->fp) != 1
+        || fwrite(data, size, 1, trace->fp) != 1)
+    {
+        trace->failed = TRUE;
+    }
+
+    trace->blocks++;
+    trace->raw_bytes += trace->raw_size;
+    trace->file_bytes += sizeof(header) + size;
+    trace->raw_size = 0;
+    trace->block_records = 0;
+    memset(&trace->last, 0, sizeof(Trace_Record));
+}
+
+static void
+encode_record(APEX_Trace *trace, const Trace_Record *record)
+{
+    unsigned char *p;
+
+    if (trace->raw_size > TRACE_BLOCK_SIZE - TRACE_RECORD_MAX)
+    {
+        write_block(trace);
+    }
+
+    p = trace->raw + trace->raw_size;
+    if (trace->kind == TRACE_INSN)
+    {
+        /* Straight-line code makes the PC delta zero, and only loads and
+         * stores carry an address, so it is against the last of those */
+        *p++ = (unsigned char)record->flags;
+        p = put_varint(p,
+                       (unsigned)record->cycle - (unsigned)trace->last.cycle);
+        p = put_varint(p, zigzag((unsigned)record->pc
+                                 - (unsigned)trace->last.pc - 4));
+        *p++ = (unsigned char)record->opcode;
+        *p++ = (unsigned char)record->rd;
+        *p++ = (unsigned char)record->rs1;
+        *p++ = (unsigned char)record->rs2;
+        trace->last.cycle = record->cycle;
+        trace->last.pc = record->pc;
+        if (record->flags & TRACE_ADDRESS)
+        {
+            p = put_varint(p, zigzag((unsigned)record->address
+                                     - (unsigned)trace->last.address));
+            trace->last.address = record->address;
+        }
+    }
+    else
+    {
+        *p++ = (unsigned char)(record->flags
+                               | log2_size(record->size) << TRACE_SIZE_SHIFT);
+        p = put_varint(p,
+                       (unsigned)record->cycle - (unsigned)trace->last.cycle);
+        p = put_varint(p, zigzag((unsigned)record->pc
+                                 - (unsigned)trace->last.pc));
+        p = put_varint(p, zigzag((unsigned)record->address
+                                 - (unsigned)trace->last.address));
+        trace->last = *record;
+    }
+    trace->raw_size = (int)(p - trace->raw);
+    trace->block_records++;
+}
+
+/*
+ * Writer thread: sleeps until a batch of records is waiting, then encodes
+ * everything in the ring. Freeing ring slots as it goes keeps a simulator
+ * that filled the ring from waiting for the whole batch.
+ */
+static void *
+write_trace(void *arg)
+{
+    APEX_Trace *trace = arg;
+
+    while (TRUE)
+    {
+        int done = __atomic_load_n(&trace->done, __ATOMIC_SEQ_CST);
+        unsigned head = __atomic_load_n(&trace->head, __ATOMIC_SEQ_CST);
+        unsigned tail = trace->tail;
+
+        if (head == tail && done)
+        {
+            break;
+        }
+
+        if (head - tail < TRACE_BATCH && !done)
+        {
+            /* The simulator signals once it sees 'sleeping', and it sees
+             * it unless the head read below already shows its batch */
+            pthread_mutex_lock(&trace->lock);
+            __atomic_store_n(&trace->sleeping, TRUE, __ATOMIC_SEQ_CST);
+            head = __atomic_load_n(&trace->head, __ATOMIC_SEQ_CST);
+            if (head - tail < TRACE_BATCH && !trace->done)
+            {
+                pthread_cond_wait(&trace->wake, &trace->lock);
+            }
+            __atomic_store_n(&trace->sleeping, FALSE, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&trace->lock);
+            continue;
+        }
+
+        while (tail != head)
+        {
+            encode_record(trace, &trace->ring[tail & (TRACE_RING_SIZE - 1)]);
+            tail++;
+            if (!(tail & 1023))
+            {
+                __atomic_store_n(&trace->tail, tail, __ATOMIC_RELEASE);
+            }
+        }
+        __atomic_store_n(&trace->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    write_block(trace);
+    return NULL;
+}
+
+static void
+free_buffers(APEX_Trace *trace)
+{
+    free(trace->ring);
+    free(trace->raw);
+    free(trace->packed);
+    free(trace->hash);
+}
+
+/*
+ * Creates the trace file 'path' for records of 'kind' and starts its writer
+ * thread. Returns NULL if either fails.
+ */
+APEX_Trace *
+APEX_trace_open(const char *path, int kind)
+{
+    APEX_Trace *trace = calloc(1, sizeof(APEX_Trace));
+
+    if (!trace)
+    {
+        return NULL;
+    }
+
+    trace->kind = kind;
+    trace->ring = malloc(TRACE_RING_SIZE * sizeof(Trace_Record));
+    trace->raw = malloc(TRACE_BLOCK_SIZE);
+    trace->packed = malloc(LZ_PACK_BOUND(TRACE_BLOCK_SIZE));
+    trace->hash = malloc(LZ_HASH_SIZE * sizeof(int));
+    trace->fp = fopen(path, "wb");
+    if (!trace->ring || !trace->raw || !trace->packed || !trace->hash
+        || !trace->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write trace %s\n", path);
+        if (trace->fp)
+        {
+            fclose(trace->fp);
+        }
+        free_buffers(trace);
+        free(trace);
+        return NULL;
+    }
+
+    fwrite(trace_magic[kind], TRACE_MAGIC_SIZE, 1, trace->fp);
+    trace->file_bytes = TRACE_MAGIC_SIZE;
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->wake, NULL);
+    if (pthread_create(&trace->thread, NULL, write_trace, trace))
+    {
+        fprintf(stderr, "APEX_Error: Unable to start trace writer\n");
+        pthread_mutex_destroy(&trace->lock);
+        pthread_cond_destroy(&trace->wake);
+        fclose(trace->fp);
+        free_buffers(trace);
+        free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+/*
+ * Writes out the records still in the ring and closes the file. The
+ * statistics stay readable until APEX_trace_free(). Returns FALSE if the
+ * file could not be written completely.
+ */
+int
+APEX_trace_close(APEX_Trace *trace)
+{
+    if (!trace->fp)
+    {
+        return !trace->failed;
+    }
+
+    pthread_mutex_lock(&trace->lock);
+    __atomic_store_n(&trace->done, TRUE, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&trace->wake);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->thread, NULL);
+
+    if (ferror(trace->fp) | fclose(trace->fp))
+    {
+        trace->failed = TRUE;
+    }
+    trace->fp = NULL;
+    if (trace->failed)
+    {
+        fprintf(stderr, "APEX_Error: Trace is incomplete, write failed\n");
+    }
+    return !trace->failed;
+}
+
+void
+APEX_trace_free(APEX_Trace *trace)
+{
+    if (!trace)
+    {
+        return;
+    }
+
+    APEX_trace_close(trace);
+    pthread_mutex_destroy(&trace->lock);
+    pthread_cond_destroy(&trace->wake);
+    free_buffers(trace);
+    free(trace);
+}
+
+void
+APEX_trace_print_stats(const APEX_Trace *trace)
+{
+    printf("----------\n%s\n----------\n",
+           trace->kind == TRACE_INSN ? "INSTRUCTION TRACE" : "MEMORY TRACE");
+    printf("Records          : %d in %d blocks\n", trace->records,
+           trace->blocks);
+    printf("Bytes            : %.0f encoded, %.0f written (%.2f bytes/record)\n",
+           trace->raw_bytes, trace->file_bytes,
+           trace->records ? trace->file_bytes / trace->records : 0.0);
+    printf("Compression      : %.2fx\n",
+           trace->file_bytes ? trace->raw_bytes / trace->file_bytes : 0.0);
+    printf("Ring full waits  : %d\n", trace->full_waits);
+    printf("\n");
+}
+
+static double
+stat_bytes_per_record(const void *owner)
+{
+    const APEX_Trace *trace = owner;
+
+    return trace->records ? trace->file_bytes / trace->records : 0.0;
+}
+
+void
+APEX_trace_register_stats(const APEX_Trace *trace, APEX_Stats *stats)
+{
+    APEX_stats_counter(stats, "records", &trace->records);
+    APEX_stats_counter(stats, "blocks", &trace->blocks);
+    APEX_stats_real(stats, "raw_bytes", &trace->raw_bytes);
+    APEX_stats_real(stats, "file_bytes", &trace->file_bytes);
+    APEX_stats_derived(stats, "bytes_per_record", stat_bytes_per_record,
+                       trace);
+    APEX_stats_counter(stats, "full_waits", &trace->full_waits);
+}
+
+/*
+ * Opens a trace written by APEX_trace_open(), or returns NULL. Its magic
+ * tells the kind of records, which is left in 'kind'.
+ */
+APEX_Trace_Reader *
+APEX_trace_reader_open(const char *path)
+{
+    APEX_Trace_Reader *reader = calloc(1, sizeof(APEX_Trace_Reader));
+    char magic[TRACE_MAGIC_SIZE];
+
+    if (!reader)
+    {
+        return NULL;
+    }
+
+    reader->raw = malloc(TRACE_BLOCK_SIZE);
+    reader->packed = malloc(LZ_PACK_BOUND(TRACE_BLOCK_SIZE));
+    reader->fp = fopen(path, "rb");
+    if (!reader->raw || !reader->packed || !reader->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to read trace %s\n", path);
+        APEX_trace_reader_close(reader);
+        return NULL;
+    }
+
+    if (fread(magic, sizeof(magic), 1, reader->fp) == 1)
+    {
+        if (!memcmp(magic, trace_magic[TRACE_INSN], sizeof(magic)))
+        {
+            reader->kind = TRACE_INSN;
+            return reader;
+        }
+        if (!memcmp(magic, trace_magic[TRACE_MEMORY], sizeof(magic)))
+        {
+            reader->kind = TRACE_MEMORY;
+            return reader;
+        }
+    }
+
+    fprintf(stderr, "APEX_Error: %s is not a trace\n", path);
+    APEX_trace_reader_close(reader);
+    return NULL;
+}
+
+/* Kind of trace 'path' is, or -1 if it is not a trace */
+int
+APEX_trace_kind(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    char magic[TRACE_MAGIC_SIZE];
+    int kind = -1;
+
+    if (!fp)
+    {
+        return -1;
+    }
+    if (fread(magic, sizeof(magic), 1, fp) == 1)
+    {
+        if (!memcmp(magic, trace_magic[TRACE_INSN], sizeof(magic)))
+        {
+            kind = TRACE_INSN;
+        }
+        else if (!memcmp(magic, trace_magic[TRACE_MEMORY], sizeof(magic)))
+        {
+            kind = TRACE_MEMORY;
+        }
+    }
+    fclose(fp);
+    return kind;
+}
+
+/* Reads and unpacks the next block, returns FALSE at the end or on errors */
+static int
+read_block(APEX_Trace_Reader *reader)
+{
+    unsigned char header[TRACE_HEADER_SIZE];
+    unsigned raw_size;
+    unsigned size;
+    unsigned records;
+
+    size_t got = fread(header, 1, sizeof(header), reader->fp);
+
+    if (got != sizeof(header))
+    {
+        return got || !feof(reader->fp) ? -1 : FALSE;
+    }
+
+    raw_size = read_u32(header);
+    size = read_u32(header + 4);
+    records = read_u32(header + 8);
+    if (raw_size > TRACE_BLOCK_SIZE || size > raw_size || !records
+        || fread(reader->packed, size, 1, reader->fp) != 1)
+    {
+        return -1;
+    }
+
+    if (size == raw_size)
+    {
+        memcpy(reader->raw, reader->packed, size);
+    }
+    else if (APEX_lz_unpack(reader->packed, size, reader->raw, raw_size)
+             != (int)raw_size)
+    {
+        return -1;
+    }
+
+    reader->raw_size = raw_size;
+    reader->offset = 0;
+    reader->left = records;
+    memset(&reader->last, 0, sizeof(Trace_Record));
+    return TRUE;
+}
+
+static int
+get_varint(APEX_Trace_Reader *reader, unsigned *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    while (reader->offset < reader->raw_size && shift < 35)
+    {
+        int byte = reader->raw[reader->offset++];
+
+        *value |= (unsigned)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return TRUE;
+        }
+        shift += 7;
+    }
+    return FALSE;
+}
+
+/*
+ * Reads the next record into 'record'. Returns TRUE if there was one,
+ * FALSE at the end of the trace and -1 if the trace is corrupt.
+ */
+int
+APEX_trace_read(APEX_Trace_Reader *reader, Trace_Record *record)
+{
+    unsigned cycle;
+    unsigned pc;
+    unsigned address;
+    int flags;
+
+    if (!reader->left)
+    {
+        int status = read_block(reader);
+
+        if (status <= 0)
+        {
+            if (status < 0)
+            {
+                fprintf(stderr, "APEX_Error: Corrupt trace\n");
+            }
+            return status;
+        }
+    }
+
+    if (reader->offset == reader->raw_size)
+    {
+        fprintf(stderr, "APEX_Error: Corrupt trace\n");
+        return -1;
+    }
+    flags = reader->raw[reader->offset++];
+    if (reader->kind == TRACE_INSN)
+    {
+        const unsigned char *p;
+
+        if (!get_varint(reader, &cycle) || !get_varint(reader, &pc)
+            || reader->raw_size - reader->offset < 4)
+        {
+            fprintf(stderr, "APEX_Error: Corrupt trace\n");
+            return -1;
+        }
+        p = reader->raw + reader->offset;
+        reader->offset += 4;
+        address = 0;
+        if ((flags & TRACE_ADDRESS) && !get_varint(reader, &address))
+        {
+            fprintf(stderr, "APEX_Error: Corrupt trace\n");
+            return -1;
+        }
+
+        record->cycle = (int)((unsigned)reader->last.cycle + cycle);
+        record->pc = (int)((unsigned)reader->last.pc + 4 + unzigzag(pc));
+        record->opcode = p[0];
+        record->rd = (signed char)p[1];
+        record->rs1 = (signed char)p[2];
+        record->rs2 = (signed char)p[3];
+        record->flags = flags;
+        record->size = 0;
+        record->address = 0;
+        reader->last.cycle = record->cycle;
+        reader->last.pc = record->pc;
+        if (flags & TRACE_ADDRESS)
+        {
+            record->address = (int)((unsigned)reader->last.address
+                                    + unzigzag(address));
+            reader->last.address = record->address;
+        }
+        reader->left--;
+        return TRUE;
+    }
+
+    if (!get_varint(reader, &cycle) || !get_varint(reader, &pc)
+        || !get_varint(reader, &address))
+    {
+        fprintf(stderr, "APEX_Error: Corrupt trace\n");
+        return -1;
+    }
+
+    record->cycle = (int)((unsigned)reader->last.cycle + cycle);
+    record->pc = (int)((unsigned)reader->last.pc + unzigzag(pc));
+    record->address = (int)((unsigned)reader->last.address
+                            + unzigzag(address));
+    record->flags = flags & ((1 << TRACE_SIZE_SHIFT) - 1);
+    record->size = 1 << (flags >> TRACE_SIZE_SHIFT);
+    record->opcode = 0;
+    record->rd = record->rs1 = record->rs2 = -1;
+    reader->last = *record;
+    reader->left--;
+    return TRUE;
+}
+
+void
+APEX_trace_reader_close(APEX_Trace_Reader *reader)
+{
+    if (!reader)
+    {
+        return;
+    }
+
+    if (reader->fp)
+    {
+        fclose(reader->fp);
+    }
+    free(reader->raw);
+    free(reader->packed);
+    free(reader);
+}
+
+/*
+ * Reads the whole trace 'path', which must hold records of 'kind', into an
+ * array the caller frees. Returns NULL if it cannot be read, else leaves
+ * the number of records in 'count'.
+ */
+Trace_Record *
+APEX_trace_load(const char *path, int kind, int *count)
+{
+    APEX_Trace_Reader *reader = APEX_trace_reader_open(path);
+    Trace_Record *records = NULL;
+    int size = 0;
+    int status;
+
+    *count = 0;
+    if (!reader)
+    {
+        return NULL;
+    }
+    if (reader->kind != kind)
+    {
+        fprintf(stderr, "APEX_Error: %s is not an %s trace\n", path,
+                trace_name[kind]);
+        APEX_trace_reader_close(reader);
+        return NULL;
+    }
+
+    do
+    {
+        if (*count == size)
+        {
+            Trace_Record *grown;
+
+            size = size ? size * 2 : 1024;
+            grown = realloc(records, size * sizeof(Trace_Record));
+            if (!grown)
+            {
+                fprintf(stderr, "APEX_Error: Trace %s does not fit in memory\n",
+                        path);
+                status = -1;
+                break;
+            }
+            records = grown;
+        }
+        status = APEX_trace_read(reader, &records[*count]);
+        if (status > 0)
+        {
+            (*count)++;
+        }
+    } while (status > 0);
+
+    APEX_trace_reader_close(reader);
+    if (status < 0)
+    {
+        free(records);
+        *count = 0;
+        return NULL;
+    }
+    return records;
+}
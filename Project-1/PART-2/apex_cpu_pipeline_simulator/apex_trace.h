@@ -0,0 +1,225 @@
+/*
+ * apex_trace.h
+ * Contains APEX memory and instruction trace declarations
+ *
+ * A memory trace records every access that reaches the data cache: loads
+ * as they read through it in Memory and retired stores as they drain from
+ * the load/store queue. Loads the queue forwarded are recorded too, flagged
+ * as such, since another cache would see them the same way.
+ *
+ * An instruction trace records every instruction as it retires, with its
+ * register operands, the address of loads and stores and whether a branch
+ * or jump was taken. It is the input of the timing model in apex_replay.h.
+ *
+ * The simulator only copies each record into a ring buffer. A host thread
+ * takes them out, delta-encodes them against the record before, packs them
+ * into blocks of TRACE_BLOCK_SIZE bytes and compresses each block with a
+ * small LZ77 coder before writing it. The file is:
+ *
+ *   "APEXMTR1" or "APEXITR1"      magic, memory or instruction trace
+ *   per block: raw size, packed size, records (32-bit little-endian)
+ *              packed bytes, stored raw when packing did not shrink them
+ *
+ * Records in a block are, starting from zeroes at the block start so each
+ * block decodes on its own:
+ *
+ *   memory:      flags byte: TRACE_STORE, TRACE_FORWARDED, log2 of the size
+ *                in bits 2-3
+ *                varint cycle delta, zigzag varint PC delta, zigzag varint
+ *                address delta
+ *
+ *   instruction: flags byte: TRACE_TAKEN, TRACE_ADDRESS
+ *                varint cycle delta, zigzag varint delta of the PC from the
+ *                one after the last, opcode, rd, rs1 and rs2 bytes, and with
+ *                TRACE_ADDRESS a zigzag varint delta from the last address
+ */
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "apex_stats.h"
+
+/* Kinds of trace */
+#define TRACE_MEMORY 0x0
+#define TRACE_INSN 0x1
+
+/* Bytes of the magic starting a trace */
+#define TRACE_MAGIC_SIZE 8
+
+/* Memory record flags */
+#define TRACE_STORE 0x1
+#define TRACE_FORWARDED 0x2
+#define TRACE_SIZE_SHIFT 2
+
+/* Instruction record flags */
+#define TRACE_TAKEN 0x1            /* Branch or jump redirected Fetch */
+#define TRACE_ADDRESS 0x2          /* Load or store, 'address' is valid */
+
+/* Records the ring buffer holds, a power of two */
+#define TRACE_RING_SIZE (1 << 16)
+
+/* Raw bytes of a block */
+#define TRACE_BLOCK_SIZE (1 << 16)
+
+/* Longest encoding of one record: flags, four bytes and three varints */
+#define TRACE_RECORD_MAX 24
+
+/* Bytes of a block header */
+#define TRACE_HEADER_SIZE 12
+
+/* Records the writer lets pile up before it is woken */
+#define TRACE_BATCH (TRACE_RING_SIZE / 4)
+
+/* Match candidates of the LZ77 coder */
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+/* Largest output of APEX_lz_pack() for 'size' bytes in */
+#define LZ_PACK_BOUND(size) ((size) + (size) / 255 + 16)
+
+/* Format of a memory access or retired instruction record */
+typedef struct Trace_Record
+{
+    int cycle;
+    int pc;
+    int address;
+    int flags;                     /* TRACE_* of the kind of trace */
+    int size;                      /* Bytes accessed, memory traces only */
+    int opcode;                    /* Instruction traces only */
+    int rd;
+    int rs1;
+    int rs2;
+} Trace_Record;
+
+/* Model of a trace being written */
+typedef struct APEX_Trace
+{
+    int kind;                      /* TRACE_MEMORY or TRACE_INSN */
+    FILE *fp;
+    Trace_Record *ring;
+    unsigned head;                 /* Records put in, by the simulator */
+    unsigned tail;                 /* Records taken out, by the writer */
+    int done;                      /* No more records will come */
+    int sleeping;                  /* The writer waits for records */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int failed;                    /* A write failed */
+
+    /* Owned by the writer thread */
+    unsigned char *raw;
+    unsigned char *packed;
+    int *hash;                     /* LZ77 match candidates */
+    int raw_size;
+    int block_records;
+    Trace_Record last;
+
+    /* Statistics */
+    int records;
+    int full_waits;                /* Times the simulator found the ring full */
+    int blocks;
+    double raw_bytes;
+    double file_bytes;
+} APEX_Trace;
+
+/* Model of a trace being read */
+typedef struct APEX_Trace_Reader
+{
+    int kind;
+    FILE *fp;
+    unsigned char *raw;
+    unsigned char *packed;
+    int raw_size;
+    int offset;                    /* Next byte of raw */
+    int left;                      /* Records left in the block */
+    Trace_Record last;
+} APEX_Trace_Reader;
+
+APEX_Trace *APEX_trace_open(const char *path, int kind);
+int APEX_trace_close(APEX_Trace *trace);
+void APEX_trace_free(APEX_Trace *trace);
+void APEX_trace_print_stats(const APEX_Trace *trace);
+void APEX_trace_register_stats(const APEX_Trace *trace, APEX_Stats *stats);
+APEX_Trace_Reader *APEX_trace_reader_open(const char *path);
+int APEX_trace_kind(const char *path);
+int APEX_trace_read(APEX_Trace_Reader *reader, Trace_Record *record);
+void APEX_trace_reader_close(APEX_Trace_Reader *reader);
+Trace_Record *APEX_trace_load(const char *path, int kind, int *count);
+int APEX_lz_pack(const unsigned char *in, int size, unsigned char *out,
+                 int *hash);
+int APEX_lz_unpack(const unsigned char *in, int size, unsigned char *out,
+                   int out_size);
+
+/*
+ * Returns the next free slot of the ring buffer, waiting for the writer if
+ * it is full. The record is not seen by the writer until
+ * APEX_trace_publish(). Called on every traced event, so these are inline.
+ */
+static inline Trace_Record *
+APEX_trace_slot(APEX_Trace *trace)
+{
+    while (trace->head - __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE)
+           == TRACE_RING_SIZE)
+    {
+        trace->full_waits++;
+        sched_yield();
+    }
+
+    return &trace->ring[trace->head & (TRACE_RING_SIZE - 1)];
+}
+
+static inline void
+APEX_trace_publish(APEX_Trace *trace)
+{
+    unsigned head = trace->head;
+
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_SEQ_CST);
+    trace->records++;
+
+    /* Wake the writer once a batch is waiting */
+    if (__atomic_load_n(&trace->sleeping, __ATOMIC_SEQ_CST)
+        && head + 1 - __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE)
+               >= TRACE_BATCH)
+    {
+        pthread_mutex_lock(&trace->lock);
+        pthread_cond_signal(&trace->wake);
+        pthread_mutex_unlock(&trace->lock);
+    }
+}
+
+/* Puts a data cache access in a memory trace */
+static inline void
+APEX_trace_put(APEX_Trace *trace, int cycle, int pc, int address, int flags,
+               int size)
+{
+    Trace_Record *record = APEX_trace_slot(trace);
+
+    record->cycle = cycle;
+    record->pc = pc;
+    record->address = address;
+    record->flags = flags;
+    record->size = size;
+    APEX_trace_publish(trace);
+}
+
+/* Puts a retired instruction in an instruction trace */
+static inline void
+APEX_trace_put_insn(APEX_Trace *trace, int cycle, int pc, int opcode, int rd,
+                    int rs1, int rs2, int address, int flags)
+{
+    Trace_Record *record = APEX_trace_slot(trace);
+
+    record->cycle = cycle;
+    record->pc = pc;
+    record->address = address;
+    record->flags = flags;
+    record->opcode = opcode;
+    record->rd = rd;
+    record->rs1 = rs1;
+    record->rs2 = rs2;
+    APEX_trace_publish(trace);
+}
+#endif
@@ -9,39 +9,235 @@
 #include <stdlib.h>
 
 #include "apex_cpu.h"
+#include "apex_system.h"
+#include "apex_sample.h"
+#include "apex_interval.h"
+#include "apex_replay.h"
+#include "apex_stats.h"
 #include <string.h>
 int
 main(int argc, char const *argv[])
 {
     APEX_CPU *cpu;
+    APEX_Config config;
+    const char *args[4];
+    int nargs = 0;
+    int status = 0;
+    int i;
 
     fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
-    if (argc < 2)
+    /* Arguments of the form name=value configure the simulated machine,
+     * everything else is positional */
+    APEX_config_init(&config);
+    for (i = 1; i < argc; ++i)
     {
-        fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+        if (strchr(argv[i], '='))
+        {
+            if (!APEX_config_set(&config, argv[i]))
+            {
+                fprintf(stderr, "APEX_Error: Invalid option %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (nargs < 4)
+        {
+            args[nargs++] = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "APEX_Error: Invalid args\n");
+            exit(1);
+        }
+    }
+
+    if (nargs < 1)
+    {
+        fprintf(stderr, "APEX_Help: Usage %s <input_file>[@pc][,<input_file>[@pc] ...] [name=value ...]\n", argv[0]);
         exit(1);
     }
 
-    cpu = APEX_cpu_init(argv[1]);
+    /* With a statistics file, SIGUSR1 writes it during the run too */
+    if (config.stats[0])
+    {
+        APEX_stats_catch_signal();
+    }
+
+    /* A recorded instruction trace is timed by the trace-driven model */
+    if (nargs > 1 && strcmp(args[1], "replay") == 0)
+    {
+        APEX_Replay replay;
+        Trace_Record *records;
+        int count;
+
+        records = APEX_trace_load(args[0], TRACE_INSN, &count);
+        if (!records || !APEX_replay_init(&replay, &config))
+        {
+            free(records);
+            exit(1);
+        }
+
+        status = !APEX_replay_run(&replay, records, count,
+                                  nargs > 2 ? atoi(args[2]) : 0);
+        APEX_replay_print_stats(&replay);
+        if (config.stats[0])
+        {
+            APEX_Stats stats;
+
+            APEX_stats_init(&stats);
+            APEX_stats_enter(&stats, "config");
+            APEX_config_register_stats(&config, &stats);
+            APEX_stats_leave(&stats);
+            APEX_replay_register_stats(&replay, &stats);
+            APEX_stats_write(&stats, config.stats);
+            APEX_stats_free(&stats);
+        }
+        APEX_replay_free(&replay);
+        free(records);
+        return status;
+    }
+
+    /* A sampling interval estimates the run from a few detailed samples */
+    if (config.sample_interval)
+    {
+        APEX_Sampler *sampler = APEX_sample_init(args[0], &config);
+
+        if (!sampler)
+        {
+            fprintf(stderr, "APEX_Error: Unable to initialize sampling\n");
+            exit(1);
+        }
+
+        status = !APEX_sample_run(sampler);
+        APEX_sample_print_stats(sampler);
+        if (config.stats[0])
+        {
+            APEX_Stats stats;
+
+            APEX_stats_init(&stats);
+            APEX_stats_enter(&stats, "config");
+            APEX_config_register_stats(&config, &stats);
+            APEX_stats_leave(&stats);
+            APEX_stats_enter(&stats, "sample");
+            APEX_sample_register_stats(sampler, &stats);
+            APEX_stats_leave(&stats);
+            APEX_stats_write(&stats, config.stats);
+            APEX_stats_free(&stats);
+        }
+        APEX_sample_stop(sampler);
+        return status;
+    }
+
+    /* Intervals simulate the whole run in parallel from checkpoints */
+    if (config.interval_size)
+    {
+        APEX_Intervals *run = APEX_intervals_init(args[0], &config);
+
+        if (!run)
+        {
+            fprintf(stderr,
+                    "APEX_Error: Unable to initialize interval simulation\n");
+            exit(1);
+        }
+
+        status = !APEX_intervals_run(run);
+        APEX_intervals_print_stats(run);
+        if (config.stats[0])
+        {
+            APEX_Stats stats;
+
+            APEX_stats_init(&stats);
+            APEX_stats_enter(&stats, "config");
+            APEX_config_register_stats(&config, &stats);
+            APEX_stats_leave(&stats);
+            APEX_stats_enter(&stats, "interval");
+            APEX_intervals_register_stats(run, &stats);
+            APEX_stats_leave(&stats);
+            APEX_stats_write(&stats, config.stats);
+            APEX_stats_free(&stats);
+        }
+        APEX_intervals_stop(run);
+        return status;
+    }
+
+    /* Several cores, or a program list, simulate a multicore system */
+    if (config.cores > 1 || strpbrk(args[0], ",@"))
+    {
+        APEX_System *system = APEX_system_init(args[0], &config);
+
+        if (!system)
+        {
+            fprintf(stderr, "APEX_Error: Unable to initialize system\n");
+            exit(1);
+        }
+
+        if (nargs > 1)
+        {
+            if (strcmp(args[1], "simulate") == 0 && nargs == 3)
+            {
+                system->max_cycles = atoi(args[2]);
+                system->single_step = 0;
+            }
+            else if (strcmp(args[1], "single_step") == 0)
+            {
+                system->single_step = 1;
+            }
+            else
+            {
+                fprintf(stderr, "APEX_Error: Invalid args\n");
+                exit(1);
+            }
+        }
+
+        APEX_system_run(system);
+
+        /* A divergence fails the run, so scripted runs notice */
+        for (i = 0; i < system->cores; ++i)
+        {
+            status |= system->cpu[i]->diverged;
+        }
+        APEX_system_stop(system);
+        return status;
+    }
+
+    cpu = APEX_cpu_init(args[0], &config);
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
-    if(argc==2){
+
+    /* A trace records the data cache accesses of the run, an instruction
+     * trace the instructions it retires */
+    if (config.trace[0])
+    {
+        cpu->trace = APEX_trace_open(config.trace, TRACE_MEMORY);
+        if (!cpu->trace)
+        {
+            exit(1);
+        }
+    }
+    if (config.itrace[0])
+    {
+        cpu->itrace = APEX_trace_open(config.itrace, TRACE_INSN);
+        if (!cpu->itrace)
+        {
+            exit(1);
+        }
+    }
+    if(nargs==1){
         APEX_cpu_run(cpu);
     }
 
-    else if(argc>2){
-        if( strcmp(argv[2], "simulate") == 0 && argc == 4){
-            int numCycles=atoi(argv[3]);
+    else if(nargs>1){
+        if( strcmp(args[1], "simulate") == 0 && nargs == 3){
+            int numCycles=atoi(args[2]);
             cpu->maxCycles=numCycles;
             cpu->single_step=0;
             APEX_cpu_run(cpu);
 
         }
-        else if (strcmp(argv[2], "single_step") == 0)
+        else if (strcmp(args[1], "single_step") == 0)
         {
             cpu->single_step = 1;
             APEX_cpu_run(cpu);
@@ -53,6 +249,7 @@ main(int argc, char const *argv[])
     }
 
     
+    status = cpu->diverged;
     APEX_cpu_stop(cpu);
-    return 0;
+    return status;
 }
\ No newline at end of file